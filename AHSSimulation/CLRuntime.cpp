@@ -0,0 +1,574 @@
+#include "CLRuntime.h"
+#include "CLSettings.h"
+#include "program_cache.h"
+#include <sstream>
+#include <vector>
+
+#define MIN(x, y)       ((x) < (y) ? (x) : (y))
+#define MAX(x, y)       ((x) > (y) ? (x) : (y))
+
+bool CLRuntime::_initialized = false;
+bool CLRuntime::_inelastic_batch_initialized = false;
+std::string CLRuntime::_build_options;
+cl::Context CLRuntime::_context;
+cl::CommandQueue CLRuntime::_queue;
+cl::Program CLRuntime::_pos_update_program;
+cl::Program CLRuntime::_wall_collision_program;
+cl::Program CLRuntime::_part_collision_program;
+cl::Program CLRuntime::_inelastic_batch_program;
+cl::Kernel CLRuntime::_pos_update_kernel;
+cl::Kernel CLRuntime::_wall_collision_kernel;
+cl::Kernel CLRuntime::_part_collision_kernel;
+cl::Kernel CLRuntime::_part_collision_argmin_kernel;
+cl::Kernel CLRuntime::_part_collision_triangular_kernel;
+cl::Kernel CLRuntime::_argmin_reduce_kernel;
+cl::Kernel CLRuntime::_inelastic_select_kernel;
+cl::Kernel CLRuntime::_inelastic_advance_kernel;
+cl::Kernel CLRuntime::_inelastic_resolve_kernel;
+cl::Kernel CLRuntime::_ensemble_batch_kernel;
+size_t CLRuntime::_capacity = 0;
+size_t CLRuntime::_stride = 0;
+cl::Buffer CLRuntime::_pos;
+cl::Buffer CLRuntime::_next_pos;
+cl::Buffer CLRuntime::_vel;
+cl::Buffer CLRuntime::_radii;
+cl::Buffer CLRuntime::_x_wall;
+cl::Buffer CLRuntime::_y_wall;
+cl::Buffer CLRuntime::_z_wall;
+cl::Buffer CLRuntime::_wall_delta_times;
+cl::Buffer CLRuntime::_wall_axis;
+cl::Buffer CLRuntime::_part_indices;
+size_t CLRuntime::_part_delta_times_capacity = 0;
+cl::Buffer CLRuntime::_part_delta_times;
+size_t CLRuntime::_argmin_group_size = ARGMIN_GROUP_SIZE;
+cl::Buffer CLRuntime::_argmin_values[2];
+cl::Buffer CLRuntime::_argmin_indices[2];
+
+
+void CLRuntime::initialize()
+{
+    if (_initialized)
+        return;
+
+    cl::Device& device = CLSettings::get_device();
+    cl::vector<cl::Device> devices;
+    devices.push_back(device);
+
+    // Create the context and the command queue
+    cl_int status = CL_SUCCESS;
+    _context = cl::Context(devices, NULL, NULL, NULL, &status);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while creating the OpenCL context." << std::endl;
+        ss << "Error code: " << status << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    _queue = cl::CommandQueue(_context, CL_QUEUE_PROFILING_ENABLE, &status);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while creating the OpenCL command queue." << std::endl;
+        ss << "Error code: " << status << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    // Build the programs and create the kernels
+    _pos_update_program = build_program({ CLSettings::get_source_position_update() }, "position update", _build_options);
+    _wall_collision_program = build_program({ CLSettings::get_source_wall_collision() }, "wall collision", _build_options);
+    _part_collision_program = build_program({ CLSettings::get_source_part_collision() }, "particle collision", _build_options);
+    _pos_update_kernel = create_kernel(_pos_update_program, POSITION_UPDATE_KERNEL_NAME);
+    _wall_collision_kernel = create_kernel(_wall_collision_program, WALL_COLLISION_KERNEL_NAME);
+    _part_collision_kernel = create_kernel(_part_collision_program, PART_COLLISION_KERNEL_NAME);
+    _part_collision_argmin_kernel = create_kernel(_part_collision_program, PART_COLLISION_ARGMIN_KERNEL_NAME);
+    _part_collision_triangular_kernel = create_kernel(_part_collision_program, PART_COLLISION_TRIANGULAR_KERNEL_NAME);
+    _argmin_reduce_kernel = create_kernel(_part_collision_program, ARGMIN_REDUCE_KERNEL_NAME);
+
+    // The work-group size of the minimum searches must be a power of two, within the limits of the
+    // device and of each kernel of the searches
+    size_t max_group_size;
+    device.getInfo(CL_DEVICE_MAX_WORK_GROUP_SIZE, &max_group_size);
+    cl::Kernel* argmin_kernels[] = { &_wall_collision_kernel, &_part_collision_argmin_kernel,
+                                     &_part_collision_triangular_kernel, &_argmin_reduce_kernel };
+    for (size_t k = 0; k < sizeof(argmin_kernels) / sizeof(argmin_kernels[0]); k++)
+        max_group_size = MIN(max_group_size, argmin_kernels[k]->getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+    while (_argmin_group_size > max_group_size)
+        _argmin_group_size /= 2;
+    // Each step of the reduction divides the number of results by the group size, so a single
+    // work-item per group would never end it
+    if (_argmin_group_size < 2)
+    {
+        std::stringstream ss;
+        ss << "The OpenCL device runs work-groups of at most " << max_group_size << " work-items, "
+           << "but the minimum searches need at least 2." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    for (size_t b = 0; b < 2; b++)
+    {
+        _argmin_values[b] = create_buffer(CL_MEM_READ_WRITE, ARGMIN_MAX_GROUPS * sizeof(cl_double), "minimum search");
+        _argmin_indices[b] = create_buffer(CL_MEM_READ_WRITE, ARGMIN_MAX_GROUPS * sizeof(cl_ulong), "minimum search");
+    }
+
+    // The walls never change size
+    _x_wall = create_buffer(CL_MEM_READ_ONLY, 2 * sizeof(cl_double), "walls");
+    _y_wall = create_buffer(CL_MEM_READ_ONLY, 2 * sizeof(cl_double), "walls");
+    _z_wall = create_buffer(CL_MEM_READ_ONLY, 2 * sizeof(cl_double), "walls");
+
+    _initialized = true;
+}
+
+void CLRuntime::initialize_inelastic_batch()
+{
+    initialize();
+    if (_inelastic_batch_initialized)
+        return;
+
+    // The batch kernels use the helpers of the particle collision source
+    _inelastic_batch_program = build_program({ CLSettings::get_source_part_collision(),
+                                                CLSettings::get_source_inelastic_batch() },
+                                              "on-device inelastic loop", _build_options);
+    _inelastic_select_kernel = create_kernel(_inelastic_batch_program, INELASTIC_SELECT_KERNEL_NAME);
+    _inelastic_advance_kernel = create_kernel(_inelastic_batch_program, INELASTIC_ADVANCE_KERNEL_NAME);
+    _inelastic_resolve_kernel = create_kernel(_inelastic_batch_program, INELASTIC_RESOLVE_KERNEL_NAME);
+    _ensemble_batch_kernel = create_kernel(_inelastic_batch_program, ENSEMBLE_BATCH_KERNEL_NAME);
+
+    _inelastic_batch_initialized = true;
+}
+
+// Exact literal of a double for the build options
+static std::string double_literal(cl_double value)
+{
+    std::stringstream ss;
+    ss << "(" << std::hexfloat << value << ")";
+    return ss.str();
+}
+
+// True if all the values are the same
+static bool uniform(cl_double* values, size_t count)
+{
+    for (size_t i = 1; i < count; i++)
+    {
+        if (values[i] != values[0])
+            return false;
+    }
+    return count > 0;
+}
+
+void CLRuntime::specialize(cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                           cl_double* radii, cl_double* masses, size_t num_parts, bool constant_particles)
+{
+    if (_initialized)
+    {
+        std::stringstream ss;
+        ss << "The OpenCL programs must be specialized before they are built." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    std::stringstream options;
+    options << "-D AHS_CONSTANT_WALLS"
+            << " -D AHS_X_WALL_MIN=" << double_literal(x_wall[0]) << " -D AHS_X_WALL_MAX=" << double_literal(x_wall[1])
+            << " -D AHS_Y_WALL_MIN=" << double_literal(y_wall[0]) << " -D AHS_Y_WALL_MAX=" << double_literal(y_wall[1])
+            << " -D AHS_Z_WALL_MIN=" << double_literal(z_wall[0]) << " -D AHS_Z_WALL_MAX=" << double_literal(z_wall[1]);
+    if (constant_particles)
+    {
+        options << " -D AHS_NUM_PARTS=" << num_parts;
+        if (uniform(radii, num_parts))
+            options << " -D AHS_UNIFORM_RADIUS=" << double_literal(radii[0]);
+        if (uniform(masses, num_parts))
+            options << " -D AHS_UNIFORM_MASS=" << double_literal(masses[0]);
+    }
+    _build_options = options.str();
+}
+
+cl::Program CLRuntime::build_program(const cl::vector<std::string>& sources, const char* name,
+                                     const std::string& options)
+{
+    cl::Device& device = CLSettings::get_device();
+    cl_int status = CL_SUCCESS;
+
+    // Load the binary built by a previous run, if any
+    std::string key = program_cache_key(device, sources, options);
+    cl::Program program;
+    if (load_cached_program(_context, device, key, options, &program))
+        return program;
+
+    program = cl::Program(_context, sources, &status);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while creating the OpenCL program for " << name << "." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    status = program.build({ device }, options.c_str());
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while building the OpenCL program for " << name << "." << std::endl;
+        std::string build_log;
+        status = program.getBuildInfo(device, CL_PROGRAM_BUILD_LOG, &build_log);
+        if (status != CL_SUCCESS)
+        {
+            ss << "Errors occurred while retrieving the build log." << std::endl;
+            throw std::runtime_error(ss.str());
+        }
+        ss << "********** BUILD LOG BEGIN **********" << std::endl
+           << build_log
+           << "**********  BUILD LOG END  **********" << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    store_cached_program(program, key);
+    return program;
+}
+
+cl::Kernel CLRuntime::create_kernel(cl::Program& program, const char* name)
+{
+    cl_int status = CL_SUCCESS;
+    cl::Kernel kernel(program, name, &status);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while creating the OpenCL kernel " << name << "." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    return kernel;
+}
+
+cl::Buffer CLRuntime::create_buffer(cl_mem_flags flags, size_t size, const char* name)
+{
+    cl_int status = CL_SUCCESS;
+    cl::Buffer buffer(_context, flags, MAX(1, size), NULL, &status);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while creating an OpenCL buffer for " << name << "." << std::endl;
+        ss << "Error code: " << status << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    return buffer;
+}
+
+void CLRuntime::reserve(size_t num_parts)
+{
+    initialize();
+    if (num_parts <= _capacity)
+        return;
+
+    // Grow geometrically, so that fission does not reallocate at every event
+    size_t capacity = MAX(num_parts, 2 * _capacity);
+    _pos = create_buffer(CL_MEM_READ_WRITE, 3 * capacity * sizeof(cl_double), "positions");
+    _next_pos = create_buffer(CL_MEM_READ_WRITE, 3 * capacity * sizeof(cl_double), "positions");
+    _vel = create_buffer(CL_MEM_READ_WRITE, 3 * capacity * sizeof(cl_double), "velocities");
+    _radii = create_buffer(CL_MEM_READ_ONLY, capacity * sizeof(cl_double), "radii");
+    _wall_delta_times = create_buffer(CL_MEM_READ_WRITE, capacity * sizeof(cl_double), "wall collision");
+    _wall_axis = create_buffer(CL_MEM_READ_WRITE, capacity * sizeof(cl_int), "wall collision");
+
+    // Indices of the particles, used by the minimum search over the wall collisions
+    std::vector<cl_ulong> indices(capacity);
+    for (size_t p = 0; p < capacity; p++)
+        indices[p] = p;
+    _part_indices = create_buffer(CL_MEM_READ_ONLY, capacity * sizeof(cl_ulong), "particle indices");
+    cl_int status = _queue.enqueueWriteBuffer(_part_indices, CL_TRUE, 0, capacity * sizeof(cl_ulong), indices.data());
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while writing the particle indices on OpenCL device memory." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    _capacity = capacity;
+}
+
+void CLRuntime::write_state(ParticleStore& parts)
+{
+    reserve(parts.capacity());
+    _stride = parts.capacity();
+    cl_int status = _queue.enqueueWriteBuffer(_pos, CL_FALSE, 0, 3 * _stride * sizeof(cl_double), parts.x);
+    status |= _queue.enqueueWriteBuffer(_vel, CL_FALSE, 0, 3 * _stride * sizeof(cl_double), parts.vx);
+    status |= _queue.enqueueWriteBuffer(_radii, CL_TRUE, 0, parts.num_parts() * sizeof(cl_double), parts.radius);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while writing the state of the system on OpenCL device memory." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+void CLRuntime::write_walls(cl_double* x_wall, cl_double* y_wall, cl_double* z_wall)
+{
+    initialize();
+    cl_int status = _queue.enqueueWriteBuffer(_x_wall, CL_FALSE, 0, 2 * sizeof(cl_double), x_wall);
+    status |= _queue.enqueueWriteBuffer(_y_wall, CL_FALSE, 0, 2 * sizeof(cl_double), y_wall);
+    status |= _queue.enqueueWriteBuffer(_z_wall, CL_TRUE, 0, 2 * sizeof(cl_double), z_wall);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while writing the walls on OpenCL device memory." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+void CLRuntime::write_velocity(ParticleStore& parts, size_t p)
+{
+    cl_int status = _queue.enqueueWriteBuffer(_vel, CL_FALSE, p * sizeof(cl_double), sizeof(cl_double), parts.vx + p);
+    status |= _queue.enqueueWriteBuffer(_vel, CL_FALSE, (_stride + p) * sizeof(cl_double), sizeof(cl_double), parts.vy + p);
+    status |= _queue.enqueueWriteBuffer(_vel, CL_TRUE, (2 * _stride + p) * sizeof(cl_double), sizeof(cl_double), parts.vz + p);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while writing the velocity of particle " << p << " on OpenCL device memory." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+void CLRuntime::write_particle(ParticleStore& parts, size_t p)
+{
+    if (parts.capacity() != _stride)
+    {
+        std::stringstream ss;
+        ss << "The state on the OpenCL device does not match the layout of the particles on the host." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    cl_int status = CL_SUCCESS;
+    for (size_t k = 0; k < 3; k++)
+    {
+        status |= _queue.enqueueWriteBuffer(_pos, CL_FALSE, (k * _stride + p) * sizeof(cl_double), sizeof(cl_double), parts.x + k * _stride + p);
+        status |= _queue.enqueueWriteBuffer(_vel, CL_FALSE, (k * _stride + p) * sizeof(cl_double), sizeof(cl_double), parts.vx + k * _stride + p);
+    }
+    status |= _queue.enqueueWriteBuffer(_radii, CL_TRUE, p * sizeof(cl_double), sizeof(cl_double), parts.radius + p);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while writing particle " << p << " on OpenCL device memory." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+void CLRuntime::read_positions(ParticleStore& parts)
+{
+    if (parts.capacity() != _stride)
+    {
+        std::stringstream ss;
+        ss << "The positions on the OpenCL device do not match the layout of the particles on the host." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    cl_int status = _queue.enqueueReadBuffer(_pos, CL_TRUE, 0, 3 * _stride * sizeof(cl_double), parts.x);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while reading the positions from OpenCL device memory." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+void CLRuntime::read_position(ParticleStore& parts, size_t p)
+{
+    cl_int status = _queue.enqueueReadBuffer(_pos, CL_FALSE, p * sizeof(cl_double), sizeof(cl_double), parts.x + p);
+    status |= _queue.enqueueReadBuffer(_pos, CL_FALSE, (_stride + p) * sizeof(cl_double), sizeof(cl_double), parts.y + p);
+    status |= _queue.enqueueReadBuffer(_pos, CL_TRUE, (2 * _stride + p) * sizeof(cl_double), sizeof(cl_double), parts.z + p);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while reading the position of particle " << p << " from OpenCL device memory." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+void CLRuntime::swap_positions()
+{
+    cl::Buffer tmp = _pos;
+    _pos = _next_pos;
+    _next_pos = tmp;
+}
+
+size_t CLRuntime::argmin_num_groups(size_t count)
+{
+    return MAX(1, MIN(ARGMIN_MAX_GROUPS, (count + _argmin_group_size - 1) / _argmin_group_size));
+}
+
+size_t CLRuntime::argmin_group_size()
+{
+    return _argmin_group_size;
+}
+
+size_t CLRuntime::get_stride()
+{
+    return _stride;
+}
+
+size_t CLRuntime::argmin_reduce(size_t num_groups)
+{
+    cl_int status = CL_SUCCESS;
+    size_t in = 0;
+    size_t count = num_groups;
+    while (count > 1)
+    {
+        num_groups = argmin_num_groups(count);
+        status = _argmin_reduce_kernel.setArg(0, _argmin_values[in]);
+        status |= _argmin_reduce_kernel.setArg(1, _argmin_indices[in]);
+        status |= _argmin_reduce_kernel.setArg(2, (cl_ulong)count);
+        status |= _argmin_reduce_kernel.setArg(3, _argmin_values[1 - in]);
+        status |= _argmin_reduce_kernel.setArg(4, _argmin_indices[1 - in]);
+        status |= _argmin_reduce_kernel.setArg(5, cl::Local(_argmin_group_size * sizeof(cl_double)));
+        status |= _argmin_reduce_kernel.setArg(6, cl::Local(_argmin_group_size * sizeof(cl_ulong)));
+        if (status != CL_SUCCESS)
+        {
+            std::stringstream ss;
+            ss << "Errors occurred while setting the arguments of the OpenCL kernel for the minimum search." << std::endl;
+            throw std::runtime_error(ss.str());
+        }
+        _queue.enqueueNDRangeKernel(_argmin_reduce_kernel, cl::NullRange,
+                                    cl::NDRange(num_groups * _argmin_group_size), cl::NDRange(_argmin_group_size));
+        in = 1 - in;
+        count = num_groups;
+    }
+
+    return in;
+}
+
+void CLRuntime::argmin_read(size_t b, cl_double* value, cl_ulong* index)
+{
+    cl_int status = _queue.enqueueReadBuffer(_argmin_values[b], CL_FALSE, 0, sizeof(cl_double), value);
+    status |= _queue.enqueueReadBuffer(_argmin_indices[b], CL_TRUE, 0, sizeof(cl_ulong), index);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while reading the result of the minimum search from OpenCL device memory." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+void CLRuntime::argmin_finish(size_t num_groups, cl_double* value, cl_ulong* index)
+{
+    argmin_read(argmin_reduce(num_groups), value, index);
+}
+
+cl::Buffer& CLRuntime::get_part_delta_times(size_t num_parts)
+{
+    if (num_parts * num_parts > _part_delta_times_capacity)
+    {
+        _part_delta_times = create_buffer(CL_MEM_READ_WRITE, num_parts * num_parts * sizeof(cl_double), "particle collision");
+        _part_delta_times_capacity = num_parts * num_parts;
+    }
+    return _part_delta_times;
+}
+
+cl::Context& CLRuntime::get_context()
+{
+    return _context;
+}
+
+cl::CommandQueue& CLRuntime::get_queue()
+{
+    return _queue;
+}
+
+cl::Kernel& CLRuntime::get_pos_update_kernel()
+{
+    return _pos_update_kernel;
+}
+
+cl::Kernel& CLRuntime::get_wall_collision_kernel()
+{
+    return _wall_collision_kernel;
+}
+
+cl::Kernel& CLRuntime::get_part_collision_kernel()
+{
+    return _part_collision_kernel;
+}
+
+cl::Kernel& CLRuntime::get_part_collision_argmin_kernel()
+{
+    return _part_collision_argmin_kernel;
+}
+
+cl::Kernel& CLRuntime::get_part_collision_triangular_kernel()
+{
+    return _part_collision_triangular_kernel;
+}
+
+cl::Kernel& CLRuntime::get_argmin_reduce_kernel()
+{
+    return _argmin_reduce_kernel;
+}
+
+cl::Kernel& CLRuntime::get_inelastic_select_kernel()
+{
+    return _inelastic_select_kernel;
+}
+
+cl::Kernel& CLRuntime::get_inelastic_advance_kernel()
+{
+    return _inelastic_advance_kernel;
+}
+
+cl::Kernel& CLRuntime::get_inelastic_resolve_kernel()
+{
+    return _inelastic_resolve_kernel;
+}
+
+cl::Kernel& CLRuntime::get_ensemble_batch_kernel()
+{
+    return _ensemble_batch_kernel;
+}
+
+cl::Buffer& CLRuntime::get_positions()
+{
+    return _pos;
+}
+
+cl::Buffer& CLRuntime::get_next_positions()
+{
+    return _next_pos;
+}
+
+cl::Buffer& CLRuntime::get_velocities()
+{
+    return _vel;
+}
+
+cl::Buffer& CLRuntime::get_radii()
+{
+    return _radii;
+}
+
+cl::Buffer& CLRuntime::get_x_wall()
+{
+    return _x_wall;
+}
+
+cl::Buffer& CLRuntime::get_y_wall()
+{
+    return _y_wall;
+}
+
+cl::Buffer& CLRuntime::get_z_wall()
+{
+    return _z_wall;
+}
+
+cl::Buffer& CLRuntime::get_wall_delta_times()
+{
+    return _wall_delta_times;
+}
+
+cl::Buffer& CLRuntime::get_wall_axis()
+{
+    return _wall_axis;
+}
+
+cl::Buffer& CLRuntime::get_part_indices()
+{
+    return _part_indices;
+}
+
+cl::Buffer& CLRuntime::get_argmin_values(size_t b)
+{
+    return _argmin_values[b];
+}
+
+cl::Buffer& CLRuntime::get_argmin_indices(size_t b)
+{
+    return _argmin_indices[b];
+}
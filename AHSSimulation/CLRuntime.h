@@ -0,0 +1,147 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+#include "particle_store.h"
+
+// Work-group size and maximum number of work-groups for the minimum searches
+#define ARGMIN_GROUP_SIZE   256
+#define ARGMIN_MAX_GROUPS   256
+
+// OpenCL objects shared by the whole simulation: a single context and command queue on the
+// device selected in CLSettings, the programs built once, and the state of the system kept
+// on the device between kernel launches.
+class CLRuntime
+{
+private:
+    static bool _initialized;
+    static bool _inelastic_batch_initialized;
+    static std::string _build_options;
+    static cl::Context _context;
+    static cl::CommandQueue _queue;
+    static cl::Program _pos_update_program;
+    static cl::Program _wall_collision_program;
+    static cl::Program _part_collision_program;
+    static cl::Program _inelastic_batch_program;
+
+    // Kernels
+    static cl::Kernel _pos_update_kernel;
+    static cl::Kernel _wall_collision_kernel;
+    static cl::Kernel _part_collision_kernel;
+    static cl::Kernel _part_collision_argmin_kernel;
+    static cl::Kernel _part_collision_triangular_kernel;
+    static cl::Kernel _argmin_reduce_kernel;
+    static cl::Kernel _inelastic_select_kernel;
+    static cl::Kernel _inelastic_advance_kernel;
+    static cl::Kernel _inelastic_resolve_kernel;
+    static cl::Kernel _ensemble_batch_kernel;
+
+    // Device-resident state of the system. Positions and velocities are planar, as in ParticleStore,
+    // with the stride of the store of the last upload.
+    static size_t _capacity;
+    static size_t _stride;
+    static cl::Buffer _pos;
+    static cl::Buffer _next_pos;
+    static cl::Buffer _vel;
+    static cl::Buffer _radii;
+    static cl::Buffer _x_wall;
+    static cl::Buffer _y_wall;
+    static cl::Buffer _z_wall;
+
+    // Scratch buffers of the kernels
+    static cl::Buffer _wall_delta_times;
+    static cl::Buffer _wall_axis;
+    static cl::Buffer _part_indices;
+    static size_t _part_delta_times_capacity;
+    static cl::Buffer _part_delta_times;
+    static size_t _argmin_group_size;
+    static cl::Buffer _argmin_values[2];
+    static cl::Buffer _argmin_indices[2];
+
+    // Build a program from the sources, or load it from the cache of the program binaries
+    static cl::Program build_program(const cl::vector<std::string>& sources, const char* name,
+                                     const std::string& options);
+    static cl::Kernel create_kernel(cl::Program& program, const char* name);
+
+    CLRuntime() {};
+    CLRuntime(CLRuntime& clr) {};
+    ~CLRuntime() {};
+    void operator=(CLRuntime& clr) {};
+
+public:
+    // Create the context, the queue and the programs. Does nothing if already done.
+    static void initialize();
+    // Build the program of the on-device inelastic loop, which is needed only by that engine and by the ensemble
+    static void initialize_inelastic_batch();
+    // Bake the constants of the run into the build options of the programs, so that the kernels can
+    // fold them. The walls never change. If the particles never change either (inelastic model),
+    // their number and, when uniform, their radius and mass are baked too.
+    // Must be called before the programs are built.
+    static void specialize(cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                           cl_double* radii, cl_double* masses, size_t num_parts, bool constant_particles);
+
+    // Create a buffer in the shared context
+    static cl::Buffer create_buffer(cl_mem_flags flags, size_t size, const char* name);
+
+    // Make the device buffers large enough for the given number of particles
+    static void reserve(size_t num_parts);
+
+    // Upload the whole state of the system, or the walls. The planar arrays are copied as a whole,
+    // and the stride of the device arrays becomes the capacity of the store.
+    static void write_state(ParticleStore& parts);
+    static void write_walls(cl_double* x_wall, cl_double* y_wall, cl_double* z_wall);
+    // Upload the velocity of a single particle, or its position, velocity and radius.
+    // The store must have the layout of the last upload.
+    static void write_velocity(ParticleStore& parts, size_t p);
+    static void write_particle(ParticleStore& parts, size_t p);
+
+    // Download the positions of all the particles, or of a single particle.
+    // The store must be the one of the last upload.
+    static void read_positions(ParticleStore& parts);
+    static void read_position(ParticleStore& parts, size_t p);
+
+    // Make the positions computed by the last position update the current ones
+    static void swap_positions();
+
+    // Reduce the partial results of a minimum search, without waiting for the result.
+    // The first step must have written num_groups results in the first argmin buffers.
+    // Returns the argmin buffers holding the result in their first element.
+    static size_t argmin_reduce(size_t num_groups);
+    // Read the result of a minimum search from the given argmin buffers
+    static void argmin_read(size_t b, cl_double* value, cl_ulong* index);
+    // Same as argmin_reduce, but the result is read
+    static void argmin_finish(size_t num_groups, cl_double* value, cl_ulong* index);
+    // Number of work-groups for the first step of a minimum search over count values
+    static size_t argmin_num_groups(size_t count);
+    static size_t argmin_group_size();
+
+    // Offset of the y components in the planar arrays, and twice that of the z components
+    static size_t get_stride();
+
+    // A buffer large enough to hold the collision times of all the couples
+    static cl::Buffer& get_part_delta_times(size_t num_parts);
+
+    static cl::Context& get_context();
+    static cl::CommandQueue& get_queue();
+    static cl::Kernel& get_pos_update_kernel();
+    static cl::Kernel& get_wall_collision_kernel();
+    static cl::Kernel& get_part_collision_kernel();
+    static cl::Kernel& get_part_collision_argmin_kernel();
+    static cl::Kernel& get_part_collision_triangular_kernel();
+    static cl::Kernel& get_argmin_reduce_kernel();
+    static cl::Kernel& get_inelastic_select_kernel();
+    static cl::Kernel& get_inelastic_advance_kernel();
+    static cl::Kernel& get_inelastic_resolve_kernel();
+    static cl::Kernel& get_ensemble_batch_kernel();
+    static cl::Buffer& get_positions();
+    static cl::Buffer& get_next_positions();
+    static cl::Buffer& get_velocities();
+    static cl::Buffer& get_radii();
+    static cl::Buffer& get_x_wall();
+    static cl::Buffer& get_y_wall();
+    static cl::Buffer& get_z_wall();
+    static cl::Buffer& get_wall_delta_times();
+    static cl::Buffer& get_wall_axis();
+    static cl::Buffer& get_part_indices();
+    static cl::Buffer& get_argmin_values(size_t b);
+    static cl::Buffer& get_argmin_indices(size_t b);
+};
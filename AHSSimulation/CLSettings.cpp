@@ -1,19 +1,45 @@
 #include "CLSettings.h"
-#include <fstream>
+#include "device_selection.h"
+#include "kernel_sources.h"
 #include <sstream>
 #include <iostream>
 
-#define POSITION_UPDATE_KERNEL_SOURCE   "pos_update.cl"
-#define WALL_COLLISION_KERNEL_SOURCE    "wall_collision.cl"
-#define PART_COLLISION_KERNEL_SOURCE    "part_collision.cl"
-
 cl::Device* CLSettings::_device;
 std::string CLSettings::_pos_update_source;
 std::string CLSettings::_wall_collision_source;
 std::string CLSettings::_part_collision_source;
+std::string CLSettings::_inelastic_batch_source;
+std::string CLSettings::_domain_source;
 std::string CLSettings::_output_file;
+int CLSettings::_engine = ENGINE_FULL_SCAN;
+int CLSettings::_broadphase = BROADPHASE_ALL_PAIRS;
+int CLSettings::_state_update = STATE_UPDATE_EAGER;
+int CLSettings::_pair_launch = PAIR_LAUNCH_SQUARE;
+size_t CLSettings::_batch_size = 64;
+size_t CLSettings::_ensemble_size = 1;
+std::string CLSettings::_backend = BACKEND_OPENCL;
+size_t CLSettings::_num_threads = 0;
+std::string CLSettings::_device_selection;
+int CLSettings::_specialize = SPECIALIZE_ON;
+size_t CLSettings::_output_buffers = 4;
+size_t CLSettings::_output_buffer_size = 4 << 20;
+int CLSettings::_output_direct = OUTPUT_DIRECT_OFF;
+int CLSettings::_output_format = OUTPUT_FORMAT_FRAMES;
+size_t CLSettings::_keyframe_interval = 10000;
+cl_double CLSettings::_snapshot_interval = 0;
+size_t CLSettings::_max_frames = 0;
+int CLSettings::_output_index = OUTPUT_INDEX_OFF;
+int CLSettings::_output_compression = OUTPUT_COMPRESSION_OFF;
+size_t CLSettings::_compression_threads = 2;
+size_t CLSettings::_checkpoint_interval = 0;
+std::string CLSettings::_checkpoint_file;
+bool CLSettings::_resume = false;
+size_t CLSettings::_seed = 0;
+cl_double CLSettings::_temperature = 1;
+cl_double CLSettings::_packing_fraction = 0;
+std::string CLSettings::_devices = DEVICES_ALL;
 
-cl_device_id CLSettings::select_device()
+cl_device_id CLSettings::select_device(cl_device_type device_type, size_t num_parts)
 {
     cl::vector<cl::Platform> plats;
     cl::Platform::get(&plats);
@@ -22,17 +48,25 @@ cl_device_id CLSettings::select_device()
     for (size_t i = 0; i < plats.size(); i++)
     {
         cl::vector<cl::Device> devs_loc;
-        plats[i].getDevices(CL_DEVICE_TYPE_ALL, &devs_loc);
+        plats[i].getDevices(device_type, &devs_loc);
         devs.insert(devs.end(), devs_loc.begin(), devs_loc.end());
     }
-
-    for (size_t i = 0; i < devs.size(); i++)
+    if (devs.empty())
     {
-        std::string devname;
-        devs[i].getInfo(CL_DEVICE_NAME, &devname);
-        std::cout << (i + 1) << ". " << devname << std::endl;
+        std::stringstream ss;
+        ss << "No OpenCL device of the requested type is available." << std::endl;
+        throw std::runtime_error(ss.str());
     }
 
+    for (size_t i = 0; i < devs.size(); i++)
+        std::cout << (i + 1) << ". " << device_full_name(devs[i]) << std::endl;
+
+    // Non-interactive selection, by calibration or by index or name
+    if (_device_selection == DEVICE_SELECTION_AUTO)
+        return devs[auto_select_device(devs, device_type, num_parts)].get();
+    if (!_device_selection.empty())
+        return devs[find_device(devs, _device_selection)].get();
+
     int d;
     while (true)
     {
@@ -80,29 +114,153 @@ void CLSettings::set_output_file(std::string& filename)
     _output_file = std::string(filename);
 }
 
+void CLSettings::set_engine(int engine)
+{
+    _engine = engine;
+}
+
+void CLSettings::set_broadphase(int broadphase)
+{
+    _broadphase = broadphase;
+}
+
+void CLSettings::set_state_update(int state_update)
+{
+    _state_update = state_update;
+}
+
+void CLSettings::set_pair_launch(int pair_launch)
+{
+    _pair_launch = pair_launch;
+}
+
+void CLSettings::set_batch_size(size_t batch_size)
+{
+    _batch_size = batch_size;
+}
+
+void CLSettings::set_ensemble_size(size_t ensemble_size)
+{
+    _ensemble_size = ensemble_size;
+}
+
+void CLSettings::set_backend(const std::string& backend)
+{
+    _backend = backend;
+}
+
+void CLSettings::set_num_threads(size_t num_threads)
+{
+    _num_threads = num_threads;
+}
+
+void CLSettings::set_device_selection(const std::string& device_selection)
+{
+    _device_selection = device_selection;
+}
+
+void CLSettings::set_specialize(int specialize)
+{
+    _specialize = specialize;
+}
+
+void CLSettings::set_output_buffers(size_t output_buffers)
+{
+    _output_buffers = output_buffers;
+}
+
+void CLSettings::set_output_buffer_size(size_t output_buffer_size)
+{
+    _output_buffer_size = output_buffer_size;
+}
+
+void CLSettings::set_output_direct(int output_direct)
+{
+    _output_direct = output_direct;
+}
+
+void CLSettings::set_output_format(int output_format)
+{
+    _output_format = output_format;
+}
+
+void CLSettings::set_keyframe_interval(size_t keyframe_interval)
+{
+    _keyframe_interval = keyframe_interval;
+}
+
+void CLSettings::set_snapshot_interval(cl_double snapshot_interval)
+{
+    _snapshot_interval = snapshot_interval;
+}
+
+void CLSettings::set_max_frames(size_t max_frames)
+{
+    _max_frames = max_frames;
+}
+
+void CLSettings::set_output_index(int output_index)
+{
+    _output_index = output_index;
+}
+
+void CLSettings::set_output_compression(int output_compression)
+{
+    _output_compression = output_compression;
+}
+
+void CLSettings::set_compression_threads(size_t compression_threads)
+{
+    _compression_threads = compression_threads;
+}
+
+void CLSettings::set_checkpoint_interval(size_t checkpoint_interval)
+{
+    _checkpoint_interval = checkpoint_interval;
+}
+
+void CLSettings::set_checkpoint_file(const std::string& checkpoint_file)
+{
+    _checkpoint_file = checkpoint_file;
+}
+
+void CLSettings::set_resume(bool resume)
+{
+    _resume = resume;
+}
+
+void CLSettings::set_seed(size_t seed)
+{
+    _seed = seed;
+}
+
+void CLSettings::set_temperature(cl_double temperature)
+{
+    _temperature = temperature;
+}
+
+void CLSettings::set_packing_fraction(cl_double packing_fraction)
+{
+    _packing_fraction = packing_fraction;
+}
+
+void CLSettings::set_devices(const std::string& devices)
+{
+    _devices = devices;
+}
+
 cl::Device& CLSettings::get_device()
 {
     return *_device;
 }
 
 
+// The kernel sources are embedded in the executable by kernel_sources.h, generated by
+// embed_kernels.py, so that it does not depend on the working directory.
 std::string CLSettings::get_source_position_update()
 {
     if (_pos_update_source.empty())
-    {
-        std::stringstream source;
-        std::ifstream stream;
-        stream.open(POSITION_UPDATE_KERNEL_SOURCE);
-        if (!stream)
-        {
-            std::stringstream ss;
-            ss << "Errors occurred while opening kernel source file " << POSITION_UPDATE_KERNEL_SOURCE << "." << std::endl;
-            throw new std::runtime_error(ss.str());
-        }
-        source << stream.rdbuf();
-
-        _pos_update_source = source.str();
-    }
+        _pos_update_source = pos_update_source;
 
     return _pos_update_source;
 }
@@ -110,20 +268,7 @@ std::string CLSettings::get_source_position_update()
 std::string CLSettings::get_source_wall_collision()
 {
     if (_wall_collision_source.empty())
-    {
-        std::stringstream source;
-        std::ifstream stream;
-        stream.open(WALL_COLLISION_KERNEL_SOURCE);
-        if (!stream)
-        {
-            std::stringstream ss;
-            ss << "Errors occurred while opening kernel source file " << WALL_COLLISION_KERNEL_SOURCE << "." << std::endl;
-            throw new std::runtime_error(ss.str());
-        }
-        source << stream.rdbuf();
-
-        _wall_collision_source = source.str();
-    }
+        _wall_collision_source = wall_collision_source;
 
     return _wall_collision_source;
 }
@@ -131,25 +276,163 @@ std::string CLSettings::get_source_wall_collision()
 std::string CLSettings::get_source_part_collision()
 {
     if (_part_collision_source.empty())
-    {
-        std::stringstream source;
-        std::ifstream stream;
-        stream.open(PART_COLLISION_KERNEL_SOURCE);
-        if (!stream)
-        {
-            std::stringstream ss;
-            ss << "Errors occurred while opening kernel source file " << PART_COLLISION_KERNEL_SOURCE << "." << std::endl;
-            throw new std::runtime_error(ss.str());
-        }
-        source << stream.rdbuf();
-
-        _part_collision_source = source.str();
-    }
+        _part_collision_source = part_collision_source;
 
     return _part_collision_source;
 }
 
+std::string CLSettings::get_source_inelastic_batch()
+{
+    if (_inelastic_batch_source.empty())
+        _inelastic_batch_source = inelastic_batch_source;
+
+    return _inelastic_batch_source;
+}
+
+std::string CLSettings::get_source_domain()
+{
+    if (_domain_source.empty())
+        _domain_source = domain_source;
+
+    return _domain_source;
+}
+
 std::string CLSettings::get_output_file()
 {
     return _output_file;
 }
+
+int CLSettings::get_engine()
+{
+    return _engine;
+}
+
+int CLSettings::get_broadphase()
+{
+    return _broadphase;
+}
+
+int CLSettings::get_state_update()
+{
+    return _state_update;
+}
+
+int CLSettings::get_pair_launch()
+{
+    return _pair_launch;
+}
+
+size_t CLSettings::get_batch_size()
+{
+    return _batch_size;
+}
+
+size_t CLSettings::get_ensemble_size()
+{
+    return _ensemble_size;
+}
+
+std::string CLSettings::get_backend()
+{
+    return _backend;
+}
+
+size_t CLSettings::get_num_threads()
+{
+    return _num_threads;
+}
+
+std::string CLSettings::get_device_selection()
+{
+    return _device_selection;
+}
+
+int CLSettings::get_specialize()
+{
+    return _specialize;
+}
+
+size_t CLSettings::get_output_buffers()
+{
+    return _output_buffers;
+}
+
+size_t CLSettings::get_output_buffer_size()
+{
+    return _output_buffer_size;
+}
+
+int CLSettings::get_output_direct()
+{
+    return _output_direct;
+}
+
+int CLSettings::get_output_format()
+{
+    return _output_format;
+}
+
+size_t CLSettings::get_keyframe_interval()
+{
+    return _keyframe_interval;
+}
+
+cl_double CLSettings::get_snapshot_interval()
+{
+    return _snapshot_interval;
+}
+
+size_t CLSettings::get_max_frames()
+{
+    return _max_frames;
+}
+
+int CLSettings::get_output_index()
+{
+    return _output_index;
+}
+
+int CLSettings::get_output_compression()
+{
+    return _output_compression;
+}
+
+size_t CLSettings::get_compression_threads()
+{
+    return _compression_threads;
+}
+
+size_t CLSettings::get_checkpoint_interval()
+{
+    return _checkpoint_interval;
+}
+
+std::string CLSettings::get_checkpoint_file()
+{
+    return _checkpoint_file;
+}
+
+bool CLSettings::get_resume()
+{
+    return _resume;
+}
+
+size_t CLSettings::get_seed()
+{
+    return _seed;
+}
+
+cl_double CLSettings::get_temperature()
+{
+    return _temperature;
+}
+
+cl_double CLSettings::get_packing_fraction()
+{
+    return _packing_fraction;
+}
+
+std::string CLSettings::get_devices()
+{
+    return _devices;
+}
\ No newline at end of file
@@ -1,14 +1,58 @@
 #pragma once
 
 #include <CL/cl2.hpp>
+#include "backend.h"
 
 #define POSITION_UPDATE_KERNEL_NAME "pos_update"
 #define WALL_COLLISION_KERNEL_NAME  "wall_collision"
 #define PART_COLLISION_KERNEL_NAME  "part_collision"
+#define PART_COLLISION_ARGMIN_KERNEL_NAME   "part_collision_argmin"
+#define ARGMIN_REDUCE_KERNEL_NAME   "argmin_reduce"
+#define PART_COLLISION_TRIANGULAR_KERNEL_NAME   "part_collision_triangular"
+#define INELASTIC_SELECT_KERNEL_NAME    "inelastic_select"
+#define INELASTIC_ADVANCE_KERNEL_NAME   "inelastic_advance"
+#define INELASTIC_RESOLVE_KERNEL_NAME   "inelastic_resolve"
+#define ENSEMBLE_BATCH_KERNEL_NAME      "ensemble_batch"
+#define DOMAIN_PART_COLLISION_KERNEL_NAME       "domain_part_collision"
+#define DOMAIN_PARTICLE_COLLISION_KERNEL_NAME   "domain_particle_collision"
+#define DOMAIN_CROSSING_KERNEL_NAME             "domain_crossing"
 
-#define SIMULATION_TYPE_INELSATIC   (size_t)0;
-#define SIMULATION_TYPE_FUSION      (size_t)1;
-#define SIMULATION_TYPE_FISSION     (size_t)2;
+#define SIMULATION_TYPE_INELSATIC   (size_t)0
+#define SIMULATION_TYPE_FUSION      (size_t)1
+#define SIMULATION_TYPE_FISSION     (size_t)2
+
+#define ENGINE_FULL_SCAN            0
+#define ENGINE_EVENT_DRIVEN         1
+#define ENGINE_DEVICE_BATCH         2
+#define ENGINE_ENSEMBLE             3
+
+#define BROADPHASE_ALL_PAIRS        0
+#define BROADPHASE_CELL_LIST        1
+
+#define STATE_UPDATE_EAGER          0
+#define STATE_UPDATE_DELAYED        1
+
+#define PAIR_LAUNCH_SQUARE          0
+#define PAIR_LAUNCH_TRIANGULAR      1
+
+#define SPECIALIZE_OFF              0
+#define SPECIALIZE_ON               1
+
+#define OUTPUT_DIRECT_OFF           0
+#define OUTPUT_DIRECT_ON            1
+
+#define OUTPUT_FORMAT_FRAMES        0
+#define OUTPUT_FORMAT_EVENT_LOG     1
+
+#define OUTPUT_INDEX_OFF            0
+#define OUTPUT_INDEX_ON             1
+
+#define OUTPUT_COMPRESSION_OFF      0
+#define OUTPUT_COMPRESSION_SHUFFLE  1
+
+// Devices of the multi-device backend (see device_selection.h)
+#define DEVICES_ALL                 "ALL"
+#define DEVICES_NUMA                "NUMA"
 
 class CLSettings
 {
@@ -17,7 +61,36 @@ private:
     static std::string _pos_update_source;
     static std::string _wall_collision_source;
     static std::string _part_collision_source;
+    static std::string _inelastic_batch_source;
+    static std::string _domain_source;
     static std::string _output_file;
+    static int _engine;
+    static int _broadphase;
+    static int _state_update;
+    static int _pair_launch;
+    static size_t _batch_size;
+    static size_t _ensemble_size;
+    static std::string _backend;
+    static size_t _num_threads;
+    static std::string _device_selection;
+    static int _specialize;
+    static size_t _output_buffers;
+    static size_t _output_buffer_size;
+    static int _output_direct;
+    static int _output_format;
+    static size_t _keyframe_interval;
+    static cl_double _snapshot_interval;
+    static size_t _max_frames;
+    static int _output_index;
+    static int _output_compression;
+    static size_t _compression_threads;
+    static size_t _checkpoint_interval;
+    static std::string _checkpoint_file;
+    static bool _resume;
+    static size_t _seed;
+    static cl_double _temperature;
+    static cl_double _packing_fraction;
+    static std::string _devices;
 
     CLSettings() {};
     CLSettings(CLSettings& cls) {};
@@ -25,12 +98,71 @@ private:
     void operator=(CLSettings& cls) {};
 
 public:
-    static cl_device_id select_device();
+    // Selection among the devices of the given type, for a system of num_parts particles.
+    // Interactive, unless a device selection has been set (see device_selection.h).
+    static cl_device_id select_device(cl_device_type device_type, size_t num_parts);
     static void set_device(cl::Device& device);
     static void set_output_file(std::string& filename);
+    static void set_engine(int engine);
+    static void set_broadphase(int broadphase);
+    static void set_state_update(int state_update);
+    static void set_pair_launch(int pair_launch);
+    static void set_batch_size(size_t batch_size);
+    // Number of replicas run by the ensemble engine, which the calibration of the devices needs
+    static void set_ensemble_size(size_t ensemble_size);
+    static void set_backend(const std::string& backend);
+    static void set_num_threads(size_t num_threads);
+    static void set_device_selection(const std::string& device_selection);
+    static void set_specialize(int specialize);
+    static void set_output_buffers(size_t output_buffers);
+    static void set_output_buffer_size(size_t output_buffer_size);
+    static void set_output_direct(int output_direct);
+    static void set_output_format(int output_format);
+    static void set_keyframe_interval(size_t keyframe_interval);
+    static void set_snapshot_interval(cl_double snapshot_interval);
+    static void set_max_frames(size_t max_frames);
+    static void set_output_index(int output_index);
+    static void set_output_compression(int output_compression);
+    static void set_compression_threads(size_t compression_threads);
+    static void set_checkpoint_interval(size_t checkpoint_interval);
+    static void set_checkpoint_file(const std::string& checkpoint_file);
+    static void set_resume(bool resume);
+    static void set_seed(size_t seed);
+    static void set_temperature(cl_double temperature);
+    static void set_packing_fraction(cl_double packing_fraction);
+    static void set_devices(const std::string& devices);
     static cl::Device& get_device();
     static std::string get_source_position_update();
     static std::string get_source_wall_collision();
     static std::string get_source_part_collision();
+    static std::string get_source_inelastic_batch();
+    static std::string get_source_domain();
     static std::string get_output_file();
+    static int get_engine();
+    static int get_broadphase();
+    static int get_state_update();
+    static int get_pair_launch();
+    static size_t get_batch_size();
+    static size_t get_ensemble_size();
+    static std::string get_backend();
+    static size_t get_num_threads();
+    static std::string get_device_selection();
+    static int get_specialize();
+    static size_t get_output_buffers();
+    static size_t get_output_buffer_size();
+    static int get_output_direct();
+    static int get_output_format();
+    static size_t get_keyframe_interval();
+    static cl_double get_snapshot_interval();
+    static size_t get_max_frames();
+    static int get_output_index();
+    static int get_output_compression();
+    static size_t get_compression_threads();
+    static size_t get_checkpoint_interval();
+    static std::string get_checkpoint_file();
+    static bool get_resume();
+    static size_t get_seed();
+    static cl_double get_temperature();
+    static cl_double get_packing_fraction();
+    static std::string get_devices();
 };
\ No newline at end of file
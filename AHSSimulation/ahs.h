@@ -2,7 +2,20 @@
 
 #include <CL/cl2.hpp>
 #include "CLSettings.h"
+#include "device_selection.h"
 #include "shared.h"
 #include "inelastic.h"
 #include "fusion.h"
-#include "fission.h"
\ No newline at end of file
+#include "fission.h"
+#include "simulation_engine.h"
+#include "output_writer.h"
+#include "trajectory.h"
+#include "compressed_reader.h"
+#include "input_loader.h"
+#include "initial_state.h"
+#include "checkpoint.h"
+#include "event_driven.h"
+#include "particle_store.h"
+#include "backends.h"
+#include "cpu_backend.h"
+#include "thread_pool.h"
\ No newline at end of file
@@ -0,0 +1,191 @@
+#include "backends.h"
+#include "shared.h"
+#include "inelastic.h"
+#include "fusion.h"
+#include "fission.h"
+#include <sstream>
+
+#define MIN(x, y)       ((x) < (y) ? (x) : (y))
+#define MAX(x, y)       ((x) > (y) ? (x) : (y))
+
+bool Backend::uses_opencl() const
+{
+    return false;
+}
+
+void Backend::specialize(cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                         cl_double* radii, cl_double* masses, size_t num_parts, bool constant_particles)
+{
+}
+
+void Backend::upload_state(ParticleStore& parts)
+{
+}
+
+void Backend::upload_walls(cl_double* x_wall, cl_double* y_wall, cl_double* z_wall)
+{
+}
+
+void Backend::upload_velocity(ParticleStore& parts, size_t p)
+{
+}
+
+void Backend::upload_particle(ParticleStore& parts, size_t p)
+{
+}
+
+void Backend::download_positions(ParticleStore& parts)
+{
+}
+
+void Backend::download_position(ParticleStore& parts, size_t p)
+{
+}
+
+void Backend::resolve_wall_collision(ParticleStore& parts, size_t p, cl_double* collision_axis)
+{
+    ::resolve_wall_collision(parts, p, collision_axis);
+    upload_velocity(parts, p);
+}
+
+void Backend::resolve_inelastic_collision(ParticleStore& parts, cl_double e, size_t i, size_t j)
+{
+    download_position(parts, i);
+    download_position(parts, j);
+    resolve_inelastic_part_collision(parts, e, i, j);
+    upload_velocity(parts, i);
+    upload_velocity(parts, j);
+}
+
+void Backend::resolve_fusion_collision(ParticleStore& parts, cl_double e, size_t i, size_t j, cl_double fusion_thresh)
+{
+    // The last particle may be moved to the index of a fused one, so its position is needed too
+    size_t num_parts = parts.num_parts();
+    download_position(parts, i);
+    download_position(parts, j);
+    download_position(parts, num_parts - 1);
+    resolve_fusion_part_collision(parts, e, i, j, fusion_thresh);
+
+    if (parts.num_parts() == num_parts)
+    {
+        upload_velocity(parts, i);
+        upload_velocity(parts, j);
+        return;
+    }
+    // The new particle is at the lower index, and the last one moved to the higher index, if any
+    upload_particle(parts, MIN(i, j));
+    if (MAX(i, j) < parts.num_parts())
+        upload_particle(parts, MAX(i, j));
+}
+
+void Backend::resolve_fission_collision(ParticleStore& parts, cl_double e, size_t i, size_t j, cl_double fusion_thresh)
+{
+    // If the new particle does not fit, the store grows and the whole state is uploaded again,
+    // which needs all the positions. This happens only a logarithmic number of times.
+    size_t num_parts = parts.num_parts();
+    size_t capacity = parts.capacity();
+    if (num_parts == capacity)
+        download_positions(parts);
+    else
+    {
+        download_position(parts, i);
+        download_position(parts, j);
+    }
+    resolve_fission_part_collision(parts, e, i, j, fusion_thresh);
+
+    if (parts.capacity() != capacity)
+        upload_state(parts);
+    else if (parts.num_parts() == num_parts)
+    {
+        upload_velocity(parts, i);
+        upload_velocity(parts, j);
+    }
+    else
+    {
+        // The broken particle is one of the two, and the new one is the last
+        upload_particle(parts, i);
+        upload_particle(parts, j);
+        upload_particle(parts, parts.num_parts() - 1);
+    }
+}
+
+
+static Backend* create_opencl_backend()
+{
+    return new OpenCLBackend(BACKEND_OPENCL, CL_DEVICE_TYPE_ALL);
+}
+
+static Backend* create_opencl_gpu_backend()
+{
+    return new OpenCLBackend(BACKEND_OPENCL_GPU, CL_DEVICE_TYPE_GPU);
+}
+
+static Backend* create_opencl_cpu_backend()
+{
+    return new OpenCLBackend(BACKEND_OPENCL_CPU, CL_DEVICE_TYPE_CPU);
+}
+
+static Backend* create_opencl_multi_backend()
+{
+    return new MultiDeviceBackend();
+}
+
+static Backend* create_native_cpu_backend()
+{
+    return new NativeCPUBackend();
+}
+
+static Backend* create_serial_backend()
+{
+    return new SerialBackend();
+}
+
+std::map<std::string, BackendFactory>& BackendRegistry::factories()
+{
+    static std::map<std::string, BackendFactory> factories;
+    if (factories.empty())
+    {
+        factories[BACKEND_OPENCL] = create_opencl_backend;
+        factories[BACKEND_OPENCL_GPU] = create_opencl_gpu_backend;
+        factories[BACKEND_OPENCL_CPU] = create_opencl_cpu_backend;
+        factories[BACKEND_OPENCL_MULTI] = create_opencl_multi_backend;
+        factories[BACKEND_NATIVE_CPU] = create_native_cpu_backend;
+        factories[BACKEND_SERIAL] = create_serial_backend;
+    }
+    return factories;
+}
+
+void BackendRegistry::add(const std::string& name, BackendFactory factory)
+{
+    factories()[name] = factory;
+}
+
+bool BackendRegistry::contains(const std::string& name)
+{
+    return factories().find(name) != factories().end();
+}
+
+Backend* BackendRegistry::create(const std::string& name)
+{
+    std::map<std::string, BackendFactory>::iterator it = factories().find(name);
+    if (it == factories().end())
+    {
+        std::stringstream ss;
+        ss << "Unknown compute backend " << name << ". Legal values are " << names() << "." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    return it->second();
+}
+
+std::string BackendRegistry::names()
+{
+    std::stringstream ss;
+    std::map<std::string, BackendFactory>::iterator it;
+    for (it = factories().begin(); it != factories().end(); it++)
+    {
+        if (it != factories().begin())
+            ss << ", ";
+        ss << "\"" << it->first << "\"";
+    }
+    return ss.str();
+}
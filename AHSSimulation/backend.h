@@ -0,0 +1,91 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+#include "particle_store.h"
+#include <map>
+#include <string>
+
+#define BACKEND_OPENCL              "OPENCL"
+#define BACKEND_OPENCL_GPU          "OPENCL_GPU"
+#define BACKEND_OPENCL_CPU          "OPENCL_CPU"
+#define BACKEND_OPENCL_MULTI        "OPENCL_MULTI"
+#define BACKEND_NATIVE_CPU          "NATIVE_CPU"
+#define BACKEND_SERIAL              "SERIAL"
+
+// Index of both particles of the next collision when no couple will ever collide
+#define NO_COLLISION                ((size_t)-1)
+
+// Compute backend of the full-scan loops: prediction of the next collisions, advancement of the
+// positions and resolution of the collisions.
+// The loops own the state on the host, in a ParticleStore. A backend can keep its own copy of the
+// state (e.g. on an OpenCL device), which is synchronized through the upload and download methods,
+// and the loops call them only where the host copy changes or is needed.
+class Backend
+{
+public:
+    virtual ~Backend() {};
+
+    // Name under which the backend is registered
+    virtual std::string name() const = 0;
+    // Prepare the backend for a simulation of num_parts particles (e.g. select the device) and describe the choice
+    virtual void initialize(size_t num_parts) = 0;
+    // True if the backend computes through CLRuntime, as the on-device batch engine requires
+    virtual bool uses_opencl() const;
+    // Constants of the run, given before the first upload. The particles are constant if their
+    // number, radii and masses never change. Backends can use them to specialize their code,
+    // and the default implementation ignores them.
+    virtual void specialize(cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                            cl_double* radii, cl_double* masses, size_t num_parts, bool constant_particles);
+
+    // Synchronization of the copy of the state held by the backend.
+    // The default implementations do nothing, as for backends working on the host arrays.
+    virtual void upload_state(ParticleStore& parts);
+    virtual void upload_walls(cl_double* x_wall, cl_double* y_wall, cl_double* z_wall);
+    virtual void upload_velocity(ParticleStore& parts, size_t p);
+    // Upload position, velocity and radius of a single particle, in the current layout of the state
+    virtual void upload_particle(ParticleStore& parts, size_t p);
+    virtual void download_positions(ParticleStore& parts);
+    virtual void download_position(ParticleStore& parts, size_t p);
+
+    // Prediction of the next collision with the walls and of the next collision between particles.
+    // Ties and systems without collisions must be handled as the OpenCL kernels do: if no couple will
+    // ever collide, dt_part is infinite and both i and j are NO_COLLISION.
+    virtual void next_collisions(ParticleStore& parts,
+                                 cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                                 size_t* p, cl_double* dt_wall, cl_double* collision_axis,
+                                 size_t* i, size_t* j, cl_double* dt_part) = 0;
+    // Advancement of all the particles by delta_time
+    virtual void advance_positions(ParticleStore& parts, cl_double delta_time) = 0;
+
+    // Resolution of the collisions. By default they are resolved on the host, after downloading
+    // the positions involved, and the changes are uploaded back.
+    virtual void resolve_wall_collision(ParticleStore& parts, size_t p, cl_double* collision_axis);
+    virtual void resolve_inelastic_collision(ParticleStore& parts, cl_double e, size_t i, size_t j);
+    // The particles can be added or removed, as by resolve_fusion_part_collision and resolve_fission_part_collision.
+    // By default only the particles changed are synchronized, unless the store has to grow.
+    virtual void resolve_fusion_collision(ParticleStore& parts, cl_double e, size_t i, size_t j, cl_double fusion_thresh);
+    virtual void resolve_fission_collision(ParticleStore& parts, cl_double e, size_t i, size_t j, cl_double fusion_thresh);
+};
+
+typedef Backend* (*BackendFactory)();
+
+// Backends selectable by name, from the BACKEND setting or the --backend option.
+// The built-in backends are registered at the first use.
+class BackendRegistry
+{
+private:
+    static std::map<std::string, BackendFactory>& factories();
+
+    BackendRegistry() {};
+    BackendRegistry(BackendRegistry& br) {};
+    ~BackendRegistry() {};
+    void operator=(BackendRegistry& br) {};
+
+public:
+    static void add(const std::string& name, BackendFactory factory);
+    static bool contains(const std::string& name);
+    // The returned backend must be deleted by the caller
+    static Backend* create(const std::string& name);
+    // Registered names, quoted and separated by commas, for the messages
+    static std::string names();
+};
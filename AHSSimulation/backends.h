@@ -0,0 +1,105 @@
+#pragma once
+
+#include "backend.h"
+#include <vector>
+
+// Backend running the OpenCL kernels on a device of the given type, with the state kept
+// on the device by CLRuntime
+class OpenCLBackend final : public Backend
+{
+private:
+    std::string _name;
+    cl_device_type _device_type;
+    cl::Device _device;
+
+public:
+    OpenCLBackend(const std::string& name, cl_device_type device_type);
+
+    std::string name() const;
+    void initialize(size_t num_parts);
+    bool uses_opencl() const;
+    void specialize(cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                    cl_double* radii, cl_double* masses, size_t num_parts, bool constant_particles);
+
+    void upload_state(ParticleStore& parts);
+    void upload_walls(cl_double* x_wall, cl_double* y_wall, cl_double* z_wall);
+    void upload_velocity(ParticleStore& parts, size_t p);
+    void upload_particle(ParticleStore& parts, size_t p);
+    void download_positions(ParticleStore& parts);
+    void download_position(ParticleStore& parts, size_t p);
+
+    void next_collisions(ParticleStore& parts,
+                         cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                         size_t* p, cl_double* dt_wall, cl_double* collision_axis,
+                         size_t* i, size_t* j, cl_double* dt_part);
+    void advance_positions(ParticleStore& parts, cl_double delta_time);
+};
+
+// Backend running the multithreaded native implementations of cpu_backend.h on the host store
+class NativeCPUBackend final : public Backend
+{
+public:
+    std::string name() const;
+    void initialize(size_t num_parts);
+
+    void next_collisions(ParticleStore& parts,
+                         cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                         size_t* p, cl_double* dt_wall, cl_double* collision_axis,
+                         size_t* i, size_t* j, cl_double* dt_part);
+    void advance_positions(ParticleStore& parts, cl_double delta_time);
+};
+
+// Reference backend: a single thread scanning all the particles and couples with the
+// host predictions of predict_collision.cpp
+class SerialBackend final : public Backend
+{
+public:
+    std::string name() const;
+    void initialize(size_t num_parts);
+
+    void next_collisions(ParticleStore& parts,
+                         cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                         size_t* p, cl_double* dt_wall, cl_double* collision_axis,
+                         size_t* i, size_t* j, cl_double* dt_part);
+    void advance_positions(ParticleStore& parts, cl_double delta_time);
+};
+
+struct DomainDevice;
+
+// Backend decomposing the box in slabs along the x axis, one for each of the OpenCL devices given by
+// the DEVICES setting. Each device holds the particles of its slab and of a halo around it, so that
+// it finds all the collisions of its particles, and the particles entering or leaving a halo are
+// moved between the devices before any collision that could follow (see multi_device_backend.cpp).
+// The programs are not specialized, since the number of particles of each device changes.
+class MultiDeviceBackend final : public Backend
+{
+private:
+    std::vector<DomainDevice*> _devices;
+    // Boundaries of the regions along x, and region of each particle (REGION_NONE if not held)
+    std::vector<cl_double> _boundaries;
+    std::vector<size_t> _region;
+
+    void decompose(ParticleStore& parts);
+    void add_particle(ParticleStore& parts, size_t g, cl_double* pos);
+    void remove_particle(size_t g);
+    void cross_boundary(ParticleStore& parts, size_t g, cl_double* dt_part, cl_ulong* part_k);
+
+public:
+    ~MultiDeviceBackend();
+
+    std::string name() const;
+    void initialize(size_t num_parts);
+
+    void upload_state(ParticleStore& parts);
+    void upload_walls(cl_double* x_wall, cl_double* y_wall, cl_double* z_wall);
+    void upload_velocity(ParticleStore& parts, size_t p);
+    void upload_particle(ParticleStore& parts, size_t p);
+    void download_positions(ParticleStore& parts);
+    void download_position(ParticleStore& parts, size_t p);
+
+    void next_collisions(ParticleStore& parts,
+                         cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                         size_t* p, cl_double* dt_wall, cl_double* collision_axis,
+                         size_t* i, size_t* j, cl_double* dt_part);
+    void advance_positions(ParticleStore& parts, cl_double delta_time);
+};
@@ -0,0 +1,212 @@
+#include "cell_list.h"
+#include <math.h>
+
+#define MAX(x, y)       ((x) > (y) ? (x) : (y))
+#define ABS(x)          ((x) < 0 ? -(x) : (x))
+
+// Upper bound on the number of cells per particle, to keep the memory linear in the particles
+#define CELLS_PER_PART  8
+
+
+CellList::CellList()
+{
+    for (size_t k = 0; k < 3; k++)
+    {
+        _lo[k] = 0;
+        _size[k] = INFINITY;
+        _dims[k] = 1;
+    }
+}
+
+void CellList::build(const ParticleStore& parts, cl_double* x_wall, cl_double* y_wall, cl_double* z_wall)
+{
+    cl_double* walls[3] = { x_wall, y_wall, z_wall };
+    const cl_double* position[3] = { parts.x, parts.y, parts.z };
+    cl_double* radii = parts.radius;
+    size_t num_parts = parts.num_parts();
+
+    // Cells must contain the largest diameter
+    cl_double max_radius = 0;
+    for (size_t p = 0; p < num_parts; p++)
+        max_radius = MAX(max_radius, radii[p]);
+    cl_double min_size = 2 * max_radius;
+
+    // Compute the grid dimensions, enlarging the cells if there are too many of them
+    size_t max_cells = MAX(1, CELLS_PER_PART * num_parts);
+    while (true)
+    {
+        size_t total = 1;
+        for (size_t k = 0; k < 3; k++)
+        {
+            cl_double length = walls[k][1] - walls[k][0];
+            _dims[k] = 1;
+            if (min_size > 0 && length > min_size)
+                _dims[k] = (size_t)floor(length / min_size);
+            _lo[k] = walls[k][0];
+            _size[k] = length > 0 ? length / _dims[k] : INFINITY;
+            total *= _dims[k];
+        }
+        if (total <= max_cells)
+            break;
+        min_size *= cbrt((cl_double)total / max_cells) * 1.01;
+    }
+
+    // Bin the particles
+    _head.assign(_dims[0] * _dims[1] * _dims[2], CELL_LIST_NONE);
+    _next.assign(num_parts, CELL_LIST_NONE);
+    _prev.assign(num_parts, CELL_LIST_NONE);
+    _cells.assign(num_parts, CELL_LIST_NONE);
+    for (size_t p = 0; p < num_parts; p++)
+    {
+        cl_double p_pos[3] = { position[0][p], position[1][p], position[2][p] };
+        link(p, cell_of(p_pos));
+    }
+}
+
+size_t CellList::cell_of(cl_double* p_pos) const
+{
+    size_t c[3];
+    for (size_t k = 0; k < 3; k++)
+    {
+        cl_double x = floor((p_pos[k] - _lo[k]) / _size[k]);
+        // Particles outside the box belong to the border cells
+        if (!(x > 0))
+            c[k] = 0;
+        else if (x >= _dims[k])
+            c[k] = _dims[k] - 1;
+        else
+            c[k] = (size_t)x;
+    }
+    return (c[2] * _dims[1] + c[1]) * _dims[0] + c[0];
+}
+
+void CellList::link(size_t p, size_t cell)
+{
+    _cells[p] = cell;
+    _prev[p] = CELL_LIST_NONE;
+    _next[p] = _head[cell];
+    if (_head[cell] != CELL_LIST_NONE)
+        _prev[_head[cell]] = p;
+    _head[cell] = p;
+}
+
+void CellList::unlink(size_t p)
+{
+    size_t cell = _cells[p];
+    if (_prev[p] != CELL_LIST_NONE)
+        _next[_prev[p]] = _next[p];
+    else
+        _head[cell] = _next[p];
+    if (_next[p] != CELL_LIST_NONE)
+        _prev[_next[p]] = _prev[p];
+    _cells[p] = CELL_LIST_NONE;
+}
+
+void CellList::append(cl_double* p_pos)
+{
+    size_t p = _cells.size();
+    _next.push_back(CELL_LIST_NONE);
+    _prev.push_back(CELL_LIST_NONE);
+    _cells.push_back(CELL_LIST_NONE);
+    link(p, cell_of(p_pos));
+}
+
+void CellList::remove(size_t p)
+{
+    size_t last = _cells.size() - 1;
+    unlink(p);
+    if (p != last)
+    {
+        // The last particle keeps its cell under the new index
+        size_t cell = _cells[last];
+        unlink(last);
+        link(p, cell);
+    }
+    _next.pop_back();
+    _prev.pop_back();
+    _cells.pop_back();
+}
+
+void CellList::rebin(size_t p, cl_double* p_pos)
+{
+    unlink(p);
+    link(p, cell_of(p_pos));
+}
+
+bool CellList::fits(cl_double radius) const
+{
+    // A single cell along an axis holds all the neighbours along it, whatever their size
+    for (size_t k = 0; k < 3; k++)
+    {
+        if (_dims[k] > 1 && 2 * radius > _size[k])
+            return false;
+    }
+    return true;
+}
+
+void CellList::get_neighbours(size_t p, std::vector<size_t>& neighbours) const
+{
+    neighbours.clear();
+
+    size_t cell = _cells[p];
+    size_t cx = cell % _dims[0];
+    size_t cy = (cell / _dims[0]) % _dims[1];
+    size_t cz = cell / (_dims[0] * _dims[1]);
+
+    for (size_t z = (cz > 0 ? cz - 1 : 0); z <= cz + 1 && z < _dims[2]; z++)
+    {
+        for (size_t y = (cy > 0 ? cy - 1 : 0); y <= cy + 1 && y < _dims[1]; y++)
+        {
+            for (size_t x = (cx > 0 ? cx - 1 : 0); x <= cx + 1 && x < _dims[0]; x++)
+            {
+                for (size_t q = _head[(z * _dims[1] + y) * _dims[0] + x]; q != CELL_LIST_NONE; q = _next[q])
+                {
+                    if (q != p)
+                        neighbours.push_back(q);
+                }
+            }
+        }
+    }
+}
+
+cl_double CellList::predict_crossing(cl_double* p_pos, cl_double* p_vel, size_t p, cl_int* axis) const
+{
+    size_t cell = _cells[p];
+    size_t c[3] = { cell % _dims[0], (cell / _dims[0]) % _dims[1], cell / (_dims[0] * _dims[1]) };
+    cl_double delta_time = INFINITY;
+
+    *axis = 0;
+    for (cl_int k = 0; k < 3; k++)
+    {
+        cl_double v = p_vel[k];
+        // Border cells are unbounded towards the outside
+        if (v == 0 || (v > 0 && c[k] == _dims[k] - 1) || (v < 0 && c[k] == 0))
+            continue;
+
+        cl_double bound = _lo[k] + (v > 0 ? c[k] + 1 : c[k]) * _size[k];
+        cl_double dt = MAX(0, (bound - p_pos[k]) / v);
+        if (dt < delta_time)
+        {
+            delta_time = dt;
+            *axis = v > 0 ? k + 1 : -(k + 1);
+        }
+    }
+
+    return delta_time;
+}
+
+void CellList::cross(size_t p, cl_int axis)
+{
+    size_t cell = _cells[p];
+    size_t stride = 1;
+    for (cl_int k = 1; k < ABS(axis); k++)
+        stride *= _dims[k - 1];
+
+    unlink(p);
+    link(p, axis > 0 ? cell + stride : cell - stride);
+}
+
+size_t CellList::num_cells() const
+{
+    return _head.size();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+#include "particle_store.h"
+#include <vector>
+
+#define CELL_LIST_NONE  ((size_t)-1)
+
+// Uniform grid over the simulation box. Cells are at least as large as the largest
+// diameter, so two particles can collide only if they lie in neighbouring cells.
+// The cells on the border of the grid are unbounded towards the outside of the box.
+class CellList
+{
+private:
+    cl_double _lo[3];
+    cl_double _size[3];
+    size_t _dims[3];
+    std::vector<size_t> _head;
+    std::vector<size_t> _next;
+    std::vector<size_t> _prev;
+    std::vector<size_t> _cells;
+
+    // Cell containing the given position
+    size_t cell_of(cl_double* p_pos) const;
+    void link(size_t p, size_t cell);
+    void unlink(size_t p);
+
+public:
+    CellList();
+
+    // Bin all the particles in a grid sized from their maximum radius
+    void build(const ParticleStore& parts, cl_double* x_wall, cl_double* y_wall, cl_double* z_wall);
+
+    // Keep the grid in sync with the changes of the store, without binning all the particles again.
+    // Bin the particle appended to the store at the given position.
+    void append(cl_double* p_pos);
+    // Remove particle p, moving the last particle to index p, as ParticleStore::remove does
+    void remove(size_t p);
+    // Bin particle p again, after its position has been changed by a collision
+    void rebin(size_t p, cl_double* p_pos);
+    // True if a particle of the given radius can be added without building the grid again
+    bool fits(cl_double radius) const;
+
+    // Collect the particles lying in the cells around particle p, p excluded
+    void get_neighbours(size_t p, std::vector<size_t>& neighbours) const;
+
+    // Time before particle p, with the given position and velocity, leaves its cell.
+    // The signed axis of the crossing is returned in axis.
+    cl_double predict_crossing(cl_double* p_pos, cl_double* p_vel, size_t p, cl_int* axis) const;
+
+    // Move particle p to the neighbouring cell along the signed axis
+    void cross(size_t p, cl_int axis);
+
+    size_t num_cells() const;
+};
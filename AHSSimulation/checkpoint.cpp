@@ -0,0 +1,343 @@
+#include "checkpoint.h"
+#include "CLSettings.h"
+#include "fission.h"
+#include <sstream>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <utility>
+#if defined(_MSC_VER)
+#include <io.h>
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+// Write and read the values of a checkpoint, throwing on errors.
+// Nothing is done for no values, since the data of an empty vector (e.g. the index) may be null.
+static void write_values(FILE* stream, const void* data, size_t size, size_t count, const std::string& filename)
+{
+    if (count == 0)
+        return;
+    if (fwrite(data, size, count, stream) != count)
+    {
+        std::stringstream ss;
+        ss << "Some errors occurred while writing the checkpoint file " << filename << "." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+static void read_values(FILE* stream, void* data, size_t size, size_t count, const std::string& filename)
+{
+    if (count == 0)
+        return;
+    if (fread(data, size, count, stream) != count)
+    {
+        std::stringstream ss;
+        ss << "The checkpoint file " << filename << " is truncated." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+
+Checkpoint::Checkpoint()
+{
+    _empty = true;
+    simtype = 0;
+    engine = 0;
+    e = 0;
+    max_time = 0;
+    for (size_t k = 0; k < 6; k++)
+        walls[k] = 0;
+    output_format = 0;
+    output_compression = 0;
+    output_index = 0;
+    keyframe_interval = 0;
+    snapshot_interval = 0;
+    max_frames = 0;
+    input_num_parts = 0;
+    time = 0;
+    num_events = 0;
+    random_draws = 0;
+    num_parts = 0;
+    output_size = 0;
+    output_offset = 0;
+    since_keyframe = 0;
+    next_sample = 0;
+    num_frames = 0;
+}
+
+bool Checkpoint::is_empty() const
+{
+    return _empty;
+}
+
+void Checkpoint::describe(size_t simtype, cl_double e, cl_double max_time,
+                          cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                          size_t num_parts, cl_double* masses, cl_double* radii)
+{
+    this->simtype = simtype;
+    engine = (size_t)CLSettings::get_engine();
+    this->e = e;
+    this->max_time = max_time;
+    walls[0] = x_wall[0];
+    walls[1] = x_wall[1];
+    walls[2] = y_wall[0];
+    walls[3] = y_wall[1];
+    walls[4] = z_wall[0];
+    walls[5] = z_wall[1];
+    output_format = (size_t)CLSettings::get_output_format();
+    output_compression = (size_t)CLSettings::get_output_compression();
+    output_index = (size_t)CLSettings::get_output_index();
+    keyframe_interval = CLSettings::get_keyframe_interval();
+    snapshot_interval = CLSettings::get_snapshot_interval();
+    max_frames = CLSettings::get_max_frames();
+    input_num_parts = num_parts;
+    input_masses.assign(masses, masses + num_parts);
+    input_radii.assign(radii, radii + num_parts);
+}
+
+void Checkpoint::capture(cl_double time, size_t num_events, ParticleStore& parts)
+{
+    _empty = false;
+    this->time = time;
+    this->num_events = num_events;
+    random_draws = fission_random_draws();
+    num_parts = parts.num_parts();
+    cl_double* pos = parts.interleaved_positions();
+    positions.assign(pos, pos + 3 * num_parts);
+    cl_double* vel = parts.interleaved_velocities();
+    velocities.assign(vel, vel + 3 * num_parts);
+    masses.assign(parts.mass, parts.mass + num_parts);
+    radii.assign(parts.radius, parts.radius + num_parts);
+}
+
+void Checkpoint::check(const Checkpoint& setup) const
+{
+    // The output is appended to the file, so it must go on in the same layout
+    std::stringstream ss;
+    if (setup.simtype != simtype)
+        ss << "The checkpoint was saved by a simulation of type " << simtype << ", not " << setup.simtype << "." << std::endl;
+    else if (setup.engine != engine)
+        ss << "The checkpoint was saved by a different engine." << std::endl;
+    else if (setup.e != e || setup.max_time != max_time || memcmp(setup.walls, walls, sizeof(walls)) != 0)
+        ss << "The checkpoint was saved by a simulation with a different elasticity, time or walls." << std::endl;
+    else if (setup.output_format != output_format || setup.output_compression != output_compression ||
+             setup.output_index != output_index || setup.keyframe_interval != keyframe_interval ||
+             setup.snapshot_interval != snapshot_interval || setup.max_frames != max_frames)
+        ss << "The checkpoint was saved by a simulation with different settings of the output." << std::endl;
+    else if (setup.input_num_parts != input_num_parts || setup.input_masses != input_masses || setup.input_radii != input_radii)
+        ss << "The checkpoint was saved by a simulation with different particles." << std::endl;
+    else
+        return;
+    throw std::runtime_error(ss.str());
+}
+
+void Checkpoint::save(const std::string& filename) const
+{
+    std::string tmpname = filename + ".tmp";
+    FILE* stream;
+    fopen_s(&stream, tmpname.c_str(), "wb");
+    if (stream == NULL)
+    {
+        std::stringstream ss;
+        ss << "Cannot open file " << tmpname << " for writing." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    size_t version = CHECKPOINT_VERSION;
+    size_t num_entries = index.size();
+    try
+    {
+        write_values(stream, CHECKPOINT_MAGIC, sizeof(char), 8, tmpname);
+        write_values(stream, &version, sizeof(size_t), 1, tmpname);
+        write_values(stream, &simtype, sizeof(size_t), 1, tmpname);
+        write_values(stream, &engine, sizeof(size_t), 1, tmpname);
+        write_values(stream, &e, sizeof(cl_double), 1, tmpname);
+        write_values(stream, &max_time, sizeof(cl_double), 1, tmpname);
+        write_values(stream, walls, sizeof(cl_double), 6, tmpname);
+        write_values(stream, &output_format, sizeof(size_t), 1, tmpname);
+        write_values(stream, &output_compression, sizeof(size_t), 1, tmpname);
+        write_values(stream, &output_index, sizeof(size_t), 1, tmpname);
+        write_values(stream, &keyframe_interval, sizeof(size_t), 1, tmpname);
+        write_values(stream, &snapshot_interval, sizeof(cl_double), 1, tmpname);
+        write_values(stream, &max_frames, sizeof(size_t), 1, tmpname);
+        write_values(stream, &input_num_parts, sizeof(size_t), 1, tmpname);
+        write_values(stream, input_masses.data(), sizeof(cl_double), input_num_parts, tmpname);
+        write_values(stream, input_radii.data(), sizeof(cl_double), input_num_parts, tmpname);
+
+        write_values(stream, &time, sizeof(cl_double), 1, tmpname);
+        write_values(stream, &num_events, sizeof(size_t), 1, tmpname);
+        write_values(stream, &random_draws, sizeof(size_t), 1, tmpname);
+        write_values(stream, &num_parts, sizeof(size_t), 1, tmpname);
+        write_values(stream, positions.data(), sizeof(cl_double), 3 * num_parts, tmpname);
+        write_values(stream, velocities.data(), sizeof(cl_double), 3 * num_parts, tmpname);
+        write_values(stream, masses.data(), sizeof(cl_double), num_parts, tmpname);
+        write_values(stream, radii.data(), sizeof(cl_double), num_parts, tmpname);
+
+        write_values(stream, &output_size, sizeof(size_t), 1, tmpname);
+        write_values(stream, &output_offset, sizeof(size_t), 1, tmpname);
+        write_values(stream, &since_keyframe, sizeof(size_t), 1, tmpname);
+        write_values(stream, &next_sample, sizeof(size_t), 1, tmpname);
+        write_values(stream, &num_frames, sizeof(size_t), 1, tmpname);
+        write_values(stream, &num_entries, sizeof(size_t), 1, tmpname);
+        write_values(stream, index.data(), sizeof(TrajectoryIndexEntry), num_entries, tmpname);
+
+        // The new checkpoint must be durable before it replaces the old one
+        bool ok = fflush(stream) == 0;
+#if defined(_MSC_VER)
+        ok = ok && _commit(_fileno(stream)) == 0;
+#else
+        ok = ok && fsync(fileno(stream)) == 0;
+#endif
+        if (!ok)
+        {
+            std::stringstream ss;
+            ss << "Some errors occurred while writing the checkpoint file " << tmpname << "." << std::endl;
+            throw std::runtime_error(ss.str());
+        }
+    }
+    catch (std::exception&)
+    {
+        fclose(stream);
+        throw;
+    }
+    fclose(stream);
+
+#if defined(_MSC_VER)
+    bool renamed = MoveFileExA(tmpname.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    bool renamed = rename(tmpname.c_str(), filename.c_str()) == 0;
+#endif
+    if (!renamed)
+    {
+        std::stringstream ss;
+        ss << "Cannot replace the checkpoint file " << filename << "." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+void Checkpoint::load(const std::string& filename)
+{
+    FILE* stream;
+    fopen_s(&stream, filename.c_str(), "rb");
+    if (stream == NULL)
+    {
+        std::stringstream ss;
+        ss << "Cannot open file " << filename << " for reading." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    try
+    {
+        char magic[8];
+        size_t version;
+        read_values(stream, magic, sizeof(char), 8, filename);
+        read_values(stream, &version, sizeof(size_t), 1, filename);
+        if (memcmp(magic, CHECKPOINT_MAGIC, 8) != 0 || version != CHECKPOINT_VERSION)
+        {
+            std::stringstream ss;
+            ss << "The file " << filename << " is not a checkpoint of this version of the simulation." << std::endl;
+            throw std::runtime_error(ss.str());
+        }
+        read_values(stream, &simtype, sizeof(size_t), 1, filename);
+        read_values(stream, &engine, sizeof(size_t), 1, filename);
+        read_values(stream, &e, sizeof(cl_double), 1, filename);
+        read_values(stream, &max_time, sizeof(cl_double), 1, filename);
+        read_values(stream, walls, sizeof(cl_double), 6, filename);
+        read_values(stream, &output_format, sizeof(size_t), 1, filename);
+        read_values(stream, &output_compression, sizeof(size_t), 1, filename);
+        read_values(stream, &output_index, sizeof(size_t), 1, filename);
+        read_values(stream, &keyframe_interval, sizeof(size_t), 1, filename);
+        read_values(stream, &snapshot_interval, sizeof(cl_double), 1, filename);
+        read_values(stream, &max_frames, sizeof(size_t), 1, filename);
+        read_values(stream, &input_num_parts, sizeof(size_t), 1, filename);
+        input_masses.resize(input_num_parts);
+        input_radii.resize(input_num_parts);
+        read_values(stream, input_masses.data(), sizeof(cl_double), input_num_parts, filename);
+        read_values(stream, input_radii.data(), sizeof(cl_double), input_num_parts, filename);
+
+        read_values(stream, &time, sizeof(cl_double), 1, filename);
+        read_values(stream, &num_events, sizeof(size_t), 1, filename);
+        read_values(stream, &random_draws, sizeof(size_t), 1, filename);
+        read_values(stream, &num_parts, sizeof(size_t), 1, filename);
+        positions.resize(3 * num_parts);
+        velocities.resize(3 * num_parts);
+        masses.resize(num_parts);
+        radii.resize(num_parts);
+        read_values(stream, positions.data(), sizeof(cl_double), 3 * num_parts, filename);
+        read_values(stream, velocities.data(), sizeof(cl_double), 3 * num_parts, filename);
+        read_values(stream, masses.data(), sizeof(cl_double), num_parts, filename);
+        read_values(stream, radii.data(), sizeof(cl_double), num_parts, filename);
+
+        size_t num_entries;
+        read_values(stream, &output_size, sizeof(size_t), 1, filename);
+        read_values(stream, &output_offset, sizeof(size_t), 1, filename);
+        read_values(stream, &since_keyframe, sizeof(size_t), 1, filename);
+        read_values(stream, &next_sample, sizeof(size_t), 1, filename);
+        read_values(stream, &num_frames, sizeof(size_t), 1, filename);
+        read_values(stream, &num_entries, sizeof(size_t), 1, filename);
+        index.resize(num_entries);
+        read_values(stream, index.data(), sizeof(TrajectoryIndexEntry), num_entries, filename);
+    }
+    catch (std::exception&)
+    {
+        fclose(stream);
+        throw;
+    }
+    fclose(stream);
+    _empty = false;
+}
+
+
+CheckpointWriter::CheckpointWriter(size_t num_events)
+{
+    _filename = CLSettings::get_checkpoint_file();
+    _interval = CLSettings::get_checkpoint_interval();
+    _last_events = num_events;
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    if (_thread.joinable())
+        _thread.join();
+}
+
+bool CheckpointWriter::is_due(size_t num_events) const
+{
+    return _interval > 0 && num_events % _interval == 0 && num_events != _last_events;
+}
+
+void CheckpointWriter::write(TrajectoryWriter* out)
+{
+    try
+    {
+        out->sync(_checkpoint.output_size);
+        _checkpoint.save(_filename);
+    }
+    catch (std::exception& e)
+    {
+        _error = e.what();
+    }
+}
+
+void CheckpointWriter::save(Checkpoint& checkpoint, TrajectoryWriter& out)
+{
+    finish();
+    _last_events = checkpoint.num_events;
+    std::swap(_checkpoint, checkpoint);
+    _thread = std::thread(&CheckpointWriter::write, this, &out);
+}
+
+void CheckpointWriter::finish()
+{
+    if (_thread.joinable())
+        _thread.join();
+    if (!_error.empty())
+    {
+        std::string error = _error;
+        _error.clear();
+        throw std::runtime_error(error);
+    }
+}
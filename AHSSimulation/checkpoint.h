@@ -0,0 +1,111 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+#include "particle_store.h"
+#include "trajectory.h"
+#include <string>
+#include <thread>
+#include <vector>
+
+// First eight bytes of a checkpoint file
+#define CHECKPOINT_MAGIC            "AHSCHKPT"
+// Version of the layout of the checkpoint files
+#define CHECKPOINT_VERSION          (size_t)2
+
+// State of a simulation, from which it can be resumed as if it had never stopped.
+// The setup of the run is saved too, so that a checkpoint cannot be resumed by a different simulation.
+class Checkpoint
+{
+private:
+    bool _empty;
+
+public:
+    // Setup, with the particles given as input, whose number, masses and radii may change in the run
+    size_t simtype;
+    size_t engine;
+    cl_double e;
+    cl_double max_time;
+    cl_double walls[6];
+    size_t output_format;
+    size_t output_compression;
+    size_t output_index;
+    size_t keyframe_interval;
+    cl_double snapshot_interval;
+    size_t max_frames;
+    size_t input_num_parts;
+    std::vector<cl_double> input_masses;
+    std::vector<cl_double> input_radii;
+
+    // State of the system, with the positions and velocities in the interleaved layout
+    cl_double time;
+    size_t num_events;
+    size_t random_draws;
+    size_t num_parts;
+    std::vector<cl_double> positions;
+    std::vector<cl_double> velocities;
+    std::vector<cl_double> masses;
+    std::vector<cl_double> radii;
+
+    // State of the output, filled by TrajectoryWriter::checkpoint
+    size_t output_size;
+    size_t output_offset;
+    size_t since_keyframe;
+    size_t next_sample;
+    size_t num_frames;
+    std::vector<TrajectoryIndexEntry> index;
+
+    // Empty checkpoint, from which nothing is resumed
+    Checkpoint();
+
+    bool is_empty() const;
+
+    // Save the setup of the run, the settings of the engine and of the output included
+    void describe(size_t simtype, cl_double e, cl_double max_time,
+                  cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                  size_t num_parts, cl_double* masses, cl_double* radii);
+
+    // Save the state of the system, after the setup. The random draws are taken from the fission model.
+    void capture(cl_double time, size_t num_events, ParticleStore& parts);
+
+    // Throw if the checkpoint was saved by a simulation with a setup different from the given one
+    void check(const Checkpoint& setup) const;
+
+    // Write the checkpoint to a temporary file, and rename it to the given one only once it is complete
+    void save(const std::string& filename) const;
+    void load(const std::string& filename);
+};
+
+// Checkpoints of a simulation, written every CLSettings::get_checkpoint_interval() events to
+// CLSettings::get_checkpoint_file() by a background thread. A checkpoint replaces the previous one
+// only after the output it refers to is durable, so that the file always holds a checkpoint that
+// can be resumed. The simulation waits only if the previous checkpoint is still being written.
+// Errors of the background thread are thrown by the next call of save or finish.
+class CheckpointWriter
+{
+private:
+    std::string _filename;
+    size_t _interval;
+    size_t _last_events;
+    Checkpoint _checkpoint;
+    std::thread _thread;
+    std::string _error;
+
+    void write(TrajectoryWriter* out);
+
+    CheckpointWriter(CheckpointWriter& cw) {};
+    void operator=(CheckpointWriter& cw) {};
+
+public:
+    // Checkpoints of a simulation that has already gone through the given number of events
+    CheckpointWriter(size_t num_events);
+    ~CheckpointWriter();
+
+    // True if a checkpoint is due after the given number of events, and was not saved yet
+    bool is_due(size_t num_events) const;
+
+    // Write the checkpoint in the background. Its contents are moved away.
+    void save(Checkpoint& checkpoint, TrajectoryWriter& out);
+
+    // Wait for the checkpoint being written
+    void finish();
+};
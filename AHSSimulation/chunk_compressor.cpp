@@ -0,0 +1,154 @@
+#include "chunk_compressor.h"
+#include "compression.h"
+#include "CLSettings.h"
+#include <sstream>
+#include <stdexcept>
+
+#define MAX(x, y)       ((x) > (y) ? (x) : (y))
+
+
+ChunkCompressor::ChunkCompressor(OutputWriter& out) : _out(out)
+{
+    _out.write(COMPRESSION_MAGIC, sizeof(char), 8);
+    start();
+}
+
+ChunkCompressor::ChunkCompressor(OutputWriter& out, bool resume) : _out(out)
+{
+    if (!resume)
+        _out.write(COMPRESSION_MAGIC, sizeof(char), 8);
+    start();
+}
+
+void ChunkCompressor::start()
+{
+    _closing = false;
+    _raw_bytes = 0;
+    _stored_bytes = 0;
+    _num_workers = MAX(1, CLSettings::get_compression_threads());
+    _max_submitted = 2 * _num_workers;
+    for (size_t t = 0; t < _num_workers; t++)
+        _workers.push_back(std::thread(&ChunkCompressor::worker_loop, this));
+}
+
+ChunkCompressor::~ChunkCompressor()
+{
+    stop();
+    for (size_t j = 0; j < _submitted.size(); j++)
+        delete _submitted[j];
+    _submitted.clear();
+}
+
+void ChunkCompressor::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending.clear();
+        _closing = true;
+    }
+    _available.notify_all();
+    for (size_t t = 0; t < _workers.size(); t++)
+        _workers[t].join();
+    _workers.clear();
+}
+
+void ChunkCompressor::worker_loop()
+{
+    while (true)
+    {
+        Job* job;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _available.wait(lock, [this]() { return !_pending.empty() || _closing; });
+            if (_pending.empty())
+                return;
+            job = _pending.front();
+            _pending.pop_front();
+        }
+
+        std::string error;
+        try
+        {
+            encode_chunk(job->data);
+        }
+        catch (std::exception& e)
+        {
+            error = e.what();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            job->error = error;
+            job->done = true;
+        }
+        _compressed.notify_all();
+    }
+}
+
+void ChunkCompressor::write_compressed(bool wait)
+{
+    while (!_submitted.empty())
+    {
+        Job* job = _submitted.front();
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!job->done && !wait)
+                return;
+            _compressed.wait(lock, [job]() { return job->done; });
+        }
+        wait = false;
+
+        _submitted.pop_front();
+        if (!job->error.empty())
+        {
+            std::string error = job->error;
+            delete job;
+            throw std::runtime_error(error);
+        }
+        _stored_bytes += job->data.size();
+        _out.write(job->data.data(), sizeof(char), job->data.size());
+        delete job;
+    }
+}
+
+void ChunkCompressor::submit(std::vector<char>& chunk)
+{
+    if (chunk.empty())
+        return;
+
+    Job* job = new Job();
+    job->data.swap(chunk);
+    job->done = false;
+    _raw_bytes += job->data.size();
+    _submitted.push_back(job);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending.push_back(job);
+    }
+    _available.notify_one();
+
+    // Write what is ready, and wait only if too many chunks are in flight
+    write_compressed(_submitted.size() > _max_submitted);
+}
+
+void ChunkCompressor::flush()
+{
+    while (!_submitted.empty())
+        write_compressed(true);
+}
+
+void ChunkCompressor::finish()
+{
+    flush();
+    stop();
+}
+
+std::string ChunkCompressor::summary() const
+{
+    std::stringstream ss;
+    ss << "Compressed " << _raw_bytes << " bytes of output to " << _stored_bytes << " bytes";
+    if (_stored_bytes > 0)
+        ss << " (ratio " << (double)_raw_bytes / _stored_bytes << ")";
+    ss << " on " << _num_workers << " threads.";
+    return ss.str();
+}
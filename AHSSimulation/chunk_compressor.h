@@ -0,0 +1,74 @@
+#pragma once
+
+#include "output_writer.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Size after which a chunk is closed, at the end of the frame or record being written
+#define COMPRESSION_CHUNK_SIZE      ((size_t)1 << 20)
+
+// Compression of the chunks of an output file on a set of worker threads, configured by
+// CLSettings::get_compression_threads(). The simulation thread submits the chunks, and writes them
+// to the output in the same order once they are compressed. It waits for the workers only if
+// twice as many chunks as the workers are still being compressed.
+class ChunkCompressor
+{
+private:
+    struct Job
+    {
+        std::vector<char> data;
+        bool done;
+        std::string error;
+    };
+
+    OutputWriter& _out;
+    std::vector<std::thread> _workers;
+    // Jobs in order of submission, owned by the simulation thread
+    std::deque<Job*> _submitted;
+    // Jobs not taken by a worker yet
+    std::deque<Job*> _pending;
+    size_t _num_workers;
+    size_t _max_submitted;
+
+    std::mutex _mutex;
+    std::condition_variable _available;
+    std::condition_variable _compressed;
+    bool _closing;
+
+    size_t _raw_bytes;
+    size_t _stored_bytes;
+
+    void start();
+    void worker_loop();
+    // Join the workers. The chunks not taken by a worker yet are left uncompressed.
+    void stop();
+    // Write the compressed chunks at the front of the queue. With wait, waits for the first one.
+    void write_compressed(bool wait);
+
+    ChunkCompressor(ChunkCompressor& cc) : _out(cc._out) {};
+    void operator=(ChunkCompressor& cc) {};
+
+public:
+    // Write the header of the compressed file and start the workers
+    ChunkCompressor(OutputWriter& out);
+    // Start the workers, appending to a compressed file resumed from a checkpoint
+    ChunkCompressor(OutputWriter& out, bool resume);
+    // Stop the workers, discarding the chunks not written yet
+    ~ChunkCompressor();
+
+    // Compress a chunk. Its contents are moved away.
+    void submit(std::vector<char>& chunk);
+
+    // Write all the chunks submitted, waiting for their compression
+    void flush();
+
+    // Write all the chunks submitted and stop the workers
+    void finish();
+
+    // Description of the compression ratio, for the log
+    std::string summary() const;
+};
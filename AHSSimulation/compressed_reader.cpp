@@ -0,0 +1,133 @@
+#include "compressed_reader.h"
+#include "compression.h"
+#include "input_loader.h"
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+
+#define MIN(x, y)       ((x) < (y) ? (x) : (y))
+
+// Size of the blocks copied by decompress_file
+#define DECOMPRESS_BLOCK_SIZE   ((size_t)1 << 20)
+
+
+CompressedReader::CompressedReader(const std::string& filename)
+{
+    _filename = filename;
+    _consumed = 0;
+    fopen_s(&_stream, filename.c_str(), "rb");
+    if (_stream == NULL)
+    {
+        std::stringstream ss;
+        ss << "Cannot open file " << filename << " for reading." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    // Without the magic, the file is read from the beginning as it is
+    char magic[8];
+    _compressed = fread(magic, sizeof(char), 8, _stream) == 8 && memcmp(magic, COMPRESSION_MAGIC, 8) == 0;
+    if (!_compressed)
+        fseek(_stream, 0, SEEK_SET);
+}
+
+CompressedReader::~CompressedReader()
+{
+    fclose(_stream);
+}
+
+bool CompressedReader::is_compressed() const
+{
+    return _compressed;
+}
+
+bool CompressedReader::next_chunk()
+{
+    size_t header[2];
+    size_t header_read = fread(header, sizeof(size_t), 2, _stream);
+    if (header_read == 0 && feof(_stream))
+        return false;
+
+    // The sizes are checked before allocating, so that a corrupted header cannot ask for any size
+    if (header_read != 2 || header[1] > stream_remaining(_stream))
+    {
+        std::stringstream ss;
+        ss << "The compressed file " << _filename << " is truncated." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    // The chunks that do not get smaller are stored as they are
+    if (header[1] > header[0] || header[0] > lz_expansion_bound(header[1]))
+    {
+        std::stringstream ss;
+        ss << "The compressed file " << _filename << " has a chunk of " << header[0] << " bytes stored in "
+           << header[1] << " bytes, which the compression cannot produce." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    std::vector<char> stored(header[1]);
+    if (fread(stored.data(), sizeof(char), stored.size(), _stream) != stored.size())
+    {
+        std::stringstream ss;
+        ss << "The compressed file " << _filename << " is truncated." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    _chunk.resize(header[0]);
+    decode_chunk(stored.data(), stored.size(), _chunk.data(), _chunk.size());
+    _consumed = 0;
+    return true;
+}
+
+size_t CompressedReader::read(void* data, size_t size, size_t count)
+{
+    if (!_compressed)
+        return fread(data, size, count, _stream);
+
+    char* bytes = (char*)data;
+    size_t total = size * count;
+    size_t done = 0;
+    while (done < total)
+    {
+        if (_consumed == _chunk.size() && !next_chunk())
+            break;
+        size_t n = MIN(total - done, _chunk.size() - _consumed);
+        memcpy(bytes + done, _chunk.data() + _consumed, n);
+        _consumed += n;
+        done += n;
+    }
+    // Like fread, only whole elements are counted
+    return size == 0 ? 0 : done / size;
+}
+
+
+void decompress_file(const std::string& inputfile, const std::string& outputfile)
+{
+    CompressedReader reader(inputfile);
+    if (!reader.is_compressed())
+    {
+        std::stringstream ss;
+        ss << "The file " << inputfile << " is not a compressed output file." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    FILE* outstream;
+    fopen_s(&outstream, outputfile.c_str(), "wb");
+    if (outstream == NULL)
+    {
+        std::stringstream ss;
+        ss << "Cannot open file " << outputfile << " for writing." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    std::vector<char> block(DECOMPRESS_BLOCK_SIZE);
+    size_t n;
+    bool ok = true;
+    while (ok && (n = reader.read(block.data(), sizeof(char), block.size())) > 0)
+        ok = fwrite(block.data(), sizeof(char), n, outstream) == n;
+    fclose(outstream);
+    if (!ok)
+    {
+        std::stringstream ss;
+        ss << "Some errors occurred while writing the file " << outputfile << "." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
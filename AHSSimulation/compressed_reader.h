@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+// Reader of output files, decompressing the chunks of the compressed ones as they are read.
+// Files that are not compressed are read as they are, so the same code can read both.
+class CompressedReader
+{
+private:
+    std::string _filename;
+    FILE* _stream;
+    bool _compressed;
+    // Decompressed chunk, and the bytes of it already read
+    std::vector<char> _chunk;
+    size_t _consumed;
+
+    // Decode the next chunk. Returns false at the end of the file.
+    bool next_chunk();
+
+    CompressedReader(CompressedReader& cr) {};
+    void operator=(CompressedReader& cr) {};
+
+public:
+    CompressedReader(const std::string& filename);
+    ~CompressedReader();
+
+    bool is_compressed() const;
+
+    // Same as fread, on the decompressed contents of the file
+    size_t read(void* data, size_t size, size_t count);
+};
+
+// Write the decompressed contents of a compressed output file to another file
+void decompress_file(const std::string& inputfile, const std::string& outputfile);
@@ -0,0 +1,216 @@
+#include "compression.h"
+#include <sstream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string.h>
+
+// Matches are at least four bytes long, and no farther than the range of their 16 bits offset
+#define LZ_MIN_MATCH        4
+#define LZ_MAX_OFFSET       65535
+#define LZ_HASH_BITS        14
+// Number of literals after which the search for matches speeds up, skipping more and more bytes
+#define LZ_SKIP_TRIGGER     6
+
+static void corrupted(const char* reason)
+{
+    std::stringstream ss;
+    ss << "Corrupted chunk in the compressed output: " << reason << "." << std::endl;
+    throw std::runtime_error(ss.str());
+}
+
+static uint32_t read32(const unsigned char* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(uint32_t));
+    return value;
+}
+
+static size_t lz_hash(uint32_t sequence)
+{
+    return (size_t)((sequence * 2654435761u) >> (32 - LZ_HASH_BITS));
+}
+
+// Write a length in the nibble of the token, and the rest in the following bytes
+static size_t write_length(unsigned char* out, size_t op, size_t length)
+{
+    length -= 15;
+    while (length >= 255)
+    {
+        out[op++] = 255;
+        length -= 255;
+    }
+    out[op++] = (unsigned char)length;
+    return op;
+}
+
+static size_t read_length(const unsigned char* in, size_t* ip, size_t size, size_t length)
+{
+    if (length < 15)
+        return length;
+    unsigned char b;
+    do
+    {
+        if (*ip >= size)
+            corrupted("truncated length");
+        b = in[(*ip)++];
+        length += b;
+    } while (b == 255);
+    return length;
+}
+
+// A sequence is a token, the literals, and the offset and length of the following match, if any
+static size_t write_sequence(unsigned char* out, size_t op, const unsigned char* literals, size_t num_literals,
+                             size_t offset, size_t match_length)
+{
+    size_t token = op++;
+    size_t match_code = match_length >= LZ_MIN_MATCH ? match_length - LZ_MIN_MATCH : 0;
+    out[token] = (unsigned char)(((num_literals < 15 ? num_literals : 15) << 4) | (match_code < 15 ? match_code : 15));
+    if (num_literals >= 15)
+        op = write_length(out, op, num_literals);
+    memcpy(out + op, literals, num_literals);
+    op += num_literals;
+    if (match_length == 0)
+        return op;
+
+    out[op++] = (unsigned char)(offset & 0xFF);
+    out[op++] = (unsigned char)(offset >> 8);
+    if (match_code >= 15)
+        op = write_length(out, op, match_code);
+    return op;
+}
+
+
+void byte_shuffle(const char* src, char* dst, size_t size)
+{
+    size_t num_values = size / SHUFFLE_WIDTH;
+    for (size_t v = 0; v < num_values; v++)
+        for (size_t b = 0; b < SHUFFLE_WIDTH; b++)
+            dst[b * num_values + v] = src[v * SHUFFLE_WIDTH + b];
+    memcpy(dst + num_values * SHUFFLE_WIDTH, src + num_values * SHUFFLE_WIDTH, size - num_values * SHUFFLE_WIDTH);
+}
+
+void byte_unshuffle(const char* src, char* dst, size_t size)
+{
+    size_t num_values = size / SHUFFLE_WIDTH;
+    for (size_t b = 0; b < SHUFFLE_WIDTH; b++)
+        for (size_t v = 0; v < num_values; v++)
+            dst[v * SHUFFLE_WIDTH + b] = src[b * num_values + v];
+    memcpy(dst + num_values * SHUFFLE_WIDTH, src + num_values * SHUFFLE_WIDTH, size - num_values * SHUFFLE_WIDTH);
+}
+
+size_t lz_bound(size_t size)
+{
+    return size + size / 255 + 16;
+}
+
+size_t lz_expansion_bound(size_t size)
+{
+    // Each byte of a length adds at most 255 bytes, more than the token and the offset can
+    return 255 * size;
+}
+
+size_t lz_compress(const char* src, size_t size, char* dst)
+{
+    const unsigned char* in = (const unsigned char*)src;
+    unsigned char* out = (unsigned char*)dst;
+    // Last position of each hash, plus one, so that zero is empty
+    std::vector<size_t> table((size_t)1 << LZ_HASH_BITS, 0);
+
+    size_t anchor = 0;
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip + LZ_MIN_MATCH <= size)
+    {
+        uint32_t sequence = read32(in + ip);
+        size_t h = lz_hash(sequence);
+        size_t candidate = table[h];
+        table[h] = ip + 1;
+        if (candidate == 0 || ip - (candidate - 1) > LZ_MAX_OFFSET || read32(in + candidate - 1) != sequence)
+        {
+            ip += 1 + ((ip - anchor) >> LZ_SKIP_TRIGGER);
+            continue;
+        }
+
+        size_t ref = candidate - 1;
+        size_t length = LZ_MIN_MATCH;
+        while (ip + length < size && in[ref + length] == in[ip + length])
+            length++;
+        op = write_sequence(out, op, in + anchor, ip - anchor, ip - ref, length);
+        ip += length;
+        anchor = ip;
+    }
+
+    // The last sequence has only literals
+    return write_sequence(out, op, in + anchor, size - anchor, 0, 0);
+}
+
+void lz_decompress(const char* src, size_t size, char* dst, size_t dst_size)
+{
+    const unsigned char* in = (const unsigned char*)src;
+    unsigned char* out = (unsigned char*)dst;
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < size)
+    {
+        unsigned char token = in[ip++];
+        size_t num_literals = read_length(in, &ip, size, token >> 4);
+        if (num_literals > size - ip || num_literals > dst_size - op)
+            corrupted("literals out of bounds");
+        memcpy(out + op, in + ip, num_literals);
+        ip += num_literals;
+        op += num_literals;
+        if (ip == size)
+            break;
+
+        if (size - ip < 2)
+            corrupted("truncated offset");
+        size_t offset = (size_t)in[ip] | ((size_t)in[ip + 1] << 8);
+        ip += 2;
+        size_t length = read_length(in, &ip, size, token & 15) + LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || length > dst_size - op)
+            corrupted("match out of bounds");
+        // The match can overlap the bytes it writes
+        for (size_t k = 0; k < length; k++, op++)
+            out[op] = out[op - offset];
+    }
+
+    if (op != dst_size)
+    {
+        std::stringstream ss;
+        ss << "Corrupted chunk in the compressed output: " << op << " bytes decompressed instead of " << dst_size << "." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+void encode_chunk(std::vector<char>& chunk)
+{
+    size_t size = chunk.size();
+    std::vector<char> shuffled(size);
+    byte_shuffle(chunk.data(), shuffled.data(), size);
+
+    std::vector<char> encoded(CHUNK_HEADER_SIZE + lz_bound(size));
+    size_t stored_size = lz_compress(shuffled.data(), size, encoded.data() + CHUNK_HEADER_SIZE);
+    // Store the chunk as it is, if the compression does not pay
+    if (stored_size >= size)
+    {
+        stored_size = size;
+        memcpy(encoded.data() + CHUNK_HEADER_SIZE, shuffled.data(), size);
+    }
+    memcpy(encoded.data(), &size, sizeof(size_t));
+    memcpy(encoded.data() + sizeof(size_t), &stored_size, sizeof(size_t));
+    encoded.resize(CHUNK_HEADER_SIZE + stored_size);
+    chunk.swap(encoded);
+}
+
+void decode_chunk(const char* src, size_t stored_size, char* dst, size_t size)
+{
+    if (stored_size > size)
+        corrupted("stored size larger than the chunk");
+
+    std::vector<char> shuffled(size);
+    if (stored_size == size)
+        memcpy(shuffled.data(), src, size);
+    else
+        lz_decompress(src, stored_size, shuffled.data(), size);
+    byte_unshuffle(shuffled.data(), dst, size);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+// First eight bytes of a compressed output file
+#define COMPRESSION_MAGIC           "AHSCHUNK"
+// Width of the values shuffled. All the values of the output are 64 bits wide.
+#define SHUFFLE_WIDTH               8
+// Size of the header of a chunk: the decompressed size and the stored size
+#define CHUNK_HEADER_SIZE           (2 * sizeof(size_t))
+
+// Compressed output files are a sequence of chunks, each one beginning with its size before and after the
+// compression. The chunks hold whole frames or records, so each one can be decoded alone, and their
+// decompressed contents, in order, are the uncompressed output file.
+// Before the compression, the bytes of the values are grouped by significance: the exponents and the high
+// bytes of the mantissas of neighbouring values are close, and make long repetitions once grouped.
+// Then the chunk is compressed with a byte-oriented LZ77 coder, in the style of LZ4, fast enough to keep
+// up with the simulation. Chunks that do not get smaller are stored shuffled, but not compressed.
+
+// Group the bytes of the values of src by significance. A tail shorter than a value is copied as it is.
+void byte_shuffle(const char* src, char* dst, size_t size);
+// Inverse of byte_shuffle
+void byte_unshuffle(const char* src, char* dst, size_t size);
+
+// Maximum size of the compression of size bytes
+size_t lz_bound(size_t size);
+// Maximum size of the decompression of size bytes
+size_t lz_expansion_bound(size_t size);
+// Compress size bytes of src into dst, that must hold lz_bound(size) bytes, and return the compressed size
+size_t lz_compress(const char* src, size_t size, char* dst);
+// Decompress size bytes of src into exactly dst_size bytes of dst. Throws if the data is corrupted.
+void lz_decompress(const char* src, size_t size, char* dst, size_t dst_size);
+
+// Replace chunk with its encoding, header included
+void encode_chunk(std::vector<char>& chunk);
+// Decode the stored bytes of a chunk into its decompressed size of dst. Throws if the data is corrupted.
+void decode_chunk(const char* src, size_t stored_size, char* dst, size_t size);
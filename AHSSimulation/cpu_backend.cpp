@@ -0,0 +1,273 @@
+#include "cpu_backend.h"
+#include "cpu_kernels.h"
+#include "thread_pool.h"
+#include "CLSettings.h"
+#include "backend.h"
+
+#include <atomic>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#define MIN(x, y)       ((x) < (y) ? (x) : (y))
+#define ABS(x)          ((x) > 0 ? (x) : -(x))
+
+// Rows of the couples taken by a thread at a time. Rows have different lengths, so
+// they are handed out dynamically.
+#define CPU_ROWS_PER_CHUNK  16
+
+typedef cl_double (*CPUPairRow)(const ParticleStore& s, size_t i, size_t j_begin, size_t j_end, size_t* j);
+
+// Earliest event found by a thread
+struct CPUCandidate
+{
+    cl_double time;
+    size_t i;
+    size_t j;
+};
+
+// Same rule of argmin_update in part_collision.cl: the smallest time, then the smallest index
+static bool earlier(const CPUCandidate& c1, const CPUCandidate& c2)
+{
+    if (c1.j == CPU_NO_PARTNER || isnan(c1.time))
+        return false;
+    if (c2.j == CPU_NO_PARTNER)
+        return true;
+    if (c1.time != c2.time)
+        return c1.time < c2.time;
+    return c1.i < c2.i || (c1.i == c2.i && c1.j < c2.j);
+}
+
+static void cpuid(int leaf, int subleaf, unsigned int* regs)
+{
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, leaf, subleaf);
+    for (int k = 0; k < 4; k++)
+        regs[k] = (unsigned int)r[k];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static unsigned long long xgetbv0()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int lo, hi;
+    __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+static int detect_isa()
+{
+    unsigned int regs[4];
+    cpuid(0, 0, regs);
+    if (regs[0] < 7)
+        return CPU_ISA_SCALAR;
+
+    // The OS must save the vector registers too
+    cpuid(1, 0, regs);
+    bool osxsave = (regs[2] & (1u << 27)) != 0;
+    bool avx = (regs[2] & (1u << 28)) != 0;
+    if (!osxsave || !avx)
+        return CPU_ISA_SCALAR;
+    unsigned long long xcr0 = xgetbv0();
+
+    cpuid(7, 0, regs);
+    bool avx2 = (regs[1] & (1u << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+    bool avx512 = (regs[1] & (1u << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+    if (avx512)
+        return CPU_ISA_AVX512;
+    if (avx2)
+        return CPU_ISA_AVX2;
+    return CPU_ISA_SCALAR;
+}
+
+int cpu_isa()
+{
+    static int isa = detect_isa();
+    return isa;
+}
+
+const char* cpu_isa_name(int isa)
+{
+    switch (isa)
+    {
+    case CPU_ISA_AVX2: return "AVX2";
+    case CPU_ISA_AVX512: return "AVX-512";
+    default: return "scalar";
+    }
+}
+
+cl_double cpu_pair_row_scalar(const ParticleStore& s, size_t i, size_t j_begin, size_t j_end, size_t* j)
+{
+    cl_double result = INFINITY;
+    *j = CPU_NO_PARTNER;
+    for (size_t k = j_begin; k < j_end; k++)
+    {
+        cl_double t = cpu_pair_time(s, i, k);
+        if (t < result)
+        {
+            result = t;
+            *j = k;
+        }
+    }
+    return result;
+}
+
+void cpu_update_positions(ParticleStore& parts, cl_double delta_time)
+{
+    ThreadPool::initialize(CLSettings::get_num_threads());
+    size_t num_threads = ThreadPool::num_threads();
+    size_t num_parts = parts.num_parts();
+    // The ranges of the threads start on the alignment of the store, so that the loops vectorize
+    size_t num_blocks = (num_parts + PARTICLE_STORE_PADDING - 1) / PARTICLE_STORE_PADDING;
+    ThreadPool::run([&](size_t t)
+    {
+        size_t begin = MIN(num_parts, PARTICLE_STORE_PADDING * (num_blocks * t / num_threads));
+        size_t end = MIN(num_parts, PARTICLE_STORE_PADDING * (num_blocks * (t + 1) / num_threads));
+        for (size_t k = begin; k < end; k++)
+            parts.x[k] = parts.x[k] + delta_time * parts.vx[k];
+        for (size_t k = begin; k < end; k++)
+            parts.y[k] = parts.y[k] + delta_time * parts.vy[k];
+        for (size_t k = begin; k < end; k++)
+            parts.z[k] = parts.z[k] + delta_time * parts.vz[k];
+    });
+}
+
+void cpu_next_wall_collision(const ParticleStore& parts,
+                             cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                             size_t* p, cl_double* delta_time, cl_double* collision_axis)
+{
+    ThreadPool::initialize(CLSettings::get_num_threads());
+    size_t num_threads = ThreadPool::num_threads();
+    size_t num_parts = parts.num_parts();
+    cl_double* walls[3] = { x_wall, y_wall, z_wall };
+    const cl_double* position[3] = { parts.x, parts.y, parts.z };
+    const cl_double* velocity[3] = { parts.vx, parts.vy, parts.vz };
+    std::vector<CPUCandidate> results(num_threads);
+    std::vector<cl_int> axes(num_threads);
+    ThreadPool::run([&](size_t t)
+    {
+        CPUCandidate best = { INFINITY, 0, CPU_NO_PARTNER };
+        cl_int best_axis = 0;
+        size_t begin = num_parts * t / num_threads;
+        size_t end = num_parts * (t + 1) / num_threads;
+        for (size_t q = begin; q < end; q++)
+        {
+            // Same rules of the wall_collision kernel
+            cl_double dt = INFINITY;
+            cl_int axis = 0;
+            for (cl_int k = 0; k < 3; k++)
+            {
+                cl_double v = velocity[k][q];
+                cl_double w = INFINITY;
+                if (v > 0)
+                    w = walls[k][1] - parts.radius[q];
+                else if (v < 0)
+                    w = walls[k][0] + parts.radius[q];
+                cl_double dk = (w - position[k][q]) / v;
+                if (k == 0 || dk < dt)
+                {
+                    dt = dk;
+                    axis = v < 0 ? -(k + 1) : k + 1;
+                }
+            }
+
+            CPUCandidate c = { dt, q, q };
+            if (earlier(c, best))
+            {
+                best = c;
+                best_axis = axis;
+            }
+        }
+        results[t] = best;
+        axes[t] = best_axis;
+    });
+
+    CPUCandidate best = { INFINITY, 0, CPU_NO_PARTNER };
+    cl_int axis = 0;
+    for (size_t t = 0; t < num_threads; t++)
+    {
+        if (earlier(results[t], best))
+        {
+            best = results[t];
+            axis = axes[t];
+        }
+    }
+
+    *p = best.i;
+    *delta_time = best.time;
+    collision_axis[0] = 0;
+    collision_axis[1] = 0;
+    collision_axis[2] = 0;
+    if (best.j == CPU_NO_PARTNER)
+        return;
+    if (axis != 0)
+        collision_axis[ABS(axis) - 1] = axis / ABS(axis);
+}
+
+void cpu_next_part_collision(const ParticleStore& parts, size_t* i, size_t* j, cl_double* delta_time)
+{
+    ThreadPool::initialize(CLSettings::get_num_threads());
+    size_t num_threads = ThreadPool::num_threads();
+    size_t num_parts = parts.num_parts();
+
+    CPUPairRow pair_row = cpu_pair_row_scalar;
+    if (cpu_isa() == CPU_ISA_AVX512)
+        pair_row = cpu_pair_row_avx512;
+    else if (cpu_isa() == CPU_ISA_AVX2)
+        pair_row = cpu_pair_row_avx2;
+
+    // Each thread keeps its own earliest collision, over the couples (i, j) with i < j
+    std::vector<CPUCandidate> results(num_threads);
+    std::atomic<size_t> next_row(0);
+    ThreadPool::run([&](size_t t)
+    {
+        CPUCandidate best = { INFINITY, 0, CPU_NO_PARTNER };
+        while (true)
+        {
+            size_t first = next_row.fetch_add(CPU_ROWS_PER_CHUNK);
+            if (first >= num_parts)
+                break;
+            size_t last = MIN(first + CPU_ROWS_PER_CHUNK, num_parts);
+            for (size_t row = first; row < last; row++)
+            {
+                CPUCandidate c;
+                c.i = row;
+                c.time = pair_row(parts, row, row + 1, num_parts, &c.j);
+                if (earlier(c, best))
+                    best = c;
+            }
+        }
+        results[t] = best;
+    });
+
+    // Merge the results of the threads
+    CPUCandidate best = { INFINITY, 0, CPU_NO_PARTNER };
+    for (size_t t = 0; t < num_threads; t++)
+    {
+        if (earlier(results[t], best))
+            best = results[t];
+    }
+
+    // No couple is found if none will ever collide
+    *delta_time = best.time;
+    if (best.j != CPU_NO_PARTNER)
+    {
+        *i = best.i;
+        *j = best.j;
+    }
+    else
+    {
+        *i = NO_COLLISION;
+        *j = NO_COLLISION;
+    }
+}
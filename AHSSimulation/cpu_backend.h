@@ -0,0 +1,22 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+#include "particle_store.h"
+
+#define CPU_ISA_SCALAR      0
+#define CPU_ISA_AVX2        1
+#define CPU_ISA_AVX512      2
+
+// Native implementations of the position update and of the collision searches of shared.h.
+// They follow the same rules of the OpenCL kernels, ties included, and run on the threads of ThreadPool.
+void cpu_update_positions(ParticleStore& parts, cl_double delta_time);
+
+void cpu_next_wall_collision(const ParticleStore& parts,
+                             cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                             size_t* p, cl_double* delta_time, cl_double* collision_axis);
+
+void cpu_next_part_collision(const ParticleStore& parts, size_t* i, size_t* j, cl_double* delta_time);
+
+// Instruction set used by the collision tests between particles, detected at the first call
+int cpu_isa();
+const char* cpu_isa_name(int isa);
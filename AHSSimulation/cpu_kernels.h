@@ -0,0 +1,52 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+#include "particle_store.h"
+#include <math.h>
+
+// All the instruction sets must give the same results, so multiply-add contraction is disabled
+#if defined(_MSC_VER)
+#pragma fp_contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+// Vectorized functions are compiled for their instruction set only, and called only
+// after the instruction set has been detected at run time
+#if defined(__GNUC__)
+#define CPU_TARGET_AVX2     __attribute__((target("avx2")))
+#define CPU_TARGET_AVX512   __attribute__((target("avx512f")))
+#else
+#define CPU_TARGET_AVX2
+#define CPU_TARGET_AVX512
+#endif
+
+#define CPU_NO_PARTNER      ((size_t)-1)
+
+// Collision time of the couple (i, j). Same arithmetic of the part_collision kernel.
+inline cl_double cpu_pair_time(const ParticleStore& s, size_t i, size_t j)
+{
+    cl_double dx = s.x[i] - s.x[j];
+    cl_double dy = s.y[i] - s.y[j];
+    cl_double dz = s.z[i] - s.z[j];
+    cl_double dvx = s.vx[i] - s.vx[j];
+    cl_double dvy = s.vy[i] - s.vy[j];
+    cl_double dvz = s.vz[i] - s.vz[j];
+    cl_double rij = s.radius[i] + s.radius[j];
+
+    cl_double a = dvx * dvx + dvy * dvy + dvz * dvz;
+    cl_double b = 2 * (dx * dvx + dy * dvy + dz * dvz);
+    cl_double c = (dx * dx + dy * dy + dz * dz) - rij * rij;
+
+    if (b >= 0 || b * b < 4 * a * c)
+        return INFINITY;
+    if (c >= 0)
+        return (-b - sqrt(b * b - 4 * a * c)) / (2 * a);
+    return -1;
+}
+
+// Earliest collision of particle i with the particles in [j_begin, j_end), ties broken by
+// the smallest partner. The partner is CPU_NO_PARTNER if no collision will ever occur.
+cl_double cpu_pair_row_scalar(const ParticleStore& s, size_t i, size_t j_begin, size_t j_end, size_t* j);
+cl_double cpu_pair_row_avx2(const ParticleStore& s, size_t i, size_t j_begin, size_t j_end, size_t* j);
+cl_double cpu_pair_row_avx512(const ParticleStore& s, size_t i, size_t j_begin, size_t j_end, size_t* j);
@@ -0,0 +1,86 @@
+#include "cpu_kernels.h"
+#include <immintrin.h>
+
+CPU_TARGET_AVX2
+cl_double cpu_pair_row_avx2(const ParticleStore& s, size_t i, size_t j_begin, size_t j_end, size_t* j)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d two = _mm256_set1_pd(2);
+    const __m256d four = _mm256_set1_pd(4);
+    const __m256d minus_one = _mm256_set1_pd(-1);
+    const __m256d inf = _mm256_set1_pd(INFINITY);
+    const __m256i step = _mm256_set1_epi64x(4);
+
+    __m256d xi = _mm256_set1_pd(s.x[i]);
+    __m256d yi = _mm256_set1_pd(s.y[i]);
+    __m256d zi = _mm256_set1_pd(s.z[i]);
+    __m256d vxi = _mm256_set1_pd(s.vx[i]);
+    __m256d vyi = _mm256_set1_pd(s.vy[i]);
+    __m256d vzi = _mm256_set1_pd(s.vz[i]);
+    __m256d ri = _mm256_set1_pd(s.radius[i]);
+
+    // Each lane keeps its own minimum, the earliest partner winning the ties
+    __m256d best = inf;
+    __m256i best_j = _mm256_set1_epi64x((long long)CPU_NO_PARTNER);
+    __m256i jv = _mm256_setr_epi64x(j_begin, j_begin + 1, j_begin + 2, j_begin + 3);
+    size_t k = j_begin;
+    for (; k + 4 <= j_end; k += 4)
+    {
+        __m256d dx = _mm256_sub_pd(xi, _mm256_loadu_pd(s.x + k));
+        __m256d dy = _mm256_sub_pd(yi, _mm256_loadu_pd(s.y + k));
+        __m256d dz = _mm256_sub_pd(zi, _mm256_loadu_pd(s.z + k));
+        __m256d dvx = _mm256_sub_pd(vxi, _mm256_loadu_pd(s.vx + k));
+        __m256d dvy = _mm256_sub_pd(vyi, _mm256_loadu_pd(s.vy + k));
+        __m256d dvz = _mm256_sub_pd(vzi, _mm256_loadu_pd(s.vz + k));
+        __m256d rij = _mm256_add_pd(ri, _mm256_loadu_pd(s.radius + k));
+
+        // Same operations, in the same order, of cpu_pair_time
+        __m256d a = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dvx, dvx), _mm256_mul_pd(dvy, dvy)), _mm256_mul_pd(dvz, dvz));
+        __m256d b = _mm256_mul_pd(two, _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dvx), _mm256_mul_pd(dy, dvy)), _mm256_mul_pd(dz, dvz)));
+        __m256d c = _mm256_sub_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz)),
+                                  _mm256_mul_pd(rij, rij));
+        __m256d bb = _mm256_mul_pd(b, b);
+        __m256d four_ac = _mm256_mul_pd(_mm256_mul_pd(four, a), c);
+        __m256d t = _mm256_div_pd(_mm256_sub_pd(_mm256_sub_pd(zero, b), _mm256_sqrt_pd(_mm256_sub_pd(bb, four_ac))),
+                                  _mm256_mul_pd(two, a));
+        t = _mm256_blendv_pd(t, minus_one, _mm256_cmp_pd(c, zero, _CMP_NGE_UQ));
+        __m256d never = _mm256_or_pd(_mm256_cmp_pd(b, zero, _CMP_GE_OQ), _mm256_cmp_pd(bb, four_ac, _CMP_LT_OQ));
+        t = _mm256_blendv_pd(t, inf, never);
+
+        __m256d update = _mm256_cmp_pd(t, best, _CMP_LT_OQ);
+        best = _mm256_blendv_pd(best, t, update);
+        best_j = _mm256_castpd_si256(_mm256_blendv_pd(_mm256_castsi256_pd(best_j), _mm256_castsi256_pd(jv), update));
+        jv = _mm256_add_epi64(jv, step);
+    }
+
+    // Merge the lanes
+    cl_double lane_best[4];
+    size_t lane_j[4];
+    _mm256_storeu_pd(lane_best, best);
+    _mm256_storeu_si256((__m256i*)lane_j, best_j);
+    cl_double result = INFINITY;
+    *j = CPU_NO_PARTNER;
+    for (size_t l = 0; l < 4; l++)
+    {
+        if (lane_j[l] == CPU_NO_PARTNER)
+            continue;
+        if (lane_best[l] < result || (lane_best[l] == result && lane_j[l] < *j))
+        {
+            result = lane_best[l];
+            *j = lane_j[l];
+        }
+    }
+
+    // The remaining partners follow all the others, so they win only if strictly earlier
+    for (; k < j_end; k++)
+    {
+        cl_double t = cpu_pair_time(s, i, k);
+        if (t < result)
+        {
+            result = t;
+            *j = k;
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,86 @@
+#include "cpu_kernels.h"
+#include <immintrin.h>
+
+CPU_TARGET_AVX512
+cl_double cpu_pair_row_avx512(const ParticleStore& s, size_t i, size_t j_begin, size_t j_end, size_t* j)
+{
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d two = _mm512_set1_pd(2);
+    const __m512d four = _mm512_set1_pd(4);
+    const __m512d minus_one = _mm512_set1_pd(-1);
+    const __m512d inf = _mm512_set1_pd(INFINITY);
+    const __m512i step = _mm512_set1_epi64(8);
+
+    __m512d xi = _mm512_set1_pd(s.x[i]);
+    __m512d yi = _mm512_set1_pd(s.y[i]);
+    __m512d zi = _mm512_set1_pd(s.z[i]);
+    __m512d vxi = _mm512_set1_pd(s.vx[i]);
+    __m512d vyi = _mm512_set1_pd(s.vy[i]);
+    __m512d vzi = _mm512_set1_pd(s.vz[i]);
+    __m512d ri = _mm512_set1_pd(s.radius[i]);
+
+    // Each lane keeps its own minimum, the earliest partner winning the ties
+    __m512d best = inf;
+    __m512i best_j = _mm512_set1_epi64((long long)CPU_NO_PARTNER);
+    __m512i jv = _mm512_add_epi64(_mm512_set1_epi64(j_begin), _mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7));
+    size_t k = j_begin;
+    for (; k + 8 <= j_end; k += 8)
+    {
+        __m512d dx = _mm512_sub_pd(xi, _mm512_loadu_pd(s.x + k));
+        __m512d dy = _mm512_sub_pd(yi, _mm512_loadu_pd(s.y + k));
+        __m512d dz = _mm512_sub_pd(zi, _mm512_loadu_pd(s.z + k));
+        __m512d dvx = _mm512_sub_pd(vxi, _mm512_loadu_pd(s.vx + k));
+        __m512d dvy = _mm512_sub_pd(vyi, _mm512_loadu_pd(s.vy + k));
+        __m512d dvz = _mm512_sub_pd(vzi, _mm512_loadu_pd(s.vz + k));
+        __m512d rij = _mm512_add_pd(ri, _mm512_loadu_pd(s.radius + k));
+
+        // Same operations, in the same order, of cpu_pair_time
+        __m512d a = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dvx, dvx), _mm512_mul_pd(dvy, dvy)), _mm512_mul_pd(dvz, dvz));
+        __m512d b = _mm512_mul_pd(two, _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dvx), _mm512_mul_pd(dy, dvy)), _mm512_mul_pd(dz, dvz)));
+        __m512d c = _mm512_sub_pd(_mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)), _mm512_mul_pd(dz, dz)),
+                                  _mm512_mul_pd(rij, rij));
+        __m512d bb = _mm512_mul_pd(b, b);
+        __m512d four_ac = _mm512_mul_pd(_mm512_mul_pd(four, a), c);
+        __m512d t = _mm512_div_pd(_mm512_sub_pd(_mm512_sub_pd(zero, b), _mm512_sqrt_pd(_mm512_sub_pd(bb, four_ac))),
+                                  _mm512_mul_pd(two, a));
+        t = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(c, zero, _CMP_NGE_UQ), t, minus_one);
+        __mmask8 never = _mm512_cmp_pd_mask(b, zero, _CMP_GE_OQ) | _mm512_cmp_pd_mask(bb, four_ac, _CMP_LT_OQ);
+        t = _mm512_mask_blend_pd(never, t, inf);
+
+        __mmask8 update = _mm512_cmp_pd_mask(t, best, _CMP_LT_OQ);
+        best = _mm512_mask_blend_pd(update, best, t);
+        best_j = _mm512_mask_blend_epi64(update, best_j, jv);
+        jv = _mm512_add_epi64(jv, step);
+    }
+
+    // Merge the lanes
+    cl_double lane_best[8];
+    size_t lane_j[8];
+    _mm512_storeu_pd(lane_best, best);
+    _mm512_storeu_si512(lane_j, best_j);
+    cl_double result = INFINITY;
+    *j = CPU_NO_PARTNER;
+    for (size_t l = 0; l < 8; l++)
+    {
+        if (lane_j[l] == CPU_NO_PARTNER)
+            continue;
+        if (lane_best[l] < result || (lane_best[l] == result && lane_j[l] < *j))
+        {
+            result = lane_best[l];
+            *j = lane_j[l];
+        }
+    }
+
+    // The remaining partners follow all the others, so they win only if strictly earlier
+    for (; k < j_end; k++)
+    {
+        cl_double t = cpu_pair_time(s, i, k);
+        if (t < result)
+        {
+            result = t;
+            *j = k;
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,536 @@
+#include "device_selection.h"
+#include "CLSettings.h"
+#include "CLRuntime.h"
+#include "inelastic.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <math.h>
+#include <stdlib.h>
+
+#define MIN(x, y)       ((x) < (y) ? (x) : (y))
+#define MAX(x, y)       ((x) > (y) ? (x) : (y))
+
+std::string read_environment(const char* name)
+{
+    char* buffer = NULL;
+    size_t length = 0;
+    if (_dupenv_s(&buffer, &length, name) != 0 || buffer == NULL)
+        return std::string();
+    std::string value(buffer);
+    free(buffer);
+    return value;
+}
+
+std::string device_full_name(cl::Device& device)
+{
+    std::string devname, platname;
+    cl_platform_id platform_id;
+    device.getInfo(CL_DEVICE_NAME, &devname);
+    device.getInfo(CL_DEVICE_PLATFORM, &platform_id);
+    cl::Platform(platform_id).getInfo(CL_PLATFORM_NAME, &platname);
+    return platname + ": " + devname;
+}
+
+static std::string to_lower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return (char)tolower(c); });
+    return str;
+}
+
+size_t find_device(cl::vector<cl::Device>& devices, const std::string& selection)
+{
+    // By index, as shown in the listing
+    if (!selection.empty() && selection.find_first_not_of("0123456789") == std::string::npos)
+    {
+        size_t d = (size_t)atoll(selection.c_str());
+        if (d == 0 || d > devices.size())
+        {
+            std::stringstream ss;
+            ss << "Device index " << selection << " is out of range. There are " << devices.size() << " devices." << std::endl;
+            throw std::runtime_error(ss.str());
+        }
+        return d - 1;
+    }
+
+    // By name
+    std::string pattern = to_lower(selection);
+    for (size_t d = 0; d < devices.size(); d++)
+    {
+        if (to_lower(device_full_name(devices[d])).find(pattern) != std::string::npos)
+            return d;
+    }
+    std::stringstream ss;
+    ss << "No OpenCL device matches " << selection << "." << std::endl;
+    throw std::runtime_error(ss.str());
+}
+
+// Sub-devices of a device, one for each NUMA node. A device that cannot be partitioned, as on
+// hosts with a single node, is returned whole.
+static cl::vector<cl::Device> numa_sub_devices(cl::Device& device)
+{
+    const cl_device_partition_property properties[] = {
+        CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0
+    };
+    cl::vector<cl::Device> sub_devices;
+    if (device.createSubDevices(properties, &sub_devices) != CL_SUCCESS || sub_devices.empty())
+    {
+        sub_devices.clear();
+        sub_devices.push_back(device);
+    }
+    return sub_devices;
+}
+
+cl::vector<cl::Device> select_devices(const std::string& selection)
+{
+    cl::vector<cl::Platform> plats;
+    cl::Platform::get(&plats);
+
+    cl_device_type device_type = selection == DEVICES_NUMA ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_ALL;
+    cl::vector<cl::Device> devs;
+    for (size_t i = 0; i < plats.size(); i++)
+    {
+        cl::vector<cl::Device> devs_loc;
+        plats[i].getDevices(device_type, &devs_loc);
+        devs.insert(devs.end(), devs_loc.begin(), devs_loc.end());
+    }
+    if (devs.empty())
+    {
+        std::stringstream ss;
+        ss << "No OpenCL device of the requested type is available." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    if (selection == DEVICES_ALL)
+        return devs;
+
+    cl::vector<cl::Device> selected;
+    if (selection == DEVICES_NUMA)
+    {
+        for (size_t d = 0; d < devs.size(); d++)
+        {
+            cl::vector<cl::Device> sub_devices = numa_sub_devices(devs[d]);
+            selected.insert(selected.end(), sub_devices.begin(), sub_devices.end());
+        }
+        return selected;
+    }
+
+    // Comma-separated indices, each one used at most once
+    std::stringstream list(selection);
+    std::string item;
+    std::vector<bool> used(devs.size(), false);
+    while (std::getline(list, item, ','))
+    {
+        if (item.empty() || item.find_first_not_of("0123456789") != std::string::npos)
+        {
+            std::stringstream ss;
+            ss << "Illegal value " << selection << " for DEVICES. Legal values are " << DEVICES_ALL << ", "
+               << DEVICES_NUMA << " or a comma-separated list of device indices." << std::endl;
+            throw std::runtime_error(ss.str());
+        }
+        size_t d = find_device(devs, item);
+        if (used[d])
+        {
+            std::stringstream ss;
+            ss << "Device " << item << " is listed more than once in DEVICES." << std::endl;
+            throw std::runtime_error(ss.str());
+        }
+        used[d] = true;
+        selected.push_back(devs[d]);
+    }
+    if (selected.empty())
+    {
+        std::stringstream ss;
+        ss << "DEVICES does not list any device." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    return selected;
+}
+
+std::string cache_file_path(const std::string& filename)
+{
+    std::string dir = read_environment(CACHE_DIR_ENV_VARIABLE);
+    if (dir.empty())
+        return filename;
+    return dir + "/" + filename;
+}
+
+// The cache holds a line for each host, type of device, order of magnitude of the number of
+// particles and workload of the calibration, with the name of the fastest device separated by a tab.
+// The workload is the pair launch of the full-scan loop and of the on-device batch, or the order of
+// magnitude of the number of replicas of the ensemble.
+static std::string cache_key(cl_device_type device_type, size_t num_parts)
+{
+    std::string host = read_environment("COMPUTERNAME");
+    if (host.empty())
+        host = read_environment("HOSTNAME");
+    if (host.empty())
+        host = "localhost";
+
+    size_t magnitude = 0;
+    while ((num_parts >> magnitude) > 1)
+        magnitude++;
+
+    std::stringstream ss;
+    ss << host << " " << device_type << " " << magnitude;
+    if (CLSettings::get_engine() == ENGINE_ENSEMBLE)
+    {
+        size_t replicas_magnitude = 0;
+        while ((CLSettings::get_ensemble_size() >> replicas_magnitude) > 1)
+            replicas_magnitude++;
+        ss << " ENSEMBLE " << replicas_magnitude;
+    }
+    else if (CLSettings::get_pair_launch() == PAIR_LAUNCH_TRIANGULAR)
+        ss << " TRIANGULAR";
+    else
+        ss << " SQUARE";
+    return ss.str();
+}
+
+static bool read_cached_device(const std::string& key, std::string* name)
+{
+    std::ifstream stream(cache_file_path(DEVICE_CACHE_FILE));
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        size_t tab = line.find('\t');
+        if (tab != std::string::npos && line.substr(0, tab) == key)
+        {
+            *name = line.substr(tab + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void write_cached_device(const std::string& key, const std::string& name)
+{
+    // Keep the entries of the other keys
+    std::vector<std::string> lines;
+    std::ifstream instream(cache_file_path(DEVICE_CACHE_FILE));
+    std::string line;
+    while (std::getline(instream, line))
+    {
+        if (line.substr(0, line.find('\t')) != key)
+            lines.push_back(line);
+    }
+    instream.close();
+    lines.push_back(key + "\t" + name);
+
+    // The cache is only an optimization, so failing to write it is not an error
+    std::ofstream outstream(cache_file_path(DEVICE_CACHE_FILE), std::ios::trunc);
+    if (!outstream)
+    {
+        std::cerr << "Cannot write the device cache " << cache_file_path(DEVICE_CACHE_FILE) << "." << std::endl;
+        return;
+    }
+    for (size_t l = 0; l < lines.size(); l++)
+        outstream << lines[l] << std::endl;
+}
+
+size_t auto_select_device(cl::vector<cl::Device>& devices, cl_device_type device_type, size_t num_parts)
+{
+    std::string key = cache_key(device_type, num_parts);
+    std::string cached;
+    if (read_cached_device(key, &cached))
+    {
+        for (size_t d = 0; d < devices.size(); d++)
+        {
+            if (device_full_name(devices[d]) == cached)
+            {
+                std::cout << "Using the device chosen by a previous calibration on this host." << std::endl;
+                return d;
+            }
+        }
+    }
+
+    // Calibrate all the devices, skipping the ones that cannot run the kernels
+    std::cout << "Calibrating the devices with " << num_parts << " particles..." << std::endl;
+    size_t best = devices.size();
+    double best_time = INFINITY;
+    for (size_t d = 0; d < devices.size(); d++)
+    {
+        double time;
+        try
+        {
+            time = calibrate_device(devices[d], num_parts);
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << "Skipping device " << device_full_name(devices[d]) << ": " << e.what();
+            continue;
+        }
+        std::cout << "  " << (d + 1) << ". " << device_full_name(devices[d]) << ": "
+                  << time * 1000 << " ms per step" << std::endl;
+        if (time < best_time)
+        {
+            best = d;
+            best_time = time;
+        }
+    }
+    if (best == devices.size())
+    {
+        std::stringstream ss;
+        ss << "None of the OpenCL devices could be calibrated." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    write_cached_device(key, device_full_name(devices[best]));
+    return best;
+}
+
+static cl::Program build_calibration_program(cl::Context& context, cl::Device& device, const cl::vector<std::string>& sources)
+{
+    cl_int status = CL_SUCCESS;
+    cl::Program program(context, sources, &status);
+    if (status == CL_SUCCESS)
+        status = program.build({ device });
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while building the OpenCL programs for the calibration." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    return program;
+}
+
+static void check_calibration_status(cl_int status, const char* what)
+{
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while " << what << " for the calibration." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+// Particles on a grid with unit spacing, moving in scattered directions, for num_replicas replicas.
+// The arrays are planar, as in ParticleStore, with stride n, and each replica follows the previous one.
+// Returns the number of particles on a side of the grid.
+static size_t calibration_particles(size_t n, size_t num_replicas, std::vector<cl_double>& pos, std::vector<cl_double>& vel)
+{
+    size_t side = (size_t)ceil(cbrt((double)n));
+    pos.resize(3 * n * num_replicas);
+    vel.resize(3 * n * num_replicas);
+    for (size_t r = 0; r < num_replicas; r++)
+    {
+        for (size_t p = 0; p < n; p++)
+        {
+            pos[3 * r * n + p] = (cl_double)(p % side);
+            pos[3 * r * n + n + p] = (cl_double)((p / side) % side);
+            pos[3 * r * n + 2 * n + p] = (cl_double)(p / (side * side));
+        }
+        for (size_t k = 0; k < 3 * n; k++)
+            vel[3 * r * n + k] = (cl_double)((k * 7919) % 1000) / 1000 - 0.5;
+    }
+    return side;
+}
+
+// Best time of the launches enqueued by step, over CALIBRATION_STEPS runs. The first run is not
+// timed, since some implementations finish the compilation at the first launch.
+static double time_calibration_steps(cl::CommandQueue& queue, const std::function<cl_int()>& step)
+{
+    double best_time = INFINITY;
+    for (size_t s = 0; s <= CALIBRATION_STEPS; s++)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        cl_int status = step();
+        status |= queue.finish();
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        check_calibration_status(status, "running the OpenCL kernels");
+        if (s > 0)
+            best_time = MIN(best_time, std::chrono::duration<double>(end - start).count());
+    }
+    return best_time;
+}
+
+// Work-group size of a minimum search launched with the given kernel: the largest power of two up
+// to ARGMIN_GROUP_SIZE within the limits of the device and of the kernel
+static size_t calibration_group_size(cl::Kernel& kernel, cl::Device& device)
+{
+    size_t group_size = ARGMIN_GROUP_SIZE;
+    size_t max_group_size;
+    device.getInfo(CL_DEVICE_MAX_WORK_GROUP_SIZE, &max_group_size);
+    max_group_size = MIN(max_group_size, kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+    while (group_size > max_group_size)
+        group_size /= 2;
+    return group_size;
+}
+
+// A step of the full-scan loop or of the on-device batch, that is a position update and the search
+// of the next collision between particles, with the pair launch of the run
+static double calibrate_step(cl::Context& context, cl::CommandQueue& queue, cl::Device& device, size_t num_parts)
+{
+    bool triangular = CLSettings::get_pair_launch() == PAIR_LAUNCH_TRIANGULAR;
+    cl_int status = CL_SUCCESS;
+    cl::Program pos_update_program = build_calibration_program(context, device, { CLSettings::get_source_position_update() });
+    cl::Program part_collision_program = build_calibration_program(context, device, { CLSettings::get_source_part_collision() });
+    cl::Kernel pos_update_kernel(pos_update_program, POSITION_UPDATE_KERNEL_NAME, &status);
+    cl::Kernel part_collision_kernel(part_collision_program, triangular ? PART_COLLISION_TRIANGULAR_KERNEL_NAME
+                                                                        : PART_COLLISION_KERNEL_NAME, &status);
+    cl::Kernel argmin_kernel(part_collision_program, PART_COLLISION_ARGMIN_KERNEL_NAME, &status);
+    check_calibration_status(status, "creating the OpenCL kernels");
+
+    // The matrix of the collision times of the square launch must fit in a single buffer.
+    // The triangular launch is bounded in the same way, so that its calibration is as short.
+    cl_ulong max_alloc;
+    device.getInfo(CL_DEVICE_MAX_MEM_ALLOC_SIZE, &max_alloc);
+    size_t n = MAX(num_parts, 2);
+    while (n > 2 && n * n * sizeof(cl_double) > max_alloc)
+        n /= 2;
+
+    std::vector<cl_double> pos, vel, radii(n, 0.25);
+    calibration_particles(n, 1, pos, vel);
+
+    size_t group_size = calibration_group_size(triangular ? part_collision_kernel : argmin_kernel, device);
+    size_t count = triangular ? n * (n - 1) / 2 : n * n;
+    size_t num_groups = MAX(1, MIN(ARGMIN_MAX_GROUPS, (count + group_size - 1) / group_size));
+
+    cl::Buffer cl_pos(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, 3 * n * sizeof(cl_double), pos.data(), &status);
+    cl::Buffer cl_next_pos(context, CL_MEM_READ_WRITE, 3 * n * sizeof(cl_double), NULL, &status);
+    cl::Buffer cl_vel(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 3 * n * sizeof(cl_double), vel.data(), &status);
+    cl::Buffer cl_radii(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * sizeof(cl_double), radii.data(), &status);
+    cl::Buffer cl_values(context, CL_MEM_READ_WRITE, num_groups * sizeof(cl_double), NULL, &status);
+    cl::Buffer cl_indices(context, CL_MEM_READ_WRITE, num_groups * sizeof(cl_ulong), NULL, &status);
+    cl::Buffer cl_delta_times;
+    if (!triangular)
+        cl_delta_times = cl::Buffer(context, CL_MEM_READ_WRITE, n * n * sizeof(cl_double), NULL, &status);
+    check_calibration_status(status, "creating the OpenCL buffers");
+
+    status = pos_update_kernel.setArg(0, cl_pos);
+    status |= pos_update_kernel.setArg(1, cl_vel);
+    status |= pos_update_kernel.setArg(2, (cl_ulong)n);
+    status |= pos_update_kernel.setArg(3, (cl_ulong)n);
+    status |= pos_update_kernel.setArg(4, (cl_double)0.001);
+    status |= pos_update_kernel.setArg(5, cl_next_pos);
+    status |= part_collision_kernel.setArg(0, cl_next_pos);
+    status |= part_collision_kernel.setArg(1, cl_vel);
+    status |= part_collision_kernel.setArg(2, cl_radii);
+    status |= part_collision_kernel.setArg(3, (cl_ulong)n);
+    status |= part_collision_kernel.setArg(4, (cl_ulong)n);
+    if (triangular)
+    {
+        status |= part_collision_kernel.setArg(5, cl_values);
+        status |= part_collision_kernel.setArg(6, cl_indices);
+        status |= part_collision_kernel.setArg(7, cl::Local(group_size * sizeof(cl_double)));
+        status |= part_collision_kernel.setArg(8, cl::Local(group_size * sizeof(cl_ulong)));
+    }
+    else
+    {
+        status |= part_collision_kernel.setArg(5, cl_delta_times);
+        status |= argmin_kernel.setArg(0, cl_delta_times);
+        status |= argmin_kernel.setArg(1, (cl_ulong)n);
+        status |= argmin_kernel.setArg(2, cl_values);
+        status |= argmin_kernel.setArg(3, cl_indices);
+        status |= argmin_kernel.setArg(4, cl::Local(group_size * sizeof(cl_double)));
+        status |= argmin_kernel.setArg(5, cl::Local(group_size * sizeof(cl_ulong)));
+    }
+    check_calibration_status(status, "setting the arguments of the OpenCL kernels");
+
+    // The first step of the minimum search is timed with the collision times, since the
+    // triangular launch does it in the same kernel
+    double best_time = time_calibration_steps(queue, [&]()
+    {
+        cl_int status = queue.enqueueNDRangeKernel(pos_update_kernel, cl::NullRange, cl::NDRange(n), cl::NullRange);
+        if (triangular)
+            return status | queue.enqueueNDRangeKernel(part_collision_kernel, cl::NullRange,
+                                                       cl::NDRange(num_groups * group_size), cl::NDRange(group_size));
+        status |= queue.enqueueNDRangeKernel(part_collision_kernel, cl::NullRange, cl::NDRange(n, n), cl::NullRange);
+        return status | queue.enqueueNDRangeKernel(argmin_kernel, cl::NullRange,
+                                                   cl::NDRange(num_groups * group_size), cl::NDRange(group_size));
+    });
+
+    // Scale to the actual size of the system, if a smaller one was used
+    return best_time * ((double)num_parts / n) * ((double)num_parts / n);
+}
+
+// An event of all the replicas of the ensemble, that is a launch of the ensemble kernel with a batch
+// of a single event and a work-group per replica
+static double calibrate_ensemble(cl::Context& context, cl::CommandQueue& queue, cl::Device& device, size_t num_parts)
+{
+    size_t num_replicas = MAX(CLSettings::get_ensemble_size(), 1);
+    cl_int status = CL_SUCCESS;
+    cl::Program program = build_calibration_program(context, device, { CLSettings::get_source_part_collision(),
+                                                                        CLSettings::get_source_inelastic_batch() });
+    cl::Kernel kernel(program, ENSEMBLE_BATCH_KERNEL_NAME, &status);
+    check_calibration_status(status, "creating the OpenCL kernels");
+
+    // The walls enclose the grid of the particles
+    size_t n = MAX(num_parts, 2);
+    std::vector<cl_double> pos, vel, radii(n, 0.25), masses(n, 1), elastic_coeffs(num_replicas, 1);
+    size_t side = calibration_particles(n, num_replicas, pos, vel);
+    cl_double walls[2] = { -1, (cl_double)side };
+    std::vector<BatchClock> clocks(num_replicas);
+    for (size_t r = 0; r < num_replicas; r++)
+    {
+        clocks[r].time = 0;
+        clocks[r].count = 0;
+        clocks[r].done = 0;
+    }
+    size_t group_size = calibration_group_size(kernel, device);
+
+    cl::Buffer cl_pos(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, pos.size() * sizeof(cl_double), pos.data(), &status);
+    cl::Buffer cl_vel(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, vel.size() * sizeof(cl_double), vel.data(), &status);
+    cl::Buffer cl_radii(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * sizeof(cl_double), radii.data(), &status);
+    cl::Buffer cl_masses(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * sizeof(cl_double), masses.data(), &status);
+    cl::Buffer cl_walls(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 2 * sizeof(cl_double), walls, &status);
+    cl::Buffer cl_elastic_coeffs(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, num_replicas * sizeof(cl_double),
+                                 elastic_coeffs.data(), &status);
+    cl::Buffer cl_clocks(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, num_replicas * sizeof(BatchClock),
+                         clocks.data(), &status);
+    cl::Buffer cl_ring(context, CL_MEM_READ_WRITE, 2 * num_replicas * sizeof(BatchRecord), NULL, &status);
+    check_calibration_status(status, "creating the OpenCL buffers");
+
+    status = kernel.setArg(0, cl_pos);
+    status |= kernel.setArg(1, cl_vel);
+    status |= kernel.setArg(2, cl_radii);
+    status |= kernel.setArg(3, cl_masses);
+    status |= kernel.setArg(4, (cl_ulong)n);
+    status |= kernel.setArg(5, (cl_ulong)n);
+    status |= kernel.setArg(6, cl_walls);
+    status |= kernel.setArg(7, cl_walls);
+    status |= kernel.setArg(8, cl_walls);
+    status |= kernel.setArg(9, cl_elastic_coeffs);
+    status |= kernel.setArg(10, (cl_double)INFINITY);
+    status |= kernel.setArg(11, (cl_ulong)1);
+    status |= kernel.setArg(12, cl_clocks);
+    status |= kernel.setArg(13, cl_ring);
+    status |= kernel.setArg(14, cl::Local(group_size * sizeof(cl_double)));
+    status |= kernel.setArg(15, cl::Local(group_size * sizeof(cl_ulong)));
+    check_calibration_status(status, "setting the arguments of the OpenCL kernels");
+
+    return time_calibration_steps(queue, [&]()
+    {
+        return queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(group_size, num_replicas),
+                                          cl::NDRange(group_size, 1));
+    });
+}
+
+double calibrate_device(cl::Device& device, size_t num_parts)
+{
+    cl::vector<cl::Device> devices;
+    devices.push_back(device);
+    cl_int status = CL_SUCCESS;
+    cl::Context context(devices, NULL, NULL, NULL, &status);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while creating the OpenCL context for the calibration." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    cl::CommandQueue queue(context, device, 0, &status);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while creating the OpenCL command queue for the calibration." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    if (CLSettings::get_engine() == ENGINE_ENSEMBLE)
+        return calibrate_ensemble(context, queue, device, num_parts);
+    return calibrate_step(context, queue, device, num_parts);
+}
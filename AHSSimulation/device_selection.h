@@ -0,0 +1,39 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+#include <string>
+
+#define DEVICE_SELECTION_AUTO       "AUTO"
+#define DEVICE_ENV_VARIABLE         "AHS_DEVICE"
+#define CACHE_DIR_ENV_VARIABLE      "AHS_CACHE_DIR"
+#define DEVICE_CACHE_FILE           "ahs_devices.cache"
+
+// Number of timed steps of the calibration, after a first untimed one
+#define CALIBRATION_STEPS           3
+
+// Value of an environment variable, or an empty string if it is not defined
+std::string read_environment(const char* name);
+
+// Path of a cache file, in the directory given by AHS_CACHE_DIR or in the working directory
+std::string cache_file_path(const std::string& filename);
+
+// Name of a device as shown in the listing, including its platform
+std::string device_full_name(cl::Device& device);
+
+// Index of the device selected by a 1-based index or by a case-insensitive part of its name
+size_t find_device(cl::vector<cl::Device>& devices, const std::string& selection);
+
+// Devices of the multi-device backend, given by the DEVICES setting: all the devices of all the
+// platforms, the CPU devices split in a sub-device for each NUMA node, or a comma-separated list of
+// 1-based indices of the listing of all the devices
+cl::vector<cl::Device> select_devices(const std::string& selection);
+
+// Index of the fastest device for a system of num_parts particles. The result is looked up in the
+// cache of the host first, and the devices are calibrated only if it is missing.
+size_t auto_select_device(cl::vector<cl::Device>& devices, cl_device_type device_type, size_t num_parts);
+
+// Seconds taken on the device by the workload of the run, with the kernels and the launch shapes it
+// uses: a step of the full-scan loop or of the on-device batch, that is a position update and the
+// search of the next collision between particles with the configured PAIR_LAUNCH, or an event of
+// all the replicas of the ensemble
+double calibrate_device(cl::Device& device, size_t num_parts);
@@ -0,0 +1,85 @@
+// Kernels of the multi-device backend. This source is built together with part_collision.cl.
+// Each device holds the particles of a slab of the box along the x axis and of its halo, in local
+// arrays. The particles are identified across the devices by their global index, held in gidx,
+// and each couple by the index of the global square matrix of the couples, so that the minimum
+// searches break the ties as on a single device.
+
+// Collision times of the local couples, with the first step of the minimum search as in
+// part_collision_argmin. Each couple is counted once, when the global index of the first particle
+// is the lowest.
+__kernel void domain_part_collision(__global const double* pos,
+									__global const double* vel,
+									__global const double* radii,
+									__global const ulong* gidx,
+									const ulong num_local,
+									const ulong stride,
+									const ulong num_parts,
+									__global double* out_values,
+									__global ulong* out_indices,
+									__local double* loc_values,
+									__local ulong* loc_indices)
+{
+	double best = INFINITY;
+	ulong best_idx = ULONG_MAX;
+	ulong count = num_local * num_local;
+	for (ulong k = get_global_id(0); k < count; k += get_global_size(0))
+	{
+		ulong a = k / num_local;
+		ulong b = k % num_local;
+		if (gidx[a] < gidx[b])
+			argmin_update(&best, &best_idx, pair_collision_time(pos, vel, radii, stride, a, b), gidx[a] * num_parts + gidx[b]);
+	}
+
+	argmin_group(best, best_idx, loc_values, loc_indices, out_values, out_indices);
+}
+
+// Same as domain_part_collision, but only for the couples of the local particle a
+__kernel void domain_particle_collision(__global const double* pos,
+										__global const double* vel,
+										__global const double* radii,
+										__global const ulong* gidx,
+										const ulong num_local,
+										const ulong stride,
+										const ulong num_parts,
+										const ulong a,
+										__global double* out_values,
+										__global ulong* out_indices,
+										__local double* loc_values,
+										__local ulong* loc_indices)
+{
+	double best = INFINITY;
+	ulong best_idx = ULONG_MAX;
+	for (ulong b = get_global_id(0); b < num_local; b += get_global_size(0))
+	{
+		if (b == a)
+			continue;
+		ulong k = gidx[a] < gidx[b] ? gidx[a] * num_parts + gidx[b] : gidx[b] * num_parts + gidx[a];
+		argmin_update(&best, &best_idx, pair_collision_time(pos, vel, radii, stride, a, b), k);
+	}
+
+	argmin_group(best, best_idx, loc_values, loc_indices, out_values, out_indices);
+}
+
+// Time at which each local particle crosses the next boundary of the regions in the direction of its
+// velocity along x. The particles of region r lie between boundaries[r - 1] and boundaries[r], and the
+// first and last regions are unbounded.
+__kernel void domain_crossing(__global const double* pos,
+							  __global const double* vel,
+							  __global const ulong* region,
+							  __global const double* boundaries,
+							  const ulong num_boundaries,
+							  const ulong num_local,
+							  __global double* delta_times)
+{
+	ulong a = get_global_id(0);
+	if (a < num_local)
+	{
+		ulong r = region[a];
+		double delta_time = INFINITY;
+		if (vel[a] > 0 && r < num_boundaries)
+			delta_time = (boundaries[r] - pos[a]) / vel[a];
+		else if (vel[a] < 0 && r > 0)
+			delta_time = (boundaries[r - 1] - pos[a]) / vel[a];
+		delta_times[a] = delta_time;
+	}
+}
@@ -0,0 +1,35 @@
+# Generates kernel_sources.h, which embeds the kernel sources in the executable so that it does not
+# depend on the working directory. Run it from any directory after changing a .cl file.
+import os
+
+KERNELS = [
+    ("pos_update_source", "pos_update.cl"),
+    ("wall_collision_source", "wall_collision.cl"),
+    ("part_collision_source", "part_collision.cl"),
+    ("inelastic_batch_source", "inelastic_batch.cl"),
+    ("domain_source", "domain.cl"),
+]
+
+# Delimiter of the raw string literals, which must not appear in the sources
+DELIMITER = "CL"
+
+directory = os.path.dirname(os.path.abspath(__file__))
+lines = [
+    "#pragma once",
+    "",
+    "// Generated by embed_kernels.py from the kernel sources: do not edit, run the script again.",
+    "// Each line of a source is a raw string literal, so that none exceeds the limits of the compilers.",
+]
+for name, filename in KERNELS:
+    with open(os.path.join(directory, filename), "r", newline="") as source:
+        text = source.read().replace("\r\n", "\n")
+    if (")" + DELIMITER + '"') in text:
+        raise SystemExit(filename + " contains the delimiter of the raw string literals")
+    lines.append("")
+    lines.append("static const char " + name + "[] =")
+    for line in text.splitlines():
+        lines.append('    R"' + DELIMITER + "(" + line + ")" + DELIMITER + '" "\\n"')
+    lines.append("    ;")
+
+with open(os.path.join(directory, "kernel_sources.h"), "w", newline="\n") as header:
+    header.write("\n".join(lines) + "\n")
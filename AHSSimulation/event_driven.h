@@ -0,0 +1,12 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+
+// Event-driven simulation loop. Collisions are predicted once for all the particles,
+// then only the particles involved in a collision are predicted again.
+// The output has the same format of the loop of the given simulation type.
+void event_simulation_loop(cl_double* pos, cl_double* vel,
+                           cl_double* masses, cl_double* radii,
+                           cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                           size_t num_parts, cl_double e, cl_double max_time,
+                           size_t simtype, cl_double threshold);
@@ -0,0 +1,99 @@
+#include "event_queue.h"
+#include <math.h>
+
+
+EventQueue::EventQueue(size_t num_parts)
+{
+    reset(num_parts);
+}
+
+void EventQueue::reset(size_t num_parts)
+{
+    _queue = std::priority_queue<Event, std::vector<Event>, EventLater>();
+    _counts.assign(num_parts, 0);
+}
+
+void EventQueue::reserve(size_t num_parts)
+{
+    if (num_parts > _counts.size())
+        _counts.resize(num_parts, 0);
+}
+
+void EventQueue::push_part_collision(cl_double time, size_t i, size_t j)
+{
+    // Events that never happen are not worth storing
+    if (time == INFINITY)
+        return;
+
+    Event event;
+    event.time = time;
+    event.type = EVENT_TYPE_PART_COLLISION;
+    event.i = i;
+    event.j = j;
+    event.count_i = _counts[i];
+    event.count_j = _counts[j];
+    event.axis = 0;
+    _queue.push(event);
+}
+
+void EventQueue::push_wall_collision(cl_double time, size_t p, cl_int axis)
+{
+    if (time == INFINITY)
+        return;
+
+    Event event;
+    event.time = time;
+    event.type = EVENT_TYPE_WALL_COLLISION;
+    event.i = p;
+    event.j = p;
+    event.count_i = _counts[p];
+    event.count_j = _counts[p];
+    event.axis = axis;
+    _queue.push(event);
+}
+
+void EventQueue::push_cell_crossing(cl_double time, size_t p, cl_int axis)
+{
+    if (time == INFINITY)
+        return;
+
+    Event event;
+    event.time = time;
+    event.type = EVENT_TYPE_CELL_CROSSING;
+    event.i = p;
+    event.j = p;
+    event.count_i = _counts[p];
+    event.count_j = _counts[p];
+    event.axis = axis;
+    _queue.push(event);
+}
+
+bool EventQueue::pop(Event* event)
+{
+    if (_queue.empty())
+        return false;
+
+    *event = _queue.top();
+    _queue.pop();
+    return true;
+}
+
+void EventQueue::invalidate(size_t p)
+{
+    _counts[p]++;
+}
+
+bool EventQueue::is_owner_valid(const Event& event) const
+{
+    return _counts[event.i] == event.count_i;
+}
+
+bool EventQueue::is_valid(const Event& event) const
+{
+    return _counts[event.i] == event.count_i && _counts[event.j] == event.count_j;
+}
+
+size_t EventQueue::size() const
+{
+    return _queue.size();
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+#include <queue>
+#include <vector>
+
+#define EVENT_TYPE_PART_COLLISION   0
+#define EVENT_TYPE_WALL_COLLISION   1
+#define EVENT_TYPE_CELL_CROSSING    2
+
+// A predicted event. The event is owned by particle i, and it involves particle j
+// if it is a collision between particles. The collision counters of the particles
+// at prediction time are stored, so that stale events can be recognized.
+struct Event
+{
+    cl_double time;
+    int type;
+    size_t i;
+    size_t j;
+    size_t count_i;
+    size_t count_j;
+    cl_int axis;
+};
+
+struct EventLater
+{
+    bool operator()(const Event& e1, const Event& e2) const
+    {
+        return e1.time > e2.time;
+    }
+};
+
+class EventQueue
+{
+private:
+    std::priority_queue<Event, std::vector<Event>, EventLater> _queue;
+    std::vector<size_t> _counts;
+
+public:
+    EventQueue(size_t num_parts);
+
+    // Drop all the events and reset the collision counters
+    void reset(size_t num_parts);
+    // Make room for the counters of num_parts particles, keeping the events and the current counters.
+    // The counters of the indices freed by a removal are kept, so that the events left in the queue
+    // for them are still recognized as stale once invalidated.
+    void reserve(size_t num_parts);
+
+    void push_part_collision(cl_double time, size_t i, size_t j);
+    void push_wall_collision(cl_double time, size_t p, cl_int axis);
+    void push_cell_crossing(cl_double time, size_t p, cl_int axis);
+
+    // Pop the earliest event. Returns false if the queue is empty.
+    bool pop(Event* event);
+
+    // Invalidate all the events predicted for the given particle
+    void invalidate(size_t p);
+
+    // An event is still valid if its owner has not collided since the prediction
+    bool is_owner_valid(const Event& event) const;
+    // A collision between particles is still valid if neither particle has collided since the prediction
+    bool is_valid(const Event& event) const;
+
+    size_t size() const;
+};
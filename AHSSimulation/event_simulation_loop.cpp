@@ -0,0 +1,425 @@
+#include "event_driven.h"
+#include "event_queue.h"
+#include "cell_list.h"
+#include "inelastic.h"
+#include "fusion.h"
+#include "fission.h"
+#include "shared.h"
+#include "CLSettings.h"
+#include "trajectory.h"
+#include "checkpoint.h"
+
+#include <sstream>
+#include <stdio.h>
+#include <math.h>
+
+#include <iostream>
+
+#define MIN(x, y)       ((x) < (y) ? (x) : (y))
+#define MAX(x, y)       ((x) > (y) ? (x) : (y))
+
+
+// State of the system used by the predictions.
+// Each particle stores its position at the time of its own clock.
+struct EventState
+{
+    ParticleStore* parts;
+    cl_double* clocks;
+    cl_double* x_wall;
+    cl_double* y_wall;
+    cl_double* z_wall;
+    CellList* cells;
+    // Scratch space for the neighbours of a particle, reused by the predictions
+    std::vector<size_t> neighbours;
+};
+
+// Position of particle p at the given time
+static void position_at(EventState& state, size_t p, cl_double time, cl_double* p_pos)
+{
+    ParticleStore& parts = *state.parts;
+    cl_double dt = time - state.clocks[p];
+    p_pos[0] = parts.x[p] + dt * parts.vx[p];
+    p_pos[1] = parts.y[p] + dt * parts.vy[p];
+    p_pos[2] = parts.z[p] + dt * parts.vz[p];
+}
+
+// Velocity of particle p
+static void velocity_of(EventState& state, size_t p, cl_double* p_vel)
+{
+    ParticleStore& parts = *state.parts;
+    p_vel[0] = parts.vx[p];
+    p_vel[1] = parts.vy[p];
+    p_vel[2] = parts.vz[p];
+}
+
+// Move particle p forward to the given time
+static void advance_particle(EventState& state, size_t p, cl_double time)
+{
+    ParticleStore& parts = *state.parts;
+    cl_double p_pos[3];
+    position_at(state, p, time, p_pos);
+    parts.x[p] = p_pos[0];
+    parts.y[p] = p_pos[1];
+    parts.z[p] = p_pos[2];
+    state.clocks[p] = time;
+}
+
+// Move all the particles forward to the given time
+static void advance_all(EventState& state, cl_double time)
+{
+    for (size_t p = 0; p < state.parts->num_parts(); p++)
+        advance_particle(state, p, time);
+}
+
+// Predict the earliest collision between particle p and the other particles.
+// If a cell list is given, only the particles in the neighbouring cells are checked.
+static void predict_part_events(EventQueue& queue, cl_double time, EventState& state, size_t p)
+{
+    std::vector<size_t>& neighbours = state.neighbours;
+    if (state.cells != NULL)
+        state.cells->get_neighbours(p, neighbours);
+
+    // Both particles are brought to the current time before solving the collision
+    cl_double* radii = state.parts->radius;
+    cl_double p_pos[3], p_vel[3], k_pos[3], k_vel[3];
+    position_at(state, p, time, p_pos);
+    velocity_of(state, p, p_vel);
+
+    size_t partner = p;
+    cl_double dt_part = INFINITY;
+    size_t num_candidates = state.cells != NULL ? neighbours.size() : state.parts->num_parts();
+    for (size_t n = 0; n < num_candidates; n++)
+    {
+        size_t k = state.cells != NULL ? neighbours[n] : n;
+        if (k == p)
+            continue;
+        position_at(state, k, time, k_pos);
+        velocity_of(state, k, k_vel);
+
+        cl_double dt = predict_part_collision(p_pos, p_vel, radii[p], k_pos, k_vel, radii[k]);
+        if (dt < dt_part)
+        {
+            dt_part = dt;
+            partner = k;
+        }
+    }
+    queue.push_part_collision(time + MAX(0, dt_part), p, partner);
+}
+
+// Predict the earliest collision between particle p and the walls
+static void predict_wall_events(EventQueue& queue, cl_double time, EventState& state, size_t p)
+{
+    cl_double p_pos[3], p_vel[3];
+    position_at(state, p, time, p_pos);
+    velocity_of(state, p, p_vel);
+
+    cl_int axis;
+    cl_double dt_wall = predict_wall_collision(p_pos, p_vel, state.parts->radius[p],
+                                               state.x_wall, state.y_wall, state.z_wall, &axis);
+    queue.push_wall_collision(time + MAX(0, dt_wall), p, axis);
+}
+
+// Predict the time particle p leaves its cell
+static void predict_crossing_events(EventQueue& queue, cl_double time, EventState& state, size_t p)
+{
+    if (state.cells == NULL)
+        return;
+
+    cl_double p_pos[3], p_vel[3];
+    position_at(state, p, time, p_pos);
+    velocity_of(state, p, p_vel);
+
+    cl_int axis;
+    cl_double dt_cross = state.cells->predict_crossing(p_pos, p_vel, p, &axis);
+    queue.push_cell_crossing(time + dt_cross, p, axis);
+}
+
+// Predict all the events of particle p
+static void predict_events(EventQueue& queue, cl_double time, EventState& state, size_t p)
+{
+    predict_part_events(queue, time, state, p);
+    predict_wall_events(queue, time, state, p);
+    predict_crossing_events(queue, time, state, p);
+}
+
+// Predict the events of all the particles, binning them again if a cell list is used.
+// All the particles must be at the given time.
+static void predict_all_events(EventQueue& queue, cl_double time, EventState& state)
+{
+    queue.reset(state.parts->num_parts());
+    if (state.cells != NULL)
+        state.cells->build(*state.parts, state.x_wall, state.y_wall, state.z_wall);
+    for (size_t p = 0; p < state.parts->num_parts(); p++)
+        predict_events(queue, time, state, p);
+}
+
+void event_simulation_loop(cl_double* pos, cl_double* vel,
+                           cl_double* masses, cl_double* radii,
+                           cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                           size_t num_parts, cl_double e, cl_double max_time,
+                           size_t simtype, cl_double threshold)
+{
+    // The setup of the run is saved by each checkpoint, and must match the one of the checkpoint resumed
+    Checkpoint setup;
+    setup.describe(simtype, e, max_time, x_wall, y_wall, z_wall, num_parts, masses, radii);
+    // When resuming, the state saved by the checkpoint replaces the input values
+    Checkpoint resume;
+    if (CLSettings::get_resume())
+    {
+        resume.load(CLSettings::get_checkpoint_file());
+        resume.check(setup);
+        pos = resume.positions.data();
+        vel = resume.velocities.data();
+        masses = resume.masses.data();
+        radii = resume.radii.data();
+        num_parts = resume.num_parts;
+        skip_fission_random_draws(resume.random_draws);
+    }
+    // Open the output file, written by a background thread
+    TrajectoryWriter out(CLSettings::get_output_file(), simtype, resume);
+    // Initialize the current time to zero, or to the time of the checkpoint
+    cl_double time = resume.time;
+    size_t num_events = resume.num_events;
+    CheckpointWriter checkpoints(num_events);
+    // Initialize the current state of the system from the input values
+    // The clocks follow the capacity of the store, so that they are reallocated only when it grows.
+    ParticleStore parts(pos, vel, masses, radii, num_parts);
+    size_t clocks_capacity = parts.capacity();
+    cl_double* curclocks = (cl_double*)calloc(clocks_capacity, sizeof(cl_double));
+    if (curclocks == NULL)
+    {
+        std::stringstream ss;
+        ss << "Some errors occurred while allocating memory in the simulation loop." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    // All the particles start at the initial time, the one of the checkpoint when resuming
+    for (size_t p = 0; p < parts.num_parts(); p++)
+        curclocks[p] = time;
+    // Output some informations about the system
+    if (resume.is_empty())
+        out.write_header(parts, e, max_time, x_wall, y_wall, z_wall);
+    else
+        std::cout << "Resuming from the checkpoint at time " << time << "." << std::endl;
+
+    // With delayed state, only the particles involved in an event are moved forward. All of them are
+    // moved only when the state is written to the output: the event log and the snapshots do it once
+    // in a while, so each event costs O(1), but the frames after each collision save the whole state
+    // after each step in time, so with them each event still costs O(N).
+    bool delayed = CLSettings::get_state_update() == STATE_UPDATE_DELAYED;
+
+    // Predict the first events for all the particles
+    std::cout << "Simulation of a system of " << num_parts
+              << " particles for " << max_time << " seconds." << std::endl;
+    CellList grid;
+    EventState state;
+    state.parts = &parts;
+    state.clocks = curclocks;
+    state.x_wall = x_wall;
+    state.y_wall = y_wall;
+    state.z_wall = z_wall;
+    state.cells = NULL;
+    if (CLSettings::get_broadphase() == BROADPHASE_CELL_LIST)
+        state.cells = &grid;
+    EventQueue queue(parts.num_parts());
+    predict_all_events(queue, time, state);
+    if (state.cells != NULL)
+        std::cout << "Particles binned in " << state.cells->num_cells() << " cells." << std::endl;
+
+    // Begin the simulation loop
+    Event event;
+    while (time < max_time && !out.is_full())
+    {
+        // Save the state once in a while, to resume the simulation if it is stopped. The events
+        // are then predicted again from the saved state, as when resuming, so that an interrupted
+        // simulation goes on exactly as the uninterrupted one.
+        if (checkpoints.is_due(num_events))
+        {
+            advance_all(state, time);
+            Checkpoint checkpoint = setup;
+            checkpoint.capture(time, num_events, parts);
+            out.checkpoint(checkpoint);
+            checkpoints.save(checkpoint, out);
+            predict_all_events(queue, time, state);
+        }
+        if (!queue.pop(&event))
+            break;
+
+        // Events predicted before the owner collided are stale
+        if (!queue.is_owner_valid(event))
+            continue;
+        // If only the partner has collided, the owner needs a new prediction
+        if (event.type == EVENT_TYPE_PART_COLLISION && !queue.is_valid(event))
+        {
+            predict_part_events(queue, time, state, event.i);
+            continue;
+        }
+        // Crossing a cell does not change the state of the system, but brings new neighbours.
+        // The predictions are still made from the time of the last collision.
+        if (event.type == EVENT_TYPE_CELL_CROSSING)
+        {
+            state.cells->cross(event.i, event.axis);
+            predict_part_events(queue, time, state, event.i);
+            predict_crossing_events(queue, time, state, event.i);
+            continue;
+        }
+        num_events++;
+
+        cl_double delta_time = MAX(0, event.time - time);
+
+        // If this step has seen an increment in time different from zero, then the system
+        // has changed after a static period, so we can save the current status.
+        // The event log saves the events instead, and the whole state once in a while.
+        if (out.is_event_log())
+        {
+            if (out.needs_keyframe())
+            {
+                advance_all(state, time);
+                out.write_keyframe(time, parts);
+            }
+        }
+        else if (out.is_sampling())
+        {
+            if (out.sample_due(event.time))
+            {
+                advance_all(state, time);
+                out.write_samples(time, event.time, parts);
+            }
+        }
+        else if (delta_time > 0 || simtype == SIMULATION_TYPE_FUSION)
+        {
+            // A frame holds all the particles, so it needs them all at the current time
+            advance_all(state, time);
+            out.write_frame(time, parts);
+        }
+
+        // Move the particles to the time of the event
+        time += delta_time;
+        if (delayed)
+        {
+            advance_particle(state, event.i, time);
+            advance_particle(state, event.j, time);
+        }
+        else
+            advance_all(state, time);
+
+        // Resolve a collision with a wall
+        if (event.type == EVENT_TYPE_WALL_COLLISION)
+        {
+            cl_double coll_axis[3];
+            axis_to_vector(event.axis, coll_axis);
+            resolve_wall_collision(parts, event.i, coll_axis);
+            if (out.is_event_log())
+                out.log_wall_collision(time, parts, event.i);
+
+            queue.invalidate(event.i);
+            predict_events(queue, time, state, event.i);
+            continue;
+        }
+
+        // Resolve a collision between particles
+        size_t prev_num_parts = parts.num_parts();
+        size_t last = prev_num_parts - 1;
+        if (simtype == SIMULATION_TYPE_INELSATIC)
+            resolve_inelastic_part_collision(parts, e, event.i, event.j);
+        else
+        {
+            // The last particle may be moved to the index of a fused one, so it must share the same clock
+            advance_particle(state, last, time);
+
+            if (simtype == SIMULATION_TYPE_FUSION)
+                resolve_fusion_part_collision(parts, e, event.i, event.j, threshold);
+            else
+                resolve_fission_part_collision(parts, e, event.i, event.j, threshold);
+        }
+        if (out.is_event_log())
+            out.log_part_collision(time, parts, event.i, event.j, prev_num_parts);
+
+        // After a fusion, the new particle is at the lower index and the last particle has been moved
+        // to the higher one. Only these two need new predictions, unless the new particle is too
+        // large for the cells.
+        if (parts.num_parts() < prev_num_parts)
+        {
+            size_t q = MIN(event.i, event.j);
+            size_t r = MAX(event.i, event.j);
+            cl_double q_pos[3] = { parts.x[q], parts.y[q], parts.z[q] };
+            state.clocks[q] = time;
+            state.clocks[r] = time;
+            if (state.cells != NULL && !state.cells->fits(parts.radius[q]))
+            {
+                advance_all(state, time);
+                predict_all_events(queue, time, state);
+                continue;
+            }
+            if (state.cells != NULL)
+            {
+                state.cells->remove(r);
+                state.cells->rebin(q, q_pos);
+            }
+
+            queue.invalidate(q);
+            queue.invalidate(r);
+            queue.invalidate(last);
+            predict_events(queue, time, state, q);
+            if (r < parts.num_parts())
+                predict_events(queue, time, state, r);
+            continue;
+        }
+        // After a fission, the broken particle has moved and the new one has been appended
+        if (parts.num_parts() > prev_num_parts)
+        {
+            if (parts.capacity() > clocks_capacity)
+            {
+                clocks_capacity = parts.capacity();
+                state.clocks = (cl_double*)realloc(state.clocks, clocks_capacity * sizeof(cl_double));
+                if (state.clocks == NULL)
+                {
+                    std::stringstream ss;
+                    ss << "Some errors occurred while allocating memory in the simulation loop." << std::endl;
+                    throw std::runtime_error(ss.str());
+                }
+            }
+            size_t n = parts.num_parts() - 1;
+            state.clocks[n] = time;
+            if (state.cells != NULL)
+            {
+                cl_double i_pos[3] = { parts.x[event.i], parts.y[event.i], parts.z[event.i] };
+                cl_double j_pos[3] = { parts.x[event.j], parts.y[event.j], parts.z[event.j] };
+                cl_double n_pos[3] = { parts.x[n], parts.y[n], parts.z[n] };
+                state.cells->rebin(event.i, i_pos);
+                state.cells->rebin(event.j, j_pos);
+                state.cells->append(n_pos);
+            }
+
+            queue.reserve(parts.num_parts());
+            queue.invalidate(event.i);
+            queue.invalidate(event.j);
+            queue.invalidate(n);
+            predict_events(queue, time, state, event.i);
+            predict_events(queue, time, state, event.j);
+            predict_events(queue, time, state, n);
+            continue;
+        }
+
+        // Otherwise, only the two particles involved need new predictions
+        queue.invalidate(event.i);
+        queue.invalidate(event.j);
+        predict_events(queue, time, state, event.i);
+        predict_events(queue, time, state, event.j);
+    }
+
+    // With no events left, the particles move freely until the time horizon
+    if (out.sample_due(INFINITY))
+    {
+        advance_all(state, time);
+        out.write_samples(time, INFINITY, parts);
+    }
+
+    // Write the pending output and close the file
+    checkpoints.finish();
+    out.close();
+    std::cout << out.summary() << std::endl;
+
+    free(state.clocks);
+
+    std::cout << "Simulation terminated after " << num_events << " events." << std::endl;
+}
@@ -1,14 +1,20 @@
 #pragma once
 
 #include <CL/cl2.hpp>
+#include "backend.h"
+#include "particle_store.h"
 
-void resolve_fission_part_collision(cl_double* pos, cl_double* vel, cl_double* masses, cl_double* radii,
-                                    size_t num_parts, cl_double e, size_t i, size_t j, cl_double fusion_thresh,
-                                    cl_double** endpos, cl_double** endvel,
-                                    cl_double** endmasses, cl_double** endradii,
-                                    size_t* endparts);
+// The particles are updated in place. The broken particle keeps its index, and the new
+// particle is appended at the end.
+void resolve_fission_part_collision(ParticleStore& parts, cl_double e, size_t i, size_t j, cl_double fusion_thresh);
+
+// The fissions draw from rand(). The number of draws made so far is saved by the checkpoints, and
+// skipped when resuming, so that the generator continues from the same state.
+size_t fission_random_draws();
+void skip_fission_random_draws(size_t num_draws);
 
 void fission_simulation_loop(cl_double* pos, cl_double* vel,
                              cl_double* masses, cl_double* radii,
                              cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
-                             size_t num_parts, cl_double e, cl_double max_time, cl_double fusion_thresh);
\ No newline at end of file
+                             size_t num_parts, cl_double e, cl_double max_time, cl_double fusion_thresh,
+                             Backend& backend);
\ No newline at end of file
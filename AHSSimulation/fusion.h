@@ -1,14 +1,15 @@
 #pragma once
 
 #include <CL/cl2.hpp>
+#include "backend.h"
+#include "particle_store.h"
 
-void resolve_fusion_part_collision(cl_double* pos, cl_double* vel, cl_double* masses, cl_double* radii,
-                                   size_t num_parts, cl_double e, size_t i, size_t j, cl_double fusion_thresh,
-                                   cl_double** endpos, cl_double** endvel, 
-                                   cl_double** endmasses, cl_double** endradii,
-                                   size_t* endparts);
+// The particles are updated in place. The new particle takes the index MIN(i, j), and the
+// particle at index MAX(i, j) is removed, moving the last particle into its place.
+void resolve_fusion_part_collision(ParticleStore& parts, cl_double e, size_t i, size_t j, cl_double fusion_thresh);
 
 void fusion_simulation_loop(cl_double* pos, cl_double* vel,
                             cl_double* masses, cl_double* radii,
                             cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
-                            size_t num_parts, cl_double e, cl_double max_time, cl_double fusion_thresh);
\ No newline at end of file
+                            size_t num_parts, cl_double e, cl_double max_time, cl_double fusion_thresh,
+                            Backend& backend);
\ No newline at end of file
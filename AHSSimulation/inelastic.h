@@ -1,12 +1,63 @@
 #pragma once
 
 #include <CL/cl2.hpp>
+#include "backend.h"
+#include "particle_store.h"
+#include <string>
+#include <vector>
 
-void resolve_inelastic_part_collision(cl_double* pos, cl_double* vel, cl_double* masses,
-                                      size_t num_parts, cl_double e,
-                                      size_t i, size_t j);
+void resolve_inelastic_part_collision(ParticleStore& parts, cl_double e, size_t i, size_t j);
 
 void inelastic_simulation_loop(cl_double* pos, cl_double* vel,
                                cl_double* masses, cl_double* radii,
                                cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
-                               size_t num_parts, cl_double e, cl_double max_time);
\ No newline at end of file
+                               size_t num_parts, cl_double e, cl_double max_time,
+                               Backend& backend);
+
+// Clock of the system on the device. Must match batch_clock in inelastic_batch.cl.
+struct BatchClock
+{
+    cl_double time;
+    cl_ulong count;
+    cl_ulong done;
+};
+
+// Types of the events resolved on the device. Must match inelastic_batch.cl.
+#define BATCH_EVENT_PART_COLLISION  0
+#define BATCH_EVENT_WALL_COLLISION  1
+
+// An event resolved on the device. Must match batch_record in inelastic_batch.cl.
+struct BatchRecord
+{
+    cl_double time;
+    cl_double delta_time;
+    cl_ulong type;
+    cl_ulong i;
+    cl_ulong j;
+    cl_double vel_i[3];
+    cl_double vel_j[3];
+};
+
+// Same as inelastic_simulation_loop, but the events are found and resolved on the device,
+// in batches of CLSettings::get_batch_size() events per round trip with the host
+void inelastic_batch_simulation_loop(cl_double* pos, cl_double* vel,
+                                     cl_double* masses, cl_double* radii,
+                                     cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                                     size_t num_parts, cl_double e, cl_double max_time);
+// A replica of an ensemble: its initial state, in the interleaved layout, its elasticity coefficient
+// and the file of its output
+struct EnsembleReplica
+{
+    cl_double* pos;
+    cl_double* vel;
+    cl_double e;
+    std::string output_file;
+};
+
+// Run an ensemble of inelastic systems with the same particles, walls and time horizon, as
+// inelastic_batch_simulation_loop would run each of them. All the replicas are advanced by the same
+// kernel launches, with a work-group per replica, and each one writes its own output.
+void ensemble_simulation_loop(std::vector<EnsembleReplica>& replicas,
+                              cl_double* masses, cl_double* radii,
+                              cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                              size_t num_parts, cl_double max_time);
@@ -0,0 +1,417 @@
+// Kernels of the on-device inelastic loop. This source is built together with part_collision.cl.
+// Each event is processed by inelastic_select, inelastic_advance and inelastic_resolve, after
+// the searches for the next wall and particle collisions, without any intervention of the host.
+
+#define BATCH_EVENT_PART_COLLISION	0
+#define BATCH_EVENT_WALL_COLLISION	1
+
+// Uniform mass baked by the build options (see CLRuntime::specialize)
+#ifdef AHS_UNIFORM_MASS
+#define MASS(masses, i)			(AHS_UNIFORM_MASS)
+#else
+#define MASS(masses, i)			((masses)[i])
+#endif
+
+// Clock of the system, shared by all the events of the batches.
+// Must match the BatchClock structure of the host.
+typedef struct
+{
+	double time;
+	ulong count;
+	ulong done;
+} batch_clock;
+
+// An event resolved on the device, with the velocities of the particles after the resolution.
+// For a collision with a wall, j is equal to i. Must match the BatchRecord structure of the host.
+typedef struct
+{
+	double time;
+	double delta_time;
+	ulong type;
+	ulong i;
+	ulong j;
+	double vel_i[3];
+	double vel_j[3];
+} batch_record;
+
+// Choose between the results of the two minimum searches and fill the time step, type and particles
+// of the event. The particle search is indexed as enumerated by the launch given by triangular.
+// Returns 0 without filling the event if neither collision will ever happen.
+inline int select_event(double wall_value,
+						ulong wall_index,
+						double part_value,
+						ulong part_index,
+						ulong num_parts,
+						int triangular,
+						batch_record* event)
+{
+	if (!isfinite(fmin(wall_value, part_value)))
+		return 0;
+
+	if (wall_value < part_value)
+	{
+		event->delta_time = wall_value;
+		event->type = BATCH_EVENT_WALL_COLLISION;
+		event->i = wall_index < num_parts ? wall_index : 0;
+		event->j = event->i;
+		return 1;
+	}
+
+	event->delta_time = part_value;
+	event->type = BATCH_EVENT_PART_COLLISION;
+	ulong k = part_index;
+	ulong count = triangular ? num_parts * (num_parts - 1) / 2 : num_parts * num_parts;
+	if (num_parts < 2 || k >= count)
+	{
+		event->i = 0;
+		event->j = 0;
+	}
+	else if (triangular)
+	{
+		double n = num_parts - 0.5;
+		ulong i = (ulong)(n - sqrt(fmax(0.0, n * n - 2.0 * k)));
+		if (i > num_parts - 2)
+			i = num_parts - 2;
+		while (i > 0 && triangle_row_start(i, num_parts) > k)
+			i--;
+		while (i < num_parts - 2 && triangle_row_start(i + 1, num_parts) <= k)
+			i++;
+		event->i = i;
+		event->j = k - triangle_row_start(i, num_parts) + i + 1;
+	}
+	else
+	{
+		event->i = k / num_parts;
+		event->j = k % num_parts;
+	}
+	return 1;
+}
+
+// Select the next event with select_event.
+// Once the time horizon is reached, or if no collision will ever happen, as the full-scan loop
+// stops, the clock is marked as done, and all the following steps do nothing.
+__kernel void inelastic_select(__global const double* wall_value,
+							   __global const ulong* wall_index,
+							   __global const double* part_value,
+							   __global const ulong* part_index,
+							   const ulong num_parts,
+							   const int triangular,
+							   const double max_time,
+							   __global batch_clock* clock,
+							   __global batch_record* event)
+{
+	if (get_global_id(0) != 0)
+		return;
+
+	batch_record selected;
+	if (clock->done || clock->time >= max_time ||
+		!select_event(wall_value[0], wall_index[0], part_value[0], part_index[0], num_parts, triangular, &selected))
+	{
+		clock->done = 1;
+		event->delta_time = 0;
+		return;
+	}
+	event->delta_time = selected.delta_time;
+	event->type = selected.type;
+	event->i = selected.i;
+	event->j = selected.j;
+}
+
+// Same as pos_update, but the time step is read from the selected event
+__kernel void inelastic_advance(__global const double* pos,
+								__global const double* vel,
+								const ulong num_parts,
+								const ulong stride,
+								__global const batch_record* event,
+								__global double* out_pos)
+{
+	int i = get_global_id(0);
+	if (i < NUM_PARTS(num_parts))
+	{
+		double delta_time = fmax(0.0, event->delta_time);
+		out_pos[i] = pos[i] + delta_time * vel[i];
+		out_pos[stride + i] = pos[stride + i] + delta_time * vel[stride + i];
+		out_pos[2 * stride + i] = pos[2 * stride + i] + delta_time * vel[2 * stride + i];
+	}
+}
+
+// Resolve an event as resolve_wall_collision and resolve_inelastic_part_collision do on the host,
+// then advance the clock and fill the time and the velocities of the record. For a collision with
+// a wall, axis is the one found by wall_collision for the particle.
+inline void resolve_event(__global const double* pos,
+						  __global double* vel,
+						  const ulong stride,
+						  __global const double* masses,
+						  const double e,
+						  const int axis,
+						  __global batch_clock* clock,
+						  batch_record* event)
+{
+	ulong i = event->i;
+	ulong j = event->j;
+	if (event->type == BATCH_EVENT_WALL_COLLISION)
+	{
+		// The collision inverts the component of the velocity along the axis
+		if (axis != 0)
+		{
+			int k = (axis > 0 ? axis : -axis) - 1;
+			vel[k * stride + i] = -vel[k * stride + i];
+		}
+	}
+	else
+	{
+		double pij[3], vij[3], inelastic[3], elastic[3];
+		for (int k = 0; k < 3; k++)
+		{
+			pij[k] = pos[k * stride + i] - pos[k * stride + j];
+			vij[k] = vel[k * stride + i] - vel[k * stride + j];
+		}
+
+		// Inelastic component
+		for (int k = 0; k < 3; k++)
+			inelastic[k] = (MASS(masses, i) * vel[k * stride + i] + MASS(masses, j) * vel[k * stride + j]) / (MASS(masses, i) + MASS(masses, j));
+
+		// Elastic component
+		double pvij = pij[0] * vij[0] + pij[1] * vij[1] + pij[2] * vij[2];
+		double pij_norm2 = pij[0] * pij[0] + pij[1] * pij[1] + pij[2] * pij[2];
+		for (int k = 0; k < 3; k++)
+			elastic[k] = e * (2 * pvij * pij[k] / pij_norm2 - vij[k]) / (MASS(masses, i) + MASS(masses, j));
+
+		// Update the velocities
+		for (int k = 0; k < 3; k++)
+		{
+			vel[k * stride + i] = inelastic[k] - MASS(masses, i) * elastic[k];
+			vel[k * stride + j] = inelastic[k] + MASS(masses, j) * elastic[k];
+		}
+	}
+
+	// Update the clock and complete the record
+	clock->time += fmax(0.0, event->delta_time);
+	event->time = clock->time;
+	for (int k = 0; k < 3; k++)
+	{
+		event->vel_i[k] = vel[k * stride + i];
+		event->vel_j[k] = vel[k * stride + j];
+	}
+}
+
+// Resolve the selected event, then append its record to the ring buffer
+__kernel void inelastic_resolve(__global const double* pos,
+								__global double* vel,
+								const ulong stride,
+								__global const double* masses,
+								const double e,
+								__global const int* wall_axis,
+								__global batch_clock* clock,
+								__global batch_record* event,
+								__global batch_record* ring,
+								const ulong ring_size)
+{
+	if (get_global_id(0) != 0 || clock->done)
+		return;
+
+	batch_record record = *event;
+	resolve_event(pos, vel, stride, masses, e, wall_axis[record.i], clock, &record);
+	*event = record;
+	ring[clock->count % ring_size] = record;
+	clock->count++;
+}
+
+
+
+// Time to the collision of particle i with a wall, and the axis of the wall, as found by wall_collision
+inline double wall_collision_time(__global const double* pos,
+								  __global const double* vel,
+								  __global const double* radii,
+								  ulong stride,
+								  __global const double* x_wall,
+								  __global const double* y_wall,
+								  __global const double* z_wall,
+								  ulong i,
+								  int* axis)
+{
+#ifdef AHS_CONSTANT_WALLS
+	const double x_min = AHS_X_WALL_MIN, x_max = AHS_X_WALL_MAX;
+	const double y_min = AHS_Y_WALL_MIN, y_max = AHS_Y_WALL_MAX;
+	const double z_min = AHS_Z_WALL_MIN, z_max = AHS_Z_WALL_MAX;
+#else
+	const double x_min = x_wall[0], x_max = x_wall[1];
+	const double y_min = y_wall[0], y_max = y_wall[1];
+	const double z_min = z_wall[0], z_max = z_wall[1];
+#endif
+
+	double x = INFINITY;
+	if (vel[i] > 0)
+		x = x_max - RADIUS(radii, i);
+	else if (vel[i] < 0)
+		x = x_min + RADIUS(radii, i);
+
+	double y = INFINITY;
+	if (vel[stride + i] > 0)
+		y = y_max - RADIUS(radii, i);
+	else if (vel[stride + i] < 0)
+		y = y_min + RADIUS(radii, i);
+
+	double z = INFINITY;
+	if (vel[2 * stride + i] > 0)
+		z = z_max - RADIUS(radii, i);
+	else if (vel[2 * stride + i] < 0)
+		z = z_min + RADIUS(radii, i);
+
+	double delta_x = (x - pos[i]) / vel[i];
+	double delta_y = (y - pos[stride + i]) / vel[stride + i];
+	double delta_z = (z - pos[2 * stride + i]) / vel[2 * stride + i];
+
+	double delta_time = delta_x;
+	*axis = vel[i] < 0 ? -1 : 1;
+	if (delta_y < delta_time)
+	{
+		delta_time = delta_y;
+		*axis = vel[stride + i] < 0 ? -2 : 2;
+	}
+	if (delta_z < delta_time)
+	{
+		delta_time = delta_z;
+		*axis = vel[2 * stride + i] < 0 ? -3 : 3;
+	}
+	return delta_time;
+}
+
+// Reduce the values held by the work-group in local memory, as argmin_group does,
+// and give the result to all the work-items
+inline void argmin_local(double* best, ulong* best_idx,
+						 __local double* loc_values, __local ulong* loc_indices)
+{
+	int l = get_local_id(0);
+	loc_values[l] = *best;
+	loc_indices[l] = *best_idx;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int s = get_local_size(0) / 2; s > 0; s >>= 1)
+	{
+		if (l < s)
+		{
+			double value = loc_values[l];
+			ulong idx = loc_indices[l];
+			argmin_update(&value, &idx, loc_values[l + s], loc_indices[l + s]);
+			loc_values[l] = value;
+			loc_indices[l] = idx;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	*best = loc_values[0];
+	*best_idx = loc_indices[0];
+	// The local memory can be reused only once everyone has read the result
+	barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+// Process up to batch_size events of each replica of an ensemble, that is of systems with the same
+// particles and walls but their own state and elasticity coefficient. Each replica is run by a
+// work-group, the replica index being the group index along the second dimension, so that a single
+// launch advances all of them. The events are found and resolved exactly as by the kernels above.
+// The replica r has its positions and velocities at 3 * r * stride, planar with the given stride,
+// and its clock at clocks[r]. The record of its c-th event is written at
+// (((c / batch_size) % 2) * num_replicas + r) * batch_size + c % batch_size, so that the records of
+// a batch of all the replicas are contiguous, and the batches alternate between two halves.
+__kernel void ensemble_batch(__global double* pos,
+							 __global double* vel,
+							 __global const double* radii,
+							 __global const double* masses,
+							 const ulong num_parts,
+							 const ulong stride,
+							 __global const double* x_wall,
+							 __global const double* y_wall,
+							 __global const double* z_wall,
+							 __global const double* elastic_coeffs,
+							 const double max_time,
+							 const ulong batch_size,
+							 __global batch_clock* clocks,
+							 __global batch_record* ring,
+							 __local double* loc_values,
+							 __local ulong* loc_indices)
+{
+	ulong r = get_group_id(1);
+	ulong num_replicas = get_num_groups(1);
+	ulong n = NUM_PARTS(num_parts);
+	ulong l = get_local_id(0);
+	ulong size = get_local_size(0);
+	__global double* p = pos + 3 * r * stride;
+	__global double* v = vel + 3 * r * stride;
+	__global batch_clock* clock = clocks + r;
+
+	for (ulong b = 0; b < batch_size; b++)
+	{
+		// Only the first work-item changes the clock, and only after the barrier
+		int finished = clock->done || clock->time >= max_time;
+		barrier(CLK_GLOBAL_MEM_FENCE);
+		if (finished)
+		{
+			if (l == 0)
+				clock->done = 1;
+			return;
+		}
+
+		// Next collision with a wall, indexed by particle
+		double wall_value = INFINITY;
+		ulong wall_index = ULONG_MAX;
+		for (ulong i = l; i < n; i += size)
+		{
+			int axis;
+			argmin_update(&wall_value, &wall_index, wall_collision_time(p, v, radii, stride, x_wall, y_wall, z_wall, i, &axis), i);
+		}
+		argmin_local(&wall_value, &wall_index, loc_values, loc_indices);
+
+		// Next collision between particles, indexed as in part_collision_argmin
+		double part_value = INFINITY;
+		ulong part_index = ULONG_MAX;
+		for (ulong k = l; k < n * n; k += size)
+		{
+			ulong i = k / n;
+			ulong j = k % n;
+			if (i < j)
+				argmin_update(&part_value, &part_index, pair_collision_time(p, v, radii, stride, i, j), k);
+		}
+		argmin_local(&part_value, &part_index, loc_values, loc_indices);
+
+		// Select the event as inelastic_select does. The time step is shared through the local memory.
+		// If no collision will ever happen, the replica is done and the particles stay still.
+		batch_record event;
+		int axis = 0;
+		if (l == 0)
+		{
+			if (select_event(wall_value, wall_index, part_value, part_index, n, 0, &event))
+			{
+				if (event.type == BATCH_EVENT_WALL_COLLISION)
+					wall_collision_time(p, v, radii, stride, x_wall, y_wall, z_wall, event.i, &axis);
+				loc_values[0] = event.delta_time;
+			}
+			else
+			{
+				clock->done = 1;
+				loc_values[0] = 0;
+			}
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		// Advance the particles as inelastic_advance does
+		double delta_time = fmax(0.0, loc_values[0]);
+		for (ulong i = l; i < n; i += size)
+		{
+			p[i] = p[i] + delta_time * v[i];
+			p[stride + i] = p[stride + i] + delta_time * v[stride + i];
+			p[2 * stride + i] = p[2 * stride + i] + delta_time * v[2 * stride + i];
+		}
+		barrier(CLK_GLOBAL_MEM_FENCE | CLK_LOCAL_MEM_FENCE);
+
+		// Resolve the event and record it
+		if (l == 0 && !clock->done)
+		{
+			resolve_event(p, v, stride, masses, elastic_coeffs[r], axis, clock, &event);
+			ulong c = clock->count;
+			ring[(((c / batch_size) % 2) * num_replicas + r) * batch_size + c % batch_size] = event;
+			clock->count++;
+		}
+		barrier(CLK_GLOBAL_MEM_FENCE);
+	}
+}
@@ -0,0 +1,502 @@
+#include "inelastic.h"
+#include "shared.h"
+#include "CLSettings.h"
+#include "trajectory.h"
+#include "CLRuntime.h"
+#include "thread_pool.h"
+
+#include <sstream>
+#include <stddef.h>
+#include <stdio.h>
+#include <vector>
+
+#include <iostream>
+
+#define MIN(x, y)       ((x) < (y) ? (x) : (y))
+#define MAX(x, y)       ((x) > (y) ? (x) : (y))
+
+// Buffers used only by the on-device loop
+struct BatchBuffers
+{
+    cl::Buffer masses;
+    cl::Buffer clock;
+    cl::Buffer event;
+    cl::Buffer ring;
+    cl::Buffer wall_value;
+    cl::Buffer wall_index;
+};
+
+// Host copy of the results of a batch. The positions are planar, with the stride of the device.
+struct BatchStage
+{
+    std::vector<BatchRecord> records;
+    BatchClock clock;
+    std::vector<cl_double> pos;
+    cl::Event ready;
+};
+
+// Enqueue the processing of batch_size events, writing their records in the half of the ring
+// buffer selected by the parity of the batch. Nothing is waited for.
+static void enqueue_batch(BatchBuffers& buffers, size_t num_parts, cl_double e, cl_double max_time,
+                          size_t batch_size)
+{
+    cl::CommandQueue& queue = CLRuntime::get_queue();
+    cl::Kernel& select_kernel = CLRuntime::get_inelastic_select_kernel();
+    cl::Kernel& advance_kernel = CLRuntime::get_inelastic_advance_kernel();
+    cl::Kernel& resolve_kernel = CLRuntime::get_inelastic_resolve_kernel();
+    cl_int triangular = CLSettings::get_pair_launch() == PAIR_LAUNCH_TRIANGULAR;
+
+    for (size_t n = 0; n < batch_size; n++)
+    {
+        cl_int status = CL_SUCCESS;
+
+        // The wall collision is kept aside, since the particle search reuses the argmin buffers
+        size_t w = enqueue_next_wall_collision(num_parts);
+        status |= queue.enqueueCopyBuffer(CLRuntime::get_argmin_values(w), buffers.wall_value, 0, 0, sizeof(cl_double));
+        status |= queue.enqueueCopyBuffer(CLRuntime::get_argmin_indices(w), buffers.wall_index, 0, 0, sizeof(cl_ulong));
+        size_t p = enqueue_next_part_collision(num_parts);
+
+        status |= select_kernel.setArg(0, buffers.wall_value);
+        status |= select_kernel.setArg(1, buffers.wall_index);
+        status |= select_kernel.setArg(2, CLRuntime::get_argmin_values(p));
+        status |= select_kernel.setArg(3, CLRuntime::get_argmin_indices(p));
+        status |= select_kernel.setArg(4, num_parts);
+        status |= select_kernel.setArg(5, triangular);
+        status |= select_kernel.setArg(6, max_time);
+        status |= select_kernel.setArg(7, buffers.clock);
+        status |= select_kernel.setArg(8, buffers.event);
+
+        status |= advance_kernel.setArg(0, CLRuntime::get_positions());
+        status |= advance_kernel.setArg(1, CLRuntime::get_velocities());
+        status |= advance_kernel.setArg(2, num_parts);
+        status |= advance_kernel.setArg(3, CLRuntime::get_stride());
+        status |= advance_kernel.setArg(4, buffers.event);
+        status |= advance_kernel.setArg(5, CLRuntime::get_next_positions());
+        if (status != CL_SUCCESS)
+        {
+            std::stringstream ss;
+            ss << "Errors occurred while enqueueing the selection of an event on the OpenCL device." << std::endl;
+            throw std::runtime_error(ss.str());
+        }
+        queue.enqueueNDRangeKernel(select_kernel, cl::NullRange, cl::NDRange(1), cl::NullRange);
+        queue.enqueueNDRangeKernel(advance_kernel, cl::NullRange, cl::NDRange(num_parts), cl::NullRange);
+        CLRuntime::swap_positions();
+
+        status = resolve_kernel.setArg(0, CLRuntime::get_positions());
+        status |= resolve_kernel.setArg(1, CLRuntime::get_velocities());
+        status |= resolve_kernel.setArg(2, CLRuntime::get_stride());
+        status |= resolve_kernel.setArg(3, buffers.masses);
+        status |= resolve_kernel.setArg(4, e);
+        status |= resolve_kernel.setArg(5, CLRuntime::get_wall_axis());
+        status |= resolve_kernel.setArg(6, buffers.clock);
+        status |= resolve_kernel.setArg(7, buffers.event);
+        status |= resolve_kernel.setArg(8, buffers.ring);
+        status |= resolve_kernel.setArg(9, (cl_ulong)(2 * batch_size));
+        if (status != CL_SUCCESS)
+        {
+            std::stringstream ss;
+            ss << "Errors occurred while enqueueing the resolution of an event on the OpenCL device." << std::endl;
+            throw std::runtime_error(ss.str());
+        }
+        queue.enqueueNDRangeKernel(resolve_kernel, cl::NullRange, cl::NDRange(1), cl::NullRange);
+    }
+}
+
+// Enqueue the reads of the results of a batch, without waiting for them
+static void enqueue_drain(BatchBuffers& buffers, BatchStage& stage, size_t batch, size_t num_parts,
+                          size_t batch_size)
+{
+    cl::CommandQueue& queue = CLRuntime::get_queue();
+    size_t half = (batch % 2) * batch_size;
+    cl_int status = queue.enqueueReadBuffer(buffers.ring, CL_FALSE, half * sizeof(BatchRecord),
+                                            batch_size * sizeof(BatchRecord), stage.records.data());
+    status |= queue.enqueueReadBuffer(buffers.clock, CL_FALSE, 0, sizeof(BatchClock), &stage.clock);
+    status |= queue.enqueueReadBuffer(CLRuntime::get_positions(), CL_FALSE, 0, stage.pos.size() * sizeof(cl_double),
+                                      stage.pos.data(), NULL, &stage.ready);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while reading the results of a batch from OpenCL device memory." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+// Replay the events of a batch on the host copy of the state, writing the same output of the full
+// scan loop. The time is updated to the one of the last event replayed.
+static void replay_records(TrajectoryWriter& out, ParticleStore& parts, cl_double* time,
+                           const BatchRecord* records, size_t num_records)
+{
+    size_t num_parts = parts.num_parts();
+    for (size_t n = 0; n < num_records; n++)
+    {
+        const BatchRecord& record = records[n];
+
+        // If this step has seen an increment in time different from zero, then the system
+        // has changed after a static period, so we can save the current status.
+        // The event log saves the events instead, and the whole state once in a while.
+        if (out.is_event_log())
+        {
+            if (out.needs_keyframe())
+                out.write_keyframe(*time, parts);
+        }
+        else if (out.is_sampling())
+            out.write_samples(*time, record.time, parts);
+        else if (record.delta_time > 0)
+            out.write_frame(*time, parts);
+
+        cl_double delta_time = MAX(0, record.delta_time);
+        for (size_t k = 0; k < num_parts; k++)
+        {
+            parts.x[k] += delta_time * parts.vx[k];
+            parts.y[k] += delta_time * parts.vy[k];
+            parts.z[k] += delta_time * parts.vz[k];
+        }
+        parts.vx[record.i] = record.vel_i[0];
+        parts.vy[record.i] = record.vel_i[1];
+        parts.vz[record.i] = record.vel_i[2];
+        parts.vx[record.j] = record.vel_j[0];
+        parts.vy[record.j] = record.vel_j[1];
+        parts.vz[record.j] = record.vel_j[2];
+        *time = record.time;
+
+        if (out.is_event_log() && record.type == BATCH_EVENT_WALL_COLLISION)
+            out.log_wall_collision(*time, parts, record.i);
+        else if (out.is_event_log())
+            out.log_part_collision(*time, parts, record.i, record.j, num_parts);
+    }
+}
+
+void inelastic_batch_simulation_loop(cl_double* pos, cl_double* vel,
+                                     cl_double* masses, cl_double* radii,
+                                     cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                                     size_t num_parts, cl_double e, cl_double max_time)
+{
+    // Open the output file, written by a background thread
+    TrajectoryWriter out(CLSettings::get_output_file(), SIMULATION_TYPE_INELSATIC);
+    // Initialize the current time to zero
+    cl_double time = 0;
+    // The host keeps a copy of the state, replaying the events to write the output
+    ParticleStore parts(pos, vel, masses, radii, num_parts);
+
+    // Upload the state and create the buffers of the loop.
+    // The ring buffer holds two batches, one written by the device while the other is drained.
+    size_t batch_size = CLSettings::get_batch_size();
+    CLRuntime::initialize_inelastic_batch();
+    CLRuntime::write_state(parts);
+    CLRuntime::write_walls(x_wall, y_wall, z_wall);
+    BatchBuffers buffers;
+    buffers.masses = CLRuntime::create_buffer(CL_MEM_READ_ONLY, num_parts * sizeof(cl_double), "masses");
+    buffers.clock = CLRuntime::create_buffer(CL_MEM_READ_WRITE, sizeof(BatchClock), "clock");
+    buffers.event = CLRuntime::create_buffer(CL_MEM_READ_WRITE, sizeof(BatchRecord), "event");
+    buffers.ring = CLRuntime::create_buffer(CL_MEM_READ_WRITE, 2 * batch_size * sizeof(BatchRecord), "ring buffer");
+    buffers.wall_value = CLRuntime::create_buffer(CL_MEM_READ_WRITE, sizeof(cl_double), "wall collision");
+    buffers.wall_index = CLRuntime::create_buffer(CL_MEM_READ_WRITE, sizeof(cl_ulong), "wall collision");
+    BatchClock clock = { 0, 0, 0 };
+    cl::CommandQueue& queue = CLRuntime::get_queue();
+    cl_int status = queue.enqueueWriteBuffer(buffers.masses, CL_FALSE, 0, num_parts * sizeof(cl_double), parts.mass);
+    status |= queue.enqueueWriteBuffer(buffers.clock, CL_TRUE, 0, sizeof(BatchClock), &clock);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while writing buffers on OpenCL device memory for the on-device loop." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    BatchStage stages[2];
+    for (size_t s = 0; s < 2; s++)
+    {
+        stages[s].records.resize(batch_size);
+        stages[s].pos.resize(3 * parts.capacity());
+    }
+
+    // Output some informations about the system
+    out.write_header(parts, e, max_time, x_wall, y_wall, z_wall);
+
+    // Begin the simulation loop
+    std::cout << "Simulation of a system of " << num_parts
+              << " particles for " << max_time << " seconds." << std::endl;
+    size_t batch = 0;
+    enqueue_batch(buffers, num_parts, e, max_time, batch_size);
+    enqueue_drain(buffers, stages[0], 0, num_parts, batch_size);
+    queue.flush();
+    bool done = false;
+    while (!done)
+    {
+        // Keep the device busy with the next batch while this one is written
+        enqueue_batch(buffers, num_parts, e, max_time, batch_size);
+        enqueue_drain(buffers, stages[(batch + 1) % 2], batch + 1, num_parts, batch_size);
+        queue.flush();
+
+        BatchStage& stage = stages[batch % 2];
+        stage.ready.wait();
+        size_t num_records = stage.clock.count - batch * batch_size;
+        if (num_records > batch_size)
+            num_records = batch_size;
+
+        // Replay the events, writing the same output of the full scan loop
+        replay_records(out, parts, &time, stage.records.data(), num_records);
+
+        // The positions computed by the device replace the replayed ones, so that the
+        // rounding errors of the replay do not accumulate
+        std::memcpy(parts.x, stage.pos.data(), stage.pos.size() * sizeof(cl_double));
+
+        // The batches already enqueued are discarded once the maximum number of frames is written
+        done = stage.clock.done != 0 || out.is_full();
+        batch++;
+    }
+    queue.finish();
+
+    // With no events left, the particles move freely until the time horizon
+    out.write_samples(time, INFINITY, parts);
+
+    // Write the pending output and close the file
+    out.close();
+    std::cout << out.summary() << std::endl;
+
+    std::cout << "Simulation terminated." << std::endl;
+}
+
+
+// Buffers of the ensemble. The positions and velocities of the replicas are planar, one replica after
+// the other, with the stride of the host stores.
+struct EnsembleBuffers
+{
+    cl::Buffer pos;
+    cl::Buffer vel;
+    cl::Buffer radii;
+    cl::Buffer masses;
+    cl::Buffer elastic_coeffs;
+    cl::Buffer clocks;
+    cl::Buffer ring;
+};
+
+// Host copy of the results of a batch of all the replicas
+struct EnsembleStage
+{
+    std::vector<BatchRecord> records;
+    std::vector<BatchClock> clocks;
+    std::vector<cl_double> pos;
+    cl::Event ready;
+};
+
+// Enqueue the processing of batch_size events of each replica, in a single launch with a work-group
+// per replica. Nothing is waited for.
+static void enqueue_ensemble_batch(EnsembleBuffers& buffers, size_t num_replicas, size_t num_parts, size_t stride,
+                                   cl_double max_time, size_t batch_size, size_t group_size)
+{
+    cl::Kernel& kernel = CLRuntime::get_ensemble_batch_kernel();
+    cl_int status = kernel.setArg(0, buffers.pos);
+    status |= kernel.setArg(1, buffers.vel);
+    status |= kernel.setArg(2, buffers.radii);
+    status |= kernel.setArg(3, buffers.masses);
+    status |= kernel.setArg(4, (cl_ulong)num_parts);
+    status |= kernel.setArg(5, (cl_ulong)stride);
+    status |= kernel.setArg(6, CLRuntime::get_x_wall());
+    status |= kernel.setArg(7, CLRuntime::get_y_wall());
+    status |= kernel.setArg(8, CLRuntime::get_z_wall());
+    status |= kernel.setArg(9, buffers.elastic_coeffs);
+    status |= kernel.setArg(10, max_time);
+    status |= kernel.setArg(11, (cl_ulong)batch_size);
+    status |= kernel.setArg(12, buffers.clocks);
+    status |= kernel.setArg(13, buffers.ring);
+    status |= kernel.setArg(14, cl::Local(group_size * sizeof(cl_double)));
+    status |= kernel.setArg(15, cl::Local(group_size * sizeof(cl_ulong)));
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while setting the arguments of the OpenCL kernel for the ensemble." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    status = CLRuntime::get_queue().enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(group_size, num_replicas),
+                                                         cl::NDRange(group_size, 1));
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while enqueueing a batch of the ensemble on the OpenCL device." << std::endl;
+        ss << "Error code: " << status << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+// Enqueue the reads of the results of a batch of all the replicas, without waiting for them
+static void enqueue_ensemble_drain(EnsembleBuffers& buffers, EnsembleStage& stage, size_t batch, size_t batch_size)
+{
+    cl::CommandQueue& queue = CLRuntime::get_queue();
+    size_t half = (batch % 2) * stage.records.size();
+    cl_int status = queue.enqueueReadBuffer(buffers.ring, CL_FALSE, half * sizeof(BatchRecord),
+                                            stage.records.size() * sizeof(BatchRecord), stage.records.data());
+    status |= queue.enqueueReadBuffer(buffers.clocks, CL_FALSE, 0, stage.clocks.size() * sizeof(BatchClock),
+                                      stage.clocks.data());
+    status |= queue.enqueueReadBuffer(buffers.pos, CL_FALSE, 0, stage.pos.size() * sizeof(cl_double),
+                                      stage.pos.data(), NULL, &stage.ready);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while reading the results of a batch of the ensemble from OpenCL device memory." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+void ensemble_simulation_loop(std::vector<EnsembleReplica>& replicas,
+                              cl_double* masses, cl_double* radii,
+                              cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                              size_t num_parts, cl_double max_time)
+{
+    size_t num_replicas = replicas.size();
+    size_t batch_size = CLSettings::get_batch_size();
+
+    // The host keeps a copy of the state of each replica, replaying its events to write its output
+    std::vector<ParticleStore*> parts(num_replicas);
+    std::vector<TrajectoryWriter*> outs(num_replicas);
+    std::vector<cl_double> times(num_replicas, 0);
+    std::vector<char> finished(num_replicas, 0);
+    for (size_t r = 0; r < num_replicas; r++)
+    {
+        parts[r] = new ParticleStore(replicas[r].pos, replicas[r].vel, masses, radii, num_parts);
+        outs[r] = new TrajectoryWriter(replicas[r].output_file, SIMULATION_TYPE_INELSATIC);
+    }
+    size_t stride = parts[0]->capacity();
+
+    // The work-group of a replica is as wide as the ones of the minimum searches, if the kernel allows it
+    CLRuntime::initialize_inelastic_batch();
+    CLRuntime::write_walls(x_wall, y_wall, z_wall);
+    size_t group_size = CLRuntime::argmin_group_size();
+    size_t max_group_size = CLRuntime::get_ensemble_batch_kernel().getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(CLSettings::get_device());
+    while (group_size > max_group_size)
+        group_size /= 2;
+
+    // Upload the replicas and create the buffers of the loop.
+    // The ring buffer holds two batches of all the replicas, one written by the device while the other is drained.
+    EnsembleBuffers buffers;
+    buffers.pos = CLRuntime::create_buffer(CL_MEM_READ_WRITE, 3 * num_replicas * stride * sizeof(cl_double), "positions");
+    buffers.vel = CLRuntime::create_buffer(CL_MEM_READ_WRITE, 3 * num_replicas * stride * sizeof(cl_double), "velocities");
+    buffers.radii = CLRuntime::create_buffer(CL_MEM_READ_ONLY, num_parts * sizeof(cl_double), "radii");
+    buffers.masses = CLRuntime::create_buffer(CL_MEM_READ_ONLY, num_parts * sizeof(cl_double), "masses");
+    buffers.elastic_coeffs = CLRuntime::create_buffer(CL_MEM_READ_ONLY, num_replicas * sizeof(cl_double), "elasticity coefficients");
+    buffers.clocks = CLRuntime::create_buffer(CL_MEM_READ_WRITE, num_replicas * sizeof(BatchClock), "clocks");
+    buffers.ring = CLRuntime::create_buffer(CL_MEM_READ_WRITE, 2 * num_replicas * batch_size * sizeof(BatchRecord), "ring buffer");
+    std::vector<cl_double> elastic_coeffs(num_replicas);
+    std::vector<BatchClock> clocks(num_replicas);
+    cl::CommandQueue& queue = CLRuntime::get_queue();
+    cl_int status = CL_SUCCESS;
+    for (size_t r = 0; r < num_replicas; r++)
+    {
+        elastic_coeffs[r] = replicas[r].e;
+        clocks[r].time = 0;
+        clocks[r].count = 0;
+        clocks[r].done = 0;
+        status |= queue.enqueueWriteBuffer(buffers.pos, CL_FALSE, 3 * r * stride * sizeof(cl_double),
+                                           3 * stride * sizeof(cl_double), parts[r]->x);
+        status |= queue.enqueueWriteBuffer(buffers.vel, CL_FALSE, 3 * r * stride * sizeof(cl_double),
+                                           3 * stride * sizeof(cl_double), parts[r]->vx);
+    }
+    status |= queue.enqueueWriteBuffer(buffers.radii, CL_FALSE, 0, num_parts * sizeof(cl_double), parts[0]->radius);
+    status |= queue.enqueueWriteBuffer(buffers.masses, CL_FALSE, 0, num_parts * sizeof(cl_double), parts[0]->mass);
+    status |= queue.enqueueWriteBuffer(buffers.elastic_coeffs, CL_FALSE, 0, num_replicas * sizeof(cl_double), elastic_coeffs.data());
+    status |= queue.enqueueWriteBuffer(buffers.clocks, CL_TRUE, 0, num_replicas * sizeof(BatchClock), clocks.data());
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while writing buffers on OpenCL device memory for the ensemble." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    EnsembleStage stages[2];
+    for (size_t s = 0; s < 2; s++)
+    {
+        stages[s].records.resize(num_replicas * batch_size);
+        stages[s].clocks.resize(num_replicas);
+        stages[s].pos.resize(3 * num_replicas * stride);
+    }
+
+    // Output some informations about the systems
+    for (size_t r = 0; r < num_replicas; r++)
+        outs[r]->write_header(*parts[r], replicas[r].e, max_time, x_wall, y_wall, z_wall);
+
+    // The events of the replicas are replayed by the threads of the pool
+    ThreadPool::initialize(CLSettings::get_num_threads());
+    size_t num_threads = ThreadPool::num_threads();
+    std::vector<std::string> errors(num_threads);
+
+    // Begin the simulation loop
+    std::cout << "Simulation of an ensemble of " << num_replicas << " systems of " << num_parts
+              << " particles for " << max_time << " seconds." << std::endl;
+    size_t batch = 0;
+    size_t num_finished = 0;
+    const cl_ulong done = 1;
+    enqueue_ensemble_batch(buffers, num_replicas, num_parts, stride, max_time, batch_size, group_size);
+    enqueue_ensemble_drain(buffers, stages[0], 0, batch_size);
+    queue.flush();
+    while (num_finished < num_replicas)
+    {
+        // Keep the device busy with the next batch while this one is written
+        enqueue_ensemble_batch(buffers, num_replicas, num_parts, stride, max_time, batch_size, group_size);
+        enqueue_ensemble_drain(buffers, stages[(batch + 1) % 2], batch + 1, batch_size);
+        queue.flush();
+
+        EnsembleStage& stage = stages[batch % 2];
+        stage.ready.wait();
+
+        // Replay the events of each replica, which ends with the events of the batch
+        ThreadPool::run([&](size_t t)
+        {
+            try
+            {
+                for (size_t r = t; r < num_replicas; r += num_threads)
+                {
+                    if (finished[r])
+                        continue;
+                    size_t count = stage.clocks[r].count;
+                    size_t num_records = count > batch * batch_size ? MIN(count - batch * batch_size, batch_size) : 0;
+                    replay_records(*outs[r], *parts[r], &times[r], stage.records.data() + r * batch_size, num_records);
+                    // The positions computed by the device replace the replayed ones
+                    std::memcpy(parts[r]->x, stage.pos.data() + 3 * r * stride, 3 * stride * sizeof(cl_double));
+                }
+            }
+            catch (std::exception& e)
+            {
+                errors[t] = e.what();
+            }
+        });
+        for (size_t t = 0; t < num_threads; t++)
+        {
+            if (!errors[t].empty())
+                throw std::runtime_error(errors[t]);
+        }
+
+        // A replica is finished once its time horizon is reached or its output is full.
+        // In the latter case it is stopped on the device as well, from the batches not yet enqueued.
+        for (size_t r = 0; r < num_replicas; r++)
+        {
+            if (finished[r] || (stage.clocks[r].done == 0 && !outs[r]->is_full()))
+                continue;
+            finished[r] = 1;
+            num_finished++;
+            if (stage.clocks[r].done == 0)
+            {
+                status = queue.enqueueWriteBuffer(buffers.clocks, CL_FALSE, r * sizeof(BatchClock) + offsetof(BatchClock, done),
+                                                  sizeof(cl_ulong), &done);
+                if (status != CL_SUCCESS)
+                {
+                    std::stringstream ss;
+                    ss << "Errors occurred while stopping a replica of the ensemble on the OpenCL device." << std::endl;
+                    throw std::runtime_error(ss.str());
+                }
+            }
+        }
+        batch++;
+    }
+    queue.finish();
+
+    for (size_t r = 0; r < num_replicas; r++)
+    {
+        // With no events left, the particles move freely until the time horizon
+        outs[r]->write_samples(times[r], INFINITY, *parts[r]);
+
+        // Write the pending output and close the file
+        outs[r]->close();
+        std::cout << "Replica " << r << ": " << outs[r]->summary() << std::endl;
+        delete outs[r];
+        delete parts[r];
+    }
+
+    std::cout << "Simulation terminated." << std::endl;
+}
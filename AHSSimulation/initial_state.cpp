@@ -0,0 +1,403 @@
+#include "initial_state.h"
+#include "thread_pool.h"
+#include "CLSettings.h"
+#include <math.h>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#define MIN(x, y)       ((x) < (y) ? (x) : (y))
+#define MAX(x, y)       ((x) > (y) ? (x) : (y))
+#define ABS(x)          ((x) > 0 ? (x) : -(x))
+
+#define PI              3.14159265358979323846
+
+// Constants of Philox-4x32: the multipliers of the rounds and the increments of the key
+#define PHILOX_M0       0xD2511F53u
+#define PHILOX_M1       0xCD9E8D57u
+#define PHILOX_W0       0x9E3779B9u
+#define PHILOX_W1       0xBB67AE85u
+#define PHILOX_ROUNDS   10
+
+// Streams of the generator, so that the different draws of the same particle are independent
+#define STREAM_PLACEMENT    1
+#define STREAM_PERMUTATION  2
+#define STREAM_JITTER       3
+#define STREAM_VELOCITY     4
+
+// Four random words for the counter made of the index of a particle, the number of the draw and the stream
+static void philox(uint64_t seed, uint64_t index, uint32_t draw, uint32_t stream, uint32_t* out)
+{
+    uint32_t c[4] = { (uint32_t)index, (uint32_t)(index >> 32), draw, stream };
+    uint32_t k[2] = { (uint32_t)seed, (uint32_t)(seed >> 32) };
+    for (int r = 0; r < PHILOX_ROUNDS; r++)
+    {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c[0];
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c[2];
+        c[0] = (uint32_t)(p1 >> 32) ^ c[1] ^ k[0];
+        c[2] = (uint32_t)(p0 >> 32) ^ c[3] ^ k[1];
+        c[1] = (uint32_t)p1;
+        c[3] = (uint32_t)p0;
+        k[0] += PHILOX_W0;
+        k[1] += PHILOX_W1;
+    }
+    for (int w = 0; w < 4; w++)
+        out[w] = c[w];
+}
+
+// Two uniform values in (0, 1), with 53 random bits each
+static void uniform_pair(uint64_t seed, uint64_t index, uint32_t draw, uint32_t stream, cl_double* u)
+{
+    uint32_t w[4];
+    philox(seed, index, draw, stream, w);
+    for (int k = 0; k < 2; k++)
+    {
+        uint64_t bits = ((uint64_t)w[2 * k] << 32) | w[2 * k + 1];
+        u[k] = ((bits >> 11) + 0.5) / 9007199254740992.0;
+    }
+}
+
+// Run body(i) for each particle, splitting them among the threads of the pool
+template<class Body>
+static void parallel_for(size_t num_parts, const Body& body)
+{
+    ThreadPool::initialize(CLSettings::get_num_threads());
+    size_t num_threads = ThreadPool::num_threads();
+    ThreadPool::run([&](size_t t)
+    {
+        size_t begin = num_parts * t / num_threads;
+        size_t end = num_parts * (t + 1) / num_threads;
+        for (size_t i = begin; i < end; i++)
+            body(i);
+    });
+}
+
+// Lower walls and lengths of the box along the three axes
+static void box_bounds(cl_double* x_wall, cl_double* y_wall, cl_double* z_wall, cl_double* low, cl_double* len)
+{
+    low[0] = x_wall[0];
+    low[1] = y_wall[0];
+    low[2] = z_wall[0];
+    len[0] = x_wall[1] - x_wall[0];
+    len[1] = y_wall[1] - y_wall[0];
+    len[2] = z_wall[1] - z_wall[0];
+}
+
+static cl_double max_radius(cl_double* radii, size_t num_parts)
+{
+    cl_double r_max = 0;
+    for (size_t i = 0; i < num_parts; i++)
+        r_max = MAX(r_max, radii[i]);
+    return r_max;
+}
+
+
+// Spheres placed so far, grouped by cell. The spheres of a cell are stored inline, one after the other,
+// so that the cells neighbouring a candidate are read with a few contiguous accesses rather than by
+// following a list through the whole system. The slots of all the cells are doubled when one is full.
+class PlacementGrid
+{
+private:
+    // Position and radius of each sphere
+    std::vector<cl_double> _slots;
+    std::vector<uint32_t> _counts;
+    size_t _capacity;
+
+public:
+    PlacementGrid(size_t num_cells) : _slots(4 * 4 * num_cells), _counts(num_cells, 0), _capacity(4) {}
+
+    bool overlaps(size_t cell, const cl_double* p, cl_double r) const
+    {
+        const cl_double* s = _slots.data() + 4 * _capacity * cell;
+        for (uint32_t k = 0; k < _counts[cell]; k++, s += 4)
+        {
+            cl_double dx = p[0] - s[0];
+            cl_double dy = p[1] - s[1];
+            cl_double dz = p[2] - s[2];
+            cl_double dr = r + s[3];
+            if (dx * dx + dy * dy + dz * dz <= dr * dr)
+                return true;
+        }
+        return false;
+    }
+
+    void insert(size_t cell, const cl_double* p, cl_double r)
+    {
+        if (_counts[cell] == _capacity)
+        {
+            std::vector<cl_double> slots(2 * _slots.size());
+            for (size_t c = 0; c < _counts.size(); c++)
+                std::copy(_slots.begin() + 4 * _capacity * c, _slots.begin() + 4 * _capacity * c + 4 * _counts[c],
+                          slots.begin() + 8 * _capacity * c);
+            _slots.swap(slots);
+            _capacity *= 2;
+        }
+        cl_double* s = _slots.data() + 4 * (_capacity * cell + _counts[cell]);
+        s[0] = p[0];
+        s[1] = p[1];
+        s[2] = p[2];
+        s[3] = r;
+        _counts[cell]++;
+    }
+};
+
+// Voxels of the box where no sphere can be placed anymore: those lying entirely within the distance
+// r + r_min of the center of a sphere of radius r already placed, r_min being the smallest radius.
+// A candidate falling in one of them is rejected without looking at its neighbours, which near the
+// jamming packing fraction is the fate of nearly every candidate. It only rejects candidates that the
+// exact test would reject too, so the configuration is the same.
+class CoverageMap
+{
+private:
+    std::vector<uint64_t> _bits;
+    size_t _voxels[3];
+    cl_double _low[3];
+    cl_double _side;
+    cl_double _r_min;
+    std::vector<cl_double> _far[3];
+
+    size_t voxel(const cl_double* p, size_t k) const
+    {
+        return MIN(_voxels[k] - 1, (size_t)((p[k] - _low[k]) / _side));
+    }
+
+public:
+    CoverageMap(const cl_double* low, const cl_double* len, size_t num_parts, cl_double r_min)
+    {
+        // Voxels a third of the smallest exclusion distance, but no more than a few tens per particle
+        _side = MAX(2 * r_min / 3, cbrt(len[0] * len[1] * len[2] / (64 * (cl_double)num_parts + 64)));
+        for (size_t k = 0; k < 3; k++)
+        {
+            _low[k] = low[k];
+            _voxels[k] = MAX((size_t)1, (size_t)ceil(len[k] / _side));
+        }
+        _r_min = r_min;
+        _bits.assign((_voxels[0] * _voxels[1] * _voxels[2] + 63) / 64, 0);
+    }
+
+    bool is_covered(const cl_double* p) const
+    {
+        size_t v = (voxel(p, 0) * _voxels[1] + voxel(p, 1)) * _voxels[2] + voxel(p, 2);
+        return (_bits[v / 64] >> (v % 64)) & 1;
+    }
+
+    void cover(const cl_double* p, cl_double r)
+    {
+        cl_double range = r + _r_min;
+        size_t first[3], last[3];
+        for (size_t k = 0; k < 3; k++)
+        {
+            cl_double q[3] = { p[0], p[1], p[2] };
+            q[k] = p[k] - range;
+            first[k] = q[k] < _low[k] ? 0 : voxel(q, k);
+            q[k] = p[k] + range;
+            last[k] = voxel(q, k);
+        }
+        // Squared distances from the center to the farthest side of each voxel, along each axis
+        for (size_t k = 0; k < 3; k++)
+        {
+            _far[k].clear();
+            for (size_t v = first[k]; v <= last[k]; v++)
+            {
+                cl_double d = MAX(ABS(_low[k] + v * _side - p[k]), ABS(_low[k] + (v + 1) * _side - p[k]));
+                _far[k].push_back(d * d);
+            }
+        }
+        cl_double range2 = range * range;
+        for (size_t x = 0; x < _far[0].size(); x++)
+        {
+            for (size_t y = 0; y < _far[1].size(); y++)
+            {
+                if (_far[0][x] + _far[1][y] >= range2)
+                    continue;
+                size_t row = ((first[0] + x) * _voxels[1] + first[1] + y) * _voxels[2] + first[2];
+                for (size_t z = 0; z < _far[2].size(); z++)
+                {
+                    if (_far[0][x] + _far[1][y] + _far[2][z] < range2)
+                        _bits[(row + z) / 64] |= (uint64_t)1 << ((row + z) % 64);
+                }
+            }
+        }
+    }
+};
+
+void scale_to_packing_fraction(cl_double* radii, size_t num_parts,
+                               cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                               cl_double packing_fraction)
+{
+    cl_double low[3], len[3];
+    box_bounds(x_wall, y_wall, z_wall, low, len);
+    cl_double volume = 0;
+    for (size_t i = 0; i < num_parts; i++)
+        volume += 4.0 / 3.0 * PI * radii[i] * radii[i] * radii[i];
+    cl_double scale = cbrt(packing_fraction * len[0] * len[1] * len[2] / volume);
+    for (size_t i = 0; i < num_parts; i++)
+        radii[i] *= scale;
+}
+
+void place_non_overlapping(cl_double* positions, cl_double* radii, size_t num_parts,
+                           cl_double* x_wall, cl_double* y_wall, cl_double* z_wall, uint64_t seed)
+{
+    cl_double low[3], len[3];
+    box_bounds(x_wall, y_wall, z_wall, low, len);
+    cl_double r_max = max_radius(radii, num_parts);
+    if (2 * r_max >= MIN(len[0], MIN(len[1], len[2])))
+    {
+        std::stringstream ss;
+        ss << "The largest sphere, of radius " << r_max << ", does not fit between the walls." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    // Cells at least as wide as the largest sphere, so that overlapping spheres are in neighbouring
+    // cells, and no more than a few for each particle
+    size_t cells[3];
+    cl_double width[3];
+    for (size_t k = 0; k < 3; k++)
+        cells[k] = MAX((size_t)1, (size_t)MIN(len[k] / (2 * r_max), (cl_double)((size_t)1 << 20)));
+    while (cells[0] * cells[1] * cells[2] > 4 * num_parts + 64)
+    {
+        size_t k = cells[0] >= cells[1] && cells[0] >= cells[2] ? 0 : (cells[1] >= cells[2] ? 1 : 2);
+        cells[k] = (cells[k] + 1) / 2;
+    }
+    for (size_t k = 0; k < 3; k++)
+        width[k] = len[k] / cells[k];
+    PlacementGrid grid(cells[0] * cells[1] * cells[2]);
+    cl_double r_min = r_max;
+    for (size_t i = 0; i < num_parts; i++)
+        r_min = MIN(r_min, radii[i]);
+    CoverageMap coverage(low, len, num_parts, r_min);
+
+    // The largest spheres are the hardest to place, so they go first
+    std::vector<size_t> order(num_parts);
+    for (size_t i = 0; i < num_parts; i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t i, size_t j) { return radii[i] > radii[j]; });
+
+    for (size_t n = 0; n < num_parts; n++)
+    {
+        size_t i = order[n];
+        cl_double r = radii[i];
+        cl_double p[3];
+        size_t c[3];
+        bool placed = false;
+        for (uint32_t a = 0; a < PLACEMENT_MAX_ATTEMPTS && !placed; a++)
+        {
+            cl_double u[4];
+            uniform_pair(seed, i, 2 * a, STREAM_PLACEMENT, u);
+            uniform_pair(seed, i, 2 * a + 1, STREAM_PLACEMENT, u + 2);
+            for (size_t k = 0; k < 3; k++)
+            {
+                p[k] = low[k] + r + u[k] * (len[k] - 2 * r);
+                c[k] = MIN(cells[k] - 1, (size_t)((p[k] - low[k]) / width[k]));
+            }
+            if (coverage.is_covered(p))
+                continue;
+
+            // Look for an overlap in the neighbouring cells
+            placed = true;
+            for (size_t cx = (c[0] > 0 ? c[0] - 1 : 0); placed && cx <= MIN(c[0] + 1, cells[0] - 1); cx++)
+            {
+                for (size_t cy = (c[1] > 0 ? c[1] - 1 : 0); placed && cy <= MIN(c[1] + 1, cells[1] - 1); cy++)
+                {
+                    for (size_t cz = (c[2] > 0 ? c[2] - 1 : 0); placed && cz <= MIN(c[2] + 1, cells[2] - 1); cz++)
+                        placed = !grid.overlaps((cx * cells[1] + cy) * cells[2] + cz, p, r);
+                }
+            }
+        }
+        if (!placed)
+        {
+            std::stringstream ss;
+            ss << "Cannot place the " << i << "-th particle without overlaps after " << PLACEMENT_MAX_ATTEMPTS << " attempts." << std::endl;
+            ss << "Lower the packing fraction, or place the particles on a lattice." << std::endl;
+            throw std::runtime_error(ss.str());
+        }
+
+        grid.insert((c[0] * cells[1] + c[1]) * cells[2] + c[2], p, r);
+        coverage.cover(p, r);
+        for (size_t k = 0; k < 3; k++)
+            positions[3 * i + k] = p[k];
+    }
+}
+
+void place_lattice(cl_double* positions, cl_double* radii, size_t num_parts,
+                   cl_double* x_wall, cl_double* y_wall, cl_double* z_wall, uint64_t seed)
+{
+    cl_double low[3], len[3];
+    box_bounds(x_wall, y_wall, z_wall, low, len);
+
+    // Cells as close to cubes as the walls allow, refining the axis with the widest ones until there
+    // are enough sites
+    cl_double side = cbrt(len[0] * len[1] * len[2] / num_parts);
+    size_t cells[3];
+    cl_double width[3];
+    for (size_t k = 0; k < 3; k++)
+        cells[k] = MAX((size_t)1, (size_t)(len[k] / side));
+    while (cells[0] * cells[1] * cells[2] < num_parts)
+    {
+        size_t k = 0;
+        for (size_t l = 1; l < 3; l++)
+        {
+            if (len[l] / cells[l] > len[k] / cells[k])
+                k = l;
+        }
+        cells[k]++;
+    }
+    for (size_t k = 0; k < 3; k++)
+        width[k] = len[k] / cells[k];
+    cl_double r_max = max_radius(radii, num_parts);
+    if (2 * r_max >= MIN(width[0], MIN(width[1], width[2])))
+    {
+        std::stringstream ss;
+        ss << "The largest sphere, of radius " << r_max << ", does not fit in the cells of the lattice, of size "
+           << width[0] << " x " << width[1] << " x " << width[2] << "." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    // The sites taken are the first ones of a random permutation of all the sites
+    size_t num_sites = cells[0] * cells[1] * cells[2];
+    std::vector<size_t> sites(num_sites);
+    for (size_t s = 0; s < num_sites; s++)
+        sites[s] = s;
+    for (size_t i = 0; i < num_parts; i++)
+    {
+        cl_double u[2];
+        uniform_pair(seed, i, 0, STREAM_PERMUTATION, u);
+        size_t s = MIN(num_sites - 1, i + (size_t)(u[0] * (num_sites - i)));
+        std::swap(sites[i], sites[s]);
+    }
+
+    parallel_for(num_parts, [&](size_t i)
+    {
+        size_t c[3];
+        c[2] = sites[i] % cells[2];
+        c[1] = sites[i] / cells[2] % cells[1];
+        c[0] = sites[i] / cells[2] / cells[1];
+        cl_double u[4];
+        uniform_pair(seed, i, 0, STREAM_JITTER, u);
+        uniform_pair(seed, i, 1, STREAM_JITTER, u + 2);
+        for (size_t k = 0; k < 3; k++)
+        {
+            cl_double jitter = width[k] / 2 - radii[i];
+            positions[3 * i + k] = low[k] + (c[k] + 0.5) * width[k] + (2 * u[k] - 1) * jitter;
+        }
+    });
+}
+
+void maxwell_boltzmann_velocities(cl_double* velocities, cl_double* masses, size_t num_parts,
+                                  cl_double temperature, uint64_t seed)
+{
+    parallel_for(num_parts, [&](size_t i)
+    {
+        // Three normal values from two Box-Muller transforms
+        cl_double u[4];
+        uniform_pair(seed, i, 0, STREAM_VELOCITY, u);
+        uniform_pair(seed, i, 1, STREAM_VELOCITY, u + 2);
+        cl_double sigma = sqrt(temperature / masses[i]);
+        cl_double r0 = sqrt(-2 * log(u[0]));
+        cl_double r1 = sqrt(-2 * log(u[2]));
+        velocities[3 * i] = sigma * r0 * cos(2 * PI * u[1]);
+        velocities[3 * i + 1] = sigma * r0 * sin(2 * PI * u[1]);
+        velocities[3 * i + 2] = sigma * r1 * cos(2 * PI * u[3]);
+    });
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+#include <stdint.h>
+
+// Positions given in the input file, or drawn from rand()
+#define PLACEMENT_NONE                  0
+// Positions drawn one particle at a time, rejecting the ones overlapping the particles already placed
+#define PLACEMENT_NON_OVERLAPPING       1
+// Positions on the sites of a lattice, moved at random inside their cells
+#define PLACEMENT_LATTICE               2
+
+// Attempts of the non-overlapping placement of a particle before giving up
+#define PLACEMENT_MAX_ATTEMPTS          1000000
+
+// Generation of non-overlapping initial configurations, run after the whole input is read, since the
+// placement depends on the radii and the velocities on the masses.
+// All the values are drawn from a counter-based generator in the style of Philox-4x32-10: each value
+// depends only on the seed, on the index of the particle and on what is drawn, so the same seed gives
+// the same configuration whatever the number of threads of the ThreadPool generating it.
+
+// Scale the radii so that the spheres fill the given fraction of the volume between the walls
+void scale_to_packing_fraction(cl_double* radii, size_t num_parts,
+                               cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                               cl_double packing_fraction);
+
+// Random sequential addition: place the particles one at a time, the largest first, at uniform random
+// positions inside the walls, drawing again the ones that overlap a particle already placed. The
+// overlaps are looked for in a grid of cells as wide as the largest sphere. Throws if a particle cannot
+// be placed in PLACEMENT_MAX_ATTEMPTS attempts, which happens near the jamming packing fraction (about
+// 0.38 for equal spheres).
+void place_non_overlapping(cl_double* positions, cl_double* radii, size_t num_parts,
+                           cl_double* x_wall, cl_double* y_wall, cl_double* z_wall, uint64_t seed);
+
+// Place the particles on random sites of the smallest lattice of cells with at least num_parts sites,
+// each one moved at random inside its own cell. Reaches higher packing fractions than the random
+// sequential addition, up to 0.52 for equal spheres. Throws if a sphere does not fit in its cell.
+void place_lattice(cl_double* positions, cl_double* radii, size_t num_parts,
+                   cl_double* x_wall, cl_double* y_wall, cl_double* z_wall, uint64_t seed);
+
+// Draw each component of the velocities from a normal distribution of variance temperature / mass
+void maxwell_boltzmann_velocities(cl_double* velocities, cl_double* masses, size_t num_parts,
+                                  cl_double temperature, uint64_t seed);
@@ -0,0 +1,521 @@
+#include "input_loader.h"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#if defined(_MSC_VER)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define MIN(x, y)       ((x) < (y) ? (x) : (y))
+
+// Longest real value handed to strtod
+#define MAX_REAL_LEN    128
+// Most significant digits that fit in the 64 bits of the fast path
+#define MAX_FAST_DIGITS 19
+
+// Powers of ten that are exact in double precision
+static const cl_double exact_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Parse the real value at p, rounded as strtod does. Values with few significant digits and a small
+// exponent are computed exactly with a single product or quotient of two exact doubles (Clinger's
+// fast path), which is correctly rounded. The others are handed to strtod.
+// Returns the end of the value, or NULL if there is none.
+static const char* parse_real(const char* p, const char* end, cl_double* value)
+{
+    const char* begin = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any_digit = false;
+    for (; p < end && is_digit(*p); p++)
+    {
+        any_digit = true;
+        if (mantissa == 0 && *p == '0')
+            continue;
+        if (digits < MAX_FAST_DIGITS)
+            mantissa = 10 * mantissa + (*p - '0');
+        else
+            exponent++;
+        digits++;
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && is_digit(*p); p++)
+        {
+            any_digit = true;
+            if (mantissa == 0 && *p == '0')
+            {
+                exponent--;
+                continue;
+            }
+            if (digits < MAX_FAST_DIGITS)
+            {
+                mantissa = 10 * mantissa + (*p - '0');
+                exponent--;
+            }
+            digits++;
+        }
+    }
+    if (any_digit && p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* q = p + 1;
+        bool negative_exponent = false;
+        if (q < end && (*q == '-' || *q == '+'))
+            negative_exponent = *q++ == '-';
+        if (q < end && is_digit(*q))
+        {
+            int given = 0;
+            for (; q < end && is_digit(*q); q++)
+                given = MIN(10 * given + (*q - '0'), 100000);
+            exponent += negative_exponent ? -given : given;
+            p = q;
+        }
+    }
+
+    bool fast = any_digit && digits <= MAX_FAST_DIGITS && mantissa <= ((uint64_t)1 << 53) &&
+                exponent >= -22 && exponent <= 22 && (p == end || is_blank(*p) || *p == ',');
+    if (fast)
+    {
+        cl_double m = (cl_double)mantissa;
+        m = exponent < 0 ? m / exact_powers[-exponent] : m * exact_powers[exponent];
+        *value = negative ? -m : m;
+        return p;
+    }
+
+    // Anything else, including the special values, is left to strtod on a terminated copy
+    char buffer[MAX_REAL_LEN];
+    size_t len = 0;
+    for (p = begin; p < end && !is_blank(*p) && *p != ',' && len < MAX_REAL_LEN - 1; p++)
+        buffer[len++] = *p;
+    buffer[len] = 0;
+    char* parsed;
+    *value = strtod(buffer, &parsed);
+    if (len == 0 || parsed != buffer + len)
+        return NULL;
+    return p;
+}
+
+// Skip the spaces and tabs of the current line
+static const char* skip_spaces(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\v' || *p == '\f'))
+        p++;
+    return p;
+}
+
+// Skip the blank characters, including the ends of line
+static const char* skip_blanks(const char* p, const char* end)
+{
+    while (p < end && is_blank(*p))
+        p++;
+    return p;
+}
+
+// Parse a row of width values, followed by the end of its line. Returns NULL on errors.
+static const char* parse_row(const char* p, const char* end, size_t width, cl_double* values)
+{
+    p = skip_blanks(p, end);
+    for (size_t k = 0; k < width; k++)
+    {
+        if (k > 0)
+        {
+            p = skip_spaces(p, end);
+            if (p == end || *p != ',')
+                return NULL;
+            p = skip_spaces(p + 1, end);
+        }
+        p = parse_real(p, end, values + k);
+        if (p == NULL)
+            return NULL;
+    }
+    p = skip_spaces(p, end);
+    if (p < end && *p != '\n')
+        return NULL;
+    return p;
+}
+
+// Number of non-blank lines in [begin, end)
+static size_t count_rows(const char* begin, const char* end)
+{
+    size_t count = 0;
+    bool filled = false;
+    for (const char* p = begin; p < end; p++)
+    {
+        if (*p == '\n')
+        {
+            count += filled;
+            filled = false;
+        }
+        else if (!is_blank(*p))
+            filled = true;
+    }
+    return count + filled;
+}
+
+// Run task(t) for t in [0, num_tasks), on a thread each but the first one
+template<class Task>
+static void run_parallel(size_t num_tasks, const Task& task)
+{
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < num_tasks; t++)
+        threads.push_back(std::thread(task, t));
+    task(0);
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+}
+
+
+InputFile::InputFile(const std::string& filename)
+{
+    _filename = filename;
+    _data = NULL;
+    _size = 0;
+    bool ok;
+#if defined(_MSC_VER)
+    _mapping = NULL;
+    _file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER size;
+    ok = _file != INVALID_HANDLE_VALUE && GetFileSizeEx(_file, &size);
+    if (ok && size.QuadPart > 0)
+    {
+        _size = (size_t)size.QuadPart;
+        _mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (_mapping != NULL)
+            _data = (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+        ok = _data != NULL;
+    }
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat info;
+    ok = fd >= 0 && fstat(fd, &info) == 0;
+    if (ok && info.st_size > 0)
+    {
+        _size = (size_t)info.st_size;
+        void* data = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ok = data != MAP_FAILED;
+        if (ok)
+        {
+            _data = (const char*)data;
+            madvise(data, _size, MADV_SEQUENTIAL);
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+#endif
+    if (!ok)
+    {
+#if defined(_MSC_VER)
+        if (_mapping != NULL)
+            CloseHandle(_mapping);
+        if (_file != INVALID_HANDLE_VALUE)
+            CloseHandle(_file);
+#endif
+        std::stringstream ss;
+        ss << "Cannot map file " << filename << " for reading." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+InputFile::~InputFile()
+{
+#if defined(_MSC_VER)
+    if (_data != NULL)
+        UnmapViewOfFile(_data);
+    if (_mapping != NULL)
+        CloseHandle(_mapping);
+    CloseHandle(_file);
+#else
+    if (_data != NULL)
+        munmap((void*)_data, _size);
+#endif
+}
+
+bool InputFile::is_binary() const
+{
+    return _size >= 8 && memcmp(_data, BINARY_INPUT_MAGIC, 8) == 0;
+}
+
+const char* InputFile::data(size_t offset) const
+{
+    return _data + offset;
+}
+
+size_t InputFile::size() const
+{
+    return _size;
+}
+
+size_t InputFile::read_rows(size_t offset, size_t num_rows, size_t width, cl_double* values, const std::string& name) const
+{
+    if (num_rows == 0)
+        return offset;
+    const char* begin = _data + offset;
+    const char* end = _data + _size;
+
+    // Split the rest of the file in parts of whole lines, one for each thread. They may go past the rows,
+    // but only the rows are parsed.
+    size_t num_chunks = MIN((size_t)(end - begin) / INPUT_MIN_CHUNK_SIZE, (size_t)std::thread::hardware_concurrency());
+    num_chunks = std::max(num_chunks, (size_t)1);
+    std::vector<const char*> bounds(num_chunks + 1);
+    bounds[0] = begin;
+    bounds[num_chunks] = end;
+    for (size_t t = 1; t < num_chunks; t++)
+    {
+        const char* p = begin + (end - begin) * t / num_chunks;
+        p = std::max(p, bounds[t - 1]);
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        bounds[t] = eol == NULL ? end : eol + 1;
+    }
+
+    // The first row of each part follows from the number of rows of the previous ones
+    std::vector<size_t> first(num_chunks + 1, 0);
+    if (num_chunks > 1)
+    {
+        run_parallel(num_chunks, [&](size_t t) {
+            first[t + 1] = count_rows(bounds[t], bounds[t + 1]);
+        });
+        for (size_t t = 0; t < num_chunks; t++)
+            first[t + 1] += first[t];
+    }
+    else
+        first[1] = num_rows;
+
+    // Each part records the first row it could not parse, and where its last row ends
+    std::vector<size_t> failed(num_chunks, num_rows);
+    std::vector<const char*> last(num_chunks, NULL);
+    run_parallel(num_chunks, [&](size_t t) {
+        const char* p = bounds[t];
+        size_t rows_end = MIN(first[t + 1], num_rows);
+        for (size_t i = first[t]; i < rows_end; i++)
+        {
+            p = parse_row(p, end, width, values + width * i);
+            if (p == NULL)
+            {
+                failed[t] = i;
+                return;
+            }
+        }
+        last[t] = p;
+    });
+
+    size_t failed_row = num_rows;
+    for (size_t t = 0; t < num_chunks; t++)
+        failed_row = MIN(failed_row, failed[t]);
+    if (failed_row == num_rows && first[num_chunks] < num_rows)
+        failed_row = first[num_chunks];
+    if (failed_row < num_rows)
+    {
+        std::stringstream ss;
+        ss << "Error while reading the " << failed_row << "-th " << name << "." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    // The last row is in the last part that begins before it
+    size_t t = num_chunks - 1;
+    while (first[t] >= num_rows)
+        t--;
+    return skip_blanks(last[t], end) - _data;
+}
+
+size_t InputFile::read_binary(char* model_name, size_t* num_parts, cl_double* max_time, cl_double* e,
+                              cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                              int* simtype, cl_double* threshold,
+                              cl_double** positions, cl_double** velocities, cl_double** masses, cl_double** radii) const
+{
+    BinaryInputHeader header;
+    if (_size < BINARY_INPUT_DATA_OFFSET)
+    {
+        std::stringstream ss;
+        ss << "The binary input file " << _filename << " is truncated." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    memcpy(&header, _data, sizeof(BinaryInputHeader));
+    if (header.version != BINARY_INPUT_VERSION)
+    {
+        std::stringstream ss;
+        ss << "The file " << _filename << " is not a binary input file of this version of the simulation." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    // Same checks of the text input
+    std::stringstream ss;
+    if (memchr(header.model_name, 0, BINARY_INPUT_NAME_LEN) == NULL)
+        ss << "The model name is not terminated." << std::endl;
+    else if (header.max_time <= 0)
+        ss << "The time horizon must be a strictly positive real value. Given value is " << header.max_time << std::endl;
+    else if (header.e < 0 || header.e > 1)
+        ss << "Invalid value for the elasticity coefficient." << std::endl
+           << "Legal values are in the interval [0, 1]. Given value is " << header.e << std::endl;
+    else if (header.simtype > 2)
+        ss << "Invalid value for the simulation type. Given value is " << header.simtype << std::endl;
+    else if (header.threshold < 0)
+        ss << "Threshold value for enabling fusion or fission must be a non-negative real value." << std::endl
+           << "Given value is " << header.threshold << std::endl;
+    else if ((_size - BINARY_INPUT_DATA_OFFSET) / (8 * sizeof(cl_double)) < header.num_parts)
+        ss << "The binary input file " << _filename << " is truncated." << std::endl;
+    if (!ss.str().empty())
+        throw std::runtime_error(ss.str());
+
+    size_t n = header.num_parts;
+    const cl_double* arrays = (const cl_double*)(_data + BINARY_INPUT_DATA_OFFSET);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (arrays[6 * n + i] <= 0)
+            ss << "Masses must be strictly positive real values." << std::endl
+               << "Given value for the " << i << "-th mass is " << arrays[6 * n + i] << std::endl;
+        else if (arrays[7 * n + i] <= 0)
+            ss << "Radii must be strictly positive real values." << std::endl
+               << "Given value for the " << i << "-th radius is " << arrays[7 * n + i] << std::endl;
+        else
+            continue;
+        throw std::runtime_error(ss.str());
+    }
+
+    *positions = (cl_double*)calloc(3 * n, sizeof(cl_double));
+    *velocities = (cl_double*)calloc(3 * n, sizeof(cl_double));
+    if (*positions == NULL || *velocities == NULL)
+    {
+        ss << "Error while allocating space for position and velocity vectors." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        for (size_t k = 0; k < 3; k++)
+        {
+            (*positions)[3 * i + k] = arrays[k * n + i];
+            (*velocities)[3 * i + k] = arrays[(3 + k) * n + i];
+        }
+    }
+    // The scalar arrays are already in the layout of the simulation
+    *masses = (cl_double*)(arrays + 6 * n);
+    *radii = (cl_double*)(arrays + 7 * n);
+
+    memcpy(model_name, header.model_name, BINARY_INPUT_NAME_LEN);
+    *num_parts = n;
+    *max_time = header.max_time;
+    *e = header.e;
+    x_wall[0] = header.walls[0];
+    x_wall[1] = header.walls[1];
+    y_wall[0] = header.walls[2];
+    y_wall[1] = header.walls[3];
+    z_wall[0] = header.walls[4];
+    z_wall[1] = header.walls[5];
+    *simtype = (int)header.simtype;
+    *threshold = header.threshold;
+    return BINARY_INPUT_DATA_OFFSET + 8 * n * sizeof(cl_double);
+}
+
+
+void write_binary_input(const std::string& filename, const char* model_name, size_t num_parts,
+                        cl_double max_time, cl_double e,
+                        cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                        int simtype, cl_double threshold,
+                        cl_double* positions, cl_double* velocities, cl_double* masses, cl_double* radii,
+                        const char* settings, size_t settings_size)
+{
+    BinaryInputHeader header;
+    memset(&header, 0, sizeof(BinaryInputHeader));
+    memcpy(header.magic, BINARY_INPUT_MAGIC, 8);
+    header.version = BINARY_INPUT_VERSION;
+    memcpy(header.model_name, model_name, MIN(strlen(model_name), (size_t)BINARY_INPUT_NAME_LEN - 1));
+    header.num_parts = num_parts;
+    header.max_time = max_time;
+    header.e = e;
+    header.walls[0] = x_wall[0];
+    header.walls[1] = x_wall[1];
+    header.walls[2] = y_wall[0];
+    header.walls[3] = y_wall[1];
+    header.walls[4] = z_wall[0];
+    header.walls[5] = z_wall[1];
+    header.simtype = (size_t)simtype;
+    header.threshold = threshold;
+
+    FILE* stream;
+    fopen_s(&stream, filename.c_str(), "wb");
+    if (stream == NULL)
+    {
+        std::stringstream ss;
+        ss << "Cannot open file " << filename << " for writing." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    // The components are taken out of the interleaved vectors one at a time
+    std::vector<char> padding(BINARY_INPUT_DATA_OFFSET - sizeof(BinaryInputHeader), 0);
+    std::vector<cl_double> component(num_parts);
+    bool ok = fwrite(&header, sizeof(BinaryInputHeader), 1, stream) == 1;
+    ok = ok && fwrite(padding.data(), sizeof(char), padding.size(), stream) == padding.size();
+    for (size_t k = 0; k < 6; k++)
+    {
+        cl_double* vectors = k < 3 ? positions : velocities;
+        for (size_t i = 0; i < num_parts; i++)
+            component[i] = vectors[3 * i + k % 3];
+        ok = ok && fwrite(component.data(), sizeof(cl_double), num_parts, stream) == num_parts;
+    }
+    ok = ok && fwrite(masses, sizeof(cl_double), num_parts, stream) == num_parts;
+    ok = ok && fwrite(radii, sizeof(cl_double), num_parts, stream) == num_parts;
+    ok = ok && fwrite(settings, sizeof(char), settings_size, stream) == settings_size;
+    ok = fclose(stream) == 0 && ok;
+    if (!ok)
+    {
+        std::stringstream ss;
+        ss << "Some errors occurred while writing the file " << filename << "." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+
+size_t stream_tell(FILE* stream)
+{
+#if defined(_MSC_VER)
+    return (size_t)_ftelli64(stream);
+#else
+    return (size_t)ftello(stream);
+#endif
+}
+
+void stream_seek(FILE* stream, size_t offset)
+{
+#if defined(_MSC_VER)
+    _fseeki64(stream, (__int64)offset, SEEK_SET);
+#else
+    fseeko(stream, (off_t)offset, SEEK_SET);
+#endif
+}
+
+size_t stream_remaining(FILE* stream)
+{
+    size_t offset = stream_tell(stream);
+    fseek(stream, 0, SEEK_END);
+    size_t end = stream_tell(stream);
+    stream_seek(stream, offset);
+    return end > offset ? end - offset : 0;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+#include <string>
+#include <stddef.h>
+#include <stdio.h>
+
+// First eight bytes of a binary input file
+#define BINARY_INPUT_MAGIC          "AHSINPUT"
+// Version of the layout of the binary input files
+#define BINARY_INPUT_VERSION        (size_t)1
+// Offset of the arrays of the particles in a binary input file
+#define BINARY_INPUT_DATA_OFFSET    512
+// Maximum length of the model name, with its terminator
+#define BINARY_INPUT_NAME_LEN       256
+// Smallest part of a text input parsed by a thread of its own
+#define INPUT_MIN_CHUNK_SIZE        ((size_t)1 << 20)
+
+// Header of a binary input file. It is followed, at BINARY_INPUT_DATA_OFFSET, by the arrays x, y, z,
+// vx, vy, vz, mass and radius, of num_parts values each, in the byte order of the machine. After them,
+// the file can hold the optional settings, as in the text input files.
+struct BinaryInputHeader
+{
+    char magic[8];
+    size_t version;
+    char model_name[BINARY_INPUT_NAME_LEN];
+    size_t num_parts;
+    cl_double max_time;
+    cl_double e;
+    cl_double walls[6];
+    size_t simtype;
+    cl_double threshold;
+};
+
+// Input file mapped in memory, read-only.
+// The rows of values of a text input are parsed by a set of threads, each one taking the rows of a
+// contiguous part of the file, and the values are rounded exactly as fscanf does. The arrays of a
+// binary input are used in place where the layout allows it, so the same model gives the same values
+// whatever the format.
+class InputFile
+{
+private:
+    std::string _filename;
+    const char* _data;
+    size_t _size;
+#if defined(_MSC_VER)
+    void* _file;
+    void* _mapping;
+#endif
+
+    InputFile(InputFile& in) {};
+    void operator=(InputFile& in) {};
+
+public:
+    InputFile(const std::string& filename);
+    ~InputFile();
+
+    // True if the file begins with BINARY_INPUT_MAGIC
+    bool is_binary() const;
+
+    // Parse num_rows rows of width comma-separated real values, one row per line, starting at the given
+    // offset. Blank lines are skipped. Returns the offset of the first non-blank line after the rows.
+    // On errors, throws with the index of the first row not read, described by name.
+    size_t read_rows(size_t offset, size_t num_rows, size_t width, cl_double* values, const std::string& name) const;
+
+    // Read the model of a binary input file, validated as the text input is. The positions and velocities
+    // are allocated in the interleaved layout, while masses and radii point into the mapped file, which
+    // must outlive them. Returns the offset of the optional settings.
+    size_t read_binary(char* model_name, size_t* num_parts, cl_double* max_time, cl_double* e,
+                       cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                       int* simtype, cl_double* threshold,
+                       cl_double** positions, cl_double** velocities, cl_double** masses, cl_double** radii) const;
+
+    // The bytes from the given offset to the end of the file
+    const char* data(size_t offset) const;
+    size_t size() const;
+};
+
+// Write a model to a binary input file, followed by the given optional settings as they are
+void write_binary_input(const std::string& filename, const char* model_name, size_t num_parts,
+                        cl_double max_time, cl_double e,
+                        cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                        int simtype, cl_double threshold,
+                        cl_double* positions, cl_double* velocities, cl_double* masses, cl_double* radii,
+                        const char* settings, size_t settings_size);
+
+// Offset of a stream and seek to an offset, in 64 bits on every platform
+size_t stream_tell(FILE* stream);
+void stream_seek(FILE* stream, size_t offset);
+// Bytes between the offset of a stream and its end, leaving the offset unchanged
+size_t stream_remaining(FILE* stream);
@@ -0,0 +1,813 @@
+#pragma once
+
+// Generated by embed_kernels.py from the kernel sources: do not edit, run the script again.
+// Each line of a source is a raw string literal, so that none exceeds the limits of the compilers.
+
+static const char pos_update_source[] =
+    R"CL(// Number of particles baked by the build options (see CLRuntime::specialize))CL" "\n"
+    R"CL(#ifdef AHS_NUM_PARTS)CL" "\n"
+    R"CL(#define NUM_PARTS(num_parts)	((ulong)AHS_NUM_PARTS))CL" "\n"
+    R"CL(#else)CL" "\n"
+    R"CL(#define NUM_PARTS(num_parts)	(num_parts))CL" "\n"
+    R"CL(#endif)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Positions and velocities are planar: the x components of all the particles, then the y)CL" "\n"
+    R"CL(// components starting at stride, then the z components starting at 2 * stride)CL" "\n"
+    R"CL(__kernel void pos_update(__global const double* pos, )CL" "\n"
+    R"CL(						 __global const double* vel,)CL" "\n"
+    R"CL(						 const ulong num_parts,)CL" "\n"
+    R"CL(						 const ulong stride,)CL" "\n"
+    R"CL(						 const double delta_time,)CL" "\n"
+    R"CL(						 __global double* out_pos))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	int i = get_global_id(0);)CL" "\n"
+    R"CL(	if (i < NUM_PARTS(num_parts)))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		out_pos[i] = pos[i] + delta_time * vel[i];)CL" "\n"
+    R"CL(		out_pos[stride + i] = pos[stride + i] + delta_time * vel[stride + i];)CL" "\n"
+    R"CL(		out_pos[2 * stride + i] = pos[2 * stride + i] + delta_time * vel[2 * stride + i];)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL(})CL" "\n"
+    ;
+
+static const char wall_collision_source[] =
+    R"CL(// Constants of the run baked by the build options (see CLRuntime::specialize).)CL" "\n"
+    R"CL(// Without them, the values given as arguments are used.)CL" "\n"
+    R"CL(#ifdef AHS_NUM_PARTS)CL" "\n"
+    R"CL(#define NUM_PARTS(num_parts)	((ulong)AHS_NUM_PARTS))CL" "\n"
+    R"CL(#else)CL" "\n"
+    R"CL(#define NUM_PARTS(num_parts)	(num_parts))CL" "\n"
+    R"CL(#endif)CL" "\n"
+    R"CL(#ifdef AHS_UNIFORM_RADIUS)CL" "\n"
+    R"CL(#define RADIUS(radii, i)		(AHS_UNIFORM_RADIUS))CL" "\n"
+    R"CL(#else)CL" "\n"
+    R"CL(#define RADIUS(radii, i)		((radii)[i]))CL" "\n"
+    R"CL(#endif)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Positions and velocities are planar, with the y and z components starting at stride and 2 * stride)CL" "\n"
+    R"CL(__kernel void wall_collision(__global const double* pos,)CL" "\n"
+    R"CL(							 __global const double* vel,)CL" "\n"
+    R"CL(							 __global const double* radii,)CL" "\n"
+    R"CL(							 const ulong num_parts,)CL" "\n"
+    R"CL(							 const ulong stride,)CL" "\n"
+    R"CL(							 __global const double* x_wall,)CL" "\n"
+    R"CL(							 __global const double* y_wall,)CL" "\n"
+    R"CL(							 __global const double* z_wall,)CL" "\n"
+    R"CL(							 __global double* delta_time,)CL" "\n"
+    R"CL(							 __global int* axis))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(#ifdef AHS_CONSTANT_WALLS)CL" "\n"
+    R"CL(	const double x_min = AHS_X_WALL_MIN, x_max = AHS_X_WALL_MAX;)CL" "\n"
+    R"CL(	const double y_min = AHS_Y_WALL_MIN, y_max = AHS_Y_WALL_MAX;)CL" "\n"
+    R"CL(	const double z_min = AHS_Z_WALL_MIN, z_max = AHS_Z_WALL_MAX;)CL" "\n"
+    R"CL(#else)CL" "\n"
+    R"CL(	const double x_min = x_wall[0], x_max = x_wall[1];)CL" "\n"
+    R"CL(	const double y_min = y_wall[0], y_max = y_wall[1];)CL" "\n"
+    R"CL(	const double z_min = z_wall[0], z_max = z_wall[1];)CL" "\n"
+    R"CL(#endif)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	int i = get_global_id(0);)CL" "\n"
+    R"CL(	if (i < NUM_PARTS(num_parts)))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		double x = INFINITY;)CL" "\n"
+    R"CL(		if (vel[i] > 0))CL" "\n"
+    R"CL(			x = x_max - RADIUS(radii, i);)CL" "\n"
+    R"CL(		else if (vel[i] < 0))CL" "\n"
+    R"CL(			x = x_min + RADIUS(radii, i);)CL" "\n"
+    R"CL(			)CL" "\n"
+    R"CL(		double y = INFINITY;)CL" "\n"
+    R"CL(		if (vel[stride + i] > 0))CL" "\n"
+    R"CL(			y = y_max - RADIUS(radii, i);)CL" "\n"
+    R"CL(		else if (vel[stride + i] < 0))CL" "\n"
+    R"CL(			y = y_min + RADIUS(radii, i);)CL" "\n"
+    R"CL(			)CL" "\n"
+    R"CL(		double z = INFINITY;)CL" "\n"
+    R"CL(		if (vel[2 * stride + i] > 0))CL" "\n"
+    R"CL(			z = z_max - RADIUS(radii, i);)CL" "\n"
+    R"CL(		else if (vel[2 * stride + i] < 0))CL" "\n"
+    R"CL(			z = z_min + RADIUS(radii, i);)CL" "\n"
+    R"CL(			)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(		double delta_x = (x - pos[i]) / vel[i];)CL" "\n"
+    R"CL(		double delta_y = (y - pos[stride + i]) / vel[stride + i];)CL" "\n"
+    R"CL(		double delta_z = (z - pos[2 * stride + i]) / vel[2 * stride + i];)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(		delta_time[i] = delta_x;)CL" "\n"
+    R"CL(		axis[i] = 1;)CL" "\n"
+    R"CL(		if (vel[i] < 0))CL" "\n"
+    R"CL(			axis[i] = -1;)CL" "\n"
+    R"CL(		if (delta_y < delta_time[i]))CL" "\n"
+    R"CL(		{)CL" "\n"
+    R"CL(			delta_time[i] = delta_y;)CL" "\n"
+    R"CL(			axis[i] = 2;)CL" "\n"
+    R"CL(			if (vel[stride + i] < 0))CL" "\n"
+    R"CL(				axis[i] = -2;)CL" "\n"
+    R"CL(		})CL" "\n"
+    R"CL(		if (delta_z < delta_time[i]))CL" "\n"
+    R"CL(		{)CL" "\n"
+    R"CL(			delta_time[i] = delta_z;)CL" "\n"
+    R"CL(			axis[i] = 3;)CL" "\n"
+    R"CL(			if (vel[2 * stride + i] < 0))CL" "\n"
+    R"CL(				axis[i] = -3;)CL" "\n"
+    R"CL(		})CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL(})CL" "\n"
+    ;
+
+static const char part_collision_source[] =
+    R"CL(// Constants of the run baked by the build options (see CLRuntime::specialize).)CL" "\n"
+    R"CL(// Without them, the values given as arguments are used.)CL" "\n"
+    R"CL(#ifdef AHS_NUM_PARTS)CL" "\n"
+    R"CL(#define NUM_PARTS(num_parts)	((ulong)AHS_NUM_PARTS))CL" "\n"
+    R"CL(#else)CL" "\n"
+    R"CL(#define NUM_PARTS(num_parts)	(num_parts))CL" "\n"
+    R"CL(#endif)CL" "\n"
+    R"CL(#ifdef AHS_UNIFORM_RADIUS)CL" "\n"
+    R"CL(#define RADIUS(radii, i)		(AHS_UNIFORM_RADIUS))CL" "\n"
+    R"CL(#else)CL" "\n"
+    R"CL(#define RADIUS(radii, i)		((radii)[i]))CL" "\n"
+    R"CL(#endif)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Collision time of the couple (i, j).)CL" "\n"
+    R"CL(// Positions and velocities are planar, with the y and z components starting at stride and 2 * stride.)CL" "\n"
+    R"CL(inline double pair_collision_time(__global const double* pos,)CL" "\n"
+    R"CL(								  __global const double* vel,)CL" "\n"
+    R"CL(								  __global const double* radii,)CL" "\n"
+    R"CL(								  ulong stride,)CL" "\n"
+    R"CL(								  ulong i, ulong j))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	// Relative position and velocity)CL" "\n"
+    R"CL(	double dx = pos[i] - pos[j];)CL" "\n"
+    R"CL(	double dy = pos[stride + i] - pos[stride + j];)CL" "\n"
+    R"CL(	double dz = pos[2 * stride + i] - pos[2 * stride + j];)CL" "\n"
+    R"CL(	double dvx = vel[i] - vel[j];)CL" "\n"
+    R"CL(	double dvy = vel[stride + i] - vel[stride + j];)CL" "\n"
+    R"CL(	double dvz = vel[2 * stride + i] - vel[2 * stride + j];)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	// Velocities dot product)CL" "\n"
+    R"CL(	double a = dvx * dvx + dvy * dvy + dvz * dvz;)CL" "\n"
+    R"CL(	// Position-velocity dot product times two)CL" "\n"
+    R"CL(	double b = 2 * (dx * dvx + dy * dvy + dz * dvz);)CL" "\n"
+    R"CL(	// Positions dot product, minus the square of the sum of radii)CL" "\n"
+    R"CL(	double c = (dx * dx + dy * dy + dz * dz))CL" "\n"
+    R"CL(			   -)CL" "\n"
+    R"CL(			   ((RADIUS(radii, i) + RADIUS(radii, j)) * (RADIUS(radii, i) + RADIUS(radii, j)));)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	// Collision occurs only if b is negative)CL" "\n"
+    R"CL(	if (b >= 0 || b*b < 4*a*c))CL" "\n"
+    R"CL(		return INFINITY;)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	// Solve the polynomial, if the relative difference between the centers is greater)CL" "\n"
+    R"CL(	// than the sum of the radii)CL" "\n"
+    R"CL(	if (c >= 0))CL" "\n"
+    R"CL(		return (- b - sqrt(b*b - 4*a*c)) / (2 * a);)CL" "\n"
+    R"CL(	// Otherwise, give to the couples the highest priority, using a negative time)CL" "\n"
+    R"CL(	return -1;)CL" "\n"
+    R"CL(})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(__kernel void part_collision(__global const double* pos,)CL" "\n"
+    R"CL(							 __global const double* vel,)CL" "\n"
+    R"CL(							 __global const double* radii,)CL" "\n"
+    R"CL(							 const ulong num_parts,)CL" "\n"
+    R"CL(							 const ulong stride,)CL" "\n"
+    R"CL(							 __global double* delta_times))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	ulong n = NUM_PARTS(num_parts);)CL" "\n"
+    R"CL(	int i = get_global_id(0);)CL" "\n"
+    R"CL(	int j = get_global_id(1);)CL" "\n"
+    R"CL(	if (i < n && j < n))CL" "\n"
+    R"CL(		delta_times[j * n + i] = pair_collision_time(pos, vel, radii, stride, i, j);)CL" "\n"
+    R"CL(})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Keep the smallest value, breaking ties with the smallest index)CL" "\n"
+    R"CL(inline void argmin_update(double* best, ulong* best_idx, double value, ulong idx))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	if (value < *best || (value == *best && idx < *best_idx)))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		*best = value;)CL" "\n"
+    R"CL(		*best_idx = idx;)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL(})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Reduce the values held by the work-group in local memory, and write the result of the group)CL" "\n"
+    R"CL(inline void argmin_group(double best, ulong best_idx,)CL" "\n"
+    R"CL(						 __local double* loc_values, __local ulong* loc_indices,)CL" "\n"
+    R"CL(						 __global double* out_values, __global ulong* out_indices))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	int l = get_local_id(0);)CL" "\n"
+    R"CL(	loc_values[l] = best;)CL" "\n"
+    R"CL(	loc_indices[l] = best_idx;)CL" "\n"
+    R"CL(	barrier(CLK_LOCAL_MEM_FENCE);)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	for (int s = get_local_size(0) / 2; s > 0; s >>= 1))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		if (l < s))CL" "\n"
+    R"CL(		{)CL" "\n"
+    R"CL(			double value = loc_values[l];)CL" "\n"
+    R"CL(			ulong idx = loc_indices[l];)CL" "\n"
+    R"CL(			argmin_update(&value, &idx, loc_values[l + s], loc_indices[l + s]);)CL" "\n"
+    R"CL(			loc_values[l] = value;)CL" "\n"
+    R"CL(			loc_indices[l] = idx;)CL" "\n"
+    R"CL(		})CL" "\n"
+    R"CL(		barrier(CLK_LOCAL_MEM_FENCE);)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	if (l == 0))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		out_values[get_group_id(0)] = loc_values[0];)CL" "\n"
+    R"CL(		out_indices[get_group_id(0)] = loc_indices[0];)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL(})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// First step of the minimum search over the matrix written by part_collision.)CL" "\n"
+    R"CL(// Only the couples (i, j) with i < j are considered, i.e. the entries i * num_parts + j.)CL" "\n"
+    R"CL(__kernel void part_collision_argmin(__global const double* delta_times,)CL" "\n"
+    R"CL(									const ulong num_parts,)CL" "\n"
+    R"CL(									__global double* out_values,)CL" "\n"
+    R"CL(									__global ulong* out_indices,)CL" "\n"
+    R"CL(									__local double* loc_values,)CL" "\n"
+    R"CL(									__local ulong* loc_indices))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	ulong n = NUM_PARTS(num_parts);)CL" "\n"
+    R"CL(	double best = INFINITY;)CL" "\n"
+    R"CL(	ulong best_idx = ULONG_MAX;)CL" "\n"
+    R"CL(	ulong count = n * n;)CL" "\n"
+    R"CL(	for (ulong k = get_global_id(0); k < count; k += get_global_size(0)))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		if (k / n < k % n))CL" "\n"
+    R"CL(			argmin_update(&best, &best_idx, delta_times[k], k);)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	argmin_group(best, best_idx, loc_values, loc_indices, out_values, out_indices);)CL" "\n"
+    R"CL(})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Following steps of the minimum search, over the results of the previous step)CL" "\n"
+    R"CL(__kernel void argmin_reduce(__global const double* values,)CL" "\n"
+    R"CL(							__global const ulong* indices,)CL" "\n"
+    R"CL(							const ulong count,)CL" "\n"
+    R"CL(							__global double* out_values,)CL" "\n"
+    R"CL(							__global ulong* out_indices,)CL" "\n"
+    R"CL(							__local double* loc_values,)CL" "\n"
+    R"CL(							__local ulong* loc_indices))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	double best = INFINITY;)CL" "\n"
+    R"CL(	ulong best_idx = ULONG_MAX;)CL" "\n"
+    R"CL(	for (ulong k = get_global_id(0); k < count; k += get_global_size(0)))CL" "\n"
+    R"CL(		argmin_update(&best, &best_idx, values[k], indices[k]);)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	argmin_group(best, best_idx, loc_values, loc_indices, out_values, out_indices);)CL" "\n"
+    R"CL(})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL()CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Index of the first couple of row i in the upper triangle, stored by rows)CL" "\n"
+    R"CL(inline ulong triangle_row_start(ulong i, ulong num_parts))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	return i * (2 * num_parts - i - 1) / 2;)CL" "\n"
+    R"CL(})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Collision times of the couples (i, j) with i < j only, each couple identified by its)CL" "\n"
+    R"CL(// index in the upper triangle stored by rows. The first step of the minimum search is)CL" "\n"
+    R"CL(// done here, so that the times are never stored.)CL" "\n"
+    R"CL(__kernel void part_collision_triangular(__global const double* pos,)CL" "\n"
+    R"CL(										__global const double* vel,)CL" "\n"
+    R"CL(										__global const double* radii,)CL" "\n"
+    R"CL(										const ulong num_parts,)CL" "\n"
+    R"CL(										const ulong stride,)CL" "\n"
+    R"CL(										__global double* out_values,)CL" "\n"
+    R"CL(										__global ulong* out_indices,)CL" "\n"
+    R"CL(										__local double* loc_values,)CL" "\n"
+    R"CL(										__local ulong* loc_indices))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	ulong parts = NUM_PARTS(num_parts);)CL" "\n"
+    R"CL(	double best = INFINITY;)CL" "\n"
+    R"CL(	ulong best_idx = ULONG_MAX;)CL" "\n"
+    R"CL(	ulong count = parts * (parts - 1) / 2;)CL" "\n"
+    R"CL(	double n = parts - 0.5;)CL" "\n"
+    R"CL(	for (ulong k = get_global_id(0); k < count; k += get_global_size(0)))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		// Invert triangle_row_start, then correct the rounding errors)CL" "\n"
+    R"CL(		ulong i = (ulong)(n - sqrt(fmax(0.0, n * n - 2.0 * k)));)CL" "\n"
+    R"CL(		if (i > parts - 2))CL" "\n"
+    R"CL(			i = parts - 2;)CL" "\n"
+    R"CL(		while (i > 0 && triangle_row_start(i, parts) > k))CL" "\n"
+    R"CL(			i--;)CL" "\n"
+    R"CL(		while (i < parts - 2 && triangle_row_start(i + 1, parts) <= k))CL" "\n"
+    R"CL(			i++;)CL" "\n"
+    R"CL(		ulong j = k - triangle_row_start(i, parts) + i + 1;)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(		argmin_update(&best, &best_idx, pair_collision_time(pos, vel, radii, stride, i, j), k);)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	argmin_group(best, best_idx, loc_values, loc_indices, out_values, out_indices);)CL" "\n"
+    R"CL(})CL" "\n"
+    ;
+
+static const char inelastic_batch_source[] =
+    R"CL(// Kernels of the on-device inelastic loop. This source is built together with part_collision.cl.)CL" "\n"
+    R"CL(// Each event is processed by inelastic_select, inelastic_advance and inelastic_resolve, after)CL" "\n"
+    R"CL(// the searches for the next wall and particle collisions, without any intervention of the host.)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(#define BATCH_EVENT_PART_COLLISION	0)CL" "\n"
+    R"CL(#define BATCH_EVENT_WALL_COLLISION	1)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Uniform mass baked by the build options (see CLRuntime::specialize))CL" "\n"
+    R"CL(#ifdef AHS_UNIFORM_MASS)CL" "\n"
+    R"CL(#define MASS(masses, i)			(AHS_UNIFORM_MASS))CL" "\n"
+    R"CL(#else)CL" "\n"
+    R"CL(#define MASS(masses, i)			((masses)[i]))CL" "\n"
+    R"CL(#endif)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Clock of the system, shared by all the events of the batches.)CL" "\n"
+    R"CL(// Must match the BatchClock structure of the host.)CL" "\n"
+    R"CL(typedef struct)CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	double time;)CL" "\n"
+    R"CL(	ulong count;)CL" "\n"
+    R"CL(	ulong done;)CL" "\n"
+    R"CL(} batch_clock;)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// An event resolved on the device, with the velocities of the particles after the resolution.)CL" "\n"
+    R"CL(// For a collision with a wall, j is equal to i. Must match the BatchRecord structure of the host.)CL" "\n"
+    R"CL(typedef struct)CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	double time;)CL" "\n"
+    R"CL(	double delta_time;)CL" "\n"
+    R"CL(	ulong type;)CL" "\n"
+    R"CL(	ulong i;)CL" "\n"
+    R"CL(	ulong j;)CL" "\n"
+    R"CL(	double vel_i[3];)CL" "\n"
+    R"CL(	double vel_j[3];)CL" "\n"
+    R"CL(} batch_record;)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Choose between the results of the two minimum searches and fill the time step, type and particles)CL" "\n"
+    R"CL(// of the event. The particle search is indexed as enumerated by the launch given by triangular.)CL" "\n"
+    R"CL(// Returns 0 without filling the event if neither collision will ever happen.)CL" "\n"
+    R"CL(inline int select_event(double wall_value,)CL" "\n"
+    R"CL(						ulong wall_index,)CL" "\n"
+    R"CL(						double part_value,)CL" "\n"
+    R"CL(						ulong part_index,)CL" "\n"
+    R"CL(						ulong num_parts,)CL" "\n"
+    R"CL(						int triangular,)CL" "\n"
+    R"CL(						batch_record* event))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	if (!isfinite(fmin(wall_value, part_value))))CL" "\n"
+    R"CL(		return 0;)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	if (wall_value < part_value))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		event->delta_time = wall_value;)CL" "\n"
+    R"CL(		event->type = BATCH_EVENT_WALL_COLLISION;)CL" "\n"
+    R"CL(		event->i = wall_index < num_parts ? wall_index : 0;)CL" "\n"
+    R"CL(		event->j = event->i;)CL" "\n"
+    R"CL(		return 1;)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	event->delta_time = part_value;)CL" "\n"
+    R"CL(	event->type = BATCH_EVENT_PART_COLLISION;)CL" "\n"
+    R"CL(	ulong k = part_index;)CL" "\n"
+    R"CL(	ulong count = triangular ? num_parts * (num_parts - 1) / 2 : num_parts * num_parts;)CL" "\n"
+    R"CL(	if (num_parts < 2 || k >= count))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		event->i = 0;)CL" "\n"
+    R"CL(		event->j = 0;)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL(	else if (triangular))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		double n = num_parts - 0.5;)CL" "\n"
+    R"CL(		ulong i = (ulong)(n - sqrt(fmax(0.0, n * n - 2.0 * k)));)CL" "\n"
+    R"CL(		if (i > num_parts - 2))CL" "\n"
+    R"CL(			i = num_parts - 2;)CL" "\n"
+    R"CL(		while (i > 0 && triangle_row_start(i, num_parts) > k))CL" "\n"
+    R"CL(			i--;)CL" "\n"
+    R"CL(		while (i < num_parts - 2 && triangle_row_start(i + 1, num_parts) <= k))CL" "\n"
+    R"CL(			i++;)CL" "\n"
+    R"CL(		event->i = i;)CL" "\n"
+    R"CL(		event->j = k - triangle_row_start(i, num_parts) + i + 1;)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL(	else)CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		event->i = k / num_parts;)CL" "\n"
+    R"CL(		event->j = k % num_parts;)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL(	return 1;)CL" "\n"
+    R"CL(})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Select the next event with select_event.)CL" "\n"
+    R"CL(// Once the time horizon is reached, or if no collision will ever happen, as the full-scan loop)CL" "\n"
+    R"CL(// stops, the clock is marked as done, and all the following steps do nothing.)CL" "\n"
+    R"CL(__kernel void inelastic_select(__global const double* wall_value,)CL" "\n"
+    R"CL(							   __global const ulong* wall_index,)CL" "\n"
+    R"CL(							   __global const double* part_value,)CL" "\n"
+    R"CL(							   __global const ulong* part_index,)CL" "\n"
+    R"CL(							   const ulong num_parts,)CL" "\n"
+    R"CL(							   const int triangular,)CL" "\n"
+    R"CL(							   const double max_time,)CL" "\n"
+    R"CL(							   __global batch_clock* clock,)CL" "\n"
+    R"CL(							   __global batch_record* event))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	if (get_global_id(0) != 0))CL" "\n"
+    R"CL(		return;)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	batch_record selected;)CL" "\n"
+    R"CL(	if (clock->done || clock->time >= max_time ||)CL" "\n"
+    R"CL(		!select_event(wall_value[0], wall_index[0], part_value[0], part_index[0], num_parts, triangular, &selected)))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		clock->done = 1;)CL" "\n"
+    R"CL(		event->delta_time = 0;)CL" "\n"
+    R"CL(		return;)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL(	event->delta_time = selected.delta_time;)CL" "\n"
+    R"CL(	event->type = selected.type;)CL" "\n"
+    R"CL(	event->i = selected.i;)CL" "\n"
+    R"CL(	event->j = selected.j;)CL" "\n"
+    R"CL(})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Same as pos_update, but the time step is read from the selected event)CL" "\n"
+    R"CL(__kernel void inelastic_advance(__global const double* pos,)CL" "\n"
+    R"CL(								__global const double* vel,)CL" "\n"
+    R"CL(								const ulong num_parts,)CL" "\n"
+    R"CL(								const ulong stride,)CL" "\n"
+    R"CL(								__global const batch_record* event,)CL" "\n"
+    R"CL(								__global double* out_pos))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	int i = get_global_id(0);)CL" "\n"
+    R"CL(	if (i < NUM_PARTS(num_parts)))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		double delta_time = fmax(0.0, event->delta_time);)CL" "\n"
+    R"CL(		out_pos[i] = pos[i] + delta_time * vel[i];)CL" "\n"
+    R"CL(		out_pos[stride + i] = pos[stride + i] + delta_time * vel[stride + i];)CL" "\n"
+    R"CL(		out_pos[2 * stride + i] = pos[2 * stride + i] + delta_time * vel[2 * stride + i];)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL(})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Resolve an event as resolve_wall_collision and resolve_inelastic_part_collision do on the host,)CL" "\n"
+    R"CL(// then advance the clock and fill the time and the velocities of the record. For a collision with)CL" "\n"
+    R"CL(// a wall, axis is the one found by wall_collision for the particle.)CL" "\n"
+    R"CL(inline void resolve_event(__global const double* pos,)CL" "\n"
+    R"CL(						  __global double* vel,)CL" "\n"
+    R"CL(						  const ulong stride,)CL" "\n"
+    R"CL(						  __global const double* masses,)CL" "\n"
+    R"CL(						  const double e,)CL" "\n"
+    R"CL(						  const int axis,)CL" "\n"
+    R"CL(						  __global batch_clock* clock,)CL" "\n"
+    R"CL(						  batch_record* event))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	ulong i = event->i;)CL" "\n"
+    R"CL(	ulong j = event->j;)CL" "\n"
+    R"CL(	if (event->type == BATCH_EVENT_WALL_COLLISION))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		// The collision inverts the component of the velocity along the axis)CL" "\n"
+    R"CL(		if (axis != 0))CL" "\n"
+    R"CL(		{)CL" "\n"
+    R"CL(			int k = (axis > 0 ? axis : -axis) - 1;)CL" "\n"
+    R"CL(			vel[k * stride + i] = -vel[k * stride + i];)CL" "\n"
+    R"CL(		})CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL(	else)CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		double pij[3], vij[3], inelastic[3], elastic[3];)CL" "\n"
+    R"CL(		for (int k = 0; k < 3; k++))CL" "\n"
+    R"CL(		{)CL" "\n"
+    R"CL(			pij[k] = pos[k * stride + i] - pos[k * stride + j];)CL" "\n"
+    R"CL(			vij[k] = vel[k * stride + i] - vel[k * stride + j];)CL" "\n"
+    R"CL(		})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(		// Inelastic component)CL" "\n"
+    R"CL(		for (int k = 0; k < 3; k++))CL" "\n"
+    R"CL(			inelastic[k] = (MASS(masses, i) * vel[k * stride + i] + MASS(masses, j) * vel[k * stride + j]) / (MASS(masses, i) + MASS(masses, j));)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(		// Elastic component)CL" "\n"
+    R"CL(		double pvij = pij[0] * vij[0] + pij[1] * vij[1] + pij[2] * vij[2];)CL" "\n"
+    R"CL(		double pij_norm2 = pij[0] * pij[0] + pij[1] * pij[1] + pij[2] * pij[2];)CL" "\n"
+    R"CL(		for (int k = 0; k < 3; k++))CL" "\n"
+    R"CL(			elastic[k] = e * (2 * pvij * pij[k] / pij_norm2 - vij[k]) / (MASS(masses, i) + MASS(masses, j));)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(		// Update the velocities)CL" "\n"
+    R"CL(		for (int k = 0; k < 3; k++))CL" "\n"
+    R"CL(		{)CL" "\n"
+    R"CL(			vel[k * stride + i] = inelastic[k] - MASS(masses, i) * elastic[k];)CL" "\n"
+    R"CL(			vel[k * stride + j] = inelastic[k] + MASS(masses, j) * elastic[k];)CL" "\n"
+    R"CL(		})CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	// Update the clock and complete the record)CL" "\n"
+    R"CL(	clock->time += fmax(0.0, event->delta_time);)CL" "\n"
+    R"CL(	event->time = clock->time;)CL" "\n"
+    R"CL(	for (int k = 0; k < 3; k++))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		event->vel_i[k] = vel[k * stride + i];)CL" "\n"
+    R"CL(		event->vel_j[k] = vel[k * stride + j];)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL(})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Resolve the selected event, then append its record to the ring buffer)CL" "\n"
+    R"CL(__kernel void inelastic_resolve(__global const double* pos,)CL" "\n"
+    R"CL(								__global double* vel,)CL" "\n"
+    R"CL(								const ulong stride,)CL" "\n"
+    R"CL(								__global const double* masses,)CL" "\n"
+    R"CL(								const double e,)CL" "\n"
+    R"CL(								__global const int* wall_axis,)CL" "\n"
+    R"CL(								__global batch_clock* clock,)CL" "\n"
+    R"CL(								__global batch_record* event,)CL" "\n"
+    R"CL(								__global batch_record* ring,)CL" "\n"
+    R"CL(								const ulong ring_size))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	if (get_global_id(0) != 0 || clock->done))CL" "\n"
+    R"CL(		return;)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	batch_record record = *event;)CL" "\n"
+    R"CL(	resolve_event(pos, vel, stride, masses, e, wall_axis[record.i], clock, &record);)CL" "\n"
+    R"CL(	*event = record;)CL" "\n"
+    R"CL(	ring[clock->count % ring_size] = record;)CL" "\n"
+    R"CL(	clock->count++;)CL" "\n"
+    R"CL(})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL()CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Time to the collision of particle i with a wall, and the axis of the wall, as found by wall_collision)CL" "\n"
+    R"CL(inline double wall_collision_time(__global const double* pos,)CL" "\n"
+    R"CL(								  __global const double* vel,)CL" "\n"
+    R"CL(								  __global const double* radii,)CL" "\n"
+    R"CL(								  ulong stride,)CL" "\n"
+    R"CL(								  __global const double* x_wall,)CL" "\n"
+    R"CL(								  __global const double* y_wall,)CL" "\n"
+    R"CL(								  __global const double* z_wall,)CL" "\n"
+    R"CL(								  ulong i,)CL" "\n"
+    R"CL(								  int* axis))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(#ifdef AHS_CONSTANT_WALLS)CL" "\n"
+    R"CL(	const double x_min = AHS_X_WALL_MIN, x_max = AHS_X_WALL_MAX;)CL" "\n"
+    R"CL(	const double y_min = AHS_Y_WALL_MIN, y_max = AHS_Y_WALL_MAX;)CL" "\n"
+    R"CL(	const double z_min = AHS_Z_WALL_MIN, z_max = AHS_Z_WALL_MAX;)CL" "\n"
+    R"CL(#else)CL" "\n"
+    R"CL(	const double x_min = x_wall[0], x_max = x_wall[1];)CL" "\n"
+    R"CL(	const double y_min = y_wall[0], y_max = y_wall[1];)CL" "\n"
+    R"CL(	const double z_min = z_wall[0], z_max = z_wall[1];)CL" "\n"
+    R"CL(#endif)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	double x = INFINITY;)CL" "\n"
+    R"CL(	if (vel[i] > 0))CL" "\n"
+    R"CL(		x = x_max - RADIUS(radii, i);)CL" "\n"
+    R"CL(	else if (vel[i] < 0))CL" "\n"
+    R"CL(		x = x_min + RADIUS(radii, i);)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	double y = INFINITY;)CL" "\n"
+    R"CL(	if (vel[stride + i] > 0))CL" "\n"
+    R"CL(		y = y_max - RADIUS(radii, i);)CL" "\n"
+    R"CL(	else if (vel[stride + i] < 0))CL" "\n"
+    R"CL(		y = y_min + RADIUS(radii, i);)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	double z = INFINITY;)CL" "\n"
+    R"CL(	if (vel[2 * stride + i] > 0))CL" "\n"
+    R"CL(		z = z_max - RADIUS(radii, i);)CL" "\n"
+    R"CL(	else if (vel[2 * stride + i] < 0))CL" "\n"
+    R"CL(		z = z_min + RADIUS(radii, i);)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	double delta_x = (x - pos[i]) / vel[i];)CL" "\n"
+    R"CL(	double delta_y = (y - pos[stride + i]) / vel[stride + i];)CL" "\n"
+    R"CL(	double delta_z = (z - pos[2 * stride + i]) / vel[2 * stride + i];)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	double delta_time = delta_x;)CL" "\n"
+    R"CL(	*axis = vel[i] < 0 ? -1 : 1;)CL" "\n"
+    R"CL(	if (delta_y < delta_time))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		delta_time = delta_y;)CL" "\n"
+    R"CL(		*axis = vel[stride + i] < 0 ? -2 : 2;)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL(	if (delta_z < delta_time))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		delta_time = delta_z;)CL" "\n"
+    R"CL(		*axis = vel[2 * stride + i] < 0 ? -3 : 3;)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL(	return delta_time;)CL" "\n"
+    R"CL(})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Reduce the values held by the work-group in local memory, as argmin_group does,)CL" "\n"
+    R"CL(// and give the result to all the work-items)CL" "\n"
+    R"CL(inline void argmin_local(double* best, ulong* best_idx,)CL" "\n"
+    R"CL(						 __local double* loc_values, __local ulong* loc_indices))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	int l = get_local_id(0);)CL" "\n"
+    R"CL(	loc_values[l] = *best;)CL" "\n"
+    R"CL(	loc_indices[l] = *best_idx;)CL" "\n"
+    R"CL(	barrier(CLK_LOCAL_MEM_FENCE);)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	for (int s = get_local_size(0) / 2; s > 0; s >>= 1))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		if (l < s))CL" "\n"
+    R"CL(		{)CL" "\n"
+    R"CL(			double value = loc_values[l];)CL" "\n"
+    R"CL(			ulong idx = loc_indices[l];)CL" "\n"
+    R"CL(			argmin_update(&value, &idx, loc_values[l + s], loc_indices[l + s]);)CL" "\n"
+    R"CL(			loc_values[l] = value;)CL" "\n"
+    R"CL(			loc_indices[l] = idx;)CL" "\n"
+    R"CL(		})CL" "\n"
+    R"CL(		barrier(CLK_LOCAL_MEM_FENCE);)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	*best = loc_values[0];)CL" "\n"
+    R"CL(	*best_idx = loc_indices[0];)CL" "\n"
+    R"CL(	// The local memory can be reused only once everyone has read the result)CL" "\n"
+    R"CL(	barrier(CLK_LOCAL_MEM_FENCE);)CL" "\n"
+    R"CL(})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Process up to batch_size events of each replica of an ensemble, that is of systems with the same)CL" "\n"
+    R"CL(// particles and walls but their own state and elasticity coefficient. Each replica is run by a)CL" "\n"
+    R"CL(// work-group, the replica index being the group index along the second dimension, so that a single)CL" "\n"
+    R"CL(// launch advances all of them. The events are found and resolved exactly as by the kernels above.)CL" "\n"
+    R"CL(// The replica r has its positions and velocities at 3 * r * stride, planar with the given stride,)CL" "\n"
+    R"CL(// and its clock at clocks[r]. The record of its c-th event is written at)CL" "\n"
+    R"CL(// (((c / batch_size) % 2) * num_replicas + r) * batch_size + c % batch_size, so that the records of)CL" "\n"
+    R"CL(// a batch of all the replicas are contiguous, and the batches alternate between two halves.)CL" "\n"
+    R"CL(__kernel void ensemble_batch(__global double* pos,)CL" "\n"
+    R"CL(							 __global double* vel,)CL" "\n"
+    R"CL(							 __global const double* radii,)CL" "\n"
+    R"CL(							 __global const double* masses,)CL" "\n"
+    R"CL(							 const ulong num_parts,)CL" "\n"
+    R"CL(							 const ulong stride,)CL" "\n"
+    R"CL(							 __global const double* x_wall,)CL" "\n"
+    R"CL(							 __global const double* y_wall,)CL" "\n"
+    R"CL(							 __global const double* z_wall,)CL" "\n"
+    R"CL(							 __global const double* elastic_coeffs,)CL" "\n"
+    R"CL(							 const double max_time,)CL" "\n"
+    R"CL(							 const ulong batch_size,)CL" "\n"
+    R"CL(							 __global batch_clock* clocks,)CL" "\n"
+    R"CL(							 __global batch_record* ring,)CL" "\n"
+    R"CL(							 __local double* loc_values,)CL" "\n"
+    R"CL(							 __local ulong* loc_indices))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	ulong r = get_group_id(1);)CL" "\n"
+    R"CL(	ulong num_replicas = get_num_groups(1);)CL" "\n"
+    R"CL(	ulong n = NUM_PARTS(num_parts);)CL" "\n"
+    R"CL(	ulong l = get_local_id(0);)CL" "\n"
+    R"CL(	ulong size = get_local_size(0);)CL" "\n"
+    R"CL(	__global double* p = pos + 3 * r * stride;)CL" "\n"
+    R"CL(	__global double* v = vel + 3 * r * stride;)CL" "\n"
+    R"CL(	__global batch_clock* clock = clocks + r;)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	for (ulong b = 0; b < batch_size; b++))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		// Only the first work-item changes the clock, and only after the barrier)CL" "\n"
+    R"CL(		int finished = clock->done || clock->time >= max_time;)CL" "\n"
+    R"CL(		barrier(CLK_GLOBAL_MEM_FENCE);)CL" "\n"
+    R"CL(		if (finished))CL" "\n"
+    R"CL(		{)CL" "\n"
+    R"CL(			if (l == 0))CL" "\n"
+    R"CL(				clock->done = 1;)CL" "\n"
+    R"CL(			return;)CL" "\n"
+    R"CL(		})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(		// Next collision with a wall, indexed by particle)CL" "\n"
+    R"CL(		double wall_value = INFINITY;)CL" "\n"
+    R"CL(		ulong wall_index = ULONG_MAX;)CL" "\n"
+    R"CL(		for (ulong i = l; i < n; i += size))CL" "\n"
+    R"CL(		{)CL" "\n"
+    R"CL(			int axis;)CL" "\n"
+    R"CL(			argmin_update(&wall_value, &wall_index, wall_collision_time(p, v, radii, stride, x_wall, y_wall, z_wall, i, &axis), i);)CL" "\n"
+    R"CL(		})CL" "\n"
+    R"CL(		argmin_local(&wall_value, &wall_index, loc_values, loc_indices);)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(		// Next collision between particles, indexed as in part_collision_argmin)CL" "\n"
+    R"CL(		double part_value = INFINITY;)CL" "\n"
+    R"CL(		ulong part_index = ULONG_MAX;)CL" "\n"
+    R"CL(		for (ulong k = l; k < n * n; k += size))CL" "\n"
+    R"CL(		{)CL" "\n"
+    R"CL(			ulong i = k / n;)CL" "\n"
+    R"CL(			ulong j = k % n;)CL" "\n"
+    R"CL(			if (i < j))CL" "\n"
+    R"CL(				argmin_update(&part_value, &part_index, pair_collision_time(p, v, radii, stride, i, j), k);)CL" "\n"
+    R"CL(		})CL" "\n"
+    R"CL(		argmin_local(&part_value, &part_index, loc_values, loc_indices);)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(		// Select the event as inelastic_select does. The time step is shared through the local memory.)CL" "\n"
+    R"CL(		// If no collision will ever happen, the replica is done and the particles stay still.)CL" "\n"
+    R"CL(		batch_record event;)CL" "\n"
+    R"CL(		int axis = 0;)CL" "\n"
+    R"CL(		if (l == 0))CL" "\n"
+    R"CL(		{)CL" "\n"
+    R"CL(			if (select_event(wall_value, wall_index, part_value, part_index, n, 0, &event)))CL" "\n"
+    R"CL(			{)CL" "\n"
+    R"CL(				if (event.type == BATCH_EVENT_WALL_COLLISION))CL" "\n"
+    R"CL(					wall_collision_time(p, v, radii, stride, x_wall, y_wall, z_wall, event.i, &axis);)CL" "\n"
+    R"CL(				loc_values[0] = event.delta_time;)CL" "\n"
+    R"CL(			})CL" "\n"
+    R"CL(			else)CL" "\n"
+    R"CL(			{)CL" "\n"
+    R"CL(				clock->done = 1;)CL" "\n"
+    R"CL(				loc_values[0] = 0;)CL" "\n"
+    R"CL(			})CL" "\n"
+    R"CL(		})CL" "\n"
+    R"CL(		barrier(CLK_LOCAL_MEM_FENCE);)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(		// Advance the particles as inelastic_advance does)CL" "\n"
+    R"CL(		double delta_time = fmax(0.0, loc_values[0]);)CL" "\n"
+    R"CL(		for (ulong i = l; i < n; i += size))CL" "\n"
+    R"CL(		{)CL" "\n"
+    R"CL(			p[i] = p[i] + delta_time * v[i];)CL" "\n"
+    R"CL(			p[stride + i] = p[stride + i] + delta_time * v[stride + i];)CL" "\n"
+    R"CL(			p[2 * stride + i] = p[2 * stride + i] + delta_time * v[2 * stride + i];)CL" "\n"
+    R"CL(		})CL" "\n"
+    R"CL(		barrier(CLK_GLOBAL_MEM_FENCE | CLK_LOCAL_MEM_FENCE);)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(		// Resolve the event and record it)CL" "\n"
+    R"CL(		if (l == 0 && !clock->done))CL" "\n"
+    R"CL(		{)CL" "\n"
+    R"CL(			resolve_event(p, v, stride, masses, elastic_coeffs[r], axis, clock, &event);)CL" "\n"
+    R"CL(			ulong c = clock->count;)CL" "\n"
+    R"CL(			ring[(((c / batch_size) % 2) * num_replicas + r) * batch_size + c % batch_size] = event;)CL" "\n"
+    R"CL(			clock->count++;)CL" "\n"
+    R"CL(		})CL" "\n"
+    R"CL(		barrier(CLK_GLOBAL_MEM_FENCE);)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL(})CL" "\n"
+    ;
+
+static const char domain_source[] =
+    R"CL(// Kernels of the multi-device backend. This source is built together with part_collision.cl.)CL" "\n"
+    R"CL(// Each device holds the particles of a slab of the box along the x axis and of its halo, in local)CL" "\n"
+    R"CL(// arrays. The particles are identified across the devices by their global index, held in gidx,)CL" "\n"
+    R"CL(// and each couple by the index of the global square matrix of the couples, so that the minimum)CL" "\n"
+    R"CL(// searches break the ties as on a single device.)CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Collision times of the local couples, with the first step of the minimum search as in)CL" "\n"
+    R"CL(// part_collision_argmin. Each couple is counted once, when the global index of the first particle)CL" "\n"
+    R"CL(// is the lowest.)CL" "\n"
+    R"CL(__kernel void domain_part_collision(__global const double* pos,)CL" "\n"
+    R"CL(									__global const double* vel,)CL" "\n"
+    R"CL(									__global const double* radii,)CL" "\n"
+    R"CL(									__global const ulong* gidx,)CL" "\n"
+    R"CL(									const ulong num_local,)CL" "\n"
+    R"CL(									const ulong stride,)CL" "\n"
+    R"CL(									const ulong num_parts,)CL" "\n"
+    R"CL(									__global double* out_values,)CL" "\n"
+    R"CL(									__global ulong* out_indices,)CL" "\n"
+    R"CL(									__local double* loc_values,)CL" "\n"
+    R"CL(									__local ulong* loc_indices))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	double best = INFINITY;)CL" "\n"
+    R"CL(	ulong best_idx = ULONG_MAX;)CL" "\n"
+    R"CL(	ulong count = num_local * num_local;)CL" "\n"
+    R"CL(	for (ulong k = get_global_id(0); k < count; k += get_global_size(0)))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		ulong a = k / num_local;)CL" "\n"
+    R"CL(		ulong b = k % num_local;)CL" "\n"
+    R"CL(		if (gidx[a] < gidx[b]))CL" "\n"
+    R"CL(			argmin_update(&best, &best_idx, pair_collision_time(pos, vel, radii, stride, a, b), gidx[a] * num_parts + gidx[b]);)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	argmin_group(best, best_idx, loc_values, loc_indices, out_values, out_indices);)CL" "\n"
+    R"CL(})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Same as domain_part_collision, but only for the couples of the local particle a)CL" "\n"
+    R"CL(__kernel void domain_particle_collision(__global const double* pos,)CL" "\n"
+    R"CL(										__global const double* vel,)CL" "\n"
+    R"CL(										__global const double* radii,)CL" "\n"
+    R"CL(										__global const ulong* gidx,)CL" "\n"
+    R"CL(										const ulong num_local,)CL" "\n"
+    R"CL(										const ulong stride,)CL" "\n"
+    R"CL(										const ulong num_parts,)CL" "\n"
+    R"CL(										const ulong a,)CL" "\n"
+    R"CL(										__global double* out_values,)CL" "\n"
+    R"CL(										__global ulong* out_indices,)CL" "\n"
+    R"CL(										__local double* loc_values,)CL" "\n"
+    R"CL(										__local ulong* loc_indices))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	double best = INFINITY;)CL" "\n"
+    R"CL(	ulong best_idx = ULONG_MAX;)CL" "\n"
+    R"CL(	for (ulong b = get_global_id(0); b < num_local; b += get_global_size(0)))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		if (b == a))CL" "\n"
+    R"CL(			continue;)CL" "\n"
+    R"CL(		ulong k = gidx[a] < gidx[b] ? gidx[a] * num_parts + gidx[b] : gidx[b] * num_parts + gidx[a];)CL" "\n"
+    R"CL(		argmin_update(&best, &best_idx, pair_collision_time(pos, vel, radii, stride, a, b), k);)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(	argmin_group(best, best_idx, loc_values, loc_indices, out_values, out_indices);)CL" "\n"
+    R"CL(})CL" "\n"
+    R"CL()CL" "\n"
+    R"CL(// Time at which each local particle crosses the next boundary of the regions in the direction of its)CL" "\n"
+    R"CL(// velocity along x. The particles of region r lie between boundaries[r - 1] and boundaries[r], and the)CL" "\n"
+    R"CL(// first and last regions are unbounded.)CL" "\n"
+    R"CL(__kernel void domain_crossing(__global const double* pos,)CL" "\n"
+    R"CL(							  __global const double* vel,)CL" "\n"
+    R"CL(							  __global const ulong* region,)CL" "\n"
+    R"CL(							  __global const double* boundaries,)CL" "\n"
+    R"CL(							  const ulong num_boundaries,)CL" "\n"
+    R"CL(							  const ulong num_local,)CL" "\n"
+    R"CL(							  __global double* delta_times))CL" "\n"
+    R"CL({)CL" "\n"
+    R"CL(	ulong a = get_global_id(0);)CL" "\n"
+    R"CL(	if (a < num_local))CL" "\n"
+    R"CL(	{)CL" "\n"
+    R"CL(		ulong r = region[a];)CL" "\n"
+    R"CL(		double delta_time = INFINITY;)CL" "\n"
+    R"CL(		if (vel[a] > 0 && r < num_boundaries))CL" "\n"
+    R"CL(			delta_time = (boundaries[r] - pos[a]) / vel[a];)CL" "\n"
+    R"CL(		else if (vel[a] < 0 && r > 0))CL" "\n"
+    R"CL(			delta_time = (boundaries[r - 1] - pos[a]) / vel[a];)CL" "\n"
+    R"CL(		delta_times[a] = delta_time;)CL" "\n"
+    R"CL(	})CL" "\n"
+    R"CL(})CL" "\n"
+    ;
@@ -2,34 +2,127 @@
 #include <string>
 #include <stdio.h>
 #include <chrono>
+#include <vector>
 
 #include "ahs.h"
 
 #define NAME_MAX_LEN    256
 
+// Parse the rows of values that follow the current line of the input file, and move the stream past them
+static bool read_given_rows(const InputFile& input, FILE* instream, size_t num_rows, size_t width,
+                            cl_double* values, const char* name)
+{
+    try
+    {
+        size_t end = input.read_rows(stream_tell(instream), num_rows, width, values, std::string(name));
+        stream_seek(instream, end);
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
 int main(int argc, char** argv)
 {
     std::cout << "Executing " << argv[0] << "..." << std::endl;
-    // Two arguments:
+    // Two positional arguments:
     // 1. A settings file
-    // 2. An output file
-    if (argc < 2)
+    // 2. An output file (optional)
+    // The option --backend NAME overrides the BACKEND setting of the input file.
+    // The option --device DEVICE overrides the AHS_DEVICE environment variable, and selects the OpenCL
+    // device by index or name, or by calibration with AUTO, without asking.
+    // The option --decompress INPUT OUTPUT decompresses a compressed output file, and exits.
+    // The option --resume continues the simulation from its checkpoint, appending to the output file.
+    // The option --write-binary FILE writes the model of the input file to FILE in the binary input format, and exits.
+    std::vector<std::string> args;
+    std::string backend_option;
+    std::string device_option = read_environment(DEVICE_ENV_VARIABLE);
+    std::string binary_option;
+    for (int a = 1; a < argc; a++)
+    {
+        if (strcmp(argv[a], "--backend") == 0)
+        {
+            if (a + 1 >= argc)
+            {
+                std::cerr << "Option --backend requires the name of a backend." << std::endl;
+                return 1;
+            }
+            backend_option = std::string(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--device") == 0)
+        {
+            if (a + 1 >= argc)
+            {
+                std::cerr << "Option --device requires an index, a name or " << DEVICE_SELECTION_AUTO << "." << std::endl;
+                return 1;
+            }
+            device_option = std::string(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--resume") == 0)
+            CLSettings::set_resume(true);
+        else if (strcmp(argv[a], "--write-binary") == 0)
+        {
+            if (a + 1 >= argc)
+            {
+                std::cerr << "Option --write-binary requires the name of the binary input file." << std::endl;
+                return 1;
+            }
+            binary_option = std::string(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--decompress") == 0)
+        {
+            if (a + 2 >= argc)
+            {
+                std::cerr << "Option --decompress requires a compressed file and an output file." << std::endl;
+                return 1;
+            }
+            try
+            {
+                decompress_file(std::string(argv[a + 1]), std::string(argv[a + 2]));
+            }
+            catch (std::exception& e)
+            {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
+            std::cout << "Decompressed " << argv[a + 1] << " to " << argv[a + 2] << std::endl;
+            return 0;
+        }
+        else
+            args.push_back(std::string(argv[a]));
+    }
+    if (args.size() < 1)
     {
         std::cerr << "Cannot execute AHSSimulation with less than one arguments." << std::endl;
         return 1;
     }
 
-    std::string inputfile(argv[1]);
+    std::string inputfile(args[0]);
     std::string outputfile;
 
-    // Input file must exists
+    // Input file must exists. It is read in binary mode, so that the offsets in the stream and in the
+    // mapped file agree.
     FILE* instream; 
-    fopen_s(&instream, inputfile.c_str(), "r");
+    fopen_s(&instream, inputfile.c_str(), "rb");
     if (instream == NULL)
     {
         std::cerr << "Cannot open file " << inputfile << " for reading." << std::endl;
         return 1;
     }
+    // The values of the particles are parsed from the file mapped in memory
+    InputFile* input;
+    try
+    {
+        input = new InputFile(inputfile);
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
 
     // Read the parameters
     std::cout << "Starting reading from file " << inputfile << std::endl;
@@ -49,272 +142,772 @@ int main(int argc, char** argv)
     char vecgenmode[NAME_MAX_LEN];
     int simtype;
     cl_double e;
-    cl_double threshold;
+    cl_double threshold = 0;
+    // Positions and velocities generated once the whole input is read
+    int placement = PLACEMENT_NONE;
+    bool maxwell_boltzmann = false;
+    // The event-driven engine finds the collisions without a backend
+    bool backend_given = !backend_option.empty();
+    // Replicas of the ensemble: the values of the elasticity coefficient swept, if any, and the
+    // number of replicas for each value
+    size_t sweep_count = 0;
+    cl_double sweep_first = 0;
+    cl_double sweep_last = 0;
+    size_t ensemble_replicas = 1;
 
     int status;
 
-    // Model name
-    status = fscanf_s(instream, "MODEL_NAME=%s%n\n", model_name, NAME_MAX_LEN, &model_name_len);
-    if (status == 0)
+    if (input->is_binary())
     {
-        std::cerr << "Error while reading model name." << std::endl;
-        return 1;
+        // Binary input, followed by the optional settings
+        try
+        {
+            size_t settings_offset = input->read_binary(model_name, &num_parts, &max_time, &e,
+                x_wall, y_wall, z_wall, &simtype, &threshold,
+                &positions, &velocities, &masses, &radii);
+            stream_seek(instream, settings_offset);
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
     }
     else
-        model_name[model_name_len] = 0;
-
-    // Number of particles
-    fscanf_s(instream, "NUM_PARTS=%llu\n", &num_parts);
-    if (status == 0)
     {
-        std::cerr << "Error while reading the number of particles." << std::endl;
-        return 1;
-    }
+        // Model name
+        status = fscanf_s(instream, "MODEL_NAME=%s%n\n", model_name, NAME_MAX_LEN, &model_name_len);
+        if (status == 0)
+        {
+            std::cerr << "Error while reading model name." << std::endl;
+            return 1;
+        }
+        else
+            model_name[model_name_len] = 0;
 
-    // Time horizon
-    status = fscanf_s(instream, "STOP_TIME=%lf\n", &max_time);
-    if (status == 0)
-    {
-        std::cerr << "Error while reading the time horizon." << std::endl;
-        return 1;
-    }
-    if (max_time <= 0)
-    {
-        std::cerr << "The time horizon must be a strictly positive real value. Given value is " << max_time << std::endl;
-        return 1;
-    }
+        // Number of particles
+        fscanf_s(instream, "NUM_PARTS=%llu\n", &num_parts);
+        if (status == 0)
+        {
+            std::cerr << "Error while reading the number of particles." << std::endl;
+            return 1;
+        }
 
-    // Elasticity coefficient
-    status = fscanf_s(instream, "ELASTIC_COEFF=%lf\n", &e);
-    if (status == 0)
-    {
-        std::cerr << "Error while reading the elasticity coefficient for the collisions." << std::endl;
-        return 1;
-    }
-    else if (e < 0 || e > 1)
-    {
-        std::cerr << "Invalid value for the elasticity coefficient." << std::endl;
-        std::cerr << "Legal values are in the interval [0, 1]. Given value is " << e << std::endl;
-        return 1;
-    }
+        // Time horizon
+        status = fscanf_s(instream, "STOP_TIME=%lf\n", &max_time);
+        if (status == 0)
+        {
+            std::cerr << "Error while reading the time horizon." << std::endl;
+            return 1;
+        }
+        if (max_time <= 0)
+        {
+            std::cerr << "The time horizon must be a strictly positive real value. Given value is " << max_time << std::endl;
+            return 1;
+        }
 
-    // X walls
-    status = fscanf_s(instream, "X_WALL=%lf, %lf\n", x_wall, x_wall + 1);
-    if (status == 0)
-    {
-        std::cerr << "Error while reading the values for walls along the X axis." << std::endl;
-        return 1;
-    }
-    // Y walls
-    status = fscanf_s(instream, "Y_WALL=%lf, %lf\n", y_wall, y_wall + 1);
-    if (status == 0)
-    {
-        std::cerr << "Error while reading the values for walls along the Y axis." << std::endl;
-        return 1;
-    }
-    // Z walls
-    status = fscanf_s(instream, "Z_WALL=%lf, %lf\n", z_wall, z_wall + 1);
-    if (status == 0)
-    {
-        std::cerr << "Error while reading the values for walls along the Z axis." << std::endl;
-        return 1;
-    }
+        // Elasticity coefficient
+        status = fscanf_s(instream, "ELASTIC_COEFF=%lf\n", &e);
+        if (status == 0)
+        {
+            std::cerr << "Error while reading the elasticity coefficient for the collisions." << std::endl;
+            return 1;
+        }
+        else if (e < 0 || e > 1)
+        {
+            std::cerr << "Invalid value for the elasticity coefficient." << std::endl;
+            std::cerr << "Legal values are in the interval [0, 1]. Given value is " << e << std::endl;
+            return 1;
+        }
 
-    // Simulation type
-    status = fscanf_s(instream, "SIM_TYPE=%s\n", simname, NAME_MAX_LEN);
-    if (status == 0)
-    {
-        std::cerr << "Error while reading the simulation type." << std::endl;
-        return 1;
-    }
-    if (strcmp(simname, "INELASTIC") == 0)
-        simtype = 0;
-    else if (strcmp(simname, "FUSION") == 0)
-        simtype = 1;
-    else if (strcmp(simname, "FISSION") == 0)
-        simtype = 2;
-    else
-    {
-        std::cerr << "Invalid value for the simulation type." << std::endl;
-        std::cerr << "Legal values are \"INELASTIC\", \"FUSION\" and \"FISSION\". Given value is " << simname << std::endl;
-        return 1;
-    }
+        // X walls
+        status = fscanf_s(instream, "X_WALL=%lf, %lf\n", x_wall, x_wall + 1);
+        if (status == 0)
+        {
+            std::cerr << "Error while reading the values for walls along the X axis." << std::endl;
+            return 1;
+        }
+        // Y walls
+        status = fscanf_s(instream, "Y_WALL=%lf, %lf\n", y_wall, y_wall + 1);
+        if (status == 0)
+        {
+            std::cerr << "Error while reading the values for walls along the Y axis." << std::endl;
+            return 1;
+        }
+        // Z walls
+        status = fscanf_s(instream, "Z_WALL=%lf, %lf\n", z_wall, z_wall + 1);
+        if (status == 0)
+        {
+            std::cerr << "Error while reading the values for walls along the Z axis." << std::endl;
+            return 1;
+        }
 
-    // Possibly, the threshold
-    if (simtype > 0)
-    {
-        status = fscanf_s(instream, "THRESHOLD=%lf\n", &threshold);
+        // Simulation type
+        status = fscanf_s(instream, "SIM_TYPE=%s\n", simname, NAME_MAX_LEN);
         if (status == 0)
         {
-            std::cerr << "Error while reading the threshold." << std::endl;
+            std::cerr << "Error while reading the simulation type." << std::endl;
             return 1;
         }
-        if (threshold < 0)
+        if (strcmp(simname, "INELASTIC") == 0)
+            simtype = 0;
+        else if (strcmp(simname, "FUSION") == 0)
+            simtype = 1;
+        else if (strcmp(simname, "FISSION") == 0)
+            simtype = 2;
+        else
         {
-            std::cerr << "Threshold value for enabling fusion or fission must be a non-negative real value." << std::endl;
-            std::cerr << "Given value is " << threshold << std::endl;
+            std::cerr << "Invalid value for the simulation type." << std::endl;
+            std::cerr << "Legal values are \"INELASTIC\", \"FUSION\" and \"FISSION\". Given value is " << simname << std::endl;
             return 1;
         }
-    }
 
-    // Positions
-    status = fscanf_s(instream, "POSITIONS=%s\n", vecgenmode, NAME_MAX_LEN);
-    if (status == 0)
-    {
-        std::cerr << "Error while reading the position input mode." << std::endl;
-        return 1;
-    }
-    positions = (cl_double*)calloc(3 * num_parts, sizeof(cl_double));
-    if (positions == NULL)
-    {
-        std::cerr << "Error while allocating space for position vectors." << std::endl;
-        return 1;
-    }
-    if (strcmp(vecgenmode, "RANDOM") == 0)
-    {
-        for (size_t i = 0; i < 3 * num_parts; i++)
-            positions[i] = ((cl_double)rand()) / RAND_MAX;
+        // Possibly, the threshold
+        if (simtype > 0)
+        {
+            status = fscanf_s(instream, "THRESHOLD=%lf\n", &threshold);
+            if (status == 0)
+            {
+                std::cerr << "Error while reading the threshold." << std::endl;
+                return 1;
+            }
+            if (threshold < 0)
+            {
+                std::cerr << "Threshold value for enabling fusion or fission must be a non-negative real value." << std::endl;
+                std::cerr << "Given value is " << threshold << std::endl;
+                return 1;
+            }
+        }
+
+        // Positions
+        status = fscanf_s(instream, "POSITIONS=%s\n", vecgenmode, NAME_MAX_LEN);
+        if (status == 0)
+        {
+            std::cerr << "Error while reading the position input mode." << std::endl;
+            return 1;
+        }
+        positions = (cl_double*)calloc(3 * num_parts, sizeof(cl_double));
+        if (positions == NULL)
+        {
+            std::cerr << "Error while allocating space for position vectors." << std::endl;
+            return 1;
+        }
+        if (strcmp(vecgenmode, "RANDOM") == 0)
+        {
+            for (size_t i = 0; i < 3 * num_parts; i++)
+                positions[i] = ((cl_double)rand()) / RAND_MAX;
+        }
+        else if (strcmp(vecgenmode, "GIVEN") == 0)
+        {
+            if (!read_given_rows(*input, instream, num_parts, 3, positions, "position vector"))
+                return 1;
+        }
+        else if (strcmp(vecgenmode, "NON_OVERLAPPING") == 0)
+            placement = PLACEMENT_NON_OVERLAPPING;
+        else if (strcmp(vecgenmode, "LATTICE") == 0)
+            placement = PLACEMENT_LATTICE;
+        else
+        {
+            std::cerr << "Invalid value for the positions input mode." << std::endl;
+            std::cerr << "Legal values are \"RANDOM\", \"GIVEN\", \"NON_OVERLAPPING\" and \"LATTICE\". Given value is " << vecgenmode << std::endl;
+            return 1;
+        }
+    
+        // Velocities
+        status = fscanf_s(instream, "VELOCITIES=%s\n", vecgenmode, NAME_MAX_LEN);
+        if (status == 0)
+        {
+            std::cerr << "Error while reading the velocity input mode." << std::endl;
+            return 1;
+        }
+        velocities = (cl_double*)calloc(3 * num_parts, sizeof(cl_double));
+        if (velocities == NULL)
+        {
+            std::cerr << "Error while allocating space for velocity vectors." << std::endl;
+            return 1;
+        }
+        if (strcmp(vecgenmode, "RANDOM") == 0)
+        {
+            for (size_t i = 0; i < 3 * num_parts; i++)
+                velocities[i] = ((cl_double)rand()) / RAND_MAX;
+        }
+        else if (strcmp(vecgenmode, "GIVEN") == 0)
+        {
+            if (!read_given_rows(*input, instream, num_parts, 3, velocities, "velocity vector"))
+                return 1;
+        }
+        else if (strcmp(vecgenmode, "MAXWELL_BOLTZMANN") == 0)
+            maxwell_boltzmann = true;
+        else
+        {
+            std::cerr << "Invalid value for the velocity input mode." << std::endl;
+            std::cerr << "Legal values are \"RANDOM\", \"GIVEN\" and \"MAXWELL_BOLTZMANN\". Given value is " << vecgenmode << std::endl;
+            return 1;
+        }
+    
+        // Masses
+        status = fscanf_s(instream, "MASSES=%s\n", vecgenmode, NAME_MAX_LEN);
+        if (status == 0)
+        {
+            std::cerr << "Error while reading the masses input mode." << std::endl;
+            return 1;
+        }
+        masses = (cl_double*)calloc(num_parts, sizeof(cl_double));
+        if (masses == NULL)
+        {
+            std::cerr << "Error while allocating space for mass values." << std::endl;
+            return 1;
+        }
+        if (strcmp(vecgenmode, "RANDOM") == 0)
+        {
+            for (size_t i = 0; i < num_parts; i++)
+                masses[i] = (((cl_double)rand()) / RAND_MAX) * 0.9 + 0.1;
+        }
+        else if (strcmp(vecgenmode, "GIVEN") == 0)
+        {
+            if (!read_given_rows(*input, instream, num_parts, 1, masses, "mass value"))
+                return 1;
+            for (size_t i = 0; i < num_parts; i++)
+            {
+                if (masses[i] <= 0)
+                {
+                    std::cerr << "Masses must be strictly positive real values." << std::endl;
+                    std::cerr << "Given value for the " << i << "-th mass is " << masses[i] << std::endl;
+                    return 1;
+                }
+            }
+        }
+        else
+        {
+            std::cerr << "Invalid value for the mass input mode." << std::endl;
+            std::cerr << "Legal values are \"RANDOM\" and \"GIVEN\". Given value is " << vecgenmode << std::endl;
+            return 1;
+        }
+    
+        // Radii
+        status = fscanf_s(instream, "RADII=%s\n", vecgenmode, NAME_MAX_LEN);
+        if (status == 0)
+        {
+            std::cerr << "Error while reading the radii input mode." << std::endl;
+            return 1;
+        }
+        radii = (cl_double*)calloc(num_parts, sizeof(cl_double));
+        if (radii == NULL)
+        {
+            std::cerr << "Error while allocating space for radius values." << std::endl;
+            return 1;
+        }
+        if (strcmp(vecgenmode, "RANDOM") == 0)
+        {
+            for (size_t i = 0; i < num_parts; i++)
+                radii[i] = (((cl_double)rand()) / RAND_MAX) * 0.9 + 0.1;
+        }
+        else if (strcmp(vecgenmode, "GIVEN") == 0)
+        {
+            if (!read_given_rows(*input, instream, num_parts, 1, radii, "radius value"))
+                return 1;
+            for (size_t i = 0; i < num_parts; i++)
+            {
+                if (radii[i] <= 0)
+                {
+                    std::cerr << "Radii must be strictly positive real values." << std::endl;
+                    std::cerr << "Given value for the " << i << "-th radius is " << radii[i] << std::endl;
+                    return 1;
+                }
+            }
+        }
+        else
+        {
+            std::cerr << "Invalid value for the radius input mode." << std::endl;
+            std::cerr << "Legal values are \"RANDOM\" and \"GIVEN\". Given value is " << vecgenmode << std::endl;
+            return 1;
+        }
     }
-    else if (strcmp(vecgenmode, "GIVEN") == 0)
+
+    // Optional settings, one KEY=VALUE pair per line
+    size_t settings_offset = stream_tell(instream);
+    char key[NAME_MAX_LEN];
+    char value[NAME_MAX_LEN];
+    while (fscanf_s(instream, "%[^=]=%s\n", key, NAME_MAX_LEN, value, NAME_MAX_LEN) == 2)
     {
-        for (size_t i = 0; i < num_parts; i++)
+        if (strcmp(key, "ENGINE") == 0)
         {
-            status = fscanf_s(instream, "%lf, %lf, %lf\n", positions + 3 * i, positions + 3 * i + 1, positions + 3 * i + 2);
-            if (status == 0)
+            if (strcmp(value, "FULL_SCAN") == 0)
+                CLSettings::set_engine(ENGINE_FULL_SCAN);
+            else if (strcmp(value, "EVENT_DRIVEN") == 0)
+                CLSettings::set_engine(ENGINE_EVENT_DRIVEN);
+            else if (strcmp(value, "DEVICE_BATCH") == 0)
+                CLSettings::set_engine(ENGINE_DEVICE_BATCH);
+            else if (strcmp(value, "ENSEMBLE") == 0)
+                CLSettings::set_engine(ENGINE_ENSEMBLE);
+            else
             {
-                std::cerr << "Error while reading the " << i << "-th position vector." << std::endl;
+                std::cerr << "Invalid value for the simulation engine." << std::endl;
+                std::cerr << "Legal values are \"FULL_SCAN\", \"EVENT_DRIVEN\", \"DEVICE_BATCH\" and \"ENSEMBLE\". Given value is " << value << std::endl;
                 return 1;
             }
         }
+        else if (strcmp(key, "BROADPHASE") == 0)
+        {
+            if (strcmp(value, "ALL_PAIRS") == 0)
+                CLSettings::set_broadphase(BROADPHASE_ALL_PAIRS);
+            else if (strcmp(value, "CELL_LIST") == 0)
+                CLSettings::set_broadphase(BROADPHASE_CELL_LIST);
+            else
+            {
+                std::cerr << "Invalid value for the broadphase." << std::endl;
+                std::cerr << "Legal values are \"ALL_PAIRS\" and \"CELL_LIST\". Given value is " << value << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(key, "STATE_UPDATE") == 0)
+        {
+            if (strcmp(value, "EAGER") == 0)
+                CLSettings::set_state_update(STATE_UPDATE_EAGER);
+            else if (strcmp(value, "DELAYED") == 0)
+                CLSettings::set_state_update(STATE_UPDATE_DELAYED);
+            else
+            {
+                std::cerr << "Invalid value for the state update mode." << std::endl;
+                std::cerr << "Legal values are \"EAGER\" and \"DELAYED\". Given value is " << value << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(key, "PAIR_LAUNCH") == 0)
+        {
+            if (strcmp(value, "SQUARE") == 0)
+                CLSettings::set_pair_launch(PAIR_LAUNCH_SQUARE);
+            else if (strcmp(value, "TRIANGULAR") == 0)
+                CLSettings::set_pair_launch(PAIR_LAUNCH_TRIANGULAR);
+            else
+            {
+                std::cerr << "Invalid value for the pair launch mode." << std::endl;
+                std::cerr << "Legal values are \"SQUARE\" and \"TRIANGULAR\". Given value is " << value << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(key, "BACKEND") == 0)
+        {
+            if (!BackendRegistry::contains(value))
+            {
+                std::cerr << "Invalid value for the compute backend." << std::endl;
+                std::cerr << "Legal values are " << BackendRegistry::names() << ". Given value is " << value << std::endl;
+                return 1;
+            }
+            CLSettings::set_backend(std::string(value));
+            backend_given = true;
+        }
+        else if (strcmp(key, "DEVICES") == 0)
+        {
+            if (strcmp(value, DEVICES_ALL) != 0 && strcmp(value, DEVICES_NUMA) != 0 &&
+                (value[0] == '\0' || strspn(value, "0123456789,") != strlen(value)))
+            {
+                std::cerr << "Invalid value for the devices of the multi-device backend." << std::endl;
+                std::cerr << "Legal values are \"" << DEVICES_ALL << "\", \"" << DEVICES_NUMA
+                          << "\" and comma-separated device indices. Given value is " << value << std::endl;
+                return 1;
+            }
+            CLSettings::set_devices(std::string(value));
+        }
+        else if (strcmp(key, "SPECIALIZE") == 0)
+        {
+            if (strcmp(value, "ON") == 0)
+                CLSettings::set_specialize(SPECIALIZE_ON);
+            else if (strcmp(value, "OFF") == 0)
+                CLSettings::set_specialize(SPECIALIZE_OFF);
+            else
+            {
+                std::cerr << "Invalid value for the kernel specialization." << std::endl;
+                std::cerr << "Legal values are \"ON\" and \"OFF\". Given value is " << value << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(key, "THREADS") == 0)
+        {
+            long long num_threads = atoll(value);
+            if (num_threads < 0)
+            {
+                std::cerr << "The number of threads must be a non-negative integer." << std::endl;
+                std::cerr << "Given value is " << value << std::endl;
+                return 1;
+            }
+            CLSettings::set_num_threads((size_t)num_threads);
+        }
+        else if (strcmp(key, "BATCH_SIZE") == 0)
+        {
+            long long batch_size = atoll(value);
+            if (batch_size <= 0)
+            {
+                std::cerr << "The batch size must be a strictly positive integer." << std::endl;
+                std::cerr << "Given value is " << value << std::endl;
+                return 1;
+            }
+            CLSettings::set_batch_size((size_t)batch_size);
+        }
+        else if (strcmp(key, "OUTPUT_FORMAT") == 0)
+        {
+            if (strcmp(value, "FRAMES") == 0)
+                CLSettings::set_output_format(OUTPUT_FORMAT_FRAMES);
+            else if (strcmp(value, "EVENT_LOG") == 0)
+                CLSettings::set_output_format(OUTPUT_FORMAT_EVENT_LOG);
+            else
+            {
+                std::cerr << "Invalid value for the output format." << std::endl;
+                std::cerr << "Legal values are \"FRAMES\" and \"EVENT_LOG\". Given value is " << value << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(key, "KEYFRAME_INTERVAL") == 0)
+        {
+            long long keyframe_interval = atoll(value);
+            if (keyframe_interval < 0)
+            {
+                std::cerr << "The keyframe interval must be a non-negative integer." << std::endl;
+                std::cerr << "Given value is " << value << std::endl;
+                return 1;
+            }
+            CLSettings::set_keyframe_interval((size_t)keyframe_interval);
+        }
+        else if (strcmp(key, "SNAPSHOT_INTERVAL") == 0)
+        {
+            cl_double snapshot_interval = atof(value);
+            if (snapshot_interval < 0)
+            {
+                std::cerr << "The snapshot interval must be a non-negative real number." << std::endl;
+                std::cerr << "Given value is " << value << std::endl;
+                return 1;
+            }
+            CLSettings::set_snapshot_interval(snapshot_interval);
+        }
+        else if (strcmp(key, "MAX_FRAMES") == 0)
+        {
+            long long max_frames = atoll(value);
+            if (max_frames < 0)
+            {
+                std::cerr << "The maximum number of frames must be a non-negative integer." << std::endl;
+                std::cerr << "Given value is " << value << std::endl;
+                return 1;
+            }
+            CLSettings::set_max_frames((size_t)max_frames);
+        }
+        else if (strcmp(key, "OUTPUT_BUFFERS") == 0)
+        {
+            long long output_buffers = atoll(value);
+            if (output_buffers <= 0)
+            {
+                std::cerr << "The number of output buffers must be a strictly positive integer." << std::endl;
+                std::cerr << "Given value is " << value << std::endl;
+                return 1;
+            }
+            CLSettings::set_output_buffers((size_t)output_buffers);
+        }
+        else if (strcmp(key, "OUTPUT_BUFFER_SIZE") == 0)
+        {
+            long long output_buffer_size = atoll(value);
+            if (output_buffer_size <= 0)
+            {
+                std::cerr << "The size of the output buffers must be a strictly positive integer." << std::endl;
+                std::cerr << "Given value is " << value << std::endl;
+                return 1;
+            }
+            // Given in KiB
+            CLSettings::set_output_buffer_size((size_t)output_buffer_size << 10);
+        }
+        else if (strcmp(key, "OUTPUT_INDEX") == 0)
+        {
+            if (strcmp(value, "ON") == 0)
+                CLSettings::set_output_index(OUTPUT_INDEX_ON);
+            else if (strcmp(value, "OFF") == 0)
+                CLSettings::set_output_index(OUTPUT_INDEX_OFF);
+            else
+            {
+                std::cerr << "Invalid value for the output index." << std::endl;
+                std::cerr << "Legal values are \"ON\" and \"OFF\". Given value is " << value << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(key, "OUTPUT_COMPRESSION") == 0)
+        {
+            if (strcmp(value, "SHUFFLE") == 0)
+                CLSettings::set_output_compression(OUTPUT_COMPRESSION_SHUFFLE);
+            else if (strcmp(value, "OFF") == 0)
+                CLSettings::set_output_compression(OUTPUT_COMPRESSION_OFF);
+            else
+            {
+                std::cerr << "Invalid value for the output compression." << std::endl;
+                std::cerr << "Legal values are \"SHUFFLE\" and \"OFF\". Given value is " << value << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(key, "COMPRESSION_THREADS") == 0)
+        {
+            long long compression_threads = atoll(value);
+            if (compression_threads <= 0)
+            {
+                std::cerr << "The number of compression threads must be a strictly positive integer." << std::endl;
+                std::cerr << "Given value is " << value << std::endl;
+                return 1;
+            }
+            CLSettings::set_compression_threads((size_t)compression_threads);
+        }
+        else if (strcmp(key, "CHECKPOINT_INTERVAL") == 0)
+        {
+            long long checkpoint_interval = atoll(value);
+            if (checkpoint_interval < 0)
+            {
+                std::cerr << "The checkpoint interval must be a non-negative integer." << std::endl;
+                std::cerr << "Given value is " << value << std::endl;
+                return 1;
+            }
+            CLSettings::set_checkpoint_interval((size_t)checkpoint_interval);
+        }
+        else if (strcmp(key, "CHECKPOINT_FILE") == 0)
+            CLSettings::set_checkpoint_file(std::string(value));
+        else if (strcmp(key, "SEED") == 0)
+        {
+            long long seed = atoll(value);
+            if (seed < 0)
+            {
+                std::cerr << "The seed must be a non-negative integer." << std::endl;
+                std::cerr << "Given value is " << value << std::endl;
+                return 1;
+            }
+            CLSettings::set_seed((size_t)seed);
+        }
+        else if (strcmp(key, "TEMPERATURE") == 0)
+        {
+            cl_double temperature = atof(value);
+            if (temperature <= 0)
+            {
+                std::cerr << "The temperature must be a strictly positive real number." << std::endl;
+                std::cerr << "Given value is " << value << std::endl;
+                return 1;
+            }
+            CLSettings::set_temperature(temperature);
+        }
+        else if (strcmp(key, "PACKING_FRACTION") == 0)
+        {
+            cl_double packing_fraction = atof(value);
+            if (packing_fraction <= 0 || packing_fraction >= 1)
+            {
+                std::cerr << "The packing fraction must be a real number between 0 and 1, excluded." << std::endl;
+                std::cerr << "Given value is " << value << std::endl;
+                return 1;
+            }
+            CLSettings::set_packing_fraction(packing_fraction);
+        }
+        else if (strcmp(key, "ENSEMBLE_ELASTIC_COEFF") == 0)
+        {
+            // The first and last values, and the number of values evenly spaced between them
+            long long count = 0;
+            if (sscanf_s(value, "%lf:%lf:%lld", &sweep_first, &sweep_last, &count) != 3 || count <= 0)
+            {
+                std::cerr << "The sweep of the elasticity coefficient must be given as FIRST:LAST:COUNT, with a strictly positive count." << std::endl;
+                std::cerr << "Given value is " << value << std::endl;
+                return 1;
+            }
+            if (sweep_first < 0 || sweep_first > 1 || sweep_last < 0 || sweep_last > 1)
+            {
+                std::cerr << "Invalid value for the sweep of the elasticity coefficient." << std::endl;
+                std::cerr << "Legal values are in the interval [0, 1]. Given value is " << value << std::endl;
+                return 1;
+            }
+            sweep_count = (size_t)count;
+        }
+        else if (strcmp(key, "ENSEMBLE_REPLICAS") == 0)
+        {
+            long long replicas = atoll(value);
+            if (replicas <= 0)
+            {
+                std::cerr << "The number of replicas must be a strictly positive integer." << std::endl;
+                std::cerr << "Given value is " << value << std::endl;
+                return 1;
+            }
+            ensemble_replicas = (size_t)replicas;
+        }
+        else if (strcmp(key, "OUTPUT_DIRECT") == 0)
+        {
+            if (strcmp(value, "ON") == 0)
+                CLSettings::set_output_direct(OUTPUT_DIRECT_ON);
+            else if (strcmp(value, "OFF") == 0)
+                CLSettings::set_output_direct(OUTPUT_DIRECT_OFF);
+            else
+            {
+                std::cerr << "Invalid value for the direct output." << std::endl;
+                std::cerr << "Legal values are \"ON\" and \"OFF\". Given value is " << value << std::endl;
+                return 1;
+            }
+        }
+        else
+        {
+            std::cerr << "Unknown setting " << key << " in the input file." << std::endl;
+            return 1;
+        }
     }
-    else
+
+    // The command line has the precedence over the input file
+    if (!backend_option.empty())
     {
-        std::cerr << "Invalid value for the positions input mode." << std::endl;
-        std::cerr << "Legal values are \"RANDOM\" and \"GIVEN\". Given value is " << vecgenmode << std::endl;
+        if (!BackendRegistry::contains(backend_option))
+        {
+            std::cerr << "Invalid value for the compute backend." << std::endl;
+            std::cerr << "Legal values are " << BackendRegistry::names() << ". Given value is " << backend_option << std::endl;
+            return 1;
+        }
+        CLSettings::set_backend(backend_option);
+    }
+    Backend* backend = BackendRegistry::create(CLSettings::get_backend());
+
+    if (CLSettings::get_broadphase() == BROADPHASE_CELL_LIST && CLSettings::get_engine() != ENGINE_EVENT_DRIVEN)
+    {
+        std::cerr << "The cell list broadphase requires the event-driven engine." << std::endl;
         return 1;
     }
-    
-    // Velocities
-    status = fscanf_s(instream, "VELOCITIES=%s\n", vecgenmode, NAME_MAX_LEN);
-    if (status == 0)
+    if (CLSettings::get_state_update() == STATE_UPDATE_DELAYED && CLSettings::get_engine() != ENGINE_EVENT_DRIVEN)
     {
-        std::cerr << "Error while reading the velocity input mode." << std::endl;
+        std::cerr << "The delayed state update requires the event-driven engine." << std::endl;
         return 1;
     }
-    velocities = (cl_double*)calloc(3 * num_parts, sizeof(cl_double));
-    if (velocities == NULL)
+    if (backend_given && CLSettings::get_engine() == ENGINE_EVENT_DRIVEN)
     {
-        std::cerr << "Error while allocating space for velocity vectors." << std::endl;
+        std::cerr << "The event-driven engine does not use a compute backend." << std::endl;
         return 1;
     }
-    if (strcmp(vecgenmode, "RANDOM") == 0)
+    if (CLSettings::get_engine() == ENGINE_DEVICE_BATCH && simtype != 0)
     {
-        for (size_t i = 0; i < 3 * num_parts; i++)
-            velocities[i] = ((cl_double)rand()) / RAND_MAX;
+        std::cerr << "The on-device batch engine supports only the inelastic model." << std::endl;
+        return 1;
     }
-    else if (strcmp(vecgenmode, "GIVEN") == 0)
+    if (CLSettings::get_engine() == ENGINE_DEVICE_BATCH && !backend->uses_opencl())
     {
-        for (size_t i = 0; i < num_parts; i++)
-        {
-            status = fscanf_s(instream, "%lf, %lf, %lf\n", velocities + 3 * i, velocities + 3 * i + 1, velocities + 3 * i + 2);
-            if (status == 0)
-            {
-                std::cerr << "Error while reading the " << i << "-th velocity vector." << std::endl;
-                return 1;
-            }
-        }
+        std::cerr << "The on-device batch engine requires an OpenCL backend." << std::endl;
+        return 1;
     }
-    else
+
+    if (CLSettings::get_engine() == ENGINE_DEVICE_BATCH && (CLSettings::get_checkpoint_interval() > 0 || CLSettings::get_resume()))
     {
-        std::cerr << "Invalid value for the velocity input mode." << std::endl;
-        std::cerr << "Legal values are \"RANDOM\" and \"GIVEN\". Given value is " << vecgenmode << std::endl;
+        std::cerr << "The on-device batch engine does not support checkpoints." << std::endl;
         return 1;
     }
-    
-    // Masses
-    status = fscanf_s(instream, "MASSES=%s\n", vecgenmode, NAME_MAX_LEN);
-    if (status == 0)
+
+    if (CLSettings::get_devices() != DEVICES_ALL && backend->name() != BACKEND_OPENCL_MULTI)
     {
-        std::cerr << "Error while reading the masses input mode." << std::endl;
+        std::cerr << "The DEVICES setting requires the " << BACKEND_OPENCL_MULTI << " backend." << std::endl;
         return 1;
     }
-    masses = (cl_double*)calloc(num_parts, sizeof(cl_double));
-    if (masses == NULL)
+
+    if (CLSettings::get_engine() == ENGINE_ENSEMBLE && simtype != 0)
     {
-        std::cerr << "Error while allocating space for mass values." << std::endl;
+        std::cerr << "The ensemble engine supports only the inelastic model." << std::endl;
         return 1;
     }
-    if (strcmp(vecgenmode, "RANDOM") == 0)
+    if (CLSettings::get_engine() == ENGINE_ENSEMBLE && !backend->uses_opencl())
     {
-        for (size_t i = 0; i < num_parts; i++)
-            masses[i] = (((cl_double)rand()) / RAND_MAX) * 0.9 + 0.1;
+        std::cerr << "The ensemble engine requires an OpenCL backend." << std::endl;
+        return 1;
     }
-    else if (strcmp(vecgenmode, "GIVEN") == 0)
+    if (CLSettings::get_engine() == ENGINE_ENSEMBLE && (CLSettings::get_checkpoint_interval() > 0 || CLSettings::get_resume()))
     {
-        for (size_t i = 0; i < num_parts; i++)
-        {
-            status = fscanf_s(instream, "%lf\n", masses + i);
-            if (status == 0)
-            {
-                std::cerr << "Error while reading the " << i << "-th mass value." << std::endl;
-                return 1;
-            }
-            if (masses[i] <= 0)
-            {
-                std::cerr << "Masses must be strictly positive real values." << std::endl;
-                std::cerr << "Given value for the " << i << "-th mass is " << masses[i] << std::endl;
-                return 1;
-            }
-        }
+        std::cerr << "The ensemble engine does not support checkpoints." << std::endl;
+        return 1;
     }
-    else
+    if ((sweep_count > 0 || ensemble_replicas > 1) && CLSettings::get_engine() != ENGINE_ENSEMBLE)
     {
-        std::cerr << "Invalid value for the mass input mode." << std::endl;
-        std::cerr << "Legal values are \"RANDOM\" and \"GIVEN\". Given value is " << vecgenmode << std::endl;
+        std::cerr << "The sweep of the elasticity coefficient and the replicas require the ensemble engine." << std::endl;
         return 1;
     }
-    
-    // Radii
-    status = fscanf_s(instream, "RADII=%s\n", vecgenmode, NAME_MAX_LEN);
-    if (status == 0)
+    if (ensemble_replicas > 1 && placement == PLACEMENT_NONE && !maxwell_boltzmann)
     {
-        std::cerr << "Error while reading the radii input mode." << std::endl;
+        std::cerr << "The replicas require the positions or the velocities to be generated, so that they differ." << std::endl;
         return 1;
     }
-    radii = (cl_double*)calloc(num_parts, sizeof(cl_double));
-    if (radii == NULL)
+
+    if (CLSettings::get_packing_fraction() > 0 && placement == PLACEMENT_NONE)
     {
-        std::cerr << "Error while allocating space for radius values." << std::endl;
+        std::cerr << "The packing fraction requires the positions to be generated, with \"NON_OVERLAPPING\" or \"LATTICE\"." << std::endl;
         return 1;
     }
-    if (strcmp(vecgenmode, "RANDOM") == 0)
+
+    // Generate the positions and velocities that depend on the radii and masses
+    try
     {
-        for (size_t i = 0; i < num_parts; i++)
-            radii[i] = (((cl_double)rand()) / RAND_MAX) * 0.9 + 0.1;
+        if (CLSettings::get_packing_fraction() > 0)
+            scale_to_packing_fraction(radii, num_parts, x_wall, y_wall, z_wall, CLSettings::get_packing_fraction());
+        if (placement == PLACEMENT_NON_OVERLAPPING)
+            place_non_overlapping(positions, radii, num_parts, x_wall, y_wall, z_wall, CLSettings::get_seed());
+        else if (placement == PLACEMENT_LATTICE)
+            place_lattice(positions, radii, num_parts, x_wall, y_wall, z_wall, CLSettings::get_seed());
+        if (maxwell_boltzmann)
+            maxwell_boltzmann_velocities(velocities, masses, num_parts, CLSettings::get_temperature(), CLSettings::get_seed());
     }
-    else if (strcmp(vecgenmode, "GIVEN") == 0)
+    catch (std::exception& e)
     {
-        for (size_t i = 0; i < num_parts; i++)
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    // The replicas of the ensemble take each value of the sweep ENSEMBLE_REPLICAS times. The k-th
+    // time, the positions and velocities are generated again from the seed SEED + k.
+    std::vector<EnsembleReplica> replicas;
+    std::vector<size_t> replica_seeds;
+    if (CLSettings::get_engine() == ENGINE_ENSEMBLE)
+    {
+        std::vector<cl_double*> replica_positions(ensemble_replicas, positions);
+        std::vector<cl_double*> replica_velocities(ensemble_replicas, velocities);
+        try
         {
-            status = fscanf_s(instream, "%lf\n", radii + i);
-            if (status == 0)
+            for (size_t k = 1; k < ensemble_replicas; k++)
             {
-                std::cerr << "Error while reading the " << i << "-th radius value." << std::endl;
-                return 1;
+                size_t seed = CLSettings::get_seed() + k;
+                if (placement != PLACEMENT_NONE)
+                {
+                    replica_positions[k] = (cl_double*)calloc(3 * num_parts, sizeof(cl_double));
+                    if (replica_positions[k] == NULL)
+                    {
+                        std::cerr << "Error while allocating space for the position vectors of the replicas." << std::endl;
+                        return 1;
+                    }
+                    if (placement == PLACEMENT_NON_OVERLAPPING)
+                        place_non_overlapping(replica_positions[k], radii, num_parts, x_wall, y_wall, z_wall, seed);
+                    else
+                        place_lattice(replica_positions[k], radii, num_parts, x_wall, y_wall, z_wall, seed);
+                }
+                if (maxwell_boltzmann)
+                {
+                    replica_velocities[k] = (cl_double*)calloc(3 * num_parts, sizeof(cl_double));
+                    if (replica_velocities[k] == NULL)
+                    {
+                        std::cerr << "Error while allocating space for the velocity vectors of the replicas." << std::endl;
+                        return 1;
+                    }
+                    maxwell_boltzmann_velocities(replica_velocities[k], masses, num_parts, CLSettings::get_temperature(), seed);
+                }
             }
-            if (radii[i] <= 0)
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+
+        size_t num_values = sweep_count > 0 ? sweep_count : 1;
+        for (size_t v = 0; v < num_values; v++)
+        {
+            for (size_t k = 0; k < ensemble_replicas; k++)
             {
-                std::cerr << "Radii must be strictly positive real values." << std::endl;
-                std::cerr << "Given value for the " << i << "-th radius is " << radii[i] << std::endl;
-                return 1;
+                EnsembleReplica replica;
+                replica.pos = replica_positions[k];
+                replica.vel = replica_velocities[k];
+                replica.e = e;
+                if (sweep_count == 1)
+                    replica.e = sweep_first;
+                else if (sweep_count > 1)
+                    replica.e = sweep_first + (sweep_last - sweep_first) * v / (sweep_count - 1);
+                replicas.push_back(replica);
+                replica_seeds.push_back(CLSettings::get_seed() + k);
             }
         }
-    }
-    else
-    {
-        std::cerr << "Invalid value for the radius input mode." << std::endl;
-        std::cerr << "Legal values are \"RANDOM\" and \"GIVEN\". Given value is " << vecgenmode << std::endl;
-        return 1;
+        CLSettings::set_ensemble_size(replicas.size());
     }
 
     // Close the input file
@@ -322,49 +915,106 @@ int main(int argc, char** argv)
 
     std::cout << "Successfully readed the input file." << std::endl;
 
+    // Only convert the input file, keeping its settings as they are
+    if (!binary_option.empty())
+    {
+        try
+        {
+            write_binary_input(binary_option, model_name, num_parts, max_time, e,
+                x_wall, y_wall, z_wall, simtype, threshold,
+                positions, velocities, masses, radii,
+                input->data(settings_offset), input->size() - settings_offset);
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        std::cout << "Binary input written to " << binary_option << std::endl;
+        return 0;
+    }
+
 
     // Get the output filename
-    if (argc > 2)
-        outputfile = std::string(argv[2]);
+    if (args.size() > 1)
+        outputfile = args[1];
     else
         outputfile = std::string(model_name) + ".out";
-    std::cout << "Results will be saved to " << outputfile << std::endl;
+    if (CLSettings::get_engine() == ENGINE_ENSEMBLE)
+    {
+        // The output of each replica is followed by its index
+        for (size_t r = 0; r < replicas.size(); r++)
+        {
+            replicas[r].output_file = outputfile + "." + std::to_string(r);
+            std::cout << "Replica " << r << " with ELASTIC_COEFF=" << replicas[r].e;
+            if (placement != PLACEMENT_NONE || maxwell_boltzmann)
+                std::cout << " and SEED=" << replica_seeds[r];
+            std::cout << " will be saved to " << replicas[r].output_file << std::endl;
+        }
+    }
+    else
+        std::cout << "Results will be saved to " << outputfile << std::endl;
 
     CLSettings::set_output_file(outputfile);
-    cl::Device device(CLSettings::select_device());
-    std::string devname;
-    device.getInfo(CL_DEVICE_NAME, &devname);
-    std::cout << "Selected device " << devname << std::endl << std::endl;
-    CLSettings::set_device(device);
+    if (CLSettings::get_checkpoint_file().empty())
+        CLSettings::set_checkpoint_file(outputfile + ".ckpt");
+    if (CLSettings::get_checkpoint_interval() > 0 || CLSettings::get_resume())
+        std::cout << "Checkpoints are saved to " << CLSettings::get_checkpoint_file() << std::endl;
+    CLSettings::set_device_selection(device_option);
+    try
+    {
+        if (CLSettings::get_engine() != ENGINE_EVENT_DRIVEN)
+        {
+            backend->initialize(num_parts);
+            // The particles of the inelastic model never change
+            backend->specialize(x_wall, y_wall, z_wall, radii, masses, num_parts, simtype == 0);
+        }
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
 
     std::cout << "Starting the simulation..." << std::endl;
     std::chrono::nanoseconds start_time;
     start_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch());
     try
     {
-        if (simtype == 0)
-            inelastic_simulation_loop(positions, velocities, masses, radii,
+        if (CLSettings::get_engine() == ENGINE_EVENT_DRIVEN)
+            event_simulation_loop(positions, velocities, masses, radii,
+                x_wall, y_wall, z_wall,
+                num_parts, e, max_time, (size_t)simtype, threshold);
+        else if (CLSettings::get_engine() == ENGINE_DEVICE_BATCH)
+            inelastic_batch_simulation_loop(positions, velocities, masses, radii,
                 x_wall, y_wall, z_wall,
                 num_parts, e, max_time);
+        else if (CLSettings::get_engine() == ENGINE_ENSEMBLE)
+            ensemble_simulation_loop(replicas,
+                masses, radii,
+                x_wall, y_wall, z_wall,
+                num_parts, max_time);
+        else if (simtype == 0)
+            inelastic_simulation_loop(positions, velocities, masses, radii,
+                x_wall, y_wall, z_wall,
+                num_parts, e, max_time, *backend);
         else if (simtype == 1)
             fusion_simulation_loop(positions, velocities, masses, radii,
                 x_wall, y_wall, z_wall,
-                num_parts, e, max_time, threshold);
+                num_parts, e, max_time, threshold, *backend);
         else if (simtype == 2)
             fission_simulation_loop(positions, velocities, masses, radii,
                 x_wall, y_wall, z_wall,
-                num_parts, e, max_time, threshold);
+                num_parts, e, max_time, threshold, *backend);
     }
-    catch (std::exception e)
+    catch (std::exception& e)
     {
         std::cerr << e.what() << std::endl;
         return 1;
     }
-    catch (std::exception* e)
-    {
-        std::cerr << e->what() << std::endl;
-        return 1;
-    }
+    delete backend;
+    // The masses and radii of a binary input are in the mapped file
+    delete input;
 
     std::chrono::nanoseconds end_time;
     end_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch());
@@ -0,0 +1,800 @@
+#include "backends.h"
+#include "shared.h"
+#include "CLSettings.h"
+#include "CLRuntime.h"
+#include "device_selection.h"
+#include "program_cache.h"
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+
+#define MIN(x, y)           ((x) < (y) ? (x) : (y))
+#define MAX(x, y)           ((x) > (y) ? (x) : (y))
+#define ABS(x)              ((x) > 0 ? (x) : -(x))
+
+// Domain decomposition.
+// The box is cut along x in a slab for each device, at the quantiles of the initial positions. A
+// particle can hit only the ones closer than the sum of the radii, so each device holds the particles
+// of its slab and the ones of the halos, up to halo_width past the cuts, and finds all the collisions
+// of the particles of its slab. The cuts and the edges of their halos split the x axis in regions:
+// the even regions 2q are held by device q only, and the odd ones 2q + 1, around the cut between
+// slabs q and q + 1, by both devices.
+// The particles carry their region, and the time at which each one crosses the next boundary is
+// searched along with the collisions. Until the first crossing, each couple colliding is held by a
+// device, so a collision earlier than the first crossing is exact, and it is the next event as on
+// a single device. Otherwise the crossing is applied, moving the particle to or from a device,
+// before any collision is taken, so the global order of the events is preserved.
+// The particles are identified by their global index and the couples by the index in the square
+// matrix of the couples, and the ties are broken by them, so the events are the ones found by the
+// other backends. All the programs are built without contractions of the floating point operations,
+// so the copies of a particle held by two devices always have the same values.
+
+// Added to the width of the halos, relative to the width of the system, so that the rounding of the
+// positions never hides a collision
+#define HALO_SLACK              1e-9
+// Smallest capacity of the local arrays of a device
+#define DOMAIN_MIN_CAPACITY     64
+// Region of a particle not held by any device
+#define REGION_NONE             SIZE_MAX
+
+// Minimum searches of a device, each one with buffers of its own so that they can run together
+#define SEARCH_WALL             0
+#define SEARCH_PART             1
+#define SEARCH_CROSSING         2
+#define SEARCH_PARTICLE         3
+#define NUM_SEARCHES            4
+
+static const char* FP_CONTRACT_OFF = "#pragma OPENCL FP_CONTRACT OFF\n";
+
+// Device of the decomposition, with its own context, queue, programs and local arrays
+struct DomainDevice
+{
+    cl::Device device;
+    cl::Context context;
+    cl::CommandQueue queue;
+    cl::Kernel pos_update_kernel;
+    cl::Kernel wall_collision_kernel;
+    cl::Kernel argmin_reduce_kernel;
+    cl::Kernel part_collision_kernel;
+    cl::Kernel particle_collision_kernel;
+    cl::Kernel crossing_kernel;
+    size_t group_size;
+
+    // Local arrays: positions and velocities are planar with stride capacity, as on a single device
+    size_t num_local;
+    size_t capacity;
+    cl::Buffer pos, next_pos, vel, radii, gidx, region;
+    cl::Buffer wall_delta_times, wall_axis, crossing_delta_times;
+    cl::Buffer x_wall, y_wall, z_wall, boundaries;
+    cl::Buffer argmin_values[NUM_SEARCHES];
+    cl::Buffer argmin_indices[NUM_SEARCHES];
+    // Results of the first step of the searches, completed by the host
+    size_t num_groups[NUM_SEARCHES];
+    cl_double values[NUM_SEARCHES][ARGMIN_MAX_GROUPS];
+    cl_ulong indices[NUM_SEARCHES][ARGMIN_MAX_GROUPS];
+
+    // Global index of each local particle, and local index of each global one (SIZE_MAX if not held)
+    std::vector<size_t> globals;
+    std::vector<size_t> locals;
+    // Host copies of the local arrays, for the transfers of the whole state
+    std::vector<cl_double> host_pos, host_vel, host_radii;
+    std::vector<cl_ulong> host_gidx, host_region;
+};
+
+static void check_status(cl_int status, const char* what)
+{
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while " << what << " on the devices of the domain decomposition." << std::endl;
+        ss << "Error code: " << status << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+static cl::Buffer create_buffer(DomainDevice& dev, cl_mem_flags flags, size_t size)
+{
+    cl_int status = CL_SUCCESS;
+    cl::Buffer buffer(dev.context, flags, MAX(1, size), NULL, &status);
+    check_status(status, "creating an OpenCL buffer");
+    return buffer;
+}
+
+static cl::Kernel create_kernel(cl::Program& program, const char* name)
+{
+    cl_int status = CL_SUCCESS;
+    cl::Kernel kernel(program, name, &status);
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while creating the OpenCL kernel " << name << "." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    return kernel;
+}
+
+// Same as CLRuntime::build_program, for the context of a device of the decomposition
+static cl::Program build_program(DomainDevice& dev, const cl::vector<std::string>& sources, const char* name)
+{
+    std::string options;
+    std::string key = program_cache_key(dev.device, sources, options);
+    cl::Program program;
+    if (load_cached_program(dev.context, dev.device, key, options, &program))
+        return program;
+
+    cl_int status = CL_SUCCESS;
+    program = cl::Program(dev.context, sources, &status);
+    if (status == CL_SUCCESS)
+        status = program.build({ dev.device }, options.c_str());
+    if (status != CL_SUCCESS)
+    {
+        std::stringstream ss;
+        ss << "Errors occurred while building the OpenCL program for " << name
+           << " on device " << device_full_name(dev.device) << "." << std::endl;
+        std::string build_log;
+        if (program.getBuildInfo(dev.device, CL_PROGRAM_BUILD_LOG, &build_log) == CL_SUCCESS)
+            ss << build_log << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    store_cached_program(program, key);
+    return program;
+}
+
+static void initialize_device(DomainDevice& dev)
+{
+    cl::vector<cl::Device> devices;
+    devices.push_back(dev.device);
+    cl_int status = CL_SUCCESS;
+    dev.context = cl::Context(devices, NULL, NULL, NULL, &status);
+    check_status(status, "creating an OpenCL context");
+    dev.queue = cl::CommandQueue(dev.context, dev.device, 0, &status);
+    check_status(status, "creating an OpenCL command queue");
+
+    cl::Program pos_update_program = build_program(dev, { FP_CONTRACT_OFF, CLSettings::get_source_position_update() },
+                                                   "position update");
+    cl::Program wall_collision_program = build_program(dev, { FP_CONTRACT_OFF, CLSettings::get_source_wall_collision() },
+                                                       "wall collision");
+    cl::Program domain_program = build_program(dev, { FP_CONTRACT_OFF, CLSettings::get_source_part_collision(),
+                                                      CLSettings::get_source_domain() },
+                                               "domain decomposition");
+    dev.pos_update_kernel = create_kernel(pos_update_program, POSITION_UPDATE_KERNEL_NAME);
+    dev.wall_collision_kernel = create_kernel(wall_collision_program, WALL_COLLISION_KERNEL_NAME);
+    dev.argmin_reduce_kernel = create_kernel(domain_program, ARGMIN_REDUCE_KERNEL_NAME);
+    dev.part_collision_kernel = create_kernel(domain_program, DOMAIN_PART_COLLISION_KERNEL_NAME);
+    dev.particle_collision_kernel = create_kernel(domain_program, DOMAIN_PARTICLE_COLLISION_KERNEL_NAME);
+    dev.crossing_kernel = create_kernel(domain_program, DOMAIN_CROSSING_KERNEL_NAME);
+
+    // The work-group size of the minimum searches must be a power of two
+    size_t max_group_size;
+    dev.device.getInfo(CL_DEVICE_MAX_WORK_GROUP_SIZE, &max_group_size);
+    dev.group_size = ARGMIN_GROUP_SIZE;
+    while (dev.group_size > max_group_size)
+        dev.group_size /= 2;
+    for (size_t s = 0; s < NUM_SEARCHES; s++)
+    {
+        dev.argmin_values[s] = create_buffer(dev, CL_MEM_READ_WRITE, ARGMIN_MAX_GROUPS * sizeof(cl_double));
+        dev.argmin_indices[s] = create_buffer(dev, CL_MEM_READ_WRITE, ARGMIN_MAX_GROUPS * sizeof(cl_ulong));
+    }
+
+    dev.x_wall = create_buffer(dev, CL_MEM_READ_ONLY, 2 * sizeof(cl_double));
+    dev.y_wall = create_buffer(dev, CL_MEM_READ_ONLY, 2 * sizeof(cl_double));
+    dev.z_wall = create_buffer(dev, CL_MEM_READ_ONLY, 2 * sizeof(cl_double));
+    dev.num_local = 0;
+    dev.capacity = 0;
+}
+
+// Make room for num_local particles, keeping the current ones. The capacity grows geometrically.
+static void reserve(DomainDevice& dev, size_t num_local)
+{
+    if (num_local <= dev.capacity)
+        return;
+    size_t capacity = MAX(DOMAIN_MIN_CAPACITY, MAX(num_local, 2 * dev.capacity));
+
+    cl::Buffer pos = create_buffer(dev, CL_MEM_READ_WRITE, 3 * capacity * sizeof(cl_double));
+    cl::Buffer vel = create_buffer(dev, CL_MEM_READ_WRITE, 3 * capacity * sizeof(cl_double));
+    cl::Buffer radii = create_buffer(dev, CL_MEM_READ_WRITE, capacity * sizeof(cl_double));
+    cl::Buffer gidx = create_buffer(dev, CL_MEM_READ_WRITE, capacity * sizeof(cl_ulong));
+    cl::Buffer region = create_buffer(dev, CL_MEM_READ_WRITE, capacity * sizeof(cl_ulong));
+    cl_int status = CL_SUCCESS;
+    if (dev.num_local > 0)
+    {
+        for (size_t c = 0; c < 3; c++)
+        {
+            status |= dev.queue.enqueueCopyBuffer(dev.pos, pos, c * dev.capacity * sizeof(cl_double),
+                                                  c * capacity * sizeof(cl_double), dev.num_local * sizeof(cl_double));
+            status |= dev.queue.enqueueCopyBuffer(dev.vel, vel, c * dev.capacity * sizeof(cl_double),
+                                                  c * capacity * sizeof(cl_double), dev.num_local * sizeof(cl_double));
+        }
+        status |= dev.queue.enqueueCopyBuffer(dev.radii, radii, 0, 0, dev.num_local * sizeof(cl_double));
+        status |= dev.queue.enqueueCopyBuffer(dev.gidx, gidx, 0, 0, dev.num_local * sizeof(cl_ulong));
+        status |= dev.queue.enqueueCopyBuffer(dev.region, region, 0, 0, dev.num_local * sizeof(cl_ulong));
+    }
+    check_status(status, "growing the local arrays");
+
+    dev.pos = pos;
+    dev.vel = vel;
+    dev.radii = radii;
+    dev.gidx = gidx;
+    dev.region = region;
+    dev.next_pos = create_buffer(dev, CL_MEM_READ_WRITE, 3 * capacity * sizeof(cl_double));
+    dev.wall_delta_times = create_buffer(dev, CL_MEM_READ_WRITE, capacity * sizeof(cl_double));
+    dev.wall_axis = create_buffer(dev, CL_MEM_READ_WRITE, capacity * sizeof(cl_int));
+    dev.crossing_delta_times = create_buffer(dev, CL_MEM_READ_WRITE, capacity * sizeof(cl_double));
+    dev.capacity = capacity;
+}
+
+// Devices holding the particles of a region: q for region 2q, q and q + 1 for region 2q + 1
+static size_t first_holder(size_t region)
+{
+    return region / 2;
+}
+
+static bool holds(size_t d, size_t region)
+{
+    return region != REGION_NONE && (d == region / 2 || (region % 2 == 1 && d == region / 2 + 1));
+}
+
+// Region of a position, that is the number of boundaries not past it
+static size_t region_of(const std::vector<cl_double>& boundaries, cl_double x)
+{
+    return std::upper_bound(boundaries.begin(), boundaries.end(), x) - boundaries.begin();
+}
+
+// Number of groups of the first step of a search over count values
+static size_t search_groups(DomainDevice& dev, size_t count)
+{
+    return MAX(1, MIN(ARGMIN_MAX_GROUPS, (count + dev.group_size - 1) / dev.group_size));
+}
+
+// Launch a kernel doing the first step of a search, and read back the results of its groups
+static void enqueue_search(DomainDevice& dev, size_t search, cl::Kernel& kernel, size_t num_groups)
+{
+    dev.num_groups[search] = num_groups;
+    cl_int status = dev.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(num_groups * dev.group_size),
+                                                   cl::NDRange(dev.group_size));
+    status |= dev.queue.enqueueReadBuffer(dev.argmin_values[search], CL_FALSE, 0,
+                                          num_groups * sizeof(cl_double), dev.values[search]);
+    status |= dev.queue.enqueueReadBuffer(dev.argmin_indices[search], CL_FALSE, 0,
+                                          num_groups * sizeof(cl_ulong), dev.indices[search]);
+    check_status(status, "launching a minimum search");
+}
+
+// Search the minimum of the given times of the local particles, indexed by their global indices
+static void enqueue_reduce(DomainDevice& dev, size_t search, cl::Buffer& delta_times)
+{
+    cl::Kernel& kernel = dev.argmin_reduce_kernel;
+    cl_int status = kernel.setArg(0, delta_times);
+    status |= kernel.setArg(1, dev.gidx);
+    status |= kernel.setArg(2, (cl_ulong)dev.num_local);
+    status |= kernel.setArg(3, dev.argmin_values[search]);
+    status |= kernel.setArg(4, dev.argmin_indices[search]);
+    status |= kernel.setArg(5, cl::Local(dev.group_size * sizeof(cl_double)));
+    status |= kernel.setArg(6, cl::Local(dev.group_size * sizeof(cl_ulong)));
+    check_status(status, "setting the arguments of the minimum search");
+    enqueue_search(dev, search, kernel, search_groups(dev, dev.num_local));
+}
+
+static void enqueue_wall_search(DomainDevice& dev)
+{
+    cl::Kernel& kernel = dev.wall_collision_kernel;
+    cl_int status = kernel.setArg(0, dev.pos);
+    status |= kernel.setArg(1, dev.vel);
+    status |= kernel.setArg(2, dev.radii);
+    status |= kernel.setArg(3, (cl_ulong)dev.num_local);
+    status |= kernel.setArg(4, (cl_ulong)dev.capacity);
+    status |= kernel.setArg(5, dev.x_wall);
+    status |= kernel.setArg(6, dev.y_wall);
+    status |= kernel.setArg(7, dev.z_wall);
+    status |= kernel.setArg(8, dev.wall_delta_times);
+    status |= kernel.setArg(9, dev.wall_axis);
+    check_status(status, "setting the arguments of the wall collision kernel");
+    if (dev.num_local > 0)
+        check_status(dev.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(dev.num_local), cl::NullRange),
+                     "launching the wall collision kernel");
+    enqueue_reduce(dev, SEARCH_WALL, dev.wall_delta_times);
+}
+
+static void enqueue_crossing_search(DomainDevice& dev, size_t num_boundaries)
+{
+    cl::Kernel& kernel = dev.crossing_kernel;
+    cl_int status = kernel.setArg(0, dev.pos);
+    status |= kernel.setArg(1, dev.vel);
+    status |= kernel.setArg(2, dev.region);
+    status |= kernel.setArg(3, dev.boundaries);
+    status |= kernel.setArg(4, (cl_ulong)num_boundaries);
+    status |= kernel.setArg(5, (cl_ulong)dev.num_local);
+    status |= kernel.setArg(6, dev.crossing_delta_times);
+    check_status(status, "setting the arguments of the boundary crossing kernel");
+    if (dev.num_local > 0)
+        check_status(dev.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(dev.num_local), cl::NullRange),
+                     "launching the boundary crossing kernel");
+    enqueue_reduce(dev, SEARCH_CROSSING, dev.crossing_delta_times);
+}
+
+static void enqueue_part_search(DomainDevice& dev, size_t num_parts)
+{
+    cl::Kernel& kernel = dev.part_collision_kernel;
+    cl_int status = kernel.setArg(0, dev.pos);
+    status |= kernel.setArg(1, dev.vel);
+    status |= kernel.setArg(2, dev.radii);
+    status |= kernel.setArg(3, dev.gidx);
+    status |= kernel.setArg(4, (cl_ulong)dev.num_local);
+    status |= kernel.setArg(5, (cl_ulong)dev.capacity);
+    status |= kernel.setArg(6, (cl_ulong)num_parts);
+    status |= kernel.setArg(7, dev.argmin_values[SEARCH_PART]);
+    status |= kernel.setArg(8, dev.argmin_indices[SEARCH_PART]);
+    status |= kernel.setArg(9, cl::Local(dev.group_size * sizeof(cl_double)));
+    status |= kernel.setArg(10, cl::Local(dev.group_size * sizeof(cl_ulong)));
+    check_status(status, "setting the arguments of the particle collision kernel");
+    enqueue_search(dev, SEARCH_PART, kernel, search_groups(dev, dev.num_local * dev.num_local));
+}
+
+// Couples of the local particle a only
+static void enqueue_particle_search(DomainDevice& dev, size_t num_parts, size_t a)
+{
+    cl::Kernel& kernel = dev.particle_collision_kernel;
+    cl_int status = kernel.setArg(0, dev.pos);
+    status |= kernel.setArg(1, dev.vel);
+    status |= kernel.setArg(2, dev.radii);
+    status |= kernel.setArg(3, dev.gidx);
+    status |= kernel.setArg(4, (cl_ulong)dev.num_local);
+    status |= kernel.setArg(5, (cl_ulong)dev.capacity);
+    status |= kernel.setArg(6, (cl_ulong)num_parts);
+    status |= kernel.setArg(7, (cl_ulong)a);
+    status |= kernel.setArg(8, dev.argmin_values[SEARCH_PARTICLE]);
+    status |= kernel.setArg(9, dev.argmin_indices[SEARCH_PARTICLE]);
+    status |= kernel.setArg(10, cl::Local(dev.group_size * sizeof(cl_double)));
+    status |= kernel.setArg(11, cl::Local(dev.group_size * sizeof(cl_ulong)));
+    check_status(status, "setting the arguments of the particle collision kernel");
+    enqueue_search(dev, SEARCH_PARTICLE, kernel, search_groups(dev, dev.num_local));
+}
+
+// Fold the results of a search, once the queue is finished, into the minimum over all the devices.
+// The ties go to the smallest index, as in the kernels.
+static void finish_search(DomainDevice& dev, size_t search, cl_double* best, cl_ulong* best_idx)
+{
+    for (size_t g = 0; g < dev.num_groups[search]; g++)
+    {
+        cl_double value = dev.values[search][g];
+        cl_ulong idx = dev.indices[search][g];
+        if (value < *best || (value == *best && idx < *best_idx))
+        {
+            *best = value;
+            *best_idx = idx;
+        }
+    }
+}
+
+static void finish_queues(std::vector<DomainDevice*>& devices)
+{
+    for (size_t d = 0; d < devices.size(); d++)
+        check_status(devices[d]->queue.finish(), "waiting for the command queue");
+}
+
+// Write a particle of the host store at the local index a, with the given position
+static void write_local(DomainDevice& dev, size_t a, ParticleStore& parts, size_t g, cl_double* pos, size_t region)
+{
+    cl_ulong values[2] = { (cl_ulong)g, (cl_ulong)region };
+    cl_int status = CL_SUCCESS;
+    for (size_t c = 0; c < 3; c++)
+        status |= dev.queue.enqueueWriteBuffer(dev.pos, CL_FALSE, (c * dev.capacity + a) * sizeof(cl_double),
+                                               sizeof(cl_double), pos + c);
+    status |= dev.queue.enqueueWriteBuffer(dev.vel, CL_FALSE, a * sizeof(cl_double), sizeof(cl_double), parts.vx + g);
+    status |= dev.queue.enqueueWriteBuffer(dev.vel, CL_FALSE, (dev.capacity + a) * sizeof(cl_double), sizeof(cl_double), parts.vy + g);
+    status |= dev.queue.enqueueWriteBuffer(dev.vel, CL_FALSE, (2 * dev.capacity + a) * sizeof(cl_double), sizeof(cl_double), parts.vz + g);
+    status |= dev.queue.enqueueWriteBuffer(dev.radii, CL_FALSE, a * sizeof(cl_double), sizeof(cl_double), parts.radius + g);
+    status |= dev.queue.enqueueWriteBuffer(dev.gidx, CL_FALSE, a * sizeof(cl_ulong), sizeof(cl_ulong), values);
+    status |= dev.queue.enqueueWriteBuffer(dev.region, CL_TRUE, a * sizeof(cl_ulong), sizeof(cl_ulong), values + 1);
+    check_status(status, "writing a particle");
+}
+
+// Remove the local particle of global index g, moving the last local particle into its place
+static void remove_local(DomainDevice& dev, size_t g)
+{
+    size_t a = dev.locals[g];
+    size_t last = dev.num_local - 1;
+    if (a != last)
+    {
+        cl_int status = CL_SUCCESS;
+        for (size_t c = 0; c < 3; c++)
+        {
+            status |= dev.queue.enqueueCopyBuffer(dev.pos, dev.pos, (c * dev.capacity + last) * sizeof(cl_double),
+                                                  (c * dev.capacity + a) * sizeof(cl_double), sizeof(cl_double));
+            status |= dev.queue.enqueueCopyBuffer(dev.vel, dev.vel, (c * dev.capacity + last) * sizeof(cl_double),
+                                                  (c * dev.capacity + a) * sizeof(cl_double), sizeof(cl_double));
+        }
+        status |= dev.queue.enqueueCopyBuffer(dev.radii, dev.radii, last * sizeof(cl_double), a * sizeof(cl_double), sizeof(cl_double));
+        status |= dev.queue.enqueueCopyBuffer(dev.gidx, dev.gidx, last * sizeof(cl_ulong), a * sizeof(cl_ulong), sizeof(cl_ulong));
+        status |= dev.queue.enqueueCopyBuffer(dev.region, dev.region, last * sizeof(cl_ulong), a * sizeof(cl_ulong), sizeof(cl_ulong));
+        check_status(status, "removing a particle");
+        dev.globals[a] = dev.globals[last];
+        dev.locals[dev.globals[a]] = a;
+    }
+    dev.globals.pop_back();
+    dev.locals[g] = SIZE_MAX;
+    dev.num_local--;
+}
+
+
+MultiDeviceBackend::~MultiDeviceBackend()
+{
+    for (size_t d = 0; d < _devices.size(); d++)
+        delete _devices[d];
+}
+
+std::string MultiDeviceBackend::name() const
+{
+    return BACKEND_OPENCL_MULTI;
+}
+
+void MultiDeviceBackend::initialize(size_t num_parts)
+{
+    cl::vector<cl::Device> devices = select_devices(CLSettings::get_devices());
+    for (size_t d = 0; d < devices.size(); d++)
+    {
+        DomainDevice* dev = new DomainDevice();
+        _devices.push_back(dev);
+        dev->device = devices[d];
+        initialize_device(*dev);
+        std::cout << "Selected device " << device_full_name(dev->device) << " for slab " << (d + 1) << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+void MultiDeviceBackend::decompose(ParticleStore& parts)
+{
+    size_t num_parts = parts.num_parts();
+    size_t num_devices = _devices.size();
+    _boundaries.clear();
+    if (num_devices == 1 || num_parts == 0)
+        return;
+
+    std::vector<cl_double> xs(parts.x, parts.x + num_parts);
+    std::sort(xs.begin(), xs.end());
+    cl_double radius = 0;
+    for (size_t g = 0; g < num_parts; g++)
+        radius = MAX(radius, parts.radius[g]);
+    cl_double halo_width = 2 * radius + HALO_SLACK * MAX(1, xs.back() - xs.front());
+
+    // The slabs hold the same number of particles, or have the same width if the halos of two
+    // cuts would overlap. Their order is needed to tell the regions apart.
+    std::vector<cl_double> cuts(num_devices - 1);
+    for (size_t s = 1; s < num_devices; s++)
+        cuts[s - 1] = xs[s * num_parts / num_devices];
+    for (size_t attempt = 0; attempt < 2; attempt++)
+    {
+        bool disjoint = true;
+        for (size_t s = 1; s < cuts.size(); s++)
+            disjoint = disjoint && cuts[s] - cuts[s - 1] > 2 * halo_width;
+        if (disjoint)
+        {
+            for (size_t s = 0; s < cuts.size(); s++)
+            {
+                _boundaries.push_back(cuts[s] - halo_width);
+                _boundaries.push_back(cuts[s] + halo_width);
+            }
+            return;
+        }
+        for (size_t s = 1; s < num_devices; s++)
+            cuts[s - 1] = xs.front() + (xs.back() - xs.front()) * s / num_devices;
+    }
+
+    std::stringstream ss;
+    ss << "The system is too narrow along x to be split among " << num_devices << " devices: "
+       << "each slab must be wider than twice the largest diameter." << std::endl;
+    throw std::runtime_error(ss.str());
+}
+
+void MultiDeviceBackend::upload_state(ParticleStore& parts)
+{
+    size_t num_parts = parts.num_parts();
+    decompose(parts);
+    _region.resize(num_parts);
+    for (size_t g = 0; g < num_parts; g++)
+        _region[g] = region_of(_boundaries, parts.x[g]);
+
+    for (size_t d = 0; d < _devices.size(); d++)
+    {
+        DomainDevice& dev = *_devices[d];
+        dev.globals.clear();
+        dev.locals.assign(num_parts, SIZE_MAX);
+        for (size_t g = 0; g < num_parts; g++)
+        {
+            if (holds(d, _region[g]))
+            {
+                dev.locals[g] = dev.globals.size();
+                dev.globals.push_back(g);
+            }
+        }
+        // The current particles are all replaced
+        dev.num_local = 0;
+        reserve(dev, dev.globals.size());
+        dev.num_local = dev.globals.size();
+
+        size_t stride = dev.capacity;
+        dev.host_pos.resize(3 * stride);
+        dev.host_vel.resize(3 * stride);
+        dev.host_radii.resize(stride);
+        dev.host_gidx.resize(stride);
+        dev.host_region.resize(stride);
+        for (size_t a = 0; a < dev.num_local; a++)
+        {
+            size_t g = dev.globals[a];
+            dev.host_pos[a] = parts.x[g];
+            dev.host_pos[stride + a] = parts.y[g];
+            dev.host_pos[2 * stride + a] = parts.z[g];
+            dev.host_vel[a] = parts.vx[g];
+            dev.host_vel[stride + a] = parts.vy[g];
+            dev.host_vel[2 * stride + a] = parts.vz[g];
+            dev.host_radii[a] = parts.radius[g];
+            dev.host_gidx[a] = g;
+            dev.host_region[a] = _region[g];
+        }
+        dev.boundaries = create_buffer(dev, CL_MEM_READ_ONLY, _boundaries.size() * sizeof(cl_double));
+
+        cl_int status = dev.queue.enqueueWriteBuffer(dev.pos, CL_FALSE, 0, 3 * stride * sizeof(cl_double), dev.host_pos.data());
+        status |= dev.queue.enqueueWriteBuffer(dev.vel, CL_FALSE, 0, 3 * stride * sizeof(cl_double), dev.host_vel.data());
+        status |= dev.queue.enqueueWriteBuffer(dev.radii, CL_FALSE, 0, stride * sizeof(cl_double), dev.host_radii.data());
+        status |= dev.queue.enqueueWriteBuffer(dev.gidx, CL_FALSE, 0, stride * sizeof(cl_ulong), dev.host_gidx.data());
+        status |= dev.queue.enqueueWriteBuffer(dev.region, CL_FALSE, 0, stride * sizeof(cl_ulong), dev.host_region.data());
+        if (!_boundaries.empty())
+            status |= dev.queue.enqueueWriteBuffer(dev.boundaries, CL_FALSE, 0, _boundaries.size() * sizeof(cl_double),
+                                                   _boundaries.data());
+        check_status(status, "writing the state");
+        dev.queue.flush();
+    }
+    finish_queues(_devices);
+}
+
+void MultiDeviceBackend::upload_walls(cl_double* x_wall, cl_double* y_wall, cl_double* z_wall)
+{
+    for (size_t d = 0; d < _devices.size(); d++)
+    {
+        DomainDevice& dev = *_devices[d];
+        cl_int status = dev.queue.enqueueWriteBuffer(dev.x_wall, CL_FALSE, 0, 2 * sizeof(cl_double), x_wall);
+        status |= dev.queue.enqueueWriteBuffer(dev.y_wall, CL_FALSE, 0, 2 * sizeof(cl_double), y_wall);
+        status |= dev.queue.enqueueWriteBuffer(dev.z_wall, CL_TRUE, 0, 2 * sizeof(cl_double), z_wall);
+        check_status(status, "writing the walls");
+    }
+}
+
+void MultiDeviceBackend::upload_velocity(ParticleStore& parts, size_t p)
+{
+    for (size_t d = 0; d < _devices.size(); d++)
+    {
+        if (!holds(d, _region[p]))
+            continue;
+        DomainDevice& dev = *_devices[d];
+        size_t a = dev.locals[p];
+        cl_int status = dev.queue.enqueueWriteBuffer(dev.vel, CL_FALSE, a * sizeof(cl_double), sizeof(cl_double), parts.vx + p);
+        status |= dev.queue.enqueueWriteBuffer(dev.vel, CL_FALSE, (dev.capacity + a) * sizeof(cl_double), sizeof(cl_double), parts.vy + p);
+        status |= dev.queue.enqueueWriteBuffer(dev.vel, CL_TRUE, (2 * dev.capacity + a) * sizeof(cl_double), sizeof(cl_double), parts.vz + p);
+        check_status(status, "writing a velocity");
+    }
+}
+
+void MultiDeviceBackend::add_particle(ParticleStore& parts, size_t g, cl_double* pos)
+{
+    for (size_t d = 0; d < _devices.size(); d++)
+    {
+        if (!holds(d, _region[g]))
+            continue;
+        DomainDevice& dev = *_devices[d];
+        reserve(dev, dev.num_local + 1);
+        dev.locals[g] = dev.num_local;
+        dev.globals.push_back(g);
+        write_local(dev, dev.num_local, parts, g, pos, _region[g]);
+        dev.num_local++;
+    }
+}
+
+void MultiDeviceBackend::remove_particle(size_t g)
+{
+    for (size_t d = 0; d < _devices.size(); d++)
+    {
+        if (holds(d, _region[g]))
+            remove_local(*_devices[d], g);
+    }
+    _region[g] = REGION_NONE;
+}
+
+void MultiDeviceBackend::upload_particle(ParticleStore& parts, size_t p)
+{
+    // The particles past the end of the store were removed
+    size_t num_parts = parts.num_parts();
+    for (size_t g = num_parts; g < _region.size(); g++)
+        remove_particle(g);
+    _region.resize(num_parts, REGION_NONE);
+    for (size_t d = 0; d < _devices.size(); d++)
+        _devices[d]->locals.resize(num_parts, SIZE_MAX);
+
+    // The particle is placed again, since its position may be in another region
+    cl_double pos[3] = { parts.x[p], parts.y[p], parts.z[p] };
+    remove_particle(p);
+    _region[p] = region_of(_boundaries, pos[0]);
+    add_particle(parts, p, pos);
+}
+
+void MultiDeviceBackend::download_positions(ParticleStore& parts)
+{
+    for (size_t d = 0; d < _devices.size(); d++)
+    {
+        DomainDevice& dev = *_devices[d];
+        dev.host_pos.resize(3 * dev.capacity);
+        cl_int status = dev.queue.enqueueReadBuffer(dev.pos, CL_FALSE, 0, 3 * dev.capacity * sizeof(cl_double), dev.host_pos.data());
+        check_status(status, "reading the positions");
+        dev.queue.flush();
+    }
+    finish_queues(_devices);
+
+    // The copies held by two devices are the same
+    for (size_t d = 0; d < _devices.size(); d++)
+    {
+        DomainDevice& dev = *_devices[d];
+        for (size_t a = 0; a < dev.num_local; a++)
+        {
+            size_t g = dev.globals[a];
+            parts.x[g] = dev.host_pos[a];
+            parts.y[g] = dev.host_pos[dev.capacity + a];
+            parts.z[g] = dev.host_pos[2 * dev.capacity + a];
+        }
+    }
+}
+
+void MultiDeviceBackend::download_position(ParticleStore& parts, size_t p)
+{
+    DomainDevice& dev = *_devices[first_holder(_region[p])];
+    size_t a = dev.locals[p];
+    cl_int status = dev.queue.enqueueReadBuffer(dev.pos, CL_FALSE, a * sizeof(cl_double), sizeof(cl_double), parts.x + p);
+    status |= dev.queue.enqueueReadBuffer(dev.pos, CL_FALSE, (dev.capacity + a) * sizeof(cl_double), sizeof(cl_double), parts.y + p);
+    status |= dev.queue.enqueueReadBuffer(dev.pos, CL_TRUE, (2 * dev.capacity + a) * sizeof(cl_double), sizeof(cl_double), parts.z + p);
+    check_status(status, "reading a position");
+}
+
+void MultiDeviceBackend::cross_boundary(ParticleStore& parts, size_t g, cl_double* dt_part, cl_ulong* part_k)
+{
+    size_t from = _region[g];
+    size_t to = parts.vx[g] > 0 ? from + 1 : from - 1;
+
+    // The position comes from a device holding the particle before the crossing
+    cl_double pos[3];
+    DomainDevice& holder = *_devices[first_holder(from)];
+    size_t a = holder.locals[g];
+    cl_int status = CL_SUCCESS;
+    for (size_t c = 0; c < 3; c++)
+        status |= holder.queue.enqueueReadBuffer(holder.pos, CL_TRUE, (c * holder.capacity + a) * sizeof(cl_double),
+                                                 sizeof(cl_double), pos + c);
+    check_status(status, "reading a position");
+
+    std::vector<DomainDevice*> gaining;
+    for (size_t d = 0; d < _devices.size(); d++)
+    {
+        DomainDevice& dev = *_devices[d];
+        if (holds(d, from) && !holds(d, to))
+            remove_local(dev, g);
+        else if (!holds(d, from) && holds(d, to))
+        {
+            reserve(dev, dev.num_local + 1);
+            dev.locals[g] = dev.num_local;
+            dev.globals.push_back(g);
+            write_local(dev, dev.num_local, parts, g, pos, to);
+            dev.num_local++;
+            gaining.push_back(&dev);
+        }
+        else if (holds(d, to))
+        {
+            cl_ulong region = to;
+            check_status(dev.queue.enqueueWriteBuffer(dev.region, CL_TRUE, dev.locals[g] * sizeof(cl_ulong),
+                                                      sizeof(cl_ulong), &region),
+                         "writing a region");
+        }
+    }
+    _region[g] = to;
+
+    // The couples of the particle with the ones of the devices it enters were never searched
+    size_t num_parts = parts.num_parts();
+    for (size_t d = 0; d < gaining.size(); d++)
+        enqueue_particle_search(*gaining[d], num_parts, gaining[d]->locals[g]);
+    finish_queues(gaining);
+    for (size_t d = 0; d < gaining.size(); d++)
+        finish_search(*gaining[d], SEARCH_PARTICLE, dt_part, part_k);
+}
+
+void MultiDeviceBackend::next_collisions(ParticleStore& parts,
+                                         cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                                         size_t* p, cl_double* dt_wall, cl_double* collision_axis,
+                                         size_t* i, size_t* j, cl_double* dt_part)
+{
+    size_t num_parts = parts.num_parts();
+
+    // All the devices search together
+    for (size_t d = 0; d < _devices.size(); d++)
+    {
+        DomainDevice& dev = *_devices[d];
+        enqueue_wall_search(dev);
+        enqueue_part_search(dev, num_parts);
+        enqueue_crossing_search(dev, _boundaries.size());
+        dev.queue.flush();
+    }
+    finish_queues(_devices);
+
+    cl_ulong wall_k = ULONG_MAX, part_k = ULONG_MAX, crossing_k = ULONG_MAX;
+    cl_double dt_crossing = INFINITY;
+    *dt_wall = INFINITY;
+    *dt_part = INFINITY;
+    for (size_t d = 0; d < _devices.size(); d++)
+    {
+        finish_search(*_devices[d], SEARCH_WALL, dt_wall, &wall_k);
+        finish_search(*_devices[d], SEARCH_PART, dt_part, &part_k);
+        finish_search(*_devices[d], SEARCH_CROSSING, &dt_crossing, &crossing_k);
+    }
+
+    // Only the axis of the colliding particle is read back, before any crossing moves the local particles
+    collision_axis[0] = 0;
+    collision_axis[1] = 0;
+    collision_axis[2] = 0;
+    *p = 0;
+    if (wall_k < num_parts)
+    {
+        *p = wall_k;
+        DomainDevice& dev = *_devices[first_holder(_region[wall_k])];
+        cl_int axis;
+        check_status(dev.queue.enqueueReadBuffer(dev.wall_axis, CL_TRUE, dev.locals[wall_k] * sizeof(cl_int),
+                                                 sizeof(cl_int), &axis),
+                     "reading the collision axis");
+        if (axis != 0)
+            collision_axis[ABS(axis) - 1] = axis / ABS(axis);
+    }
+
+    // A collision not later than the first crossing is the next event. Otherwise, the crossing is
+    // applied and the searches are updated, until the crossings left are later than the collisions.
+    while (dt_crossing < *dt_wall && dt_crossing < *dt_part)
+    {
+        cross_boundary(parts, crossing_k, dt_part, &part_k);
+
+        for (size_t d = 0; d < _devices.size(); d++)
+        {
+            enqueue_crossing_search(*_devices[d], _boundaries.size());
+            _devices[d]->queue.flush();
+        }
+        finish_queues(_devices);
+        dt_crossing = INFINITY;
+        crossing_k = ULONG_MAX;
+        for (size_t d = 0; d < _devices.size(); d++)
+            finish_search(*_devices[d], SEARCH_CROSSING, &dt_crossing, &crossing_k);
+    }
+
+    // No couple is found if none will ever collide
+    *i = NO_COLLISION;
+    *j = NO_COLLISION;
+    if (part_k != ULONG_MAX)
+    {
+        *i = part_k / num_parts;
+        *j = part_k % num_parts;
+    }
+}
+
+void MultiDeviceBackend::advance_positions(ParticleStore& parts, cl_double delta_time)
+{
+    for (size_t d = 0; d < _devices.size(); d++)
+    {
+        DomainDevice& dev = *_devices[d];
+        if (dev.num_local == 0)
+            continue;
+        cl::Kernel& kernel = dev.pos_update_kernel;
+        cl_int status = kernel.setArg(0, dev.pos);
+        status |= kernel.setArg(1, dev.vel);
+        status |= kernel.setArg(2, (cl_ulong)dev.num_local);
+        status |= kernel.setArg(3, (cl_ulong)dev.capacity);
+        status |= kernel.setArg(4, delta_time);
+        status |= kernel.setArg(5, dev.next_pos);
+        check_status(status, "setting the arguments of the position update kernel");
+        check_status(dev.queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(dev.num_local), cl::NullRange),
+                     "launching the position update kernel");
+        dev.queue.flush();
+        std::swap(dev.pos, dev.next_pos);
+    }
+}
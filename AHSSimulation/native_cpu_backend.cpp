@@ -0,0 +1,31 @@
+#include "backends.h"
+#include "cpu_backend.h"
+#include "thread_pool.h"
+#include "CLSettings.h"
+#include <iostream>
+
+std::string NativeCPUBackend::name() const
+{
+    return BACKEND_NATIVE_CPU;
+}
+
+void NativeCPUBackend::initialize(size_t num_parts)
+{
+    ThreadPool::initialize(CLSettings::get_num_threads());
+    std::cout << "Selected native CPU backend with " << ThreadPool::num_threads() << " threads and "
+              << cpu_isa_name(cpu_isa()) << " collision tests" << std::endl << std::endl;
+}
+
+void NativeCPUBackend::next_collisions(ParticleStore& parts,
+                                       cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                                       size_t* p, cl_double* dt_wall, cl_double* collision_axis,
+                                       size_t* i, size_t* j, cl_double* dt_part)
+{
+    cpu_next_wall_collision(parts, x_wall, y_wall, z_wall, p, dt_wall, collision_axis);
+    cpu_next_part_collision(parts, i, j, dt_part);
+}
+
+void NativeCPUBackend::advance_positions(ParticleStore& parts, cl_double delta_time)
+{
+    cpu_update_positions(parts, delta_time);
+}
@@ -1,163 +1,126 @@
 #include "shared.h"
 #include "CLSettings.h"
+#include "backend.h"
+#include "CLRuntime.h"
 #include <sstream>
 #include <math.h>
 
 #include <iostream>
 
-void next_part_collision(cl_double* in_pos, cl_double* in_vel, cl_double* radii, size_t num_parts,
-                         size_t* i, size_t* j, cl_double* delta_time)
+#define MIN(x, y)           ((x) < (y) ? (x) : (y))
+#define MAX(x, y)           ((x) > (y) ? (x) : (y))
+
+// Couple (i, j) of the given index in the upper triangle stored by rows,
+// as enumerated by the part_collision_triangular kernel
+static void triangle_pair(size_t k, size_t num_parts, size_t* i, size_t* j)
 {
-    // Get the device and create the list
-    cl::Device& device = CLSettings::get_device();
-    cl::vector<cl::Device> devices;
-    devices.push_back(device);
+    // The first guess comes from the inverse of the row start, then it is corrected
+    cl_double n = num_parts - 0.5;
+    size_t row = (size_t)(n - sqrt(MAX(0.0, n * n - 2.0 * k)));
+    row = MIN(row, num_parts - 2);
+    while (row > 0 && row * (2 * num_parts - row - 1) / 2 > k)
+        row--;
+    while (row < num_parts - 2 && (row + 1) * (2 * num_parts - row - 2) / 2 <= k)
+        row++;
+    size_t row_start = row * (2 * num_parts - row - 1) / 2;
+
+    *i = row;
+    *j = k - row_start + row + 1;
+}
 
-    // Create the context
-    static bool first_run = false;
+size_t enqueue_next_part_collision(size_t num_parts)
+{
+    cl::CommandQueue& queue = CLRuntime::get_queue();
     cl_int status = CL_SUCCESS;
-    static cl::Context context(devices, NULL, NULL, NULL, &status);
-    if (!first_run && status != CL_SUCCESS)
-    {
-        std::stringstream ss;
-        ss << "Errors occurred while creating the OpenCL context for position update." << std::endl;
-        throw new std::runtime_error(ss.str());
-    }
 
-    // Create and build the program
-    cl::vector<std::string> sources;
-    sources.push_back(CLSettings::get_source_part_collision());
-    static cl::Program program(context, sources, &status);
-    if (!first_run && status != CL_SUCCESS)
-    {
-        std::stringstream ss;
-        ss << "Errors occurred while creating the OpenCL program for position update." << std::endl;
-        throw new std::runtime_error(ss.str());
-    }
-    if (!first_run)
-        status = program.build({ device });
-    if (!first_run && status != CL_SUCCESS)
+    // Find the minimum on the device, so that only the result is read back
+    bool triangular = CLSettings::get_pair_launch() == PAIR_LAUNCH_TRIANGULAR;
+    size_t group_size = CLRuntime::argmin_group_size();
+    size_t count = triangular ? num_parts * (num_parts - 1) / 2 : num_parts * num_parts;
+    size_t num_groups = CLRuntime::argmin_num_groups(count);
+
+    // Only the couples (i, j) with i < j are computed, and the first step of the minimum search is done with them
+    if (triangular)
     {
-        std::stringstream ss;
-        ss << "Errors occurred while building the OpenCL program for position update." << std::endl;
-        std::string build_log;
-        status = program.getBuildInfo(device, CL_PROGRAM_BUILD_LOG, &build_log);
+        cl::Kernel& tri_kernel = CLRuntime::get_part_collision_triangular_kernel();
+        status = tri_kernel.setArg(0, CLRuntime::get_positions());
+        status |= tri_kernel.setArg(1, CLRuntime::get_velocities());
+        status |= tri_kernel.setArg(2, CLRuntime::get_radii());
+        status |= tri_kernel.setArg(3, num_parts);
+        status |= tri_kernel.setArg(4, CLRuntime::get_stride());
+        status |= tri_kernel.setArg(5, CLRuntime::get_argmin_values(0));
+        status |= tri_kernel.setArg(6, CLRuntime::get_argmin_indices(0));
+        status |= tri_kernel.setArg(7, cl::Local(group_size * sizeof(cl_double)));
+        status |= tri_kernel.setArg(8, cl::Local(group_size * sizeof(cl_ulong)));
         if (status != CL_SUCCESS)
         {
-            ss << "Errors occurred while retrieving the build log." << std::endl;
-            throw new std::runtime_error(ss.str());
+            std::stringstream ss;
+            ss << "Errors occurred while setting the arguments of the OpenCL kernel for the triangular launch." << std::endl;
+            throw std::runtime_error(ss.str());
         }
-        ss << "********** BUILD LOG BEGIN **********" << std::endl
-            << build_log
-            << "**********  BUILD LOG END  **********" << std::endl;
-        throw std::runtime_error(ss.str());
-    }
-
-    // Create the buffers
-    // Input positions
-    cl::Buffer cl_in_pos(context, CL_MEM_READ_ONLY, 3 * num_parts * sizeof(cl_double), &status);
-    if (status != CL_SUCCESS)
-    {
-        std::stringstream ss;
-        ss << "Errors occurred while creating an OpenCL input buffer for position update." << std::endl;
-        throw new std::runtime_error(ss.str());
+        queue.enqueueNDRangeKernel(tri_kernel, cl::NullRange, cl::NDRange(num_groups * group_size), cl::NDRange(group_size));
     }
-    // Input velocities
-    cl::Buffer cl_in_vel(context, CL_MEM_READ_ONLY, 3 * num_parts * sizeof(cl_double), &status);
-    if (status != CL_SUCCESS)
+    // Otherwise, the whole matrix is computed and then searched
+    else
     {
-        std::stringstream ss;
-        ss << "Errors occurred while creating an OpenCL input buffer for position update." << std::endl;
-        throw new std::runtime_error(ss.str());
-    }
-    // Input radii
-    cl::Buffer cl_in_radii(context, CL_MEM_READ_ONLY, num_parts * sizeof(cl_double), &status);
-    if (status != CL_SUCCESS)
-    {
-        std::stringstream ss;
-        ss << "Errors occurred while creating an OpenCL input buffer for position update." << std::endl;
-        throw new std::runtime_error(ss.str());
-    }
-    // Output delta time
-    cl::Buffer cl_out_delta_time(context, CL_MEM_WRITE_ONLY, num_parts * num_parts * sizeof(cl_double), &status);
-    if (status != CL_SUCCESS)
-    {
-        std::stringstream ss;
-        ss << "Errors occurred while creating an OpenCL output buffer for position update." << std::endl;
-        throw new std::runtime_error(ss.str());
-    }
+        cl::Buffer& cl_delta_times = CLRuntime::get_part_delta_times(num_parts);
+        cl::Kernel& kernel = CLRuntime::get_part_collision_kernel();
+        status = kernel.setArg(0, CLRuntime::get_positions());
+        status |= kernel.setArg(1, CLRuntime::get_velocities());
+        status |= kernel.setArg(2, CLRuntime::get_radii());
+        status |= kernel.setArg(3, num_parts);
+        status |= kernel.setArg(4, CLRuntime::get_stride());
+        status |= kernel.setArg(5, cl_delta_times);
+        if (status != CL_SUCCESS)
+        {
+            std::stringstream ss;
+            ss << "Errors occurred while setting the arguments of the OpenCL kernel for particle collision." << std::endl;
+            throw std::runtime_error(ss.str());
+        }
 
-    // Create the command queue and enqueue the buffers
-    static cl::CommandQueue queue(context, CL_QUEUE_PROFILING_ENABLE, &status);
-    if (!first_run && status != CL_SUCCESS)
-    {
-        std::stringstream ss;
-        ss << "Errors occurred while creating the OpenCL command queue in positions update." << std::endl;
-        ss << "Error code: " << status << std::endl;
-        throw std::runtime_error(ss.str());
-    }
-    status = queue.enqueueWriteBuffer(cl_in_pos, CL_TRUE, 0, 3 * num_parts * sizeof(cl_double), in_pos);
-    status |= queue.enqueueWriteBuffer(cl_in_vel, CL_TRUE, 0, 3 * num_parts * sizeof(cl_double), in_vel);
-    status |= queue.enqueueWriteBuffer(cl_in_radii, CL_TRUE, 0, num_parts * sizeof(cl_double), radii);
-    if (status != CL_SUCCESS)
-    {
-        std::stringstream ss;
-        ss << "Errors occurred while writing buffers on OpenCL device memory for positions update." << std::endl;
-        throw new std::runtime_error(ss.str());
-    }
+        // Execute the kernel
+        if (num_parts > 0)
+            queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(num_parts, num_parts), cl::NullRange);
 
-    // Create the kernel and set the arguments
-    static cl::Kernel kernel(program, PART_COLLISION_KERNEL_NAME, &status);
-    if (!first_run && status != CL_SUCCESS)
-    {
-        std::stringstream ss;
-        ss << "Errors occurred while creating the OpenCL kernel for position update." << std::endl;
-        throw new std::runtime_error(ss.str());
+        // First step, over the matrix of the collision times
+        cl::Kernel& argmin_kernel = CLRuntime::get_part_collision_argmin_kernel();
+        status = argmin_kernel.setArg(0, cl_delta_times);
+        status |= argmin_kernel.setArg(1, num_parts);
+        status |= argmin_kernel.setArg(2, CLRuntime::get_argmin_values(0));
+        status |= argmin_kernel.setArg(3, CLRuntime::get_argmin_indices(0));
+        status |= argmin_kernel.setArg(4, cl::Local(group_size * sizeof(cl_double)));
+        status |= argmin_kernel.setArg(5, cl::Local(group_size * sizeof(cl_ulong)));
+        if (status != CL_SUCCESS)
+        {
+            std::stringstream ss;
+            ss << "Errors occurred while setting the arguments of the OpenCL kernel for the minimum search." << std::endl;
+            throw std::runtime_error(ss.str());
+        }
+        queue.enqueueNDRangeKernel(argmin_kernel, cl::NullRange, cl::NDRange(num_groups * group_size), cl::NDRange(group_size));
     }
 
-    status = kernel.setArg(0, cl_in_pos);
-    status |= kernel.setArg(1, cl_in_vel);
-    status |= kernel.setArg(2, cl_in_radii);
-    status |= kernel.setArg(3, num_parts);
-    status |= kernel.setArg(4, cl_out_delta_time);
-    if (status != CL_SUCCESS)
-    {
-        std::stringstream ss;
-        ss << "errors occurred while setting the arguments of the opencl kernel for position update." << std::endl;
-        throw new std::runtime_error(ss.str());
-    }
+    // Following steps, until a single value is left
+    return CLRuntime::argmin_reduce(num_groups);
+}
 
-    // Execute the kernel
-    queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(num_parts, num_parts), cl::NullRange);
+void next_part_collision_device(size_t num_parts, size_t* i, size_t* j, cl_double* delta_time)
+{
+    cl_ulong k;
+    CLRuntime::argmin_read(enqueue_next_part_collision(num_parts), delta_time, &k);
 
-    // Retrieve the results
-    cl_double* delta_times = (cl_double*)calloc(num_parts * num_parts, sizeof(cl_double));
-    if (delta_times == NULL)
+    // With less than two particles there are no couples, and no couple is found if none will ever collide
+    bool triangular = CLSettings::get_pair_launch() == PAIR_LAUNCH_TRIANGULAR;
+    size_t count = triangular ? num_parts * (num_parts - 1) / 2 : num_parts * num_parts;
+    if (num_parts < 2 || k >= count)
     {
-        std::stringstream ss;
-        ss << "Errors occurred during the allocation of memory." << std::endl;
-        throw std::runtime_error(ss.str());
+        *i = NO_COLLISION;
+        *j = NO_COLLISION;
     }
-    queue.enqueueReadBuffer(cl_out_delta_time, CL_TRUE, 0, num_parts * num_parts * sizeof(cl_double), delta_times);
-    queue.finish();
-
-    // Compute the minimum delta_time
-    *delta_time = INFINITY;
-    for (register size_t ii = 0; ii < num_parts; ii++)
+    else if (triangular)
+        triangle_pair(k, num_parts, i, j);
+    else
     {
-        for (register size_t jj = ii + 1; jj < num_parts; jj++)
-        {
-            size_t k = ii * num_parts + jj;
-            if (delta_times[k] < *delta_time)
-            {
-                *delta_time = delta_times[k];
-                *i = ii;
-                *j = jj;
-            }
-        }
+        *i = k / num_parts;
+        *j = k % num_parts;
     }
-
-    free(delta_times);
-
-    first_run = true;
-}
\ No newline at end of file
+}
@@ -0,0 +1,81 @@
+#include "backends.h"
+#include "shared.h"
+#include "CLSettings.h"
+#include "CLRuntime.h"
+#include <iostream>
+
+OpenCLBackend::OpenCLBackend(const std::string& name, cl_device_type device_type)
+{
+    _name = name;
+    _device_type = device_type;
+}
+
+std::string OpenCLBackend::name() const
+{
+    return _name;
+}
+
+void OpenCLBackend::initialize(size_t num_parts)
+{
+    _device = cl::Device(CLSettings::select_device(_device_type, num_parts));
+    std::string devname;
+    _device.getInfo(CL_DEVICE_NAME, &devname);
+    std::cout << "Selected device " << devname << std::endl << std::endl;
+    CLSettings::set_device(_device);
+}
+
+bool OpenCLBackend::uses_opencl() const
+{
+    return true;
+}
+
+void OpenCLBackend::specialize(cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                               cl_double* radii, cl_double* masses, size_t num_parts, bool constant_particles)
+{
+    if (CLSettings::get_specialize() == SPECIALIZE_ON)
+        CLRuntime::specialize(x_wall, y_wall, z_wall, radii, masses, num_parts, constant_particles);
+}
+
+void OpenCLBackend::upload_state(ParticleStore& parts)
+{
+    CLRuntime::write_state(parts);
+}
+
+void OpenCLBackend::upload_walls(cl_double* x_wall, cl_double* y_wall, cl_double* z_wall)
+{
+    CLRuntime::write_walls(x_wall, y_wall, z_wall);
+}
+
+void OpenCLBackend::upload_velocity(ParticleStore& parts, size_t p)
+{
+    CLRuntime::write_velocity(parts, p);
+}
+
+void OpenCLBackend::upload_particle(ParticleStore& parts, size_t p)
+{
+    CLRuntime::write_particle(parts, p);
+}
+
+void OpenCLBackend::download_positions(ParticleStore& parts)
+{
+    CLRuntime::read_positions(parts);
+}
+
+void OpenCLBackend::download_position(ParticleStore& parts, size_t p)
+{
+    CLRuntime::read_position(parts, p);
+}
+
+void OpenCLBackend::next_collisions(ParticleStore& parts,
+                                    cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                                    size_t* p, cl_double* dt_wall, cl_double* collision_axis,
+                                    size_t* i, size_t* j, cl_double* dt_part)
+{
+    next_wall_collision_device(parts.num_parts(), p, dt_wall, collision_axis);
+    next_part_collision_device(parts.num_parts(), i, j, dt_part);
+}
+
+void OpenCLBackend::advance_positions(ParticleStore& parts, cl_double delta_time)
+{
+    update_positions_device(parts.num_parts(), delta_time);
+}
@@ -0,0 +1,372 @@
+#include "output_writer.h"
+#include "CLSettings.h"
+#include <chrono>
+#include <sstream>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_MSC_VER)
+#include <io.h>
+#endif
+#if defined(__linux__)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define MIN(x, y)       ((x) < (y) ? (x) : (y))
+#define MAX(x, y)       ((x) > (y) ? (x) : (y))
+
+static char* aligned_buffer(size_t size)
+{
+    void* buffer = NULL;
+#if defined(_MSC_VER)
+    buffer = _aligned_malloc(size, OUTPUT_ALIGNMENT);
+#else
+    if (posix_memalign(&buffer, OUTPUT_ALIGNMENT, size) != 0)
+        buffer = NULL;
+#endif
+    if (buffer == NULL)
+    {
+        std::stringstream ss;
+        ss << "Some errors occurred while allocating the output buffers." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    return (char*)buffer;
+}
+
+static void aligned_buffer_free(char* buffer)
+{
+#if defined(_MSC_VER)
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+// Open an existing file for writing at the given offset, discarding what follows
+static FILE* open_truncated(const std::string& filename, size_t offset)
+{
+    FILE* stream;
+    fopen_s(&stream, filename.c_str(), "r+b");
+    if (stream == NULL)
+        return NULL;
+
+    bool ok;
+#if defined(_MSC_VER)
+    ok = _fseeki64(stream, 0, SEEK_END) == 0 && (size_t)_ftelli64(stream) >= offset;
+    ok = ok && _chsize_s(_fileno(stream), offset) == 0 && _fseeki64(stream, offset, SEEK_SET) == 0;
+#else
+    ok = fseeko(stream, 0, SEEK_END) == 0 && (size_t)ftello(stream) >= offset;
+    ok = ok && ftruncate(fileno(stream), offset) == 0 && fseeko(stream, offset, SEEK_SET) == 0;
+#endif
+    if (!ok)
+    {
+        fclose(stream);
+        std::stringstream ss;
+        ss << "The output file " << filename << " is shorter than " << offset << " bytes, and cannot be resumed." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    return stream;
+}
+
+
+OutputWriter::OutputWriter(const std::string& filename)
+{
+    open(filename, false, 0);
+}
+
+OutputWriter::OutputWriter(const std::string& filename, bool append, size_t offset)
+{
+    open(filename, append, offset);
+}
+
+void OutputWriter::open(const std::string& filename, bool append, size_t offset)
+{
+    _filename = filename;
+    _stream = NULL;
+    _fd = -1;
+    // The data appended would not be aligned
+    _direct = !append && CLSettings::get_output_direct() == OUTPUT_DIRECT_ON;
+    _fill = 0;
+    _head = 0;
+    _tail = 0;
+    _closing = false;
+    _failed = false;
+    _written = offset;
+    _bytes = offset;
+    _stalls = 0;
+    _stall_seconds = 0;
+    _max_pending = 0;
+
+#if defined(__linux__)
+    if (_direct)
+    {
+        _fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        // Not all the file systems support direct output
+        if (_fd < 0 && errno == EINVAL)
+            std::cerr << "Direct output is not supported for " << filename << ". Using buffered output." << std::endl;
+    }
+#else
+    if (_direct)
+        std::cerr << "Direct output is not supported on this platform. Using buffered output." << std::endl;
+#endif
+    if (_fd < 0 && append)
+    {
+        _stream = open_truncated(filename, offset);
+        if (_stream != NULL)
+            setvbuf(_stream, NULL, _IONBF, 0);
+    }
+    else if (_fd < 0)
+    {
+        _direct = false;
+        fopen_s(&_stream, filename.c_str(), "wb");
+        // The buffers of the ring already batch the writes
+        if (_stream != NULL)
+            setvbuf(_stream, NULL, _IONBF, 0);
+    }
+    if (_fd < 0 && _stream == NULL)
+    {
+        std::stringstream ss;
+        ss << "Some error occurred while opening the output file in the simulation loop." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+
+    // Buffers are whole blocks, so that only the last write can be unaligned
+    _buffer_size = MAX(1, (CLSettings::get_output_buffer_size() + OUTPUT_ALIGNMENT - 1) / OUTPUT_ALIGNMENT) * OUTPUT_ALIGNMENT;
+    _buffers.assign(MAX(1, CLSettings::get_output_buffers()), NULL);
+    _sizes.assign(_buffers.size(), 0);
+    try
+    {
+        for (size_t b = 0; b < _buffers.size(); b++)
+            _buffers[b] = aligned_buffer(_buffer_size);
+    }
+    catch (std::exception&)
+    {
+        for (size_t b = 0; b < _buffers.size(); b++)
+            aligned_buffer_free(_buffers[b]);
+        if (_stream != NULL)
+            fclose(_stream);
+        throw;
+    }
+
+    _writer = std::thread(&OutputWriter::writer_loop, this);
+}
+
+OutputWriter::~OutputWriter()
+{
+    try
+    {
+        close();
+    }
+    catch (std::exception&)
+    {
+    }
+    for (size_t b = 0; b < _buffers.size(); b++)
+        aligned_buffer_free(_buffers[b]);
+}
+
+void OutputWriter::writer_loop()
+{
+    while (true)
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (_head.load(std::memory_order_acquire) == tail)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _filled.wait(lock, [this, tail]() { return _head.load(std::memory_order_acquire) != tail || _closing; });
+            // All the buffers handed over before the closing have been written
+            if (_head.load(std::memory_order_acquire) == tail)
+                return;
+            continue;
+        }
+
+        // After an error, the buffers are only recycled, so that the simulation thread never waits forever
+        size_t b = tail % _buffers.size();
+        if (!_failed.load(std::memory_order_relaxed))
+        {
+            try
+            {
+                write_buffer(_buffers[b], _sizes[b]);
+            }
+            catch (std::exception& e)
+            {
+                _error = e.what();
+                _failed.store(true, std::memory_order_release);
+            }
+        }
+
+        _written.fetch_add(_sizes[b], std::memory_order_release);
+        _tail.store(tail + 1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+        }
+        // Both the simulation thread and a checkpoint may be waiting
+        _emptied.notify_all();
+    }
+}
+
+void OutputWriter::write_buffer(const char* data, size_t size)
+{
+    bool ok = true;
+#if defined(__linux__)
+    if (_fd >= 0)
+    {
+        // Direct writes must be whole blocks. The unaligned tail, at the end of the file,
+        // is written after turning the direct output off.
+        size_t aligned = _direct ? size / OUTPUT_ALIGNMENT * OUTPUT_ALIGNMENT : size;
+        size_t done = 0;
+        while (ok && done < size)
+        {
+            if (done == aligned)
+            {
+                ok = fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) & ~O_DIRECT) == 0;
+                _direct = false;
+                aligned = size;
+                continue;
+            }
+            ssize_t written = ::write(_fd, data + done, aligned - done);
+            ok = written > 0;
+            if (ok)
+                done += (size_t)written;
+        }
+    }
+    else
+#endif
+        ok = fwrite(data, 1, size, _stream) == size;
+
+    if (!ok)
+    {
+        std::stringstream ss;
+        ss << "Some errors occurred while writing the output file " << _filename << "." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+void OutputWriter::acquire()
+{
+    // Wait for the writer thread only if all the buffers are pending
+    size_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_acquire) < _buffers.size())
+        return;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _emptied.wait(lock, [this, head]() { return head - _tail.load(std::memory_order_acquire) < _buffers.size(); });
+    }
+    _stalls++;
+    _stall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void OutputWriter::publish()
+{
+    size_t head = _head.load(std::memory_order_relaxed);
+    _sizes[head % _buffers.size()] = _fill;
+    _bytes += _fill;
+    _fill = 0;
+    _head.store(head + 1, std::memory_order_release);
+    _max_pending = MAX(_max_pending, head + 1 - _tail.load(std::memory_order_relaxed));
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+    }
+    _filled.notify_one();
+}
+
+void OutputWriter::check()
+{
+    if (_failed.load(std::memory_order_acquire))
+        throw std::runtime_error(_error);
+}
+
+void OutputWriter::write(const void* data, size_t size, size_t count)
+{
+    check();
+    const char* bytes = (const char*)data;
+    size_t remaining = size * count;
+    while (remaining > 0)
+    {
+        if (_fill == 0)
+            acquire();
+        size_t n = MIN(remaining, _buffer_size - _fill);
+        memcpy(_buffers[_head.load(std::memory_order_relaxed) % _buffers.size()] + _fill, bytes, n);
+        _fill += n;
+        bytes += n;
+        remaining -= n;
+        if (_fill == _buffer_size)
+            publish();
+    }
+}
+
+size_t OutputWriter::tell() const
+{
+    return _bytes + _fill;
+}
+
+void OutputWriter::flush()
+{
+    check();
+    // The buffer being filled has already been acquired
+    if (_fill > 0)
+        publish();
+}
+
+void OutputWriter::sync(size_t bytes)
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _emptied.wait(lock, [this, bytes]() { return _written.load(std::memory_order_acquire) >= bytes || _failed.load(std::memory_order_acquire); });
+    }
+    check();
+
+    bool ok = true;
+#if defined(_MSC_VER)
+    ok = _commit(_fileno(_stream)) == 0;
+#else
+    ok = fsync(_fd >= 0 ? _fd : fileno(_stream)) == 0;
+#endif
+    if (!ok)
+    {
+        std::stringstream ss;
+        ss << "Some errors occurred while synchronizing the output file " << _filename << "." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+void OutputWriter::close()
+{
+    if (!_writer.joinable())
+        return;
+
+    if (_fill > 0)
+        publish();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closing = true;
+    }
+    _filled.notify_one();
+    _writer.join();
+
+#if defined(__linux__)
+    if (_fd >= 0)
+        ::close(_fd);
+#endif
+    if (_stream != NULL)
+        fclose(_stream);
+    _fd = -1;
+    _stream = NULL;
+
+    check();
+}
+
+std::string OutputWriter::summary() const
+{
+    std::stringstream ss;
+    ss << "Written " << _bytes << " bytes of output through " << _buffers.size() << " buffers of "
+       << _buffer_size << " bytes (at most " << _max_pending << " pending). ";
+    if (_stalls == 0)
+        ss << "The simulation never waited for the output.";
+    else
+        ss << "The simulation waited " << _stalls << " times for the output, for " << _stall_seconds << " seconds.";
+    return ss.str();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+
+// Alignment of the buffers and granularity of their size, as required by the direct output
+#define OUTPUT_ALIGNMENT    4096
+
+// Output file written by a background thread, configured by the OUTPUT_* settings of CLSettings.
+// The simulation thread copies the data into the buffer at the head of a ring of preallocated
+// buffers, and hands the buffer over to the writer thread once it is full, so that the storage
+// always sees large aligned writes. The ring has a single producer and a single consumer, which
+// synchronize through its atomic indices: the simulation thread waits only if all the buffers
+// are pending, and the writer thread only if none is.
+// Errors of the writer thread are thrown by the next call of write or close.
+class OutputWriter
+{
+private:
+    std::string _filename;
+    FILE* _stream;
+    int _fd;
+    bool _direct;
+
+    // Ring of buffers. Buffer b % size is filled by the simulation thread for b == _head, and
+    // written by the writer thread for _tail <= b < _head.
+    std::vector<char*> _buffers;
+    std::vector<size_t> _sizes;
+    size_t _buffer_size;
+    size_t _fill;
+    std::atomic<size_t> _head;
+    std::atomic<size_t> _tail;
+
+    // Handshake for the waits on an empty or full ring
+    std::mutex _mutex;
+    std::condition_variable _filled;
+    std::condition_variable _emptied;
+    bool _closing;
+    std::thread _writer;
+
+    std::atomic<bool> _failed;
+    std::string _error;
+
+    // Bytes written to the file by the writer thread
+    std::atomic<size_t> _written;
+
+    // Backpressure metrics
+    size_t _bytes;
+    size_t _stalls;
+    double _stall_seconds;
+    size_t _max_pending;
+
+    void open(const std::string& filename, bool append, size_t offset);
+    void writer_loop();
+    void write_buffer(const char* data, size_t size);
+    void acquire();
+    void publish();
+    void check();
+
+    OutputWriter(OutputWriter& ow) {};
+    void operator=(OutputWriter& ow) {};
+
+public:
+    // Create the file and start the writer thread
+    OutputWriter(const std::string& filename);
+    // Same, but with append the file must exist, and is truncated to offset and appended to.
+    // Used to resume a simulation.
+    OutputWriter(const std::string& filename, bool append, size_t offset);
+    // Close the file, if not done yet, ignoring the errors
+    ~OutputWriter();
+
+    // Same as fwrite, on the file of the writer
+    void write(const void* data, size_t size, size_t count);
+
+    // Number of bytes handed over so far, that is the offset in the file of the next write
+    size_t tell() const;
+    // Hand the data written so far over to the writer thread, without waiting for it.
+    // The following writes are not aligned anymore, so the direct output is turned off.
+    void flush();
+    // Wait until the first bytes of the file are written, and make them durable.
+    // Can be called by a thread other than the simulation one.
+    void sync(size_t bytes);
+
+    // Write the pending data, stop the writer thread and close the file
+    void close();
+
+    // Description of the metrics of the ring, for the log
+    std::string summary() const;
+};
@@ -1,46 +1,187 @@
+// Constants of the run baked by the build options (see CLRuntime::specialize).
+// Without them, the values given as arguments are used.
+#ifdef AHS_NUM_PARTS
+#define NUM_PARTS(num_parts)	((ulong)AHS_NUM_PARTS)
+#else
+#define NUM_PARTS(num_parts)	(num_parts)
+#endif
+#ifdef AHS_UNIFORM_RADIUS
+#define RADIUS(radii, i)		(AHS_UNIFORM_RADIUS)
+#else
+#define RADIUS(radii, i)		((radii)[i])
+#endif
+
+// Collision time of the couple (i, j).
+// Positions and velocities are planar, with the y and z components starting at stride and 2 * stride.
+inline double pair_collision_time(__global const double* pos,
+								  __global const double* vel,
+								  __global const double* radii,
+								  ulong stride,
+								  ulong i, ulong j)
+{
+	// Relative position and velocity
+	double dx = pos[i] - pos[j];
+	double dy = pos[stride + i] - pos[stride + j];
+	double dz = pos[2 * stride + i] - pos[2 * stride + j];
+	double dvx = vel[i] - vel[j];
+	double dvy = vel[stride + i] - vel[stride + j];
+	double dvz = vel[2 * stride + i] - vel[2 * stride + j];
+
+	// Velocities dot product
+	double a = dvx * dvx + dvy * dvy + dvz * dvz;
+	// Position-velocity dot product times two
+	double b = 2 * (dx * dvx + dy * dvy + dz * dvz);
+	// Positions dot product, minus the square of the sum of radii
+	double c = (dx * dx + dy * dy + dz * dz)
+			   -
+			   ((RADIUS(radii, i) + RADIUS(radii, j)) * (RADIUS(radii, i) + RADIUS(radii, j)));
+
+	// Collision occurs only if b is negative
+	if (b >= 0 || b*b < 4*a*c)
+		return INFINITY;
+
+	// Solve the polynomial, if the relative difference between the centers is greater
+	// than the sum of the radii
+	if (c >= 0)
+		return (- b - sqrt(b*b - 4*a*c)) / (2 * a);
+	// Otherwise, give to the couples the highest priority, using a negative time
+	return -1;
+}
+
 __kernel void part_collision(__global const double* pos,
 							 __global const double* vel,
 							 __global const double* radii,
 							 const ulong num_parts,
+							 const ulong stride,
 							 __global double* delta_times)
 {
+	ulong n = NUM_PARTS(num_parts);
 	int i = get_global_id(0);
 	int j = get_global_id(1);
-	if (i < num_parts && j < num_parts)
+	if (i < n && j < n)
+		delta_times[j * n + i] = pair_collision_time(pos, vel, radii, stride, i, j);
+}
+
+
+// Keep the smallest value, breaking ties with the smallest index
+inline void argmin_update(double* best, ulong* best_idx, double value, ulong idx)
+{
+	if (value < *best || (value == *best && idx < *best_idx))
 	{
-		// Velocities dot product
-		double a = (vel[3 * i]     - vel[3 * j])     * (vel[3 * i]     - vel[3 * j])     +
-				   (vel[3 * i + 1] - vel[3 * j + 1]) * (vel[3 * i + 1] - vel[3 * j + 1]) + 
-				   (vel[3 * i + 2] - vel[3 * j + 2]) * (vel[3 * i + 2] - vel[3 * j + 2]);
-		// Position-velocity dot product times two
-		double b = 2 * ((pos[3 * i]     - pos[3 * j])     * (vel[3 * i]     - vel[3 * j])     +
-					    (pos[3 * i + 1] - pos[3 * j + 1]) * (vel[3 * i + 1] - vel[3 * j + 1]) + 
-					    (pos[3 * i + 2] - pos[3 * j + 2]) * (vel[3 * i + 2] - vel[3 * j + 2]));
-		// Positions dot product, minus the square of the sum of radii
-		double c = ((pos[3 * i]     - pos[3 * j])     * (pos[3 * i]     - pos[3 * j])     +
-					(pos[3 * i + 1] - pos[3 * j + 1]) * (pos[3 * i + 1] - pos[3 * j + 1]) + 
-					(pos[3 * i + 2] - pos[3 * j + 2]) * (pos[3 * i + 2] - pos[3 * j + 2]))
-				   -
-				   ((radii[i] + radii[j]) * (radii[i] + radii[j]));
-
-		// Collision occurs only if b is negative
-		if (b >= 0 || b*b < 4*a*c)
+		*best = value;
+		*best_idx = idx;
+	}
+}
+
+// Reduce the values held by the work-group in local memory, and write the result of the group
+inline void argmin_group(double best, ulong best_idx,
+						 __local double* loc_values, __local ulong* loc_indices,
+						 __global double* out_values, __global ulong* out_indices)
+{
+	int l = get_local_id(0);
+	loc_values[l] = best;
+	loc_indices[l] = best_idx;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int s = get_local_size(0) / 2; s > 0; s >>= 1)
+	{
+		if (l < s)
 		{
-			delta_times[j * num_parts + i] = INFINITY;
+			double value = loc_values[l];
+			ulong idx = loc_indices[l];
+			argmin_update(&value, &idx, loc_values[l + s], loc_indices[l + s]);
+			loc_values[l] = value;
+			loc_indices[l] = idx;
 		}
-		else
-		{
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
 
-			//printf("A(%d, %d) = %f\nB(%d, %d) = %f\nC(%d, %d) = %f\n", i, j, a, i, j, b, i, j, c);
-			//printf("(%d, %d) ==> %f\n", i, j, (- b - sqrt(b*b - 4*a*c)) / (2 * a));
+	if (l == 0)
+	{
+		out_values[get_group_id(0)] = loc_values[0];
+		out_indices[get_group_id(0)] = loc_indices[0];
+	}
+}
 
-			// Solve the polynomial, if the relative difference between the centers is greater
-			// than the sum of the radii
-			if (c >= 0)
-				delta_times[j * num_parts + i] = (- b - sqrt(b*b - 4*a*c)) / (2 * a);
-			// Otherwise, give to the couples the highest priority, using a negative time
-			else
-				delta_times[j * num_parts + i] = -1;
-		}
+// First step of the minimum search over the matrix written by part_collision.
+// Only the couples (i, j) with i < j are considered, i.e. the entries i * num_parts + j.
+__kernel void part_collision_argmin(__global const double* delta_times,
+									const ulong num_parts,
+									__global double* out_values,
+									__global ulong* out_indices,
+									__local double* loc_values,
+									__local ulong* loc_indices)
+{
+	ulong n = NUM_PARTS(num_parts);
+	double best = INFINITY;
+	ulong best_idx = ULONG_MAX;
+	ulong count = n * n;
+	for (ulong k = get_global_id(0); k < count; k += get_global_size(0))
+	{
+		if (k / n < k % n)
+			argmin_update(&best, &best_idx, delta_times[k], k);
 	}
-}
\ No newline at end of file
+
+	argmin_group(best, best_idx, loc_values, loc_indices, out_values, out_indices);
+}
+
+// Following steps of the minimum search, over the results of the previous step
+__kernel void argmin_reduce(__global const double* values,
+							__global const ulong* indices,
+							const ulong count,
+							__global double* out_values,
+							__global ulong* out_indices,
+							__local double* loc_values,
+							__local ulong* loc_indices)
+{
+	double best = INFINITY;
+	ulong best_idx = ULONG_MAX;
+	for (ulong k = get_global_id(0); k < count; k += get_global_size(0))
+		argmin_update(&best, &best_idx, values[k], indices[k]);
+
+	argmin_group(best, best_idx, loc_values, loc_indices, out_values, out_indices);
+}
+
+
+
+// Index of the first couple of row i in the upper triangle, stored by rows
+inline ulong triangle_row_start(ulong i, ulong num_parts)
+{
+	return i * (2 * num_parts - i - 1) / 2;
+}
+
+// Collision times of the couples (i, j) with i < j only, each couple identified by its
+// index in the upper triangle stored by rows. The first step of the minimum search is
+// done here, so that the times are never stored.
+__kernel void part_collision_triangular(__global const double* pos,
+										__global const double* vel,
+										__global const double* radii,
+										const ulong num_parts,
+										const ulong stride,
+										__global double* out_values,
+										__global ulong* out_indices,
+										__local double* loc_values,
+										__local ulong* loc_indices)
+{
+	ulong parts = NUM_PARTS(num_parts);
+	double best = INFINITY;
+	ulong best_idx = ULONG_MAX;
+	ulong count = parts * (parts - 1) / 2;
+	double n = parts - 0.5;
+	for (ulong k = get_global_id(0); k < count; k += get_global_size(0))
+	{
+		// Invert triangle_row_start, then correct the rounding errors
+		ulong i = (ulong)(n - sqrt(fmax(0.0, n * n - 2.0 * k)));
+		if (i > parts - 2)
+			i = parts - 2;
+		while (i > 0 && triangle_row_start(i, parts) > k)
+			i--;
+		while (i < parts - 2 && triangle_row_start(i + 1, parts) <= k)
+			i++;
+		ulong j = k - triangle_row_start(i, parts) + i + 1;
+
+		argmin_update(&best, &best_idx, pair_collision_time(pos, vel, radii, stride, i, j), k);
+	}
+
+	argmin_group(best, best_idx, loc_values, loc_indices, out_values, out_indices);
+}
@@ -28,15 +28,58 @@ void cross_prod(cl_double* v1, cl_double* v2, cl_double* u)
 #define MIN(x, y)   ((x) < (y) ? (x) : (y))
 #define ABS(x)      ((x) < 0 ? -(x) : (x))
 
-void resolve_inelastic_part_collision(cl_double* pos, cl_double* vel, cl_double* masses,
-                                      size_t num_parts, cl_double e,
-                                      size_t i, size_t j)
+// Calls of rand() made by the fission collisions, so that the generator can be restored from a checkpoint
+static size_t random_draws = 0;
+
+static int fission_rand()
+{
+    random_draws++;
+    return rand();
+}
+
+size_t fission_random_draws()
+{
+    return random_draws;
+}
+
+void skip_fission_random_draws(size_t num_draws)
+{
+    for (size_t d = 0; d < num_draws; d++)
+        fission_rand();
+}
+
+// Position and velocity of particle p
+static void load_particle(ParticleStore& parts, size_t p, cl_double* p_pos, cl_double* p_vel)
+{
+    p_pos[0] = parts.x[p];
+    p_pos[1] = parts.y[p];
+    p_pos[2] = parts.z[p];
+    p_vel[0] = parts.vx[p];
+    p_vel[1] = parts.vy[p];
+    p_vel[2] = parts.vz[p];
+}
+
+static void store_position(ParticleStore& parts, size_t p, cl_double* p_pos)
+{
+    parts.x[p] = p_pos[0];
+    parts.y[p] = p_pos[1];
+    parts.z[p] = p_pos[2];
+}
+
+static void store_velocity(ParticleStore& parts, size_t p, cl_double* p_vel)
+{
+    parts.vx[p] = p_vel[0];
+    parts.vy[p] = p_vel[1];
+    parts.vz[p] = p_vel[2];
+}
+
+void resolve_inelastic_part_collision(ParticleStore& parts, cl_double e, size_t i, size_t j)
 {
     // Positions and velocities
-    cl_double* pi = pos + (3 * i);
-    cl_double* vi = vel + (3 * i);
-    cl_double* pj = pos + (3 * j);
-    cl_double* vj = vel + (3 * j);
+    cl_double pi[3], vi[3], pj[3], vj[3];
+    load_particle(parts, i, pi, vi);
+    load_particle(parts, j, pj, vj);
+    cl_double* masses = parts.mass;
     // Pij and Vij
     cl_double pij[3] = { pi[0] - pj[0], pi[1] - pj[1], pi[2] - pj[2] };
     cl_double vij[3] = { vi[0] - vj[0], vi[1] - vj[1], vi[2] - vj[2] };
@@ -59,21 +102,20 @@ void resolve_inelastic_part_collision(cl_double* pos, cl_double* vel, cl_double*
         vi[k] = inelastic[k] - masses[i] * elastic[k];
         vj[k] = inelastic[k] + masses[j] * elastic[k];
     }
+    store_velocity(parts, i, vi);
+    store_velocity(parts, j, vj);
 }
 
 
 
-void resolve_fusion_part_collision(cl_double* pos, cl_double* vel, cl_double* masses, cl_double* radii,
-                                   size_t num_parts, cl_double e, size_t i, size_t j, cl_double fusion_thresh, 
-                                   cl_double** endpos, cl_double** endvel,
-                                   cl_double** endmasses, cl_double** endradii,
-                                   size_t* endparts)
+void resolve_fusion_part_collision(ParticleStore& parts, cl_double e, size_t i, size_t j, cl_double fusion_thresh)
 {
     // Positions and velocities
-    cl_double* pi = pos + (3 * i);
-    cl_double* vi = vel + (3 * i);
-    cl_double* pj = pos + (3 * j);
-    cl_double* vj = vel + (3 * j);
+    cl_double pi[3], vi[3], pj[3], vj[3];
+    load_particle(parts, i, pi, vi);
+    load_particle(parts, j, pj, vj);
+    cl_double* masses = parts.mass;
+    cl_double* radii = parts.radius;
     // Pij and Vij
     cl_double pij[3] = { pi[0] - pj[0], pi[1] - pj[1], pi[2] - pj[2] };
     cl_double vij[3] = { vi[0] - vj[0], vi[1] - vj[1], vi[2] - vj[2] };
@@ -94,89 +136,44 @@ void resolve_fusion_part_collision(cl_double* pos, cl_double* vel, cl_double* ma
     if (ABS(pvij / sqrt(pij_norm2)) > fusion_thresh)
     {
         //std::cout << "Fusion collision between particles " << i << " and " << j << std::endl;
-        // Allocate new space for new data
-        *endpos = (cl_double*)calloc((num_parts - 1) * 3, sizeof(cl_double));
-        *endvel = (cl_double*)calloc((num_parts - 1) * 3, sizeof(cl_double));
-        *endmasses = (cl_double*)calloc(num_parts - 1, sizeof(cl_double));
-        *endradii = (cl_double*)calloc(num_parts - 1, sizeof(cl_double));
-        *endparts = num_parts - 1;
-        if (endpos == NULL || endvel == NULL || endmasses == NULL || endradii == NULL)
-        {
-            std::stringstream ss;
-            ss << "Error occurred while allocating memory in particle velocity update for fusion model." << std::endl;
-            throw std::runtime_error(ss.str());
-        }
-
-        // Copy the content, excluding the fused element
-        std::memcpy((*endpos), pos, 3 * MIN(i, j) * sizeof(cl_double));
-        std::memcpy((*endpos) + 3 * MIN(i, j), pos + 3 * (MIN(i, j) + 1), (MAX(i, j) - MIN(i, j) - 1) * 3 * sizeof(cl_double));
-        std::memcpy((*endpos) + 3 * (MAX(i, j) - 1), pos + 3 * (MAX(i, j) + 1), (num_parts - MAX(i, j) - 1) * 3 * sizeof(cl_double));
-
-        std::memcpy((*endvel), vel, 3 * MIN(i, j) * sizeof(cl_double));
-        std::memcpy((*endvel) + 3 * MIN(i, j), vel + 3 * (MIN(i, j) + 1), (MAX(i, j) - MIN(i, j) - 1) * 3 * sizeof(cl_double));
-        std::memcpy((*endvel) + 3 * (MAX(i, j) - 1), vel + 3 * (MAX(i, j) + 1), (num_parts - MAX(i, j) - 1) * 3 * sizeof(cl_double));
-
-        std::memcpy((*endmasses), masses, MIN(i, j) * sizeof(cl_double));
-        std::memcpy((*endmasses) + MIN(i, j), masses + (MIN(i, j) + 1), (MAX(i, j) - MIN(i, j) - 1) * sizeof(cl_double));
-        std::memcpy((*endmasses) + (MAX(i, j) - 1), masses + (MAX(i, j) + 1), (num_parts - MAX(i, j) - 1) * sizeof(cl_double));
-
-        std::memcpy((*endradii), radii, MIN(i, j) * sizeof(cl_double));
-        std::memcpy((*endradii) + MIN(i, j), radii + (MIN(i, j) + 1), (MAX(i, j) - MIN(i, j) - 1) * sizeof(cl_double));
-        std::memcpy((*endradii) + (MAX(i, j) - 1), radii + (MAX(i, j) + 1), (num_parts - MAX(i, j) - 1) * sizeof(cl_double));
-
-        // Finally, assign position, velocity, mass and radius to the new particle
+        // Position, velocity, mass and radius of the new particle
+        cl_double fused_pos[3];
         for (size_t k = 0; k < 3; k++)
-        {
-            (*endpos)[3 * ((*endparts) - 1) + k] = (pi[k] + pj[k]) / 2;
-            (*endvel)[3 * ((*endparts) - 1) + k] = inelastic[k];
-        }
-        (*endmasses)[(*endparts) - 1] = masses[i] + masses[j];
-        (*endradii)[(*endparts) - 1] = pow(pow(radii[i], 3) + pow(radii[j], 3), 1.0 / 3.0);
+            fused_pos[k] = (pi[k] + pj[k]) / 2;
+        cl_double fused_mass = masses[i] + masses[j];
+        cl_double fused_radius = pow(pow(radii[i], 3) + pow(radii[j], 3), 1.0 / 3.0);
+
+        // The new particle takes the place of the first fused one, and the second one is removed
+        size_t q = MIN(i, j);
+        parts.remove(MAX(i, j));
+        store_position(parts, q, fused_pos);
+        store_velocity(parts, q, inelastic);
+        parts.mass[q] = fused_mass;
+        parts.radius[q] = fused_radius;
     }
     // Otherwise, the update is the normal inelastic collision update
     else
     {
-        // Allocate new space for new data
-        *endpos = (cl_double*)calloc(num_parts * 3, sizeof(cl_double));
-        *endvel = (cl_double*)calloc(num_parts * 3, sizeof(cl_double));
-        *endmasses = (cl_double*)calloc(num_parts, sizeof(cl_double));
-        *endradii = (cl_double*)calloc(num_parts, sizeof(cl_double));
-        *endparts = num_parts;
-        if (endpos == NULL || endvel == NULL || endmasses == NULL || endradii == NULL)
-        {
-            std::stringstream ss;
-            ss << "Error occurred while allocating memory in particle velocity update for fusion model." << std::endl;
-            throw std::runtime_error(ss.str());
-        }
-
-        // Copy the data
-        std::memcpy(*endpos, pos, 3 * num_parts * sizeof(cl_double));
-        std::memcpy(*endvel, vel, 3 * num_parts * sizeof(cl_double));
-        std::memcpy(*endmasses, masses, num_parts * sizeof(cl_double));
-        std::memcpy(*endradii, radii, num_parts * sizeof(cl_double));
-
         // Update the velocities
         for (size_t k = 0; k < 3; k++)
         {
-            (*endvel)[3 * i + k] = inelastic[k] - masses[i] * elastic[k];
-            (*endvel)[3 * j + k] = inelastic[k] + masses[j] * elastic[k];
+            vi[k] = inelastic[k] - masses[i] * elastic[k];
+            vj[k] = inelastic[k] + masses[j] * elastic[k];
         }
+        store_velocity(parts, i, vi);
+        store_velocity(parts, j, vj);
     }
 }
 
 
-void resolve_fission_part_collision(cl_double* pos, cl_double* vel, 
-                                    cl_double* masses, cl_double* radii, 
-                                    size_t num_parts, cl_double e, size_t i, size_t j, cl_double fusion_thresh, 
-                                    cl_double** endpos, cl_double** endvel, 
-                                    cl_double** endmasses, cl_double** endradii, 
-                                    size_t* endparts)
+void resolve_fission_part_collision(ParticleStore& parts, cl_double e, size_t i, size_t j, cl_double fusion_thresh)
 {
     // Positions and velocities
-    cl_double* pi = pos + (3 * i);
-    cl_double* vi = vel + (3 * i);
-    cl_double* pj = pos + (3 * j);
-    cl_double* vj = vel + (3 * j);
+    cl_double pi[3], vi[3], pj[3], vj[3];
+    load_particle(parts, i, pi, vi);
+    load_particle(parts, j, pj, vj);
+    cl_double* masses = parts.mass;
+    cl_double* radii = parts.radius;
     // Pij and Vij
     cl_double pij[3] = { pi[0] - pj[0], pi[1] - pj[1], pi[2] - pj[2] };
     cl_double vij[3] = { vi[0] - vj[0], vi[1] - vj[1], vi[2] - vj[2] };
@@ -197,27 +194,8 @@ void resolve_fission_part_collision(cl_double* pos, cl_double* vel,
     if (ABS(pvij / sqrt(pij_norm2)) > fusion_thresh)
     {
         //std::cout << "Fission collision between particles " << i << " and " << j << std::endl;
-        // Allocate new space for new data
-        *endpos = (cl_double*)calloc((num_parts + 1) * 3, sizeof(cl_double));
-        *endvel = (cl_double*)calloc((num_parts + 1) * 3, sizeof(cl_double));
-        *endmasses = (cl_double*)calloc(num_parts + 1, sizeof(cl_double));
-        *endradii = (cl_double*)calloc(num_parts + 1, sizeof(cl_double));
-        *endparts = num_parts + 1;
-        if (*endpos == NULL || *endvel == NULL || *endmasses == NULL || *endradii == NULL)
-        {
-            std::stringstream ss;
-            ss << "Error occurred while allocating memory in particle velocity update for fission model." << std::endl;
-            throw std::runtime_error(ss.str());
-        }
-
-        // Copy the content to the new data
-        std::memcpy(*endpos, pos, 3 * num_parts * sizeof(cl_double));
-        std::memcpy(*endvel, vel, 3 * num_parts * sizeof(cl_double));
-        std::memcpy(*endmasses, masses, num_parts * sizeof(cl_double));
-        std::memcpy(*endradii, radii, num_parts * sizeof(cl_double));
-
         // Determine the broken particle. Select one particle at random, first
-        size_t brok = rand() % 2;
+        size_t brok = fission_rand() % 2;
         brok = brok * i + (1 - brok) * j;   // i.e. rand = 1 -> brok = i, rand = 0 -> brok = j
         // Select the fastest particle, along the collision axis
         if (ABS(dot_prod(pij, vi, 3)) < ABS(dot_prod(pij, vj, 3)))
@@ -237,78 +215,74 @@ void resolve_fission_part_collision(cl_double* pos, cl_double* vel,
         // If all the quantities compared are equals, then the random selection is kept
         // Select the other particle
         size_t other = brok == i ? j : i;
+        cl_double* brok_pos = brok == i ? pi : pj;
+        cl_double* brok_vel = brok == i ? vi : vj;
+        cl_double* other_vel = brok == i ? vj : vi;
 
         // Update the particles' velocity using normal collision update
         cl_double sign = brok == i ? 1 : -1;
+        cl_double next_brok_vel[3], next_other_vel[3];
         for (size_t k = 0; k < 3; k++)
         {
-            (*endvel)[3 * brok + k] = inelastic[k] - sign * e * masses[other] * elastic[k];
-            (*endvel)[3 * other + k] = inelastic[k] + sign * e * masses[brok] * elastic[k];
+            next_brok_vel[k] = inelastic[k] - sign * e * masses[other] * elastic[k];
+            next_other_vel[k] = inelastic[k] + sign * e * masses[brok] * elastic[k];
         }
 
-        // Define the radii of the new particles
-        (*endradii)[brok] = pow(4, 1.0 / 3.0) / 2 * radii[brok];
-        (*endradii)[*endparts - 1] = pow(4, 1.0 / 3.0) / 2 * radii[brok];
-
-        // Define the masses of the new particles
-        (*endmasses)[brok] = masses[brok] / 2;
-        (*endmasses)[*endparts - 1] = masses[brok] / 2;
+        // Define the radii and the masses of the new particles
+        cl_double next_radius = pow(4, 1.0 / 3.0) / 2 * radii[brok];
+        cl_double next_mass = masses[brok] / 2;
 
         // Compute the normal component to the collision plane
         cl_double normal[3];
-        cross_prod(vel + 3 * other, pij, normal);
+        cross_prod(other_vel, pij, normal);
         // Scale to unit. If length is zero, choose random
         cl_double normal_length = sqrt(dot_prod(normal, normal, 3));
         if (normal_length == 0)
         {
             for (size_t k = 0; k < 3; k++)
-                normal[k] = ((cl_double)rand()) / RAND_MAX;
+                normal[k] = ((cl_double)fission_rand()) / RAND_MAX;
             normal_length = sqrt(dot_prod(normal, normal, 3));
         }
         for (size_t k = 0; k < 3; k++)
             normal[k] /= normal_length;
 
         // Compute the length of the normal component
-        cl_double v_prev = dot_prod(vel + 3 * brok, vel + 3 * brok, 3);
-        cl_double v_next = dot_prod(*endvel + 3 * brok, *endvel + 3 * brok, 3);
+        cl_double v_prev = dot_prod(brok_vel, brok_vel, 3);
+        cl_double v_next = dot_prod(next_brok_vel, next_brok_vel, 3);
         normal_length = sqrt(ABS(v_prev - v_next));
 
         // Finally, assign position and velocity to the new particles
+        cl_double new_pos[3], new_vel[3], next_brok_pos[3];
         for (size_t k = 0; k < 3; k++)
         {
-            (*endpos)[3 * ((*endparts) - 1) + k] =  pos[3 * brok + k] + normal[k] * (*endradii)[brok];
-            (*endpos)[3 * brok + k] =               pos[3 * brok + k] - normal[k] * (*endradii)[brok];
-            (*endvel)[3 * ((*endparts) - 1) + k] =  (*endvel)[3 * brok + k] + normal[k] * normal_length;
-            (*endvel)[3 * brok + k] =               (*endvel)[3 * brok + k] - normal[k] * normal_length;
+            new_pos[k] =        brok_pos[k] + normal[k] * next_radius;
+            next_brok_pos[k] =  brok_pos[k] - normal[k] * next_radius;
+            new_vel[k] =        next_brok_vel[k] + normal[k] * normal_length;
+            next_brok_vel[k] =  next_brok_vel[k] - normal[k] * normal_length;
         }
+        store_position(parts, brok, next_brok_pos);
+        store_velocity(parts, brok, next_brok_vel);
+        store_velocity(parts, other, next_other_vel);
+        parts.radius[brok] = next_radius;
+        parts.mass[brok] = next_mass;
+
+        // The new particle is appended after all the others
+        size_t q = parts.append();
+        store_position(parts, q, new_pos);
+        store_velocity(parts, q, new_vel);
+        parts.radius[q] = next_radius;
+        parts.mass[q] = next_mass;
     }
     // Otherwise, the update is the normal inelastic collision update
     else
     {
-        // Allocate new space for new data
-        *endpos = (cl_double*)calloc(num_parts * 3, sizeof(cl_double));
-        *endvel = (cl_double*)calloc(num_parts * 3, sizeof(cl_double));
-        *endmasses = (cl_double*)calloc(num_parts, sizeof(cl_double));
-        *endradii = (cl_double*)calloc(num_parts, sizeof(cl_double));
-        *endparts = num_parts;
-        if (*endpos == NULL || *endvel == NULL || *endmasses == NULL || *endradii == NULL)
-        {
-            std::stringstream ss;
-            ss << "Error occurred while allocating memory in particle velocity update for fission model." << std::endl;
-            throw std::runtime_error(ss.str());
-        }
-
-        // Copy the data
-        std::memcpy(*endpos, pos, 3 * num_parts * sizeof(cl_double));
-        std::memcpy(*endvel, vel, 3 * num_parts * sizeof(cl_double));
-        std::memcpy(*endmasses, masses, num_parts * sizeof(cl_double));
-        std::memcpy(*endradii, radii, num_parts * sizeof(cl_double));
-
         // Update the velocities
         for (size_t k = 0; k < 3; k++)
         {
-            (*endvel)[3 * i + k] = inelastic[k] - masses[i] * elastic[k];
-            (*endvel)[3 * j + k] = inelastic[k] + masses[j] * elastic[k];
+            vi[k] = inelastic[k] - masses[i] * elastic[k];
+            vj[k] = inelastic[k] + masses[j] * elastic[k];
         }
+        store_velocity(parts, i, vi);
+        store_velocity(parts, j, vj);
     }
-}
\ No newline at end of file
+}
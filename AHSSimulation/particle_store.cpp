@@ -0,0 +1,153 @@
+#include "particle_store.h"
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX(x, y)       ((x) > (y) ? (x) : (y))
+
+// Number of arrays in the block: positions, velocities, masses and radii
+#define PARTICLE_STORE_ARRAYS   8
+
+static cl_double* aligned_calloc(size_t count)
+{
+    size_t size = MAX(1, count) * sizeof(cl_double);
+    void* block = NULL;
+#if defined(_MSC_VER)
+    block = _aligned_malloc(size, PARTICLE_STORE_ALIGNMENT);
+#else
+    if (posix_memalign(&block, PARTICLE_STORE_ALIGNMENT, size) != 0)
+        block = NULL;
+#endif
+    if (block == NULL)
+    {
+        std::stringstream ss;
+        ss << "Some errors occurred while allocating memory for the particles." << std::endl;
+        throw std::runtime_error(ss.str());
+    }
+    memset(block, 0, size);
+    return (cl_double*)block;
+}
+
+static void aligned_free(cl_double* block)
+{
+#if defined(_MSC_VER)
+    _aligned_free(block);
+#else
+    free(block);
+#endif
+}
+
+ParticleStore::ParticleStore(cl_double* pos, cl_double* vel, cl_double* masses, cl_double* radii, size_t num_parts)
+{
+    _num_parts = 0;
+    _capacity = 0;
+    _block = NULL;
+    reserve(num_parts);
+
+    _num_parts = num_parts;
+    for (size_t p = 0; p < num_parts; p++)
+    {
+        x[p] = pos[3 * p];
+        y[p] = pos[3 * p + 1];
+        z[p] = pos[3 * p + 2];
+        vx[p] = vel[3 * p];
+        vy[p] = vel[3 * p + 1];
+        vz[p] = vel[3 * p + 2];
+    }
+    memcpy(mass, masses, num_parts * sizeof(cl_double));
+    memcpy(radius, radii, num_parts * sizeof(cl_double));
+}
+
+ParticleStore::~ParticleStore()
+{
+    aligned_free(_block);
+}
+
+size_t ParticleStore::num_parts() const
+{
+    return _num_parts;
+}
+
+size_t ParticleStore::capacity() const
+{
+    return _capacity;
+}
+
+void ParticleStore::reserve(size_t num_parts)
+{
+    if (_block != NULL && num_parts <= _capacity)
+        return;
+
+    // Round up to whole vectors, so that every array starts on the alignment too
+    size_t capacity = MAX(1, (num_parts + PARTICLE_STORE_PADDING - 1) / PARTICLE_STORE_PADDING) * PARTICLE_STORE_PADDING;
+    cl_double* block = aligned_calloc(PARTICLE_STORE_ARRAYS * capacity);
+    for (size_t a = 0; a < PARTICLE_STORE_ARRAYS && _block != NULL; a++)
+        memcpy(block + a * capacity, _block + a * _capacity, _num_parts * sizeof(cl_double));
+    aligned_free(_block);
+
+    _block = block;
+    _capacity = capacity;
+    x = _block;
+    y = x + _capacity;
+    z = y + _capacity;
+    vx = z + _capacity;
+    vy = vx + _capacity;
+    vz = vy + _capacity;
+    mass = vz + _capacity;
+    radius = mass + _capacity;
+}
+
+size_t ParticleStore::append()
+{
+    if (_num_parts == _capacity)
+        reserve(MAX(_num_parts + 1, 2 * _capacity));
+    return _num_parts++;
+}
+
+void ParticleStore::remove(size_t p)
+{
+    size_t last = --_num_parts;
+    if (p == last)
+        return;
+    for (size_t a = 0; a < PARTICLE_STORE_ARRAYS; a++)
+    {
+        cl_double* values = _block + a * _capacity;
+        values[p] = values[last];
+    }
+}
+
+cl_double* ParticleStore::interleaved_positions()
+{
+    _interleaved.resize(3 * _num_parts);
+    for (size_t p = 0; p < _num_parts; p++)
+    {
+        _interleaved[3 * p] = x[p];
+        _interleaved[3 * p + 1] = y[p];
+        _interleaved[3 * p + 2] = z[p];
+    }
+    return _interleaved.data();
+}
+
+cl_double* ParticleStore::interleaved_positions(cl_double delta_time)
+{
+    _interleaved.resize(3 * _num_parts);
+    for (size_t p = 0; p < _num_parts; p++)
+    {
+        _interleaved[3 * p] = x[p] + delta_time * vx[p];
+        _interleaved[3 * p + 1] = y[p] + delta_time * vy[p];
+        _interleaved[3 * p + 2] = z[p] + delta_time * vz[p];
+    }
+    return _interleaved.data();
+}
+
+cl_double* ParticleStore::interleaved_velocities()
+{
+    _interleaved.resize(3 * _num_parts);
+    for (size_t p = 0; p < _num_parts; p++)
+    {
+        _interleaved[3 * p] = vx[p];
+        _interleaved[3 * p + 1] = vy[p];
+        _interleaved[3 * p + 2] = vz[p];
+    }
+    return _interleaved.data();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+#include <vector>
+
+// Alignment of the arrays, in bytes, as required by the widest vectors used (AVX-512)
+#define PARTICLE_STORE_ALIGNMENT    64
+// The capacity is a multiple of the number of doubles in a vector, so that every array
+// ends on a vector boundary
+#define PARTICLE_STORE_PADDING      (PARTICLE_STORE_ALIGNMENT / sizeof(cl_double))
+
+// State of the particles in the structure-of-arrays layout, with one array for each component.
+// The arrays are aligned to PARTICLE_STORE_ALIGNMENT and hold capacity() particles, the ones
+// past num_parts() being padding. They lie in a single block, so that the positions x, y and z
+// (and the velocities vx, vy and vz) form a planar array with stride capacity().
+// The store is a pool: removing a particle moves the last one into its place, and appending
+// grows the capacity geometrically, so that changing the number of particles costs O(1)
+// amortized and the block is reallocated only a logarithmic number of times.
+// The interleaved layout (x0, y0, z0, x1, ...) is used only by the input and output files.
+class ParticleStore
+{
+private:
+    size_t _num_parts;
+    size_t _capacity;
+    cl_double* _block;
+    std::vector<cl_double> _interleaved;
+
+    ParticleStore(ParticleStore& ps) {};
+    void operator=(ParticleStore& ps) {};
+
+public:
+    cl_double* x;
+    cl_double* y;
+    cl_double* z;
+    cl_double* vx;
+    cl_double* vy;
+    cl_double* vz;
+    cl_double* mass;
+    cl_double* radius;
+
+    // Store of the particles given in the interleaved layout
+    ParticleStore(cl_double* pos, cl_double* vel, cl_double* masses, cl_double* radii, size_t num_parts);
+    ~ParticleStore();
+
+    size_t num_parts() const;
+    size_t capacity() const;
+
+    // Make room for the given number of particles, keeping the current ones
+    void reserve(size_t num_parts);
+    // Append a particle and return its index. Its values must be set by the caller.
+    // When the store is full, the capacity is doubled.
+    size_t append();
+    // Remove particle p, moving the last particle to index p
+    void remove(size_t p);
+
+    // Interleaved copies of the positions and velocities, for the output. They are written in a
+    // buffer owned by the store, which is valid until the next call.
+    cl_double* interleaved_positions();
+    cl_double* interleaved_velocities();
+    // Same as interleaved_positions, with the particles moved forward by delta_time at constant velocity
+    cl_double* interleaved_positions(cl_double delta_time);
+};
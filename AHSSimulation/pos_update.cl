@@ -1,14 +1,24 @@
+// Number of particles baked by the build options (see CLRuntime::specialize)
+#ifdef AHS_NUM_PARTS
+#define NUM_PARTS(num_parts)	((ulong)AHS_NUM_PARTS)
+#else
+#define NUM_PARTS(num_parts)	(num_parts)
+#endif
+
+// Positions and velocities are planar: the x components of all the particles, then the y
+// components starting at stride, then the z components starting at 2 * stride
 __kernel void pos_update(__global const double* pos, 
 						 __global const double* vel,
 						 const ulong num_parts,
+						 const ulong stride,
 						 const double delta_time,
 						 __global double* out_pos)
 {
 	int i = get_global_id(0);
-	if (i < num_parts)
+	if (i < NUM_PARTS(num_parts))
 	{
-		out_pos[3 * i] = pos[3 * i] + delta_time * vel[3 * i];
-		out_pos[3 * i + 1] = pos[3 * i + 1] + delta_time * vel[3 * i + 1];
-		out_pos[3 * i + 2] = pos[3 * i + 2] + delta_time * vel[3 * i + 2];
+		out_pos[i] = pos[i] + delta_time * vel[i];
+		out_pos[stride + i] = pos[stride + i] + delta_time * vel[stride + i];
+		out_pos[2 * stride + i] = pos[2 * stride + i] + delta_time * vel[2 * stride + i];
 	}
 }
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "shared.h"
+#include <math.h>
+
+#define ABS(x)      ((x) < 0 ? -(x) : (x))
+
+
+cl_double predict_part_collision(cl_double* pos_i, cl_double* vel_i, cl_double radius_i,
+                                 cl_double* pos_j, cl_double* vel_j, cl_double radius_j)
+{
+    // Relative position and velocity
+    cl_double dx = pos_i[0] - pos_j[0];
+    cl_double dy = pos_i[1] - pos_j[1];
+    cl_double dz = pos_i[2] - pos_j[2];
+    cl_double dvx = vel_i[0] - vel_j[0];
+    cl_double dvy = vel_i[1] - vel_j[1];
+    cl_double dvz = vel_i[2] - vel_j[2];
+    cl_double rij = radius_i + radius_j;
+
+    // Same coefficients computed by the part_collision kernel
+    cl_double a = dvx * dvx + dvy * dvy + dvz * dvz;
+    cl_double b = 2 * (dx * dvx + dy * dvy + dz * dvz);
+    cl_double c = dx * dx + dy * dy + dz * dz - rij * rij;
+
+    // Collision occurs only if b is negative
+    if (b >= 0 || b * b < 4 * a * c)
+        return INFINITY;
+    // Overlapping particles get the highest priority, as does a couple whose c is NaN
+    if (!(c >= 0))
+        return -1;
+    return (-b - sqrt(b * b - 4 * a * c)) / (2 * a);
+}
+
+cl_double predict_part_collision(const ParticleStore& parts, size_t i, size_t j)
+{
+    cl_double pos_i[3] = { parts.x[i], parts.y[i], parts.z[i] };
+    cl_double vel_i[3] = { parts.vx[i], parts.vy[i], parts.vz[i] };
+    cl_double pos_j[3] = { parts.x[j], parts.y[j], parts.z[j] };
+    cl_double vel_j[3] = { parts.vx[j], parts.vy[j], parts.vz[j] };
+    return predict_part_collision(pos_i, vel_i, parts.radius[i], pos_j, vel_j, parts.radius[j]);
+}
+
+cl_double predict_wall_collision(cl_double* p_pos, cl_double* p_vel, cl_double radius,
+                                 cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                                 cl_int* axis)
+{
+    cl_double* walls[3] = { x_wall, y_wall, z_wall };
+    cl_double delta_time = INFINITY;
+
+    *axis = 0;
+    for (cl_int k = 0; k < 3; k++)
+    {
+        cl_double v = p_vel[k];
+        if (v == 0)
+            continue;
+
+        // Same rule of the wall_collision kernel
+        cl_double w = v > 0 ? walls[k][1] - radius : walls[k][0] + radius;
+        cl_double dt = (w - p_pos[k]) / v;
+        if (*axis == 0 || dt < delta_time)
+        {
+            delta_time = dt;
+            *axis = v > 0 ? k + 1 : -(k + 1);
+        }
+    }
+
+    return delta_time;
+}
+
+cl_double predict_wall_collision(const ParticleStore& parts, size_t p,
+                                 cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                                 cl_int* axis)
+{
+    cl_double p_pos[3] = { parts.x[p], parts.y[p], parts.z[p] };
+    cl_double p_vel[3] = { parts.vx[p], parts.vy[p], parts.vz[p] };
+    return predict_wall_collision(p_pos, p_vel, parts.radius[p], x_wall, y_wall, z_wall, axis);
+}
+
+void axis_to_vector(cl_int axis, cl_double* collision_axis)
+{
+    collision_axis[0] = 0;
+    collision_axis[1] = 0;
+    collision_axis[2] = 0;
+    if (axis != 0)
+        collision_axis[ABS(axis) - 1] = axis / ABS(axis);
+}
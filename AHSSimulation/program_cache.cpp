@@ -0,0 +1,143 @@
+#include "program_cache.h"
+#include "device_selection.h"
+#include "input_loader.h"
+#include <chrono>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+
+// 64-bit FNV-1a hash
+static cl_ulong hash_string(const std::string& str, cl_ulong hash = 14695981039346656037ULL)
+{
+    for (size_t c = 0; c < str.size(); c++)
+    {
+        hash ^= (unsigned char)str[c];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static std::string program_cache_path(const std::string& key)
+{
+    std::stringstream ss;
+    ss << "ahs_" << std::hex << hash_string(key) << ".clbin";
+    return cache_file_path(ss.str());
+}
+
+static bool program_cache_enabled()
+{
+    return read_environment(PROGRAM_CACHE_ENV_VARIABLE) != "0";
+}
+
+std::string program_cache_key(cl::Device& device, const cl::vector<std::string>& sources, const std::string& options)
+{
+    std::string device_version, driver_version;
+    device.getInfo(CL_DEVICE_VERSION, &device_version);
+    device.getInfo(CL_DRIVER_VERSION, &driver_version);
+
+    // The length of each source is hashed too, so that moving code between sources changes the key
+    cl_ulong source_hash = hash_string("");
+    for (size_t s = 0; s < sources.size(); s++)
+    {
+        std::stringstream length;
+        length << sources[s].size() << ":";
+        source_hash = hash_string(length.str(), source_hash);
+        source_hash = hash_string(sources[s], source_hash);
+    }
+
+    std::stringstream ss;
+    ss << device_full_name(device) << "\n"
+       << device_version << "\n"
+       << driver_version << "\n"
+       << options << "\n"
+       << std::hex << source_hash;
+    return ss.str();
+}
+
+bool load_cached_program(cl::Context& context, cl::Device& device, const std::string& key,
+                         const std::string& options, cl::Program* program)
+{
+    if (!program_cache_enabled())
+        return false;
+
+    FILE* stream;
+    fopen_s(&stream, program_cache_path(key).c_str(), "rb");
+    if (stream == NULL)
+        return false;
+
+    // The whole key is stored, so that a collision of the hashes in the file name is detected
+    char magic[sizeof(PROGRAM_CACHE_MAGIC)];
+    size_t key_size, binary_size;
+    bool valid = fread(magic, 1, sizeof(magic), stream) == sizeof(magic) &&
+                 memcmp(magic, PROGRAM_CACHE_MAGIC, sizeof(magic)) == 0 &&
+                 fread(&key_size, sizeof(size_t), 1, stream) == 1 &&
+                 key_size == key.size();
+    std::string cached_key(valid ? key_size : 0, '\0');
+    valid = valid && fread(&cached_key[0], 1, key_size, stream) == key_size && cached_key == key &&
+            fread(&binary_size, sizeof(size_t), 1, stream) == 1 && binary_size > 0 &&
+            binary_size == stream_remaining(stream);
+    cl::Program::Binaries binaries(1);
+    if (valid)
+    {
+        binaries[0].resize(binary_size);
+        valid = fread(binaries[0].data(), 1, binary_size, stream) == binary_size;
+    }
+    fclose(stream);
+    if (!valid)
+        return false;
+
+    // A binary rejected by the driver is simply rebuilt from the sources, and replaced
+    cl_int status = CL_SUCCESS;
+    cl::vector<cl_int> binary_status;
+    cl::vector<cl::Device> devices;
+    devices.push_back(device);
+    cl::Program cached(context, devices, binaries, &binary_status, &status);
+    if (status != CL_SUCCESS || binary_status.empty() || binary_status[0] != CL_SUCCESS)
+        return false;
+    if (cached.build(devices, options.c_str()) != CL_SUCCESS)
+        return false;
+
+    *program = cached;
+    return true;
+}
+
+void store_cached_program(cl::Program& program, const std::string& key)
+{
+    if (!program_cache_enabled())
+        return;
+
+    cl::vector<cl::vector<unsigned char>> binaries;
+    if (program.getInfo(CL_PROGRAM_BINARIES, &binaries) != CL_SUCCESS || binaries.size() != 1 || binaries[0].empty())
+        return;
+
+    // Write to a temporary file and then rename it, so that concurrent runs never read a partial binary
+    std::string path = program_cache_path(key);
+    std::stringstream tmp_path;
+    tmp_path << path << "." << std::chrono::high_resolution_clock::now().time_since_epoch().count() << ".tmp";
+    FILE* stream;
+    fopen_s(&stream, tmp_path.str().c_str(), "wb");
+    if (stream == NULL)
+        return;
+    size_t key_size = key.size();
+    size_t binary_size = binaries[0].size();
+    bool written = fwrite(PROGRAM_CACHE_MAGIC, 1, sizeof(PROGRAM_CACHE_MAGIC), stream) == sizeof(PROGRAM_CACHE_MAGIC) &&
+                   fwrite(&key_size, sizeof(size_t), 1, stream) == 1 &&
+                   fwrite(key.data(), 1, key_size, stream) == key_size &&
+                   fwrite(&binary_size, sizeof(size_t), 1, stream) == 1 &&
+                   fwrite(binaries[0].data(), 1, binary_size, stream) == binary_size;
+    written = fclose(stream) == 0 && written;
+
+    if (!written)
+    {
+        remove(tmp_path.str().c_str());
+        return;
+    }
+
+    // The rename does not replace an existing file on every system
+    if (rename(tmp_path.str().c_str(), path.c_str()) != 0)
+    {
+        remove(path.c_str());
+        if (rename(tmp_path.str().c_str(), path.c_str()) != 0)
+            remove(tmp_path.str().c_str());
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+#include <string>
+
+// Setting this environment variable to 0 disables the cache of the program binaries
+#define PROGRAM_CACHE_ENV_VARIABLE  "AHS_PROGRAM_CACHE"
+#define PROGRAM_CACHE_MAGIC         "AHSCLBIN"
+
+// Key of a program in the cache: name, platform, version and driver of the device,
+// build options and a hash of the sources
+std::string program_cache_key(cl::Device& device, const cl::vector<std::string>& sources, const std::string& options);
+
+// Create and build the program from the binary cached with the given key.
+// Returns false if there is no usable binary, in which case the program must be built from the sources.
+bool load_cached_program(cl::Context& context, cl::Device& device, const std::string& key,
+                         const std::string& options, cl::Program* program);
+
+// Save the binary of a program built from the sources. Failures are ignored, since the cache is only an optimization.
+void store_cached_program(cl::Program& program, const std::string& key);
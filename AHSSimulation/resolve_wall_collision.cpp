@@ -1,17 +1,12 @@
 #include "shared.h"
 
 
-void resolve_wall_collision(cl_double* in_pos, cl_double* in_vel,
-                            size_t p, cl_double* collision_axis)
+void resolve_wall_collision(ParticleStore& parts, size_t p, cl_double* collision_axis)
 {
-    // Get the position and velocity of particle p
-    cl_double x = in_pos[p * 3];
-    cl_double y = in_pos[p * 3 + 1];
-    cl_double z = in_pos[p * 3 + 2];
-
-    cl_double vx = in_vel[p * 3];
-    cl_double vy = in_vel[p * 3 + 1];
-    cl_double vz = in_vel[p * 3 + 2];
+    // Get the velocity of particle p
+    cl_double vx = parts.vx[p];
+    cl_double vy = parts.vy[p];
+    cl_double vz = parts.vz[p];
 
     // The collision against a wall inverts the sign of the component along the collision axis
     // Compute the dot product between velocity and collision axis
@@ -27,8 +22,8 @@ void resolve_wall_collision(cl_double* in_pos, cl_double* in_vel,
     vy -= 2 * collision_axis[1];
     vz -= 2 * collision_axis[2];
 
-    // Set the velocity inside the array
-    in_vel[p * 3] = vx;
-    in_vel[p * 3 + 1] = vy;
-    in_vel[p * 3 + 2] = vz;
-}
\ No newline at end of file
+    // Set the velocity inside the arrays
+    parts.vx[p] = vx;
+    parts.vy[p] = vy;
+    parts.vz[p] = vz;
+}
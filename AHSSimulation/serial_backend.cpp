@@ -0,0 +1,68 @@
+#include "backends.h"
+#include "shared.h"
+#include <iostream>
+#include <math.h>
+
+std::string SerialBackend::name() const
+{
+    return BACKEND_SERIAL;
+}
+
+void SerialBackend::initialize(size_t num_parts)
+{
+    std::cout << "Selected serial reference backend" << std::endl << std::endl;
+}
+
+void SerialBackend::next_collisions(ParticleStore& parts,
+                                    cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                                    size_t* p, cl_double* dt_wall, cl_double* collision_axis,
+                                    size_t* i, size_t* j, cl_double* dt_part)
+{
+    size_t num_parts = parts.num_parts();
+
+    // As on the device, the first candidate is taken even if it never collides,
+    // and the ties go to the smallest index
+    cl_int axis = 0;
+    *p = 0;
+    *dt_wall = INFINITY;
+    for (size_t q = 0; q < num_parts; q++)
+    {
+        cl_int q_axis;
+        cl_double dt = predict_wall_collision(parts, q, x_wall, y_wall, z_wall, &q_axis);
+        if (q == 0 || dt < *dt_wall)
+        {
+            *p = q;
+            *dt_wall = dt;
+            axis = q_axis;
+        }
+    }
+    axis_to_vector(axis, collision_axis);
+
+    // No couple is found if none will ever collide
+    *i = NO_COLLISION;
+    *j = NO_COLLISION;
+    *dt_part = INFINITY;
+    for (size_t a = 0; a < num_parts; a++)
+    {
+        for (size_t b = a + 1; b < num_parts; b++)
+        {
+            cl_double dt = predict_part_collision(parts, a, b);
+            if (dt < *dt_part)
+            {
+                *i = a;
+                *j = b;
+                *dt_part = dt;
+            }
+        }
+    }
+}
+
+void SerialBackend::advance_positions(ParticleStore& parts, cl_double delta_time)
+{
+    for (size_t q = 0; q < parts.num_parts(); q++)
+    {
+        parts.x[q] = parts.x[q] + delta_time * parts.vx[q];
+        parts.y[q] = parts.y[q] + delta_time * parts.vy[q];
+        parts.z[q] = parts.z[q] + delta_time * parts.vz[q];
+    }
+}
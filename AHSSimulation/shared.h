@@ -1,17 +1,40 @@
 #pragma once
 
 #include <CL/cl2.hpp>
+#include "particle_store.h"
 
-void update_positions(cl_double* in_pos, cl_double* in_vel,
-                      size_t num_parts, cl_double delta_time,
-                      cl_double* out_pos);
+// Searches and updates working on the state kept on the device by CLRuntime, which must have
+// been uploaded before. The position update leaves the new positions on the device.
+void update_positions_device(size_t num_parts, cl_double delta_time);
 
-void next_wall_collision(cl_double* in_pos, cl_double* in_vel, cl_double* radii, size_t num_parts,
-                         cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
-                         size_t* p, cl_double* delta_time, cl_double* collision_axis);
+void next_wall_collision_device(size_t num_parts, size_t* p, cl_double* delta_time, cl_double* collision_axis);
 
-void next_part_collision(cl_double* in_pos, cl_double* in_vel, cl_double* radii, size_t num_parts,
-                         size_t* i, size_t* j, cl_double* delta_time);
+void next_part_collision_device(size_t num_parts, size_t* i, size_t* j, cl_double* delta_time);
 
-void resolve_wall_collision(cl_double* in_pos, cl_double* in_vel, 
-                            size_t p, cl_double* collision_axis);
\ No newline at end of file
+// Enqueue the searches for the next collisions without waiting for them. The result is left in
+// the first element of the argmin buffers of CLRuntime with the returned index.
+size_t enqueue_next_wall_collision(size_t num_parts);
+
+size_t enqueue_next_part_collision(size_t num_parts);
+
+void resolve_wall_collision(ParticleStore& parts, size_t p, cl_double* collision_axis);
+
+// Host-side prediction of the collision time between two particles with the given positions,
+// velocities and radii. Follows the same rules of the part_collision kernel.
+cl_double predict_part_collision(cl_double* pos_i, cl_double* vel_i, cl_double radius_i,
+                                 cl_double* pos_j, cl_double* vel_j, cl_double radius_j);
+// Same, for particles i and j of the store
+cl_double predict_part_collision(const ParticleStore& parts, size_t i, size_t j);
+
+// Host-side prediction of the collision time between a particle with the given position,
+// velocity and radius and the walls. Follows the same rules of the wall_collision kernel.
+cl_double predict_wall_collision(cl_double* p_pos, cl_double* p_vel, cl_double radius,
+                                 cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                                 cl_int* axis);
+// Same, for particle p of the store
+cl_double predict_wall_collision(const ParticleStore& parts, size_t p,
+                                 cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                                 cl_int* axis);
+
+// Convert a signed collision axis (+-1, +-2, +-3) to the vector used by resolve_wall_collision
+void axis_to_vector(cl_int axis, cl_double* collision_axis);
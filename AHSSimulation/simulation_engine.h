@@ -0,0 +1,205 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+#include "CLSettings.h"
+#include "backend.h"
+#include "particle_store.h"
+#include "trajectory.h"
+#include "checkpoint.h"
+#include "fission.h"
+
+#include <sstream>
+
+#include <iostream>
+
+// Collision policies of the full-scan engine. A policy describes a model of collision between
+// particles: how it is resolved and how the output is framed. It must provide
+//  - simtype: the simulation type, which selects the layout of the output;
+//  - save_frame(delta_time): true if a frame must be saved before a step of the given length;
+//  - resolve(backend, parts, e, i, j, threshold): resolution of a collision between particles, a
+//    template on the type of the backend, so that the call is resolved at compile time when the
+//    loop is instantiated for a final backend class.
+
+struct InelasticPolicy
+{
+    static const size_t simtype = SIMULATION_TYPE_INELSATIC;
+
+    // The system has changed only after a static period
+    static bool save_frame(cl_double delta_time)
+    {
+        return delta_time > 0;
+    }
+
+    template <class BackendType>
+    static void resolve(BackendType& backend, ParticleStore& parts, cl_double e, size_t i, size_t j, cl_double threshold)
+    {
+        backend.resolve_inelastic_collision(parts, e, i, j);
+    }
+};
+
+struct FusionPolicy
+{
+    static const size_t simtype = SIMULATION_TYPE_FUSION;
+
+    // Fusions can happen with no time in between, and every one of them is saved
+    static bool save_frame(cl_double delta_time)
+    {
+        return true;
+    }
+
+    template <class BackendType>
+    static void resolve(BackendType& backend, ParticleStore& parts, cl_double e, size_t i, size_t j, cl_double threshold)
+    {
+        backend.resolve_fusion_collision(parts, e, i, j, threshold);
+    }
+};
+
+struct FissionPolicy
+{
+    static const size_t simtype = SIMULATION_TYPE_FISSION;
+
+    static bool save_frame(cl_double delta_time)
+    {
+        return delta_time > 0;
+    }
+
+    template <class BackendType>
+    static void resolve(BackendType& backend, ParticleStore& parts, cl_double e, size_t i, size_t j, cl_double threshold)
+    {
+        backend.resolve_fission_collision(parts, e, i, j, threshold);
+    }
+};
+
+
+// Full-scan simulation loop, shared by all the collision models. At each step the backend finds the
+// next collision with the walls and between particles, the system is advanced to the earliest one
+// and the collision is resolved, by the backend for the walls and by the policy for the particles.
+// The threshold is passed to the policy, and ignored by the models without one.
+// The loop is instantiated for each built-in backend, whose classes are final, so that the calls to
+// the backend and to the resolution of the policy are direct (see simulation_loop.cpp).
+template <class Policy, class BackendType>
+void simulation_loop(cl_double* pos, cl_double* vel,
+                     cl_double* masses, cl_double* radii,
+                     cl_double* x_wall, cl_double* y_wall, cl_double* z_wall,
+                     size_t num_parts, cl_double e, cl_double max_time, cl_double threshold,
+                     BackendType& backend)
+{
+    // The setup of the run is saved by each checkpoint, and must match the one of the checkpoint resumed
+    Checkpoint setup;
+    setup.describe(Policy::simtype, e, max_time, x_wall, y_wall, z_wall, num_parts, masses, radii);
+    // When resuming, the state saved by the checkpoint replaces the input values
+    Checkpoint resume;
+    if (CLSettings::get_resume())
+    {
+        resume.load(CLSettings::get_checkpoint_file());
+        resume.check(setup);
+        pos = resume.positions.data();
+        vel = resume.velocities.data();
+        masses = resume.masses.data();
+        radii = resume.radii.data();
+        num_parts = resume.num_parts;
+        skip_fission_random_draws(resume.random_draws);
+    }
+    // Open the output file, written by a background thread
+    TrajectoryWriter out(CLSettings::get_output_file(), Policy::simtype, resume);
+    // Initialize the current time to zero, or to the time of the checkpoint
+    cl_double time = resume.time;
+    size_t num_events = resume.num_events;
+    CheckpointWriter checkpoints(num_events);
+    // Initialize the current state of the system from the input values.
+    // The collision resolution updates it in place, and may add and remove particles.
+    // The backend may hold the positions, while the host holds the velocities and uploads
+    // only the ones changed by a collision.
+    ParticleStore parts(pos, vel, masses, radii, num_parts);
+    backend.upload_state(parts);
+    backend.upload_walls(x_wall, y_wall, z_wall);
+    // Output some informations about the system
+    if (resume.is_empty())
+        out.write_header(parts, e, max_time, x_wall, y_wall, z_wall);
+    else
+        std::cout << "Resuming from the checkpoint at time " << time << "." << std::endl;
+
+    // Begin the simulation loop
+    std::cout << "Simulation of a system of " << num_parts
+              << " particles for " << max_time << " seconds." << std::endl;
+    // Once the maximum number of frames is written, nothing else would be saved
+    while (time < max_time && !out.is_full())
+    {
+        size_t p, i, j;
+        cl_double delta_time, dt_wall, dt_part;
+        cl_double coll_axis[3];
+
+        // Check for the next collision
+        backend.next_collisions(parts, x_wall, y_wall, z_wall,
+                                &p, &dt_wall, coll_axis, &i, &j, &dt_part);
+        delta_time = dt_wall < dt_part ? dt_wall : dt_part;
+
+        // Update positions
+        cl_double step = 0 > delta_time ? 0 : delta_time;
+
+        // Save the current status, as the policy requires, or at the sample times before the collision.
+        // The event log saves the events instead.
+        if (out.is_sampling())
+        {
+            if (out.sample_due(time + step))
+            {
+                backend.download_positions(parts);
+                out.write_samples(time, time + step, parts);
+            }
+        }
+        else if (!out.is_event_log() && Policy::save_frame(delta_time))
+        {
+            backend.download_positions(parts);
+            out.write_frame(time, parts);
+        }
+
+        // Without any collision the particles would move freely forever, so nothing is left to simulate
+        if (!(dt_wall < dt_part) && i == NO_COLLISION)
+            break;
+
+        backend.advance_positions(parts, step);
+
+        // If a collision with a wall occurs first, resolve it
+        size_t prev_num_parts = parts.num_parts();
+        if (dt_wall < dt_part)
+            backend.resolve_wall_collision(parts, p, coll_axis);
+        // Otherwise, resolve the collision between the particles
+        else
+            Policy::resolve(backend, parts, e, i, j, threshold);
+
+        // Update the time
+        time += step;
+
+        // Log the event, and the whole state once in a while
+        if (out.is_event_log())
+        {
+            if (dt_wall < dt_part)
+                out.log_wall_collision(time, parts, p);
+            else
+                out.log_part_collision(time, parts, i, j, prev_num_parts);
+            if (out.needs_keyframe())
+            {
+                backend.download_positions(parts);
+                out.write_keyframe(time, parts);
+            }
+        }
+
+        // Save the state once in a while, to resume the simulation if it is stopped
+        num_events++;
+        if (checkpoints.is_due(num_events))
+        {
+            backend.download_positions(parts);
+            Checkpoint checkpoint = setup;
+            checkpoint.capture(time, num_events, parts);
+            out.checkpoint(checkpoint);
+            checkpoints.save(checkpoint, out);
+        }
+    }
+
+    // Write the pending output and close the file
+    checkpoints.finish();
+    out.close();
+    std::cout << out.summary() << std::endl;
+
+    std::cout << "Simulation terminated." << std::endl;
+}
@@ -0,0 +1,93 @@
+#include "thread_pool.h"
+#include <stdlib.h>
+
+std::vector<std::thread> ThreadPool::_workers;
+std::mutex ThreadPool::_mutex;
+std::condition_variable ThreadPool::_start;
+std::condition_variable ThreadPool::_finish;
+const std::function<void(size_t)>* ThreadPool::_task = NULL;
+size_t ThreadPool::_generation = 0;
+size_t ThreadPool::_pending = 0;
+bool ThreadPool::_stop = false;
+
+void ThreadPool::initialize(size_t num_threads)
+{
+    static bool initialized = false;
+    if (initialized)
+        return;
+    initialized = true;
+
+    if (num_threads == 0)
+        num_threads = std::thread::hardware_concurrency();
+    if (num_threads == 0)
+        num_threads = 1;
+
+    for (size_t t = 1; t < num_threads; t++)
+        _workers.push_back(std::thread(worker_loop, t));
+    atexit(shutdown);
+}
+
+void ThreadPool::shutdown()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _start.notify_all();
+    for (size_t t = 0; t < _workers.size(); t++)
+        _workers[t].join();
+    _workers.clear();
+}
+
+size_t ThreadPool::num_threads()
+{
+    return _workers.size() + 1;
+}
+
+void ThreadPool::worker_loop(size_t id)
+{
+    size_t generation = 0;
+    while (true)
+    {
+        const std::function<void(size_t)>* task;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _start.wait(lock, [&]() { return _stop || _generation != generation; });
+            if (_stop)
+                return;
+            generation = _generation;
+            task = _task;
+        }
+
+        (*task)(id);
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _pending--;
+        }
+        _finish.notify_one();
+    }
+}
+
+void ThreadPool::run(const std::function<void(size_t)>& task)
+{
+    if (_workers.empty())
+    {
+        task(0);
+        return;
+    }
+
+    // Wake the workers, then do the share of the calling thread
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _task = &task;
+        _pending = _workers.size();
+        _generation++;
+    }
+    _start.notify_all();
+
+    task(0);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _finish.wait(lock, [&]() { return _pending == 0; });
+}
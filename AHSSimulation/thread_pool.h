@@ -0,0 +1,42 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads shared by the native CPU backend.
+// The calling thread takes part in each task as thread 0.
+class ThreadPool
+{
+private:
+    static std::vector<std::thread> _workers;
+    static std::mutex _mutex;
+    static std::condition_variable _start;
+    static std::condition_variable _finish;
+    static const std::function<void(size_t)>* _task;
+    static size_t _generation;
+    static size_t _pending;
+    static bool _stop;
+
+    static void worker_loop(size_t id);
+
+    ThreadPool() {};
+    ThreadPool(ThreadPool& tp) {};
+    ~ThreadPool() {};
+    void operator=(ThreadPool& tp) {};
+
+public:
+    // Start the workers. With zero threads, all the hardware threads are used.
+    // Does nothing if already done.
+    static void initialize(size_t num_threads);
+
+    // Join the workers. Called automatically at exit.
+    static void shutdown();
+
+    static size_t num_threads();
+
+    // Run task(t) on each thread t in [0, num_threads()) and wait for all of them
+    static void run(const std::function<void(size_t)>& task);
+};
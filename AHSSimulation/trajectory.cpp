@@ -0,0 +1,267 @@
+#include "trajectory.h"
+#include "CLSettings.h"
+#include "checkpoint.h"
+
+#define MIN(x, y)       ((x) < (y) ? (x) : (y))
+#define MAX(x, y)       ((x) > (y) ? (x) : (y))
+
+
+TrajectoryWriter::TrajectoryWriter(const std::string& filename, size_t simtype)
+    : TrajectoryWriter(filename, simtype, Checkpoint())
+{
+}
+
+TrajectoryWriter::TrajectoryWriter(const std::string& filename, size_t simtype, const Checkpoint& resume)
+    : _out(filename, !resume.is_empty(), resume.output_size)
+{
+    _simtype = simtype;
+    _event_log = CLSettings::get_output_format() == OUTPUT_FORMAT_EVENT_LOG;
+    _keyframe_interval = CLSettings::get_keyframe_interval();
+    _since_keyframe = resume.since_keyframe;
+    _max_time = resume.max_time;
+    _snapshot_interval = _event_log ? 0 : CLSettings::get_snapshot_interval();
+    _next_sample = resume.next_sample;
+    _max_frames = _event_log ? 0 : CLSettings::get_max_frames();
+    _num_frames = resume.num_frames;
+    _indexed = CLSettings::get_output_index() == OUTPUT_INDEX_ON;
+    _index = resume.index;
+    _offset = resume.output_offset;
+    _compressor = NULL;
+    if (CLSettings::get_output_compression() == OUTPUT_COMPRESSION_SHUFFLE)
+        _compressor = new ChunkCompressor(_out, !resume.is_empty());
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+    delete _compressor;
+}
+
+void TrajectoryWriter::emit(const void* data, size_t size, size_t count)
+{
+    if (_compressor == NULL)
+        _out.write(data, size, count);
+    else
+        _chunk.insert(_chunk.end(), (const char*)data, (const char*)data + size * count);
+    _offset += size * count;
+}
+
+void TrajectoryWriter::end_record()
+{
+    // The chunks end with a whole frame or record, so that each one can be decoded alone
+    if (_compressor != NULL && _chunk.size() >= COMPRESSION_CHUNK_SIZE)
+    {
+        _compressor->submit(_chunk);
+        _chunk.reserve(COMPRESSION_CHUNK_SIZE);
+    }
+}
+
+void TrajectoryWriter::write_header(ParticleStore& parts, cl_double e, cl_double max_time,
+                                    cl_double* x_wall, cl_double* y_wall, cl_double* z_wall)
+{
+    size_t simtype = _simtype | (_event_log ? TRAJECTORY_EVENT_LOG : 0) | (_indexed ? TRAJECTORY_INDEXED : 0);
+    size_t num_parts = parts.num_parts();
+    _max_time = max_time;
+    emit(&simtype, sizeof(size_t), 1);      // Simulation type
+    emit(&num_parts, sizeof(size_t), 1);    // Number of particles
+    emit(&e, sizeof(cl_double), 1);         // Elasticity
+    emit(&max_time, sizeof(cl_double), 1);  // Time horizon
+    emit(x_wall, sizeof(cl_double), 2);     // X wall
+    emit(y_wall, sizeof(cl_double), 2);     // Y wall
+    emit(z_wall, sizeof(cl_double), 2);     // Z wall
+    if (_indexed)
+    {
+        size_t version = TRAJECTORY_VERSION;
+        emit(&version, sizeof(size_t), 1);  // Version of the layout
+    }
+
+    if (_event_log)
+    {
+        emit(&_keyframe_interval, sizeof(size_t), 1);     // Events between two keyframes
+        write_keyframe(0, parts);
+    }
+    // Without fusions and fissions, the radii never change
+    else if (_simtype == SIMULATION_TYPE_INELSATIC)
+        emit(parts.radius, sizeof(cl_double), num_parts);    // Particles' radii
+    end_record();
+}
+
+bool TrajectoryWriter::is_event_log() const
+{
+    return _event_log;
+}
+
+void TrajectoryWriter::write_frame(cl_double time, ParticleStore& parts)
+{
+    write_frame_at(time, 0, parts);
+}
+
+void TrajectoryWriter::write_frame_at(cl_double time, cl_double delta_time, ParticleStore& parts)
+{
+    if (is_full())
+        return;
+
+    size_t num_parts = parts.num_parts();
+    if (_indexed)
+        _index.push_back({ time, _offset, num_parts });
+    emit(&time, sizeof(cl_double), 1);
+    if (_simtype != SIMULATION_TYPE_INELSATIC)
+    {
+        emit(&num_parts, sizeof(size_t), 1);
+        emit(parts.radius, sizeof(cl_double), num_parts);
+    }
+    emit(parts.interleaved_positions(delta_time), sizeof(cl_double), 3 * num_parts);
+    emit(parts.interleaved_velocities(), sizeof(cl_double), 3 * num_parts);
+    _num_frames++;
+    end_record();
+}
+
+bool TrajectoryWriter::is_sampling() const
+{
+    return _snapshot_interval > 0;
+}
+
+bool TrajectoryWriter::sample_due(cl_double next_time) const
+{
+    if (!is_sampling() || is_full())
+        return false;
+    cl_double sample = _next_sample * _snapshot_interval;
+    return sample < next_time && sample <= _max_time;
+}
+
+void TrajectoryWriter::write_samples(cl_double time, cl_double next_time, ParticleStore& parts)
+{
+    // The sample times are multiples of the interval, so that the rounding errors do not accumulate
+    while (sample_due(next_time))
+    {
+        cl_double sample = _next_sample * _snapshot_interval;
+        write_frame_at(sample, MAX(0, sample - time), parts);
+        _next_sample++;
+    }
+}
+
+bool TrajectoryWriter::is_full() const
+{
+    return _max_frames > 0 && _num_frames >= _max_frames;
+}
+
+void TrajectoryWriter::write_particle(ParticleStore& parts, size_t p)
+{
+    cl_double values[8] = { parts.x[p], parts.y[p], parts.z[p],
+                            parts.vx[p], parts.vy[p], parts.vz[p],
+                            parts.mass[p], parts.radius[p] };
+    emit(values, sizeof(cl_double), 8);
+}
+
+void TrajectoryWriter::log_wall_collision(cl_double time, ParticleStore& parts, size_t p)
+{
+    size_t type = LOG_RECORD_WALL_COLLISION;
+    cl_double p_vel[3] = { parts.vx[p], parts.vy[p], parts.vz[p] };
+    emit(&time, sizeof(cl_double), 1);
+    emit(&type, sizeof(size_t), 1);
+    emit(&p, sizeof(size_t), 1);
+    emit(p_vel, sizeof(cl_double), 3);
+    _since_keyframe++;
+    end_record();
+}
+
+void TrajectoryWriter::log_part_collision(cl_double time, ParticleStore& parts, size_t i, size_t j, size_t prev_num_parts)
+{
+    size_t num_parts = parts.num_parts();
+    size_t type = LOG_RECORD_PART_COLLISION;
+    if (num_parts < prev_num_parts)
+        type = LOG_RECORD_FUSION;
+    else if (num_parts > prev_num_parts)
+        type = LOG_RECORD_FISSION;
+    emit(&time, sizeof(cl_double), 1);
+    emit(&type, sizeof(size_t), 1);
+    emit(&i, sizeof(size_t), 1);
+    emit(&j, sizeof(size_t), 1);
+
+    if (type == LOG_RECORD_PART_COLLISION)
+    {
+        cl_double vel[6] = { parts.vx[i], parts.vy[i], parts.vz[i], parts.vx[j], parts.vy[j], parts.vz[j] };
+        emit(vel, sizeof(cl_double), 6);
+    }
+    // The new particle took the lower index
+    else if (type == LOG_RECORD_FUSION)
+        write_particle(parts, MIN(i, j));
+    // Both particles changed, and the new one was appended
+    else
+    {
+        write_particle(parts, i);
+        write_particle(parts, j);
+        write_particle(parts, num_parts - 1);
+    }
+    _since_keyframe++;
+    end_record();
+}
+
+bool TrajectoryWriter::needs_keyframe() const
+{
+    return _event_log && _keyframe_interval > 0 && _since_keyframe >= _keyframe_interval;
+}
+
+void TrajectoryWriter::write_keyframe(cl_double time, ParticleStore& parts)
+{
+    size_t type = LOG_RECORD_KEYFRAME;
+    size_t num_parts = parts.num_parts();
+    if (_indexed)
+        _index.push_back({ time, _offset, num_parts });
+    emit(&time, sizeof(cl_double), 1);
+    emit(&type, sizeof(size_t), 1);
+    emit(&num_parts, sizeof(size_t), 1);
+    emit(parts.mass, sizeof(cl_double), num_parts);
+    emit(parts.radius, sizeof(cl_double), num_parts);
+    emit(parts.interleaved_positions(), sizeof(cl_double), 3 * num_parts);
+    emit(parts.interleaved_velocities(), sizeof(cl_double), 3 * num_parts);
+    _since_keyframe = 0;
+    end_record();
+}
+
+void TrajectoryWriter::checkpoint(Checkpoint& checkpoint)
+{
+    // The output of the checkpoint ends with a whole chunk
+    if (_compressor != NULL)
+    {
+        _compressor->submit(_chunk);
+        _compressor->flush();
+    }
+    _out.flush();
+
+    checkpoint.output_size = _out.tell();
+    checkpoint.output_offset = _offset;
+    checkpoint.since_keyframe = _since_keyframe;
+    checkpoint.next_sample = _next_sample;
+    checkpoint.num_frames = _num_frames;
+    checkpoint.index = _index;
+}
+
+void TrajectoryWriter::sync(size_t bytes)
+{
+    _out.sync(bytes);
+}
+
+void TrajectoryWriter::close()
+{
+    if (_indexed)
+    {
+        size_t num_entries = _index.size();
+        emit(_index.data(), sizeof(TrajectoryIndexEntry), num_entries);
+        emit(&num_entries, sizeof(size_t), 1);
+        emit(TRAJECTORY_INDEX_MAGIC, sizeof(char), 8);
+        _indexed = false;
+    }
+    if (_compressor != NULL)
+    {
+        _compressor->submit(_chunk);
+        _compressor->finish();
+    }
+    _out.close();
+}
+
+std::string TrajectoryWriter::summary() const
+{
+    if (_compressor != NULL)
+        return _compressor->summary() + " " + _out.summary();
+    return _out.summary();
+}
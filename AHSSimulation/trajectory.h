@@ -0,0 +1,121 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+#include "particle_store.h"
+#include "output_writer.h"
+#include "chunk_compressor.h"
+#include <string>
+#include <vector>
+
+// Flag added to the simulation type in the header of an event log
+#define TRAJECTORY_EVENT_LOG        ((size_t)1 << 8)
+
+// Flag added to the simulation type in the header of a file with an index of the frames in its footer
+#define TRAJECTORY_INDEXED          ((size_t)1 << 9)
+// Version of the layout of the indexed files, written in their header
+#define TRAJECTORY_VERSION          (size_t)1
+// Last eight bytes of an indexed file
+#define TRAJECTORY_INDEX_MAGIC      "AHSINDEX"
+
+// Types of the records of an event log
+#define LOG_RECORD_KEYFRAME         (size_t)0
+#define LOG_RECORD_WALL_COLLISION   (size_t)1
+#define LOG_RECORD_PART_COLLISION   (size_t)2
+#define LOG_RECORD_FUSION           (size_t)3
+#define LOG_RECORD_FISSION          (size_t)4
+
+class Checkpoint;
+
+// Entry of the index of a trajectory file: a frame, or a keyframe of the event log
+struct TrajectoryIndexEntry
+{
+    cl_double time;
+    size_t offset;
+    size_t num_parts;
+};
+
+// Output of a simulation, in the format selected by CLSettings::get_output_format().
+// With frames, the whole state is written at the steps chosen by the loop or, if a snapshot interval
+// is set, at its multiples. At most CLSettings::get_max_frames() frames are written, if not zero.
+// With the event log, the whole state is written only in the keyframes, one every
+// CLSettings::get_keyframe_interval() events, and each event is logged with the particles it changed.
+// If CLSettings::get_output_index() is on, the time, the offset and the number of particles of each frame,
+// or keyframe, are collected and written in a footer, so that the readers can seek a frame by time.
+// If CLSettings::get_output_compression() is on, the output is compressed in chunks by a ChunkCompressor.
+// See the README for the layouts.
+class TrajectoryWriter
+{
+private:
+    OutputWriter _out;
+    size_t _simtype;
+    bool _event_log;
+    size_t _keyframe_interval;
+    size_t _since_keyframe;
+    cl_double _max_time;
+    cl_double _snapshot_interval;
+    size_t _next_sample;
+    size_t _max_frames;
+    size_t _num_frames;
+    bool _indexed;
+    std::vector<TrajectoryIndexEntry> _index;
+    // Offset in the uncompressed output
+    size_t _offset;
+    // With compression, the output is collected in chunks
+    ChunkCompressor* _compressor;
+    std::vector<char> _chunk;
+
+    // Write to the output, or to the current chunk, like fwrite
+    void emit(const void* data, size_t size, size_t count);
+    // Mark the end of a frame or record, after which the chunk can be compressed
+    void end_record();
+
+    void write_particle(ParticleStore& parts, size_t p);
+    // Write a frame at the given time, moving the particles at constant velocity for delta_time
+    void write_frame_at(cl_double time, cl_double delta_time, ParticleStore& parts);
+
+public:
+    TrajectoryWriter(const std::string& filename, size_t simtype);
+    // Continue the output saved by a checkpoint, without writing the header again.
+    // If the checkpoint is empty, same as above.
+    TrajectoryWriter(const std::string& filename, size_t simtype, const Checkpoint& resume);
+    ~TrajectoryWriter();
+
+    // Write the header. With the event log, the initial state is written too, as the first keyframe.
+    void write_header(ParticleStore& parts, cl_double e, cl_double max_time,
+                      cl_double* x_wall, cl_double* y_wall, cl_double* z_wall);
+
+    bool is_event_log() const;
+
+    // Write a frame, with the positions and velocities of all the particles at the given time
+    void write_frame(cl_double time, ParticleStore& parts);
+    // True if the frames are written at fixed intervals rather than by write_frame
+    bool is_sampling() const;
+    // True if a sample falls before next_time, the time of the next event
+    bool sample_due(cl_double next_time) const;
+    // Write the samples before next_time. The particles are at the given time, the time of the last
+    // event, and move at constant velocity until the next one.
+    void write_samples(cl_double time, cl_double next_time, ParticleStore& parts);
+    // True once the maximum number of frames has been written, after which the simulation can stop
+    bool is_full() const;
+
+    // Log the events, with the time right after them. The particles changed must be up to date on the host:
+    // the velocities, and for the fusions and fissions their positions too.
+    void log_wall_collision(cl_double time, ParticleStore& parts, size_t p);
+    // A collision between particles. It is logged as a fusion or as a fission if the number of
+    // particles has changed from prev_num_parts.
+    void log_part_collision(cl_double time, ParticleStore& parts, size_t i, size_t j, size_t prev_num_parts);
+
+    // True if a keyframe is due. All the positions must then be brought up to date on the host,
+    // and passed to write_keyframe.
+    bool needs_keyframe() const;
+    void write_keyframe(cl_double time, ParticleStore& parts);
+
+    // Hand the output written so far over to the storage, and save its state in the checkpoint
+    void checkpoint(Checkpoint& checkpoint);
+    // Wait until the first bytes of the output file are durable. Can be called by another thread.
+    void sync(size_t bytes);
+
+    // Write the pending output, and the index if any, and close the file
+    void close();
+    std::string summary() const;
+};
@@ -1,55 +1,80 @@
+// Constants of the run baked by the build options (see CLRuntime::specialize).
+// Without them, the values given as arguments are used.
+#ifdef AHS_NUM_PARTS
+#define NUM_PARTS(num_parts)	((ulong)AHS_NUM_PARTS)
+#else
+#define NUM_PARTS(num_parts)	(num_parts)
+#endif
+#ifdef AHS_UNIFORM_RADIUS
+#define RADIUS(radii, i)		(AHS_UNIFORM_RADIUS)
+#else
+#define RADIUS(radii, i)		((radii)[i])
+#endif
+
+// Positions and velocities are planar, with the y and z components starting at stride and 2 * stride
 __kernel void wall_collision(__global const double* pos,
 							 __global const double* vel,
 							 __global const double* radii,
 							 const ulong num_parts,
+							 const ulong stride,
 							 __global const double* x_wall,
 							 __global const double* y_wall,
 							 __global const double* z_wall,
 							 __global double* delta_time,
 							 __global int* axis)
 {
+#ifdef AHS_CONSTANT_WALLS
+	const double x_min = AHS_X_WALL_MIN, x_max = AHS_X_WALL_MAX;
+	const double y_min = AHS_Y_WALL_MIN, y_max = AHS_Y_WALL_MAX;
+	const double z_min = AHS_Z_WALL_MIN, z_max = AHS_Z_WALL_MAX;
+#else
+	const double x_min = x_wall[0], x_max = x_wall[1];
+	const double y_min = y_wall[0], y_max = y_wall[1];
+	const double z_min = z_wall[0], z_max = z_wall[1];
+#endif
+
 	int i = get_global_id(0);
-	if (i < num_parts)
+	if (i < NUM_PARTS(num_parts))
 	{
 		double x = INFINITY;
-		if (vel[3 * i] > 0)
-			x = x_wall[1] - radii[i];
-		else if (vel[3 * i] < 0)
-			x = x_wall[0] + radii[i];
+		if (vel[i] > 0)
+			x = x_max - RADIUS(radii, i);
+		else if (vel[i] < 0)
+			x = x_min + RADIUS(radii, i);
 			
 		double y = INFINITY;
-		if (vel[3 * i + 1] > 0)
-			y = y_wall[1] - radii[i];
-		else if (vel[3 * i + 1] < 0)
-			y = y_wall[0] + radii[i];
+		if (vel[stride + i] > 0)
+			y = y_max - RADIUS(radii, i);
+		else if (vel[stride + i] < 0)
+			y = y_min + RADIUS(radii, i);
 			
 		double z = INFINITY;
-		if (vel[3 * i + 2] > 0)
-			z = z_wall[1] - radii[i];
-		else if (vel[3 * i + 2] < 0)
-			z = z_wall[0] + radii[i];
+		if (vel[2 * stride + i] > 0)
+			z = z_max - RADIUS(radii, i);
+		else if (vel[2 * stride + i] < 0)
+			z = z_min + RADIUS(radii, i);
 			
 
-		double delta_x = (x - pos[3 * i]) / vel[3 * i];
-		double delta_y = (y - pos[3 * i + 1]) / vel[3 * i + 1];
-		double delta_z = (z - pos[3 * i + 2]) / vel[3 * i + 2];
+		double delta_x = (x - pos[i]) / vel[i];
+		double delta_y = (y - pos[stride + i]) / vel[stride + i];
+		double delta_z = (z - pos[2 * stride + i]) / vel[2 * stride + i];
 
 		delta_time[i] = delta_x;
 		axis[i] = 1;
-		if (vel[3 * i] < 0)
+		if (vel[i] < 0)
 			axis[i] = -1;
 		if (delta_y < delta_time[i])
 		{
 			delta_time[i] = delta_y;
 			axis[i] = 2;
-			if (vel[3 * i + 1] < 0)
+			if (vel[stride + i] < 0)
 				axis[i] = -2;
 		}
 		if (delta_z < delta_time[i])
 		{
 			delta_time[i] = delta_z;
 			axis[i] = 3;
-			if (vel[3 * i + 2] < 0)
+			if (vel[2 * stride + i] < 0)
 				axis[i] = -3;
 		}
 	}